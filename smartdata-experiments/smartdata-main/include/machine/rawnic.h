@@ -0,0 +1,355 @@
+#pragma once
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <machine/nic.h>
+#include <utility/debug.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+
+extern const char* globalInterface;
+
+// Ethernet NIC on a raw AF_PACKET socket bound to the interface of its unit in Traits<RAWNIC>::INTERFACES
+// (globalInterface by default), using TPACKET_V3 memory-mapped rings.
+// The kernel fills RX blocks of BLOCK_SIZE bytes, retired when full or after RX_TIMEOUT ms, and the
+// receive thread walks each block in place, moving frames into pool buffers for the observers, with
+// no system call per frame. TX frames are written into the TX ring and the kernel is kicked once per
+// send(). Only TSTP frames are captured. Needs CAP_NET_RAW; e.g. on a veth pair:
+//   ip link add veth0 type veth peer name veth1; ip link set veth0 up; ip link set veth1 up
+class RAWNIC : public NIC<Ethernet>
+{
+private:
+	static const unsigned int BUFFERS = Traits<RAWNIC>::BUFFERS;
+	static const unsigned int BLOCK_SIZE = Traits<RAWNIC>::BLOCK_SIZE;
+	static const unsigned int BLOCKS = Traits<RAWNIC>::BLOCKS;
+	static const unsigned int FRAME_SIZE = Traits<RAWNIC>::FRAME_SIZE;
+	static const unsigned int RX_TIMEOUT = Traits<RAWNIC>::RX_TIMEOUT;
+	static const unsigned int RX_QUEUE = 10;
+
+	// Offset of frame data in TX ring slots (TPACKET3_HDRLEN - sizeof(sockaddr_ll))
+	static const unsigned int TX_DATA = TPACKET_ALIGN(sizeof(tpacket3_hdr));
+
+	int _socket = -1;
+	Configuration _configuration;
+	Statistics _statistics;
+	Buffer_Pool<Buffer, BUFFERS> _pool;
+
+	// Rings, mapped back to back: RX blocks first, then TX frames
+	unsigned char * _ring;
+	unsigned char * _tx_ring;
+	unsigned int _tx_frames;
+	unsigned int _tx_cur;
+	pthread_mutex_t _tx_lock;
+
+	const char * _interface;
+
+	// Frames waiting for receive()
+	Buffer::List _rx_queue;
+	pthread_mutex_t _rx_lock;
+	pthread_cond_t _rx_ready;
+
+public:
+	RAWNIC(unsigned int unit = 0): _pool(this, static_cast<void *>(0)), _ring(0), _tx_ring(0), _tx_frames(0), _tx_cur(0), _interface(interface(unit))
+	{
+		db<RAWNIC>(TRC) << "RAWNIC(unit=" << unit << ",if=" << (_interface ? _interface : "?") << ")" << endl;
+
+		pthread_mutex_init(&_tx_lock, 0);
+		pthread_mutex_init(&_rx_lock, 0);
+		pthread_cond_init(&_rx_ready, 0);
+
+		_configuration.unit = unit;
+
+		// Units sharing an interface would all get the same frames
+		if (!_interface) {
+			db<RAWNIC>(ERR) << "RAWNIC: no interface configured for unit " << unit << "!" << endl;
+			return;
+		}
+		_configuration.timer_accuracy = 1; // timer_accuracy();
+		_configuration.timer_frequency = 1000000; //  timer_frequency();
+
+		_socket = socket(AF_PACKET, SOCK_RAW, htons(PROTO_TSTP));
+		if (_socket < 0) {
+			db<RAWNIC>(ERR) << "RAWNIC: could not open packet socket (errno=" << errno << ")!" << endl;
+			return;
+		}
+
+		// Set Address (the interface's)
+		ifreq ifr;
+		memset(&ifr, 0, sizeof(ifr));
+		strncpy(ifr.ifr_name, _interface, IFNAMSIZ - 1);
+		if (ioctl(_socket, SIOCGIFHWADDR, &ifr) == 0)
+			for (unsigned int i = 0; i < 6; i++)
+				_configuration.address[i] = ifr.ifr_hwaddr.sa_data[i];
+		address(_configuration.address);
+
+		int version = TPACKET_V3;
+		setsockopt(_socket, SOL_PACKET, PACKET_VERSION, &version, sizeof(version));
+
+		tpacket_req3 req;
+		memset(&req, 0, sizeof(req));
+		req.tp_block_size = BLOCK_SIZE;
+		req.tp_block_nr = BLOCKS;
+		req.tp_frame_size = FRAME_SIZE;
+		req.tp_frame_nr = (BLOCK_SIZE / FRAME_SIZE) * BLOCKS;
+		req.tp_retire_blk_tov = RX_TIMEOUT;
+		if (setsockopt(_socket, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+			db<RAWNIC>(ERR) << "RAWNIC: could not set up the RX ring (errno=" << errno << ")!" << endl;
+			return;
+		}
+		req.tp_retire_blk_tov = 0; // must be zero for TX
+		if (setsockopt(_socket, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0) {
+			db<RAWNIC>(ERR) << "RAWNIC: could not set up the TX ring (errno=" << errno << ")!" << endl;
+			return;
+		}
+		_tx_frames = req.tp_frame_nr;
+
+		void * ring = mmap(0, 2 * BLOCK_SIZE * BLOCKS, PROT_READ | PROT_WRITE, MAP_SHARED, _socket, 0);
+		if (ring == MAP_FAILED) {
+			db<RAWNIC>(ERR) << "RAWNIC: could not map the rings (errno=" << errno << ")!" << endl;
+			return;
+		}
+		_ring = reinterpret_cast<unsigned char *>(ring);
+		_tx_ring = _ring + BLOCK_SIZE * BLOCKS;
+
+		sockaddr_ll addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sll_family = AF_PACKET;
+		addr.sll_protocol = htons(PROTO_TSTP);
+		addr.sll_ifindex = if_nametoindex(_interface);
+		if (bind(_socket, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+			db<RAWNIC>(ERR) << "RAWNIC: could not bind to " << _interface << " (errno=" << errno << ")!" << endl;
+			return;
+		}
+
+		// Reset
+		reconfigure(&_configuration);
+
+		create_receive_thread();
+	}
+
+	virtual int send(const Address & dst, const Protocol & prot, const void * data, unsigned int size)
+	{
+		db<RAWNIC>(TRC) << "RAWNIC::send(s=" << address() << ",d=" << dst << ",p=" << hex << prot << dec << ",d=" << data << ",s=" << size << ")" << endl;
+
+		if (!_tx_ring || (size > MTU))
+			return 0;
+
+		pthread_mutex_lock(&_tx_lock);
+		tpacket3_hdr * hdr = reinterpret_cast<tpacket3_hdr *>(_tx_ring + _tx_cur * FRAME_SIZE);
+		if (hdr->tp_status != TP_STATUS_AVAILABLE) {
+			// Ring full: whatever the kernel has not sent yet stays there, this frame is dropped
+			pthread_mutex_unlock(&_tx_lock);
+			_statistics.tx_overruns++;
+			return 0;
+		}
+		++_tx_cur %= _tx_frames;
+
+		Frame * frame = reinterpret_cast<Frame *>(reinterpret_cast<unsigned char *>(hdr) + TX_DATA);
+		new (frame) Header(address(), dst, prot);
+		memcpy(frame->data<void>(), data, size);
+		hdr->tp_len = HEADER_SIZE + size;
+		hdr->tp_next_offset = 0;
+		__sync_synchronize();
+		hdr->tp_status = TP_STATUS_SEND_REQUEST;
+		pthread_mutex_unlock(&_tx_lock);
+
+		::send(_socket, 0, 0, MSG_DONTWAIT);
+
+		_statistics.tx_packets++;
+		_statistics.tx_bytes += HEADER_SIZE + size;
+
+		return size;
+	}
+	virtual int receive(Address * src, Protocol * prot, void * data, unsigned int size)
+	{
+		db<RAWNIC>(TRC) << "RAWNIC::receive(d=" << data << ",s=" << size << ")" << endl;
+
+		// Sleep until the receive thread queues a frame
+		pthread_mutex_lock(&_rx_lock);
+		while (_rx_queue.empty())
+			pthread_cond_wait(&_rx_ready, &_rx_lock);
+		Buffer * buf = _rx_queue.remove()->object();
+		pthread_mutex_unlock(&_rx_lock);
+
+		if (src)
+			*src = buf->frame()->src();
+		if (prot)
+			*prot = buf->frame()->prot();
+
+		unsigned int ret = (buf->size() < size) ? buf->size() : size;
+		memcpy(data, buf->frame()->data<void>(), ret);
+
+		free(buf);
+
+		return ret;
+	}
+
+	virtual Buffer * alloc(const Address & dst, const Protocol & prot, unsigned int once, unsigned int always, unsigned int payload)
+	{
+		db<RAWNIC>(TRC) << "RAWNIC::alloc(s=" << address() << ",d=" << dst << ",p=" << hex << prot << dec << ",on=" << once << ",al=" << always << ",ld=" << payload << ")" << endl;
+
+		Buffer* buf = _pool.get();
+		if (!buf) {
+			db<RAWNIC>(WRN) << "RAWNIC::alloc: buffer pool exhausted, allocating from the heap" << endl;
+			buf = new Buffer(this, 0);
+		}
+		buf->size(once + always + payload);
+
+		buf->is_microframe = false;
+		buf->trusted = false;
+		buf->is_new = true;
+		buf->random_backoff_exponent = 0;
+		buf->microframe_count = 0;
+		buf->times_txed = 0;
+		buf->offset = 0;
+
+		return buf;
+	}
+	virtual int send(Buffer * buf)
+	{
+		db<RAWNIC>(TRC) << "RAWNIC::send(buf=" << buf << ")" << endl;
+
+		int ret = send(Address::BROADCAST, PROTO_TSTP, buf->frame()->data<void>(), buf->size());
+		free(buf);
+
+		return ret;
+	}
+
+	virtual void free(Buffer * buf)
+	{
+		db<RAWNIC>(TRC) << "RAWNIC::free(buf=" << buf << ")" << endl;
+
+		if (_pool.contains(buf))
+			_pool.put(buf);
+		else
+			delete buf;
+	}
+
+	virtual const Address& address()
+	{
+		return _configuration.address;
+	}
+
+	virtual void address(const Address& addr)
+	{
+		db<RAWNIC>(TRC) << "RAWNIC::address(addr=" << addr << ")" << endl;
+		_configuration.address = addr;
+		_configuration.selector = Configuration::ADDRESS;
+		reconfigure(&_configuration);
+	}
+
+	virtual bool reconfigure(const Configuration * c = 0)
+	{
+		db<RAWNIC>(TRC) << "RAWNIC::reconfigure(c=" << c << ")" << endl;
+		return true;
+	}
+
+	virtual const Configuration & configuration()
+	{
+		return _configuration;
+	}
+
+	virtual const Statistics& statistics()
+	{
+		_statistics.time_stamp = TSC::time_stamp();
+		return _statistics;
+	}
+
+private:
+	// Of a unit, or 0 if it has none
+	static const char * interface(unsigned int unit)
+	{
+		if (unit >= COUNTOF(Traits<RAWNIC>::INTERFACES))
+			return 0;
+		if (!unit && !Traits<RAWNIC>::INTERFACES[unit])
+			return globalInterface;
+		return Traits<RAWNIC>::INTERFACES[unit];
+	}
+
+	void create_receive_thread()
+	{
+		pthread_t threadHandle;
+		pthread_create(&threadHandle, 0, receive_thread, this);
+	}
+
+	void data_received(const unsigned char * data, unsigned int size)
+	{
+		// A frame longer than a Frame (e.g. a jumbo one on the interface) would not fit a buffer, and a truncated
+		// one would have its upper layers read past what was copied, so it is dropped (as UDPNIC drops those MSG_TRUNC)
+		if (size > sizeof(Frame))
+			return;
+
+		Buffer * buf = _pool.get();
+		if (!buf) {
+			_statistics.rx_overruns++;
+			return;
+		}
+
+		memcpy(reinterpret_cast<unsigned char *>(buf->frame()), data, size);
+		buf->size(size - HEADER_SIZE);
+		buf->is_microframe = false;
+		buf->trusted = false;
+		buf->is_new = false;
+		buf->relevant = false;
+		buf->destined_to_me = false;
+
+		_statistics.rx_packets++;
+		_statistics.rx_bytes += size;
+
+		if (!notify(buf->frame()->prot(), buf)) {
+			// Nobody observing: keep it for receive(), or drop it if too many are waiting already
+			pthread_mutex_lock(&_rx_lock);
+			bool queued = _rx_queue.size() < RX_QUEUE;
+			if (queued) {
+				_rx_queue.insert(buf->link());
+				pthread_cond_signal(&_rx_ready);
+			}
+			pthread_mutex_unlock(&_rx_lock);
+			if (!queued)
+				free(buf);
+		}
+	}
+
+	static void* receive_thread(void* p)
+	{
+		db<RAWNIC>(TRC) << "RAWNIC::receive_thread()" << endl;
+
+		RAWNIC* nic = reinterpret_cast<RAWNIC*>(p);
+
+		pollfd pfd;
+		pfd.fd = nic->_socket;
+		pfd.events = POLLIN | POLLERR;
+
+		for (unsigned int b = 0; true; ++b %= BLOCKS) {
+			tpacket_block_desc * block = reinterpret_cast<tpacket_block_desc *>(nic->_ring + b * BLOCK_SIZE);
+
+			// Sleep until the kernel retires this block to us
+			while (!(block->hdr.bh1.block_status & TP_STATUS_USER)) {
+				pfd.revents = 0;
+				poll(&pfd, 1, -1);
+			}
+			__sync_synchronize();
+
+			tpacket3_hdr * pkt = reinterpret_cast<tpacket3_hdr *>(reinterpret_cast<unsigned char *>(block) + block->hdr.bh1.offset_to_first_pkt);
+			for (unsigned int i = 0; i < block->hdr.bh1.num_pkts; i++) {
+				sockaddr_ll * ll = reinterpret_cast<sockaddr_ll *>(reinterpret_cast<unsigned char *>(pkt) + TPACKET_ALIGN(sizeof(tpacket3_hdr)));
+				// Frames we sent ourselves show up as outgoing
+				if ((ll->sll_pkttype != PACKET_OUTGOING) && (pkt->tp_snaplen > HEADER_SIZE))
+					nic->data_received(reinterpret_cast<unsigned char *>(pkt) + pkt->tp_mac, pkt->tp_snaplen);
+				pkt = reinterpret_cast<tpacket3_hdr *>(reinterpret_cast<unsigned char *>(pkt) + pkt->tp_next_offset);
+			}
+
+			// Hand the block back to the kernel
+			__sync_synchronize();
+			block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+		}
+
+		return 0;
+	}
+};
@@ -0,0 +1,404 @@
+#pragma once
+#include <machine/nic.h>
+#include <utility/debug.h>
+#include <utility/geometry.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Simulated Ethernet NIC for running many TSTP nodes inside a single process.
+// All SIMNICs share one Ether: a frame sent by a node reaches every other node within
+// Traits<TSTP>::RADIO_RANGE of it (and addressed to it, or broadcast), each getting its own copy
+// in a buffer drawn from its pool. Nodes are kept in a uniform grid of RADIO_RANGE sized cells,
+// hashed into CELLS buckets, so a transmission only looks at the 27 cells around the sender and
+// delivery cost follows the density of the network, not its size. RSSI falls linearly with
+// distance, from -30 dBm next to the sender down to -90 dBm at the edge of the range, and frames
+// can be dropped with a LOSS percent probability.
+// Frames go on the air asynchronously and are delivered, in order, by a single Ether thread, so
+// observers never run nested in a send() and the stacks see one frame at a time.
+// Node positions must match what each node's Locator reports as here().
+// All nodes share the Ether's clock, which counts microseconds since the Ether came up, to match
+// the timer_frequency SIMNICs report; frames are time stamped (sfdts) as they arrive.
+class SIMNIC : public NIC<Ethernet>
+{
+public:
+	typedef Point<long, 3> Position;
+
+private:
+	static const unsigned int BUFFERS = Traits<SIMNIC>::BUFFERS;
+	static const unsigned int CELLS = Traits<SIMNIC>::CELLS;
+	static const unsigned int LOSS = Traits<SIMNIC>::LOSS;
+	static const unsigned int RANGE = Traits<TSTP>::RADIO_RANGE;
+	static const unsigned int RX_QUEUE = 10;
+
+	// The shared medium
+	class Ether
+	{
+	private:
+		typedef Simple_List<SIMNIC> Cell;
+
+	public:
+		Ether(): _seed(1), _busy(false)
+		{
+			db<SIMNIC>(TRC) << "SIMNIC::Ether()" << endl;
+
+			clock_gettime(CLOCK_MONOTONIC, &_epoch);
+
+			pthread_rwlock_init(&_grid_lock, 0);
+			pthread_mutex_init(&_air_lock, 0);
+			pthread_cond_init(&_air_ready, 0);
+			pthread_cond_init(&_air_idle, 0);
+
+			pthread_t thread;
+			pthread_create(&thread, 0, &run, this);
+			pthread_detach(thread);
+		}
+
+		void attach(SIMNIC * nic)
+		{
+			pthread_rwlock_wrlock(&_grid_lock);
+			place(nic);
+			pthread_rwlock_unlock(&_grid_lock);
+		}
+
+		void detach(SIMNIC * nic)
+		{
+			pthread_rwlock_wrlock(&_grid_lock);
+			_cells[nic->_bucket].remove(&nic->_link);
+			pthread_rwlock_unlock(&_grid_lock);
+		}
+
+		void move(SIMNIC * nic, const Position & p)
+		{
+			pthread_rwlock_wrlock(&_grid_lock);
+			_cells[nic->_bucket].remove(&nic->_link);
+			nic->_position = p;
+			place(nic);
+			pthread_rwlock_unlock(&_grid_lock);
+		}
+
+		void transmit(Buffer * buf)
+		{
+			pthread_mutex_lock(&_air_lock);
+			_air.insert(buf->link());
+			pthread_cond_signal(&_air_ready);
+			pthread_mutex_unlock(&_air_lock);
+		}
+
+		TSC::Time_Stamp time_stamp() const
+		{
+			timespec t;
+			clock_gettime(CLOCK_MONOTONIC, &t);
+			return static_cast<TSC::Time_Stamp>(t.tv_sec - _epoch.tv_sec) * 1000000 + (t.tv_nsec - _epoch.tv_nsec) / 1000;
+		}
+
+		// Waits until every frame put on the air has been delivered
+		void drain()
+		{
+			pthread_mutex_lock(&_air_lock);
+			while(!_air.empty() || _busy)
+				pthread_cond_wait(&_air_idle, &_air_lock);
+			pthread_mutex_unlock(&_air_lock);
+		}
+
+	private:
+		static long cell(long c) { return (c >= 0) ? c / long(RANGE) : (c + 1) / long(RANGE) - 1; }
+
+		static unsigned int bucket(long x, long y, long z)
+		{
+			return (static_cast<unsigned long>(x) * 73856093UL ^ static_cast<unsigned long>(y) * 19349663UL ^ static_cast<unsigned long>(z) * 83492791UL) % CELLS;
+		}
+
+		void place(SIMNIC * nic)
+		{
+			nic->_cell = Position(cell(nic->_position.x), cell(nic->_position.y), cell(nic->_position.z));
+			nic->_bucket = bucket(nic->_cell.x, nic->_cell.y, nic->_cell.z);
+			_cells[nic->_bucket].insert(&nic->_link);
+		}
+
+		void deliver(Buffer * buf)
+		{
+			SIMNIC * sender = static_cast<SIMNIC *>(buf->nic());
+			const Position & p = sender->_position;
+			const Address & dst = buf->frame()->dst();
+			bool broadcast = (dst == Address(Address::BROADCAST));
+
+			pthread_rwlock_rdlock(&_grid_lock);
+			for(long x = sender->_cell.x - 1; x <= sender->_cell.x + 1; x++)
+				for(long y = sender->_cell.y - 1; y <= sender->_cell.y + 1; y++)
+					for(long z = sender->_cell.z - 1; z <= sender->_cell.z + 1; z++)
+						for(Cell::Element * e = _cells[bucket(x, y, z)].head(); e; e = e->next()) {
+							SIMNIC * nic = e->object();
+							// Buckets are shared by distant cells that hash alike
+							if((nic == sender) || (nic->_cell.x != x) || (nic->_cell.y != y) || (nic->_cell.z != z))
+								continue;
+							if(!broadcast && (dst != nic->address()))
+								continue;
+							long long dx = nic->_position.x - p.x, dy = nic->_position.y - p.y, dz = nic->_position.z - p.z;
+							unsigned long long d2 = dx * dx + dy * dy + dz * dz;
+							if(d2 > static_cast<unsigned long long>(RANGE) * RANGE)
+								continue;
+							if(LOSS && (static_cast<unsigned int>(rand_r(&_seed)) % 100 < LOSS))
+								continue;
+							nic->arrive(buf, Math::sqrt(d2));
+						}
+			pthread_rwlock_unlock(&_grid_lock);
+		}
+
+		static void * run(void * p)
+		{
+			db<SIMNIC>(TRC) << "SIMNIC::Ether::run()" << endl;
+
+			Ether * ether = reinterpret_cast<Ether *>(p);
+
+			pthread_mutex_lock(&ether->_air_lock);
+			while(true) {
+				while(ether->_air.empty()) {
+					ether->_busy = false;
+					pthread_cond_broadcast(&ether->_air_idle);
+					pthread_cond_wait(&ether->_air_ready, &ether->_air_lock);
+				}
+				ether->_busy = true;
+				Buffer * buf = ether->_air.remove()->object();
+				pthread_mutex_unlock(&ether->_air_lock);
+
+				// Receivers may send from their observers, which only puts frames on the air
+				ether->deliver(buf);
+				buf->nic()->free(buf);
+
+				pthread_mutex_lock(&ether->_air_lock);
+			}
+			pthread_mutex_unlock(&ether->_air_lock);
+
+			return 0;
+		}
+
+	private:
+		timespec _epoch;
+
+		Cell _cells[CELLS];
+		pthread_rwlock_t _grid_lock;
+
+		Buffer::List _air;
+		unsigned int _seed;
+		bool _busy;
+		pthread_mutex_t _air_lock;
+		pthread_cond_t _air_ready;
+		pthread_cond_t _air_idle;
+	};
+
+public:
+	// Units must be unique in the process, for they make the addresses
+	SIMNIC(unsigned int unit = 0, const Position & here = Position(0, 0, 0)): _pool(this, static_cast<void *>(0)), _position(here), _link(this)
+	{
+		db<SIMNIC>(TRC) << "SIMNIC(unit=" << unit << ",here=" << here << ")" << endl;
+
+		pthread_mutex_init(&_rx_lock, 0);
+		pthread_cond_init(&_rx_ready, 0);
+
+		_configuration.unit = unit;
+		_configuration.timer_accuracy = 1; // timer_accuracy();
+		_configuration.timer_frequency = 1000000; //  timer_frequency();
+
+		// Locally administered, unique within the process
+		Address addr;
+		addr[0] = 0x02;
+		addr[1] = 0x00;
+		for(unsigned int i = 0; i < 4; i++)
+			addr[2 + i] = _configuration.unit >> (24 - 8 * i);
+		address(addr);
+
+		ether().attach(this);
+	}
+	~SIMNIC()
+	{
+		db<SIMNIC>(TRC) << "~SIMNIC(this=" << this << ")" << endl;
+
+		ether().detach(this);
+		ether().drain();
+	}
+
+	const Position & position() const { return _position; }
+	void position(const Position & p) { ether().move(this, p); }
+
+	virtual int send(const Address & dst, const Protocol & prot, const void * data, unsigned int size)
+	{
+		db<SIMNIC>(TRC) << "SIMNIC::send(s=" << address() << ",d=" << dst << ",p=" << hex << prot << dec << ",d=" << data << ",s=" << size << ")" << endl;
+
+		if(size > MTU)
+			return 0;
+
+		Buffer * buf = _pool.get();
+		if(!buf) {
+			_statistics.tx_overruns++;
+			return 0;
+		}
+		new (buf->frame()) Frame(address(), dst, prot, data, size);
+		buf->size(size);
+
+		return transmit(buf);
+	}
+	virtual int receive(Address * src, Protocol * prot, void * data, unsigned int size)
+	{
+		db<SIMNIC>(TRC) << "SIMNIC::receive(d=" << data << ",s=" << size << ")" << endl;
+
+		pthread_mutex_lock(&_rx_lock);
+		while(_rx_queue.empty())
+			pthread_cond_wait(&_rx_ready, &_rx_lock);
+		Buffer * buf = _rx_queue.remove()->object();
+		pthread_mutex_unlock(&_rx_lock);
+
+		if(src)
+			*src = buf->frame()->src();
+		if(prot)
+			*prot = buf->frame()->prot();
+
+		unsigned int ret = (buf->size() < size) ? buf->size() : size;
+		memcpy(data, buf->frame()->data<void>(), ret);
+
+		free(buf);
+
+		return ret;
+	}
+
+	virtual Buffer * alloc(const Address & dst, const Protocol & prot, unsigned int once, unsigned int always, unsigned int payload)
+	{
+		db<SIMNIC>(TRC) << "SIMNIC::alloc(s=" << address() << ",d=" << dst << ",p=" << hex << prot << dec << ",on=" << once << ",al=" << always << ",ld=" << payload << ")" << endl;
+
+		Buffer * buf = _pool.get();
+		if(!buf) {
+			db<SIMNIC>(WRN) << "SIMNIC::alloc: buffer pool exhausted, allocating from the heap" << endl;
+			buf = new Buffer(this, 0);
+		}
+		new (buf->frame()) Header(address(), dst, prot);
+		buf->size(once + always + payload);
+
+		buf->is_microframe = false;
+		buf->trusted = false;
+		buf->is_new = true;
+		buf->random_backoff_exponent = 0;
+		buf->microframe_count = 0;
+		buf->times_txed = 0;
+		buf->offset = 0;
+
+		return buf;
+	}
+	virtual int send(Buffer * buf)
+	{
+		db<SIMNIC>(TRC) << "SIMNIC::send(buf=" << buf << ")" << endl;
+
+		return transmit(buf);
+	}
+
+	virtual void free(Buffer * buf)
+	{
+		db<SIMNIC>(TRC) << "SIMNIC::free(buf=" << buf << ")" << endl;
+
+		if(_pool.contains(buf))
+			_pool.put(buf);
+		else
+			delete buf;
+	}
+
+	virtual const Address & address()
+	{
+		return _configuration.address;
+	}
+
+	virtual void address(const Address & addr)
+	{
+		db<SIMNIC>(TRC) << "SIMNIC::address(addr=" << addr << ")" << endl;
+		_configuration.address = addr;
+		_configuration.selector = Configuration::ADDRESS;
+		reconfigure(&_configuration);
+	}
+
+	virtual bool reconfigure(const Configuration * c = 0)
+	{
+		db<SIMNIC>(TRC) << "SIMNIC::reconfigure(c=" << c << ")" << endl;
+		return true;
+	}
+
+	virtual const Configuration & configuration()
+	{
+		return _configuration;
+	}
+
+	virtual const Statistics & statistics()
+	{
+		_statistics.time_stamp = ether().time_stamp();
+		return _statistics;
+	}
+
+private:
+	static Ether & ether()
+	{
+		static Ether ether;
+		return ether;
+	}
+
+	int transmit(Buffer * buf)
+	{
+		unsigned int size = buf->size();
+
+		_statistics.tx_packets++;
+		_statistics.tx_bytes += HEADER_SIZE + size;
+
+		// The Ether frees the buffer once it has been delivered
+		ether().transmit(buf);
+
+		return size;
+	}
+
+	// Called by the Ether thread for every node within range of the sender
+	void arrive(Buffer * frame, unsigned int distance)
+	{
+		Buffer * buf = _pool.get();
+		if(!buf) {
+			_statistics.rx_overruns++;
+			return;
+		}
+
+		memcpy(reinterpret_cast<unsigned char *>(buf->frame()), reinterpret_cast<const unsigned char *>(frame->frame()), HEADER_SIZE + frame->size());
+		buf->size(frame->size());
+		buf->rssi = -30 - static_cast<int>(60 * distance / RANGE);
+		buf->sfdts = ether().time_stamp();
+		buf->is_microframe = false;
+		buf->trusted = false;
+		buf->is_new = false;
+		buf->relevant = false;
+		buf->destined_to_me = false;
+
+		_statistics.rx_packets++;
+		_statistics.rx_bytes += HEADER_SIZE + frame->size();
+
+		if(!notify(buf->frame()->prot(), buf)) {
+			// Nobody observing: keep it for receive(), or drop it if too many are waiting already
+			pthread_mutex_lock(&_rx_lock);
+			bool queued = _rx_queue.size() < RX_QUEUE;
+			if(queued) {
+				_rx_queue.insert(buf->link());
+				pthread_cond_signal(&_rx_ready);
+			}
+			pthread_mutex_unlock(&_rx_lock);
+			if(!queued)
+				free(buf);
+		}
+	}
+
+private:
+	Configuration _configuration;
+	Statistics _statistics;
+	Buffer_Pool<Buffer, BUFFERS> _pool;
+
+	// Placement on the Ether's grid
+	Position _position;
+	Position _cell;
+	unsigned int _bucket;
+	Simple_List<SIMNIC>::Element _link;
+
+	// Frames waiting for receive()
+	Buffer::List _rx_queue;
+	pthread_mutex_t _rx_lock;
+	pthread_cond_t _rx_ready;
+};
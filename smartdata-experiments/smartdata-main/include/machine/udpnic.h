@@ -1,44 +1,68 @@
 #pragma once
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <machine/nic.h>
 #include <utility/debug.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
 
 extern char* globalIPAddress;
 
-#define RX_BUFS 10
-
+// Ethernet frames tunneled over UDP.
+// Datagrams are received by an epoll-driven thread in batches of up to RX_BATCH (recvmmsg),
+// straight into the frames of buffers drawn from a pool of BUFFERS preallocated ones.
+// Received buffers are handed to observers, which must free() them back to the pool; those nobody
+// observes are queued (up to RX_QUEUE) for receive().
+// Buffers handed to send(Buffer *) belong to the NIC from then on: they are queued and sent
+// in batches of up to TX_BATCH (sendmmsg), either once the batch fills up or after TX_FLUSH ms.
+// Each unit uses its own pair of ports, so several of them can serve different TSTP stacks.
 class UDPNIC : public NIC<Ethernet>
 {
 private:
+	static const unsigned int RX_BATCH = Traits<UDPNIC>::RX_BATCH;
+	static const unsigned int TX_BATCH = Traits<UDPNIC>::TX_BATCH;
+	static const unsigned int TX_FLUSH = Traits<UDPNIC>::TX_FLUSH;
+	static const unsigned int BUFFERS = Traits<UDPNIC>::BUFFERS;
+	static const unsigned int RX_QUEUE = 10;
+	static const unsigned short BASE_PORT = 5000; // unit n sends from BASE_PORT + 2n to BASE_PORT + 2n + 1, where it also listens
+
 	int _socket = -1;
-	fd_set _fd;
 	sockaddr_in _remoteAddress;
 	Configuration _configuration;
 	Statistics _statistics;
-	Buffer* _rx_bufs[RX_BUFS];
-	unsigned int _rx_cur_consume;
-	unsigned int _rx_cur_produce;
+	Buffer_Pool<Buffer, BUFFERS> _pool;
+
+	// Frames waiting for receive()
+	Buffer::List _rx_queue;
+	pthread_mutex_t _rx_lock;
+	pthread_cond_t _rx_ready;
+
+	// TX batch, protected by _tx_lock and flushed by whoever fills it or by the receive thread on timeout
+	pthread_mutex_t _tx_lock;
+	Buffer* _tx_bufs[TX_BATCH];
+	mmsghdr _tx_msgs[TX_BATCH];
+	iovec _tx_iovs[TX_BATCH];
+	unsigned int _tx_count;
+	long long _tx_deadline;
+	int _tx_event;
 
 
 public:
-	UDPNIC()
+	UDPNIC(unsigned int unit = 0): _pool(this, static_cast<void *>(0))
 	{
-		db<UDPNIC>(TRC) << "UDPNIC()" << endl;
+		db<UDPNIC>(TRC) << "UDPNIC(unit=" << unit << ")" << endl;
 
-		_rx_cur_consume = 0;
-		_rx_cur_produce = 0;
+		pthread_mutex_init(&_rx_lock, 0);
+		pthread_cond_init(&_rx_ready, 0);
 
 		_configuration.timer_accuracy = 1;
 
-		_configuration.unit = 1;
-
-		// Initialize RX buffer pool
-		for (unsigned int i = 0; i < RX_BUFS; i++)
-			_rx_bufs[i] = new /*(SYSTEM)*/ Buffer(this, 0);
+		_configuration.unit = unit;
 
 		// Set Address
 		// const UUID & id = (unsigned char[]){ 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08 }; //  Machine::uuid();
@@ -63,16 +87,26 @@ public:
 		memset(&servaddr, '\0', sizeof(sockaddr));
 		servaddr.sin_family = AF_INET;
 		servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
-		servaddr.sin_port = htons(5000);
+		servaddr.sin_port = htons(BASE_PORT + 2 * unit);
 		bind(_socket, (struct sockaddr *)&servaddr, sizeof(sockaddr));
 
-		FD_ZERO(&_fd);
-		FD_SET(_socket, &_fd);
-
 		_remoteAddress.sin_family = AF_INET;
-		_remoteAddress.sin_port = htons(5001);
+		_remoteAddress.sin_port = htons(BASE_PORT + 2 * unit + 1);
 		_remoteAddress.sin_addr.s_addr = inet_addr(globalIPAddress);
 
+		// All TX messages go to the same peer, so their headers are set once
+		pthread_mutex_init(&_tx_lock, 0);
+		_tx_count = 0;
+		_tx_deadline = 0;
+		_tx_event = eventfd(0, EFD_NONBLOCK);
+		memset(_tx_msgs, 0, sizeof(_tx_msgs));
+		for (unsigned int i = 0; i < TX_BATCH; i++) {
+			_tx_msgs[i].msg_hdr.msg_name = &_remoteAddress;
+			_tx_msgs[i].msg_hdr.msg_namelen = sizeof(_remoteAddress);
+			_tx_msgs[i].msg_hdr.msg_iov = &_tx_iovs[i];
+			_tx_msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
 		create_receive_thread();
 
 		usleep(100000);
@@ -86,42 +120,28 @@ public:
 	{
 		db<UDPNIC>(TRC) << "UDPNIC::send(s=" << address() << ",d=" << dst << ",p=" << hex << prot << dec << ",d=" << data << ",s=" << size << ")" << endl;
 
-		fd_set writefd;
-		memcpy(&writefd, &_fd, sizeof(fd_set));
-		struct timeval timeout;
-		timeout.tv_sec = 0;
-		timeout.tv_usec = 0;
-		if (select(_socket + 1, NULL, &writefd, NULL, &timeout) > 0)
-		{
-			db<UDPNIC>(TRC) << "sendto size=" << size << ", data=" << data << endl;
-			sendto(_socket, data, size, 0, (struct sockaddr *)&_remoteAddress,
-				sizeof(_remoteAddress));
-			return size;
-		}
+		int ret = sendto(_socket, data, size, 0, (struct sockaddr *)&_remoteAddress, sizeof(_remoteAddress));
 
-		return 0;
+		return (ret < 0) ? 0 : ret;
 	}
 	virtual int receive(Address * src, Protocol * prot, void * data, unsigned int size)
 	{
 		db<UDPNIC>(TRC) << "UDPNIC::receive(s=" /*<< *src << ",p=" << hex << *prot << dec*/ << ",d=" << data << ",s=" << size << ") => " << endl;
 
-		Buffer * buf;
-		for (buf = 0; !buf; ++_rx_cur_consume %= RX_BUFS) { // _xx_cur_xxx are simple accelerators to avoid scanning the ring buffer from the beginning.
-														   // Losing a write in a race condition is assumed to be harmless. The FINC + CAS alternative seems too expensive.
-			unsigned int idx = _rx_cur_consume;
-			if (_rx_bufs[idx]->lock()) {
-				if (_rx_bufs[idx]->size() > 0)
-					buf = _rx_bufs[idx];
-				else
-					_rx_bufs[idx]->unlock();
-			}
-		}
-
-		Address dst;
+		// Sleep until the receive thread queues a frame
+		pthread_mutex_lock(&_rx_lock);
+		while (_rx_queue.empty())
+			pthread_cond_wait(&_rx_ready, &_rx_lock);
+		Buffer * buf = _rx_queue.remove()->object();
+		pthread_mutex_unlock(&_rx_lock);
 
-		unsigned int ret = 0;
+		if (src)
+			*src = buf->frame()->src();
+		if (prot)
+			*prot = buf->frame()->prot();
 
-		memcpy(data, buf->frame()->data<Frame>(), (buf->size() < size ? buf->size() : size));
+		unsigned int ret = (buf->size() < size) ? buf->size() : size;
+		memcpy(data, buf->frame()->data<void>(), ret);
 
 		free(buf);
 
@@ -132,9 +152,13 @@ public:
 	{
 		db<UDPNIC>(TRC) << "UDPNIC::alloc(s=" << address() << ",d=" << dst << ",p=" << hex << prot << dec << ",on=" << once << ",al=" << always << ",ld=" << payload << ")" << endl;
 
-		Buffer* buf = new Buffer(this, 0);
+		Buffer* buf = _pool.get();
+		if (!buf) {
+			db<UDPNIC>(WRN) << "UDPNIC::alloc: buffer pool exhausted, allocating from the heap" << endl;
+			buf = new Buffer(this, 0);
+		}
 		buf->size(once + always + payload);
-		
+
 		// TCB - do we need it?
 		// MAC::marshal(buf);
 		buf->is_microframe = false;
@@ -151,13 +175,40 @@ public:
 	virtual int send(Buffer * buf)
 	{
 		db<UDPNIC>(TRC) << "UDPNIC::send(buf=" << buf << ",frame=" << buf->frame() << " => " << *(buf->frame()) << endl;
-		return send(address(), NIC::PROTO_IP, buf->link(), buf->size());
+
+		unsigned int size = HEADER_SIZE + buf->size();
+
+		if (TX_BATCH <= 1) {
+			int ret = send(address(), NIC::PROTO_IP, buf->frame(), size);
+			free(buf);
+			return ret;
+		}
+
+		pthread_mutex_lock(&_tx_lock);
+		_tx_bufs[_tx_count] = buf;
+		_tx_iovs[_tx_count].iov_base = buf->frame();
+		_tx_iovs[_tx_count].iov_len = size;
+		_tx_count++;
+		if (_tx_count == TX_BATCH)
+			flush();
+		else if (_tx_count == 1) {
+			// Arm the flush timeout on the receive thread
+			_tx_deadline = now() + TX_FLUSH;
+			eventfd_write(_tx_event, 1);
+		}
+		pthread_mutex_unlock(&_tx_lock);
+
+		return size;
 	}
 
 	virtual void free(Buffer * buf)
 	{
 		db<UDPNIC>(TRC) << "UDPNIC::free(buf=" << buf << ")" << endl;
-		delete buf;
+
+		if (_pool.contains(buf))
+			_pool.put(buf);
+		else
+			delete buf;
 	}
 
 	virtual const Address& address()
@@ -165,7 +216,7 @@ public:
 		db<UDPNIC>(TRC) << "UDPNIC::address()" << endl;
 		return _configuration.address;
 	}
-	
+
 	virtual void address(const Address& addr)
 	{
 		db<UDPNIC>(TRC) << "UDPNIC::address(addr=" << addr << ")" << endl;
@@ -175,7 +226,7 @@ public:
 	}
 
 	virtual bool reconfigure(const Configuration * c = 0)
-	{ 
+	{
 		db<UDPNIC>(TRC) << "UDPNIC::reconfigure(c=" << c << ")" << endl;
 		return true;
 	}
@@ -202,17 +253,66 @@ public:
 		pthread_attr_destroy(&attr);
 	}
 
-	void data_received(const char* data, int size)
+	// Delivers a frame received in place into a pool buffer
+	void data_received(Buffer* buf, int size)
 	{
 		Protocol prot = PROTO_TSTP;
-		Buffer* buf = new Buffer(this, 0);
 
-		buf->size(size);
+		buf->size(size - HEADER_SIZE);
+		buf->is_microframe = false;
+		buf->trusted = false;
+		buf->is_new = false;
+		buf->relevant = false;
+		buf->destined_to_me = false;
+
+		_statistics.rx_packets++;
+		_statistics.rx_bytes += size;
+
+		if (!notify(prot, buf)) {
+			// Nobody observing: keep it for receive(), or drop it if too many are waiting already
+			pthread_mutex_lock(&_rx_lock);
+			bool queued = _rx_queue.size() < RX_QUEUE;
+			if (queued) {
+				_rx_queue.insert(buf->link());
+				pthread_cond_signal(&_rx_ready);
+			}
+			pthread_mutex_unlock(&_rx_lock);
+			if (!queued)
+				free(buf);
+		}
+	}
+
+private:
+	static long long now()
+	{
+		timespec t;
+		clock_gettime(CLOCK_MONOTONIC, &t);
+		return static_cast<long long>(t.tv_sec) * 1000 + t.tv_nsec / 1000000;
+	}
 
-		// buf->fill(size, data);
-		memcpy(buf, data, size);
+	// Sends the pending TX batch; must be called with _tx_lock held
+	void flush()
+	{
+		db<UDPNIC>(TRC) << "UDPNIC::flush(n=" << _tx_count << ")" << endl;
+
+		for (unsigned int sent = 0; sent < _tx_count; ) {
+			int ret = sendmmsg(_socket, &_tx_msgs[sent], _tx_count - sent, 0);
+			if (ret < 0) {
+				if (errno == EINTR)
+					continue;
+				db<UDPNIC>(WRN) << "UDPNIC::flush: sendmmsg failed (errno=" << errno << "), " << _tx_count - sent << " frames dropped" << endl;
+				break;
+			}
+			for (int i = 0; i < ret; i++) {
+				_statistics.tx_packets++;
+				_statistics.tx_bytes += _tx_msgs[sent + i].msg_len;
+			}
+			sent += ret;
+		}
 
-		notify(prot, buf);
+		for (unsigned int i = 0; i < _tx_count; i++)
+			free(_tx_bufs[i]);
+		_tx_count = 0;
 	}
 
 	static void* receive_thread(void* p)
@@ -222,34 +322,94 @@ public:
 		UDPNIC* udpnic = (UDPNIC*)p;
 
 		int _socket = -1;
-		fd_set _fd;
 
-		_socket = socket(AF_INET, SOCK_DGRAM, 0);
+		_socket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
 
 		struct sockaddr_in servaddr;
 		memset(&servaddr, '\0', sizeof(sockaddr));
 		servaddr.sin_family = AF_INET;
 		servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
-		servaddr.sin_port = htons(5001);
+		servaddr.sin_port = htons(BASE_PORT + 2 * udpnic->_configuration.unit + 1);
 		bind(_socket, (struct sockaddr *)&servaddr, sizeof(sockaddr));
 
-		FD_ZERO(&_fd);
-		FD_SET(_socket, &_fd);
+		int poll = epoll_create1(0);
+		epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.fd = _socket;
+		epoll_ctl(poll, EPOLL_CTL_ADD, _socket, &ev);
+		ev.data.fd = udpnic->_tx_event;
+		epoll_ctl(poll, EPOLL_CTL_ADD, udpnic->_tx_event, &ev);
+
+		// Buffers armed for the next recvmmsg; frames are received in place
+		Buffer * bufs[RX_BATCH];
+		mmsghdr msgs[RX_BATCH];
+		iovec iovs[RX_BATCH];
+		unsigned int armed = 0;
+		memset(msgs, 0, sizeof(msgs));
+		for (unsigned int i = 0; i < RX_BATCH; i++) {
+			iovs[i].iov_len = sizeof(Frame);
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
 
 		while (true)
 		{
-			struct timeval timeout;
-			timeout.tv_sec = 1;
-			timeout.tv_usec = 0;
-			fd_set readfd;
-			memcpy(&readfd, &_fd, sizeof(fd_set));
-			char data[2048];
-			int size = 2048;
-			if (select(_socket + 1, &readfd, NULL, NULL, &timeout) > 0)
-			{
-				int ret = recvfrom(_socket, data, size, 0, NULL, NULL);
-				if (ret > 0)
-					udpnic->data_received(data, size);
+			// Sleep until there is something to receive or a pending TX batch is due
+			int timeout = -1;
+			pthread_mutex_lock(&udpnic->_tx_lock);
+			if (udpnic->_tx_count) {
+				long long left = udpnic->_tx_deadline - now();
+				if (left <= 0) {
+					udpnic->flush();
+				} else
+					timeout = left;
+			}
+			pthread_mutex_unlock(&udpnic->_tx_lock);
+
+			epoll_event events[2];
+			int n = epoll_wait(poll, events, 2, timeout);
+			for (int e = 0; e < n; e++) {
+				if (events[e].data.fd == udpnic->_tx_event) {
+					eventfd_t v;
+					eventfd_read(udpnic->_tx_event, &v);
+					continue;
+				}
+
+				// Drain the socket, up to RX_BATCH datagrams per system call
+				while (true) {
+					for (Buffer * buf; (armed < RX_BATCH) && (buf = udpnic->_pool.get()); armed++) {
+						bufs[armed] = buf;
+						iovs[armed].iov_base = buf->frame();
+					}
+
+					int ret;
+					if (armed)
+						ret = recvmmsg(_socket, msgs, armed, 0, NULL);
+					else {
+						// Pool exhausted: drop a datagram so the socket does not stay readable forever
+						Frame discard;
+						if (recv(_socket, &discard, sizeof(Frame), 0) < 0)
+							break;
+						db<UDPNIC>(WRN) << "UDPNIC::receive_thread: buffer pool exhausted, frame dropped" << endl;
+						continue;
+					}
+					if (ret < 0)
+						break;
+
+					for (int i = 0; i < ret; i++) {
+						if ((msgs[i].msg_len > HEADER_SIZE) && !(msgs[i].msg_hdr.msg_flags & MSG_TRUNC))
+							udpnic->data_received(bufs[i], msgs[i].msg_len);
+						else
+							udpnic->free(bufs[i]);
+					}
+
+					// Keep the buffers that were not used armed for the next call
+					armed -= ret;
+					for (unsigned int i = 0; i < armed; i++) {
+						bufs[i] = bufs[i + ret];
+						iovs[i].iov_base = bufs[i]->frame();
+					}
+				}
 			}
 		}
 	}
@@ -1,6 +1,20 @@
 #pragma once
 #include <system/traits.h>
 
+// Topology: the TSTP stacks this process runs, where they are and how they reach each other. A program that needs
+// another one (e.g. a benchmark) brings it in a header of its own, given to all of its sources with -include
+// (see src/bench/handshake_traits.h), which defines __topology_traits__
+#ifndef __topology_traits__
+template<> struct Traits<Topology> : public Traits_Tokens
+{
+	static const unsigned int NODES = 1; // (> 1 => NETWORKING)
+	static const bool simulated = false; // on SIMNICs, on the in-process Ether, instead of UDPNICs or RAWNICs
+	static const bool forwarder = true; // relay frames towards their destinations (false => single-hop networks)
+	static constexpr unsigned int NICS[] = { 0 }; // relative to NIC_Family (i.e. Traits<Ethernet>::DEVICES[NICS[i]]
+	static constexpr long POSITIONS[][3] = { { 0, 0, 0 } }; // cm, of each stack (as NICS), for its Locator and SIMNIC ((0, 0, 0) => the sink)
+};
+#endif
+
 // Build
 template<> struct Traits<Build> : public Traits_Tokens
 {
@@ -10,7 +24,7 @@ template<> struct Traits<Build> : public Traits_Tokens
 	static const unsigned int MACHINE = RISCV;
 	static const unsigned int MODEL = SiFive_E;
 	static const unsigned int CPUS = 1;
-	static const unsigned int NODES = 1; // (> 1 => NETWORKING)
+	static const unsigned int NODES = Traits<Topology>::NODES; // (> 1 => NETWORKING)
 	static const unsigned int EXPECTED_SIMULATION_TIME = 60; // s (0 => not simulated)
 
 	// Default flags
@@ -96,6 +110,35 @@ template<> struct Traits<System> : public Traits<Build>
 	static const unsigned int HEAP_SIZE = (Traits<Application>::MAX_THREADS + 1) * Traits<Application>::STACK_SIZE;
 };
 
+template<> struct Traits<UDPNIC> : public Traits<Machine_Common>
+{
+	static const unsigned int BUFFERS = 256; // preallocated frame buffers shared by RX and TX (< 65535)
+	static const unsigned int RX_BATCH = 32; // datagrams per recvmmsg (1 => one syscall per datagram)
+	static const unsigned int TX_BATCH = 32; // frames per sendmmsg (1 => frames are sent right away)
+	static const unsigned int TX_FLUSH = 1; // ms a partial TX batch may wait before being sent
+};
+
+template<> struct Traits<RAWNIC> : public Traits<Machine_Common>
+{
+	static const bool enabled = false; // use RAWNIC instead of UDPNIC
+	static constexpr const char * INTERFACES[] = { 0 }; // of each unit, by Traits<Topology>::NICS (only the first may be 0 => globalInterface)
+
+	static const unsigned int BUFFERS = 256; // preallocated frame buffers shared by RX and TX (< 65535)
+	static const unsigned int BLOCK_SIZE = 64 * 1024; // bytes per ring block (multiple of the page size)
+	static const unsigned int BLOCKS = 64; // blocks per ring (RX and TX)
+	static const unsigned int FRAME_SIZE = 2048; // bytes per frame slot
+	static const unsigned int RX_TIMEOUT = 1; // ms until a partially filled RX block is handed over
+};
+
+template<> struct Traits<SIMNIC> : public Traits<Machine_Common>
+{
+	static const bool enabled = Traits<Topology>::simulated; // use a SIMNIC on the in-process Ether instead of UDPNIC or RAWNIC
+
+	static const unsigned int BUFFERS = 32; // preallocated frame buffers per node (< 65535)
+	static const unsigned int CELLS = 4096; // buckets of the Ether's spatial grid
+	static const unsigned int LOSS = 0; // % of frames lost on each link
+};
+
 template<> struct Traits<Thread> : public Traits<Build>
 {
 	static const bool enabled = Traits<System>::multithread;
@@ -107,18 +150,68 @@ template<> struct Traits<Thread> : public Traits<Build>
 	static const unsigned int QUANTUM = 10000; // us
 };
 
+template<> struct Traits<Alarm> : public Traits<Build>
+{
+	static const unsigned int FREQUENCY = 10000; // Hz (timing wheel tick)
+	static const unsigned int DISPATCHERS = 0; // timer threads (0 => one per online core)
+};
+
 template<> struct Traits<SmartData> : public Traits<Build>
 {
-	static const unsigned char PREDICTOR = NONE;
+	static const unsigned char PREDICTOR = DBP; // of PREDICTIVE SmartData, which send Models instead of Responses
+	static const unsigned int PREDICTION_ERROR = 5; // % of a value its prediction may miss it by
+	static const unsigned int PREDICTION_MISSES = 0; // consecutive misses before a new model is sent
+	static const unsigned int PREDICTION_WINDOW = 10; // samples DBP derives its models from (<= 100)
+	static const unsigned int PREDICTION_POINTS = 3; // samples averaged at each end of DBP's window
+	static constexpr float PREDICTION_PROCESS_NOISE = 0.0001f; // KFP: variance of the drift of a value between samples
+	static constexpr float PREDICTION_MEASUREMENT_NOISE = 0.01f; // KFP: variance of the samples around the value
+	static constexpr float PREDICTION_SMOOTHING = 0.1f; // DESP: weight of each sample in the level (Holt's alpha)
+	static constexpr float PREDICTION_TREND_SMOOTHING = 0.05f; // DESP: weight of each slope in the trend (Holt's beta)
+	static const unsigned int REGIONS = 1024; // hash buckets of the spatial index of interests of each unit (a power of 2)
+};
+
+template<> struct Traits<Ciphers> : public Traits<Build>
+{
+	static const bool AES_NI = true; // use AES-NI instructions when the CPU has them
+	static const bool MONTGOMERY = true; // Bignums in Montgomery form on 64-bit digits (where the compiler has unsigned __int128)
+};
+
+template<> struct Traits<Series_Store> : public Traits<Build>
+{
+	static const unsigned int BLOCK = 1024; // records per sealed (compressed) block of a series
+	static constexpr unsigned long long ROLLUPS[] = { 1000000, 60000000, 3600000000ULL }; // us, windows of the rollups kept for each series
+	static const unsigned int ROLLUP = 256; // aggregates per rollup block
+	static const unsigned int DENSITY = 8; // records a window must take, at the sampling period of a series, for it to keep that rollup
+	static const unsigned int PROBE = 64; // records of a series whose times tell its sampling period
+};
+
+template<> struct Traits<Series_Ingestor> : public Traits<Build>
+{
+	static const unsigned int BATCH = 256; // records per batch handed to the store at once
+	static const unsigned int BATCHES = 256; // batches open or waiting for the store before producers block
+	static const unsigned int FLUSH = 100; // ms a partially filled batch may wait before being stored
+	static const unsigned int SYNC = 1000; // ms between syncs of the store to stable storage (0 => never)
 };
 
 // Utilities
 template<> struct Traits<Debug> : public Traits<Build>
 {
 	static const bool error = true;
+#ifndef __bench__
 	static const bool warning = true;
 	static const bool info = true;
 	static const bool trace = true;
+#else
+	// Benchmarks (src/bench) only report errors, for tracing would be most of what they measure
+	static const bool warning = false;
+	static const bool info = false;
+	static const bool trace = false;
+#endif
+
+	static const bool async = false; // db<> only queues records, a background thread formats them (see utility/log.h); errors and warnings are still printed at once
+	static const unsigned int BUFFER = 64 * 1024; // bytes of the record ring of each logging thread (a power of 2)
+	static const unsigned int FLUSH = 1; // ms the background thread waits for records when all rings are empty
+	static constexpr const char * LOG_FILE = 0; // binary log written instead of formatted output (0 => none)
 };
 
 template<> struct Traits<Network> : public Traits<Build>
@@ -134,11 +227,18 @@ template<> struct Traits<Network> : public Traits<Build>
 template<> struct Traits<TSTP> : public Traits<Network>
 {
 	typedef Ethernet NIC_Family;
-	static constexpr unsigned int NICS[] = { 0 }; // relative to NIC_Family (i.e. Traits<Ethernet>::DEVICES[NICS[i]]
-	static const unsigned int UNITS = COUNTOF(NICS);
+	static const unsigned int UNITS = COUNTOF(Traits<Topology>::NICS); // stacks, one per NIC in Traits<Topology>::NICS
 
 	static const unsigned int KEY_SIZE = 16;
 	static const unsigned int RADIO_RANGE = 8000; // approximated radio range in centimeters
+	static const bool forwarder = Traits<Topology>::forwarder;
+
+	static const unsigned int WORKERS = 0; // receive pipeline threads per stack (0 => one per online core)
+	static const unsigned int QUEUE = 256; // frames pending on each worker (a power of 2)
+	static const unsigned int CLIENTS = 1024; // buckets of the unit-indexed client table (a power of 2)
+	static const unsigned int PEERS = 256; // buckets of each index of security peers and pending keys (a power of 2)
+	static const unsigned int HANDSHAKES = 16; // security handshakes the key manager keeps open at a time
+	static const unsigned int HANDSHAKERS = 0; // security handshake threads per stack (0 => one per online core)
 
 	static const bool enabled = Traits<Network>::enabled && (NETWORKS::Count<TSTP>::Result > 0);
 };
@@ -34,7 +34,8 @@ public:
 
     void learn(const Space & coordinates, const Percent & confidence, const RSSI & rssi) {
         db<TSTP>(INF) << "HeCoPS::learn(c=" << coordinates << ",conf=" << confidence << ",rssi=" << static_cast<int>(rssi) << ")" << endl;
-        if(confidence < CONFIDENCE_TRASHOLD)
+        // Peers can't tell a node that was placed (100%) where it is any better
+        if((confidence < CONFIDENCE_TRASHOLD) || (_confidence == 100))
             return;
         unsigned int idx = -1u;
 
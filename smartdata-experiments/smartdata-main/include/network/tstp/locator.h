@@ -8,7 +8,7 @@
 
 #include <network/hecops.h>
 
-class TSTP::Locator: private SmartData, private Data_Observer<Buffer>
+class TSTP::Locator: private SmartData, private Part, private Data_Observer<Buffer>
 {
     friend class TSTP;
 
@@ -16,25 +16,25 @@ private:
     typedef HeCoPS<Space, 3> Engine;
 
 public:
-    Locator();
+    Locator(TSTP * tstp);
     ~Locator();
 
-    static const Space & here() { return _engine.here(); }
-    static const Percent & confidence() { return _engine.confidence(); }
-    static const Global_Space & reference() { return _reference; }
+    const Space & here() const { return _engine.here(); }
+    const Percent & confidence() const { return _engine.confidence(); }
+    const Global_Space & reference() const { return _reference; }
 
-    static Global_Space absolute(const Space & s) { return _reference + s; }
-    static Global_Space absolute(const Spacetime & st) { return _reference + st.space; }
-    static Space relative(const Global_Space & s) { Global_Space tmp = s; tmp -= _reference; return tmp; } // note that Point - Point returns the distance, that's why the -= is necessary here
+    Global_Space absolute(const Space & s) const { return _reference + s; }
+    Global_Space absolute(const Spacetime & st) const { return _reference + st.space; }
+    Space relative(const Global_Space & s) const { Global_Space tmp = s; tmp -= _reference; return tmp; } // note that Point - Point returns the distance, that's why the -= is necessary here
 
 private:
     void update(Data_Observed<Buffer> * obs, Buffer * buf);
 
-    static void marshal(Buffer * buf);
+    void marshal(Buffer * buf);
 
 private:
-    static Global_Space _reference;
-    static Engine _engine;
+    Global_Space _reference;
+    Engine _engine;
 };
 
 #endif
@@ -7,7 +7,7 @@
 #ifdef __tstp__
 
 
-class TSTP::Manager: private SmartData, private Data_Observer<Buffer>
+class TSTP::Manager: private SmartData, private Part, private Data_Observer<Buffer>
 {
     friend class TSTP;
 
@@ -17,33 +17,54 @@ private:
 
     static const unsigned int RANGE = Traits<TSTP>::RADIO_RANGE;
 
+public:
     // Model Control Message
+    // Sent by predictive SmartData in place of Responses, to the sink, whenever the model it predicts them with
+    // stops predicting them within the configured error (see Responsive_SmartData::process())
     class Model: public Control
     {
-    protected:
-        typedef unsigned char Data[MTU - sizeof(Header)];
+    public:
+        typedef unsigned char Data[MTU - sizeof(Control) - sizeof(Time)];
 
     public:
         template<typename M>
-        Model(const Region & dst, const M & model)
-        : Control(dst, 0, 0, 0, EPOCH), _model(model) {}
+        Model(const Spacetime & origin, const Unit & unit, const Device_Id & device, const Uncertainty & uncertainty, const Time & expiry, const M & m)
+        : Control(origin, unit, device, MODEL), _expiry(expiry) {
+            _misc = uncertainty;
+            model(m);
+        }
 
-        Region destination() const { return Region(_origin, _radius, _t1); }
+        Region destination() const { return Region(sink(), 0, _origin.time, _origin.time + _expiry); }
+
+        Uncertainty uncertainty() const { return static_cast<Uncertainty>(_misc); }
+        const Time & expiry() const { return _expiry; }
 
         template<typename T>
-        T * model() { return reinterpret_cast<T *>(&_model); }
+        const T & model() const {
+            static_assert(sizeof(T) <= sizeof(Data), "Predictor models must fit in a Model message");
+            return *reinterpret_cast<const T *>(&_model);
+        }
         template<typename T>
-        void model(const T & m) { *reinterpret_cast<T *>(&_model) = m; }
+        void model(const T & m) {
+            static_assert(sizeof(T) <= sizeof(Data), "Predictor models must fit in a Model message");
+            *reinterpret_cast<T *>(&_model) = m;
+        }
+
+        // Size of a message carrying a model of type M (Data is just the most that fits in a frame)
+        template<typename M>
+        static unsigned int size() { return sizeof(Model) - sizeof(Data) + sizeof(M); }
 
         friend Debug & operator<<(Debug & db, const Model & m) {
-            db << reinterpret_cast<const Control &>(m) << ",d=" << m.region() << ",e=" << m._model;
+            db << reinterpret_cast<const Control &>(m) << ",d=" << m.destination() << ",x=" << m._expiry;
             return db;
         }
 
     private:
+        Time _expiry;
         Data _model;
     } __attribute__((packed));
 
+private:
 //    // TSTP Smart Data bindings
 //    // Predictive (binder between Model messages and Smart Data)
 //    class Predictive: public Model
@@ -79,17 +100,13 @@ private:
 //    };
 
 public:
-    Manager();
+    Manager(TSTP * tstp);
     ~Manager();
 
-    bool synchronized();
-
-    static Region destination(Buffer * buf);
-
 private:
     void update(Data_Observed<Buffer> * obs, Buffer * buf);
 
-    static void marshal(Buffer * buf);
+    void marshal(Buffer * buf);
 };
 
 #endif
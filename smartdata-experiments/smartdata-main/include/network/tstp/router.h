@@ -8,23 +8,21 @@
 
 #include <smartdata.h>
 
-class TSTP::Router: private SmartData, private Data_Observer<Buffer>
+class TSTP::Router: private SmartData, private Part, private Data_Observer<Buffer>
 {
     friend class TSTP;
 
 private:
-    static const bool forwarder = true;
+    static const bool forwarder = Traits<TSTP>::forwarder;
     static const bool drop_expired = true;
 
     static const unsigned int RANGE = Traits<TSTP>::RADIO_RANGE;
 
 public:
-    Router();
+    Router(TSTP * tstp);
     ~Router();
 
-    bool synchronized();
-
-    static Region destination(Buffer * buf);
+    Region destination(Buffer * buf);
 
 private:
     void update(Data_Observed<Buffer> * obs, Buffer * buf);
@@ -75,7 +73,7 @@ private:
         buf->offset /= RANGE;
     }
 
-    static void marshal(Buffer * buf);
+    void marshal(Buffer * buf);
 };
 
 #endif
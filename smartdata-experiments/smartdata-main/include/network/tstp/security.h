@@ -13,20 +13,29 @@
 #include <utility/poly1305.h>
 #include <utility/diffie_hellman.h>
 #include <utility/array.h>
+#include <utility/hash.h>
+#include <utility/octree.h>
 #include <system/thread.h>
 #include <network/tstp/tstp.h>
 
 
-class TSTP::Security: private SmartData, private Data_Observer<Buffer>
+class TSTP::Security: private SmartData, private Part, private Data_Observer<Buffer>
 {
     friend class TSTP;
 
+public:
+    static const Time::Type KEY_MANAGER_PERIOD = 10 * 1000 * 1000;
+    static const Time::Type KEY_EXPIRY = 1 * 60 * 1000 * 1000;
+    static const Time::Type HANDSHAKE_TIMEOUT = 1 * 1000 * 1000; // an unanswered handshake frees its slot after this
+    static const Time::Type KEY_RENEWAL = KEY_EXPIRY / 4 * 3; // trusted peers start a new handshake once their key is this old
+    static const unsigned int HANDSHAKES = Traits<TSTP>::HANDSHAKES; // handshakes the key manager keeps open at a time
+
 private:
     static const bool use_encryption = false;
     static const unsigned int KEY_SIZE = Traits<TSTP>::KEY_SIZE;
-    static const Time::Type KEY_MANAGER_PERIOD = 10 * 1000 * 1000;
-    static const Time::Type KEY_EXPIRY = 1 * 60 * 1000 * 1000;
     static const Time::Type POLY_TIME_WINDOW = KEY_EXPIRY / 2;
+    static const unsigned int BATCH = 32; // frames authenticated together by authenticate()
+    static const unsigned int WINDOWS = 4; // time windows whose masks and keys unpack() keeps for a batch
 
 #define _SYS
 
@@ -41,21 +50,56 @@ public:
     typedef _DH::Public_Key Public_Key;
     typedef _DH::Shared_Key Master_Secret;
 
-    class Packed_Public_Key: public Public_Key {
+    // Public keys go on the wire as the bytes of their coordinates (see Bignum::to_bytes()), which, unlike the
+    // Bignums themselves, do not depend on the build (e.g. on Montgomery form or on the size of a digit)
+    class Packed_Public_Key {
+    private:
+        typedef Public_Key::Coordinate Coordinate;
+
     public:
-        Packed_Public_Key(const Public_Key & pub): Public_Key(pub.x, pub.y, pub.z) {};
+        Packed_Public_Key(const Public_Key & pub) { *this = pub; }
+
+        void operator=(const Public_Key & pub) {
+            pub.x.to_bytes(_x, KEY_SIZE);
+            pub.y.to_bytes(_y, KEY_SIZE);
+            pub.z.to_bytes(_z, KEY_SIZE);
+        }
+
+        operator Public_Key() const { return Public_Key(Coordinate(_x, KEY_SIZE), Coordinate(_y, KEY_SIZE), Coordinate(_z, KEY_SIZE)); }
+
+        friend Debug & operator<<(Debug & db, const Packed_Public_Key & k) {
+            db << Public_Key(k);
+            return db;
+        }
+
+    private:
+        unsigned char _x[KEY_SIZE];
+        unsigned char _y[KEY_SIZE];
+        unsigned char _z[KEY_SIZE];
     } __attribute__((packed));
 
+    // Peers are kept in a list each for pending and trusted ones (for the key manager to walk), and indexed by the
+    // regions they may be deployed in (to find the peer of a message's origin) and by their Auth (to find the peer
+    // of an Auth_Request, which may be a trusted one renewing its key). Pending keys are linked to the peer of their DH message and indexed by
+    // public key, so a repeated DH message reuses the master secret already computed for it.
     class Peer;
     typedef Simple_List<Peer> Peers;
+    typedef Loose_Octree<Peer, Region, Traits<TSTP>::PEERS> Deployments;
+    typedef Hash<Peer, Traits<TSTP>::PEERS> Auths;
+    class Pending_Key;
+    typedef List<Pending_Key> Pending_Keys;
+    typedef Hash<Pending_Key, Traits<TSTP>::PEERS> Public_Keys;
+
     class Peer
     {
     public:
-        Peer(const Node_Id & id, const Region & v): _id(id), _valid(v), _el(this), _auth_time(0) {
-            _aes.encrypt(_id, _id, _auth);
+        Peer(const Node_Id & id, const Region & v, _AES & aes)
+        : _id(id), _valid(v), _el(this), _deploy_el(this, &_valid), _auth_el(this), _trusted(false), _renewed(false), _handshaking(false), _auth_time(0), _handshake_time(0) {
+            aes.expand_key(_id, _schedule);
+            aes.encrypt(_id, _schedule, _auth);
+            _auth_el.rank(Auths::key(&_auth, sizeof(Auth)));
         }
 
-        void valid(const Region & r) { _valid = r; }
         const Region & valid() const { return _valid; }
 
         bool valid_deploy(const Space & where, const Time & when) {
@@ -68,16 +112,37 @@ public:
 
         const Time & authentication_time() { return _auth_time; }
 
+        bool trusted() const { return _trusted; }
+        void trusted(bool t) { _trusted = t; }
+
+        // Whether a handshake with the peer is open, and since when
+        bool handshaking() const { return _handshaking; }
+        const Time & handshake_time() const { return _handshake_time; }
+        void open_handshake(const Time & t) { _handshaking = true; _handshake_time = t; }
+        void close_handshake() { _handshaking = false; }
+
         Peers::Element * link() { return &_el; }
+        Deployments::Element * deploy_link() { return &_deploy_el; }
+        Auths::Element * auth_link() { return &_auth_el; }
+
+        Pending_Keys & keys() { return _keys; }
 
         const Master_Secret & master_secret() const { return _master_secret; }
-        void master_secret(const Master_Secret & ms) {
+        void master_secret(const Master_Secret & ms, const Time & now) {
+            _previous_master_secret = _master_secret;
+            _renewed = _trusted;
             _master_secret = ms;
-            _auth_time = now();
+            _auth_time = now;
         }
 
+        // Frames packed with the key a renewal replaced are accepted for a while, until the other end has the new one
+        bool renewed(const Time & now) const { return _renewed && (now - _auth_time <= HANDSHAKE_TIMEOUT); }
+        const Master_Secret & previous_master_secret() const { return _previous_master_secret; }
+
         const Auth & auth() const { return _auth; }
         const Node_Id & id() const { return _id; }
+        // The id expanded as an AES key, which the MACs of every frame packed for the peer are masked with
+        const _AES::Schedule & schedule() const { return _schedule; }
 
         friend Debug & operator<<(Debug & db, const Peer & p) {
             db << "{id=" << p._id << ",au=" << p._auth << ",v=" << p._valid << ",ms=" << p._master_secret << ",el=" << &p._el << "}";
@@ -86,44 +151,52 @@ public:
 
     private:
         Node_Id _id;
+        _AES::Schedule _schedule;
         Auth _auth;
         Region _valid;
         Master_Secret _master_secret;
+        Master_Secret _previous_master_secret;
         Peers::Element _el;
+        Deployments::Element _deploy_el;
+        Auths::Element _auth_el;
+        Pending_Keys _keys;
+        bool _trusted;
+        bool _renewed;
+        bool _handshaking;
         Time _auth_time;
+        Time _handshake_time;
     };
 
-    class  Pending_Key;
-    typedef Simple_List<Pending_Key> Pending_Keys;
     class Pending_Key
     {
     public:
-        Pending_Key(const Public_Key & pk): _master_secret_calculated(false), _creation(now()), _public_key(pk), _el(this) {}
-
-        bool expired() { return now() - _creation > KEY_EXPIRY; }
-
-        const Master_Secret & master_secret() {
-            if(_master_secret_calculated)
-                return _master_secret;
-            _master_secret = _dh.shared_key(_public_key);
-            _master_secret_calculated = true;
+        Pending_Key(const Public_Key & pk, const Master_Secret & ms, Peer * peer, const Time & now)
+        : _creation(now), _public_key(pk), _master_secret(ms), _peer(peer), _el(this), _key_el(this, Public_Keys::key(&_public_key, sizeof(Public_Key))) {
             db<TSTP>(INF) << "TSTP::Security::Pending_Key: Master Secret set: " << _master_secret << endl;
-            return _master_secret;
         }
 
+        bool expired(const Time & now) { return now - _creation > KEY_EXPIRY; }
+        void renew(const Time & now) { _creation = now; }
+
+        const Public_Key & public_key() const { return _public_key; }
+        const Master_Secret & master_secret() const { return _master_secret; }
+        Peer * peer() const { return _peer; }
+
         Pending_Keys::Element * link() { return &_el; };
+        Public_Keys::Element * key_link() { return &_key_el; };
 
         friend Debug & operator<<(Debug & db, const Pending_Key & p) {
-            db << "{msc=" << p._master_secret_calculated << ",c=" << p._creation << ",pk=" << p._public_key << ",ms=" << p._master_secret << ",el=" << &p._el << "}";
+            db << "{c=" << p._creation << ",pk=" << p._public_key << ",ms=" << p._master_secret << ",el=" << &p._el << "}";
             return db;
         }
 
     private:
-        bool _master_secret_calculated;
         Time _creation;
         Public_Key _public_key;
         Master_Secret _master_secret;
+        Peer * _peer;
         Pending_Keys::Element _el;
+        Public_Keys::Element _key_el;
     };
 
     // Diffie-Hellman Request Security Bootstrap Control Message
@@ -228,52 +301,147 @@ public:
     } __attribute__((packed));
 
 public:
-    Security();
+    Security(TSTP * tstp);
     ~Security();
 
-    static void add_peer(const unsigned char * peer_id, unsigned int id_len, const Region & valid_region) {
+    const Node_Id & id() const { return _id; }
+
+    void add_peer(const unsigned char * peer_id, unsigned int id_len, const Region & valid_region) {
         Node_Id id(peer_id, id_len);
-        Peer * peer = new /*(SYSTEM)*/ Peer(id, valid_region);
+        Peer * peer = new /*(SYSTEM)*/ Peer(id, valid_region, _aes);
+        write_lock();
         _pending_peers.insert(peer->link());
+        _pending_deployments.insert(peer->deploy_link());
+        _auths.insert(peer->auth_link());
+        unlock();
         if(!_key_manager)
-            _key_manager = new /*(SYSTEM)*/ Thread(&key_manager);
+            _key_manager = new /*(SYSTEM)*/ Thread(&manage_keys, this);
+        else
+            wake_key_manager();
     }
 
+    // Size of the message a received frame's MAC covers (it follows the message), or 0 if it is not packed. RESPONSE frames
+    // are packed over their first sizeof(Master_Secret) bytes and Model messages as a whole, since a peer that forged one
+    // would have the sink predict whatever it wanted.
+    static unsigned int packed(Buffer * buf);
+
+    // Authenticates (and, with encryption, decrypts) n received packed frames (e.g. a burst at the sink), setting
+    // trusted on those that check, and returns how many did. Frames are grouped by the peer deployed at their origin,
+    // BATCH at a time, and those of each peer verified together, so the masks and keys of a time window are computed once.
+    unsigned int authenticate(Buffer * const bufs[], unsigned int n);
+
+    // Peers trusted, of those, how many authenticated (i.e. got their current key) since a given time
+    unsigned int trusted(const Time & since = 0);
+
     static Time deadline(const Time & origin) {
         return origin + Math::min(KEY_MANAGER_PERIOD, KEY_EXPIRY) / 2;
     }
 
 private:
+    class Handshaker;
+
+    // Size of the largest bootstrap control message
+    static const unsigned int DH_SIZE = sizeof(DH_Request) > sizeof(DH_Response) ? sizeof(DH_Request) : sizeof(DH_Response);
+    static const unsigned int AUTH_SIZE = sizeof(Auth_Request) > sizeof(Auth_Granted) ? sizeof(Auth_Request) : sizeof(Auth_Granted);
+    static const unsigned int HANDSHAKE_SIZE = DH_SIZE > AUTH_SIZE ? DH_SIZE : AUTH_SIZE;
+
     void update(Data_Observed<Buffer> * obs, Buffer * buf);
 
-    static void marshal(Buffer * buf);
+    // Runs a bootstrap control message (on a handshaker, the one of the message's origin)
+    void handshake(Control * msg);
+
+    // Peers and pending keys are read by the senders and receivers of RESPONSE frames and changed by handshakes and
+    // the key manager. The helpers below expect the lock held (for writing, if they change anything).
+    void read_lock() { pthread_rwlock_rdlock(&_peers_lock); }
+    void write_lock() { pthread_rwlock_wrlock(&_peers_lock); }
+    void unlock() { pthread_rwlock_unlock(&_peers_lock); }
+
+    Peer * pending_peer(const Space & where, const Time & when);
+    Peer * trusted_peer(const Space & where, const Time & when);
+    // Calls f(peer) for each peer, pending or trusted, deployed at where
+    template<typename F>
+    void peers(const Space & where, const Time & when, F f) {
+        _pending_deployments.search(where, when, f);
+        _trusted_deployments.search(where, when, f);
+    }
+    Pending_Key * pending_key(const Public_Key & pk);
+    void trust(Peer * peer);
+    void untrust(Peer * peer);
+    void discard(Peer * peer);
+    void discard(Pending_Key * pk);
+
+    void marshal(Buffer * buf);
 
-    static void pack(unsigned char * msg, const Peer * peer);
-    static bool unpack(const Peer * peer, unsigned char * msg, const unsigned char * mac, Time reception_time);
+    // Writes the MAC of the size bytes of msg right after them
+    void pack(unsigned char * msg, unsigned int size, const Peer * peer);
+    // Each message is followed by its MAC
+    unsigned int unpack(const Peer * peer, const Master_Secret & master_secret, unsigned char * const msgs[], const unsigned int sizes[], const Time reception_times[], unsigned int n, bool valid[]);
 
     // TODO: remove?
-    static void encrypt(const unsigned char * msg, const Peer * peer, unsigned char * out) {
+    void encrypt(const unsigned char * msg, const Peer * peer, unsigned char * out) {
         OTP key = otp(peer->master_secret(), peer->id());
         _aes.encrypt(msg, key, out);
     }
-    static OTP otp(const Master_Secret & master_secret, const Node_Id & id);
-    static bool verify_auth_request(const Master_Secret & master_secret, const Node_Id & id, const OTP & otp);
-    static int key_manager();
+    OTP otp(const Master_Secret & master_secret, const Node_Id & id);
+    bool verify_auth_request(const Master_Secret & master_secret, const Node_Id & id, const OTP & otp);
+    int key_manager();
+    static int manage_keys(Security * s) { return s->key_manager(); }
+    // Makes the key manager run before its period ends (e.g. because a handshake slot was freed)
+    void wake_key_manager();
+    // Stops the key manager and the handshakers, which marshal through the other parts of the stack (see ~TSTP)
+    void stop();
+
+private:
+    Node_Id _id;
+    Auth _auth;
+
+    Thread * _key_manager;
+    pthread_mutex_t _key_manager_mutex;
+    pthread_cond_t _key_manager_wakeup;
+    bool _key_manager_woken;
+    bool _key_manager_stopped; // told to return by ~Security
+    unsigned int _n_handshakers;
+    Handshaker * _handshakers;
+    pthread_rwlock_t _peers_lock;
+    Peers _pending_peers;
+    Peers _trusted_peers;
+    Deployments _pending_deployments;
+    Deployments _trusted_deployments;
+    Auths _auths;
+    Public_Keys _pending_keys;
+    unsigned int _dh_requests_open;
+
+    _AES _aes;
+    _AES & _cipher;
+    _DH _dh;
+};
+
+// Thread of the handshake pool of a Security. It runs the bootstrap control messages (copied out of their frames)
+// of the origins its Security hashes to it, so the Diffie-Hellman work of concurrent handshakes is spread over the
+// pool instead of the receive thread of the NIC all parts run on, while each peer's messages keep their order.
+// That thread is the only one to put into its queue. A null message makes the handshaker exit.
+class TSTP::Security::Handshaker
+{
+    friend class TSTP::Security;
+
+private:
+    typedef Ring_Buffer<Control *, Traits<TSTP>::QUEUE> Queue;
+
+public:
+    Handshaker(): _security(0), _sleeping(0) {}
+
+    void put(Control * msg);
+
+private:
+    static void * run(void * p);
 
 private:
-    static Node_Id _id;
-    static Auth _auth;
-
-    static Thread * _key_manager;
-    static Pending_Keys _pending_keys;
-    static volatile bool _peers_lock;
-    static Peers _pending_peers;
-    static Peers _trusted_peers;
-    static unsigned int _dh_requests_open;
-
-    static _AES _aes;
-    static _AES & _cipher;
-    static _DH _dh;
+    Security * _security;
+    Queue _queue;
+    volatile unsigned int _sleeping;
+    pthread_t _thread;
+    pthread_mutex_t _mutex;
+    pthread_cond_t _ready;
 };
 
 #endif
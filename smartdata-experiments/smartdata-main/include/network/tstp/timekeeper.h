@@ -10,7 +10,7 @@
 #include <utility/handler.h>
 
 
-class TSTP::Timekeeper: private SmartData, private Data_Observer<Buffer>
+class TSTP::Timekeeper: private SmartData, private Part, private Data_Observer<Buffer>
 {
     friend class TSTP;
 
@@ -27,7 +27,7 @@ public:
     class Epoch: public Control
     {
     public:
-        Epoch(const Region & r, const Time & t = Timekeeper::reference(), const Global_Space & c = Locator::reference())
+        Epoch(const Region & r, const Time & t, const Global_Space & c)
         : Control(r, 0, 0, EPOCH), _reference(t), _coordinates(c) { }
 
         Region destination() const { return Region(_origin, _radius, _t1); }
@@ -48,7 +48,7 @@ public:
     class Keep_Alive: public Control
     {
     public:
-        Keep_Alive(): Control(Spacetime(here(), now()), 0, 0, KEEP_ALIVE) {}
+        Keep_Alive(const Spacetime & origin): Control(origin, 0, 0, KEEP_ALIVE) {}
 
         friend Debug & operator<<(Debug & db, const Keep_Alive & k) {
             db << reinterpret_cast<const Control &>(k);
@@ -57,38 +57,41 @@ public:
     } __attribute__((packed));
 
 public:
-    Timekeeper();
+    Timekeeper(TSTP * tstp);
     ~Timekeeper();
 
-    static Time now() { return ts2us(time_stamp()) + _skew; }
-    static bool synchronized() { return (_next_sync > now()); }
-    static Time reference() { return _reference; }
+    Time now() const { return ts2us(time_stamp()) + _skew; }
+    bool synchronized() { return (_next_sync > now()); }
+    Time reference() const { return _reference; }
 
-    static Time absolute(const Time & t) { return _reference + t; }
-    static Time relative(const Time & t) { return t - _reference; }
+    Time absolute(const Time & t) const { return _reference + t; }
+    Time relative(const Time & t) const { return t - _reference; }
 
 private:
     void update(Data_Observed<Buffer> * obs, Buffer * buf);
 
-    static void reference(const Time & t) { _reference = t; }
+    void reference(const Time & t) { _reference = t; }
 
-    static void marshal(Buffer * buf);
+    void marshal(Buffer * buf);
 
-    static Time time_stamp() { return _nic->statistics().time_stamp; }
+    void bootstrap();
 
-    static Time sync_period() {
+    Time time_stamp() const { return nic()->statistics().time_stamp; }
+
+    Time sync_period() const {
         Time tmp = Time(timer_accuracy()) * Time(timer_frequency()) / Time(1000000); // missed microseconds per second
 		tmp = Time(MAX_DRIFT) / tmp * Time(1000000); // us until MAX_DRIFT
         return tmp;
     }
-    static void keep_alive();
+    void keep_alive();
+    static void life_keeper(Timekeeper * t) { t->keep_alive(); }
 
 private:
-    static Time _reference;
-    static Time _skew;
-    static volatile Time _next_sync;
-    static Function_Handler * _life_keeper_handler;
-    static Alarm * _life_keeper;
+    Time _reference;
+    Time _skew;
+    volatile Time _next_sync;
+    Functor_Handler<Timekeeper> * _life_keeper_handler;
+    Alarm * _life_keeper;
 };
 
 #endif
@@ -12,6 +12,8 @@
 #undef __nic_common_only__
 #include <smartdata.h>
 #include <utility/convert.h>
+#include <utility/buffer.h>
+#include <pthread.h>
 
 class TSTP: private Traits<TSTP>::NIC_Family, private SmartData, private NIC<Traits<TSTP>::NIC_Family>::Observer
 {
@@ -26,6 +28,8 @@ public:
     // Parts
     typedef Traits<TSTP>::NIC_Family NIC_Family;
     template<typename Engine, bool duty_cycling> class MAC;
+    class Part;
+    class Worker;
     class Router;
     class Locator;
     class Timekeeper;
@@ -91,34 +95,46 @@ public:
     };
 
 protected:
-    TSTP(NIC<NIC_Family> * nic);
+    TSTP(unsigned int unit, NIC<NIC_Family> * nic);
 
 public:
     ~TSTP();
 
-    static Buffer * alloc(unsigned int size);
-    static int send(Buffer * buf);
+    // There is one TSTP stack per NIC in Traits<Topology>::NICS, each with its own parts, state, place and clock.
+    // The static interface below takes the stack to serve (its index in NICS, the first one by default), so each
+    // client (e.g. a SmartData) sticks to the stack it was bound to. Naming a stack that does not exist is an error.
+    static TSTP * get_by_nic(unsigned int unit) { return (unit < UNITS) ? _networks[unit] : 0; }
+
+    unsigned int unit() const { return _unit; }
+    NIC<NIC_Family> * nic() const { return _nic; }
+    Security * security() const { return _security; }
+
+    // A buffer must be sent through the stack it was allocated from
+    static Buffer * alloc(unsigned int size, unsigned int nic = 0);
+    static int send(Buffer * buf, unsigned int nic = 0);
+
+    // Whether a buffer arrived through (or was allocated from) a given stack
+    static bool carried(const Buffer * buf, unsigned int nic = 0) { return buf->nic() == stack(nic)->_nic; }
 
     // Local Space-Time (network scope, sink at center)
-    static Space here();
-    static Time now();
-    static Time_Stamp time_stamp();
+    static Space here(unsigned int nic = 0);
+    static Time now(unsigned int nic = 0);
 
-    static Time relative(const Time & t);
-    static Space relative(Global_Space global);
+    static Time relative(const Time & t, unsigned int nic = 0);
+    static Space relative(Global_Space global, unsigned int nic = 0);
     static Space sink() { return Space(0, 0, 0); }
 
     // Global Space-Time
-    static Global_Space absolute(const Space & s);
-    static Time absolute(const Time & t);
+    static Global_Space absolute(const Space & s, unsigned int nic = 0);
+    static Time absolute(const Time & t, unsigned int nic = 0);
 
     // Timer-related service routines
-    static const PPM & timer_accuracy() { return _nic->configuration().timer_accuracy;}
-    static const Hertz & timer_frequency() { return _nic->configuration().timer_frequency; }
-    static Time_Stamp us2ts(const Time & time) { return Convert::us2count<Time, Time_Stamp>(timer_frequency(), time); }
-    static Time ts2us(const Time_Stamp & ts) { return Convert::count2us<Hertz, Time_Stamp, Time>(timer_frequency(), ts); }
+    static const PPM & timer_accuracy(unsigned int nic = 0) { return stack(nic)->_nic->configuration().timer_accuracy;}
+    static const Hertz & timer_frequency(unsigned int nic = 0) { return stack(nic)->_nic->configuration().timer_frequency; }
+    static Time_Stamp us2ts(const Time & time, unsigned int nic = 0) { return Convert::us2count<Time, Time_Stamp>(timer_frequency(nic), time); }
+    static Time ts2us(const Time_Stamp & ts, unsigned int nic = 0) { return Convert::count2us<Hertz, Time_Stamp, Time>(timer_frequency(nic), ts); }
 
-    // TSTP clients (e.g. SmartData) are unit-based Buffer observers
+    // TSTP clients (e.g. SmartData) are unit-based Buffer observers, shared by all stacks and indexed by unit
     static void attach(Data_Observer<Buffer, Unit> * sd, const Unit & unit) { _clients.attach(sd, unit); }
     static void detach(Data_Observer<Buffer, Unit> * sd, const Unit & unit) { _clients.detach(sd, unit); }
     static bool notify(const Unit & unit, Buffer * buf) { return _clients.notify(unit, buf); }
@@ -126,28 +142,95 @@ public:
     friend Debug & operator<<(Debug & db, const Packet & p);
 
 private:
-    // TSTP components are unconditional Buffer observers
-    static void attach(Data_Observer<Buffer> * part) { _parts.attach(part); }
-    static void detach(Data_Observer<Buffer> * part) { _parts.detach(part); }
-    static bool notify(Buffer * buf) { return _parts.notify(buf); }
+    static const unsigned int UNITS = Traits<TSTP>::UNITS;
 
     void update(NIC_Family::Observed * obs, const Protocol & prot, Buffer * buf);
+    void process(Buffer * const bufs[], unsigned int n);
+
+    void marshal(Buffer * buf);
 
-    static void marshal(Buffer * buf);
+    static TSTP * stack(unsigned int unit) {
+        assert((unit < UNITS) && _networks[unit]);
+        return _networks[unit];
+    }
 
 public:
-    static void init();
+    // Brings up the stacks of the first units NICs of Traits<Topology>::NICS (e.g. a benchmark running part of its topology)
+    static void init(unsigned int units = UNITS);
 
 private:
-    static Security * _security;
-    static Timekeeper * _timekeeper;
-    static Locator * _locator;
-    static Router * _router;
-    static Manager * _manager;
-
-    static NIC<NIC_Family> * _nic;
-    static Data_Observed<Buffer> _parts;
-    static Data_Observed<Buffer, Unit> _clients;
+    unsigned int _unit;
+    NIC<NIC_Family> * _nic;
+    Data_Observed<Buffer> _parts;
+    unsigned int _n_workers;
+    Worker * _workers;
+
+    Security * _security;
+    Timekeeper * _timekeeper;
+    Locator * _locator;
+    Router * _router;
+    Manager * _manager;
+
+    static TSTP * _networks[UNITS];
+    static Hashed_Data_Observed<Buffer, Unit, Traits<TSTP>::CLIENTS> _clients;
+};
+
+// TSTP components are unconditional Buffer observers bound to one stack.
+// Their helpers shadow the static interface of TSTP, so the code of the parts refers to its own stack.
+class TSTP::Part
+{
+protected:
+    Part(TSTP * tstp): _tstp(tstp) {}
+
+    TSTP * tstp() const { return _tstp; }
+    NIC<NIC_Family> * nic() const { return _tstp->_nic; }
+
+    void attach(Data_Observer<Buffer> * part) { _tstp->_parts.attach(part); }
+    void detach(Data_Observer<Buffer> * part) { _tstp->_parts.detach(part); }
+
+    Buffer * alloc(unsigned int size) const { return _tstp->_nic->alloc(Address::BROADCAST, PROTO_TSTP, 0, 0, size); }
+    int send(Buffer * buf) const { _tstp->marshal(buf); return _tstp->_nic->send(buf); }
+
+    Space here() const;
+    Time now() const;
+    bool synchronized() const;
+
+    const PPM & timer_accuracy() const { return _tstp->_nic->configuration().timer_accuracy; }
+    const Hertz & timer_frequency() const { return _tstp->_nic->configuration().timer_frequency; }
+    Time_Stamp us2ts(const Time & time) const { return Convert::us2count<Time, Time_Stamp>(timer_frequency(), time); }
+    Time ts2us(const Time_Stamp & ts) const { return Convert::count2us<Hertz, Time_Stamp, Time>(timer_frequency(), ts); }
+
+protected:
+    TSTP * _tstp;
+};
+
+// Stage of the receive pipeline: a thread pinned to a core that runs the clients on the frames destined
+// to this node that its stack hashes to it by (unit, origin), so each series is always handled in order by
+// the same worker. The parts have already run on them, in the receive thread of the stack's NIC, which is
+// the only one to put into its queue. The worker takes up to a batch of them at a time, so the responses among them
+// are authenticated together. A null buffer makes the worker exit.
+class TSTP::Worker
+{
+    friend class TSTP;
+
+private:
+    typedef Ring_Buffer<Buffer *, Traits<TSTP>::QUEUE> Queue;
+
+public:
+    Worker(): _tstp(0), _sleeping(0) {}
+
+    void put(Buffer * buf);
+
+private:
+    static void * run(void * p);
+
+private:
+    TSTP * _tstp;
+    Queue _queue;
+    volatile unsigned int _sleeping;
+    pthread_t _thread;
+    pthread_mutex_t _mutex;
+    pthread_cond_t _ready;
 };
 
 #endif
@@ -161,17 +244,33 @@ private:
 #include <network/tstp/router.h>
 #include <network/tstp/manager.h>
 
-inline TSTP::~TSTP() { db<TSTP>(TRC) << "TSTP::~TSTP()" << endl; _nic->detach(this, 0); }
-inline TSTP::Buffer * TSTP::alloc(unsigned int size) { return _nic->alloc(Address::BROADCAST, PROTO_TSTP, 0, 0, size); }
-inline int TSTP::send(TSTP::Buffer * buf) { db<TSTP>(TRC) << "TSTP::send(buf=" << buf << ")" << endl; marshal(buf); return _nic->send(buf); }
-
-inline TSTP::Space TSTP::here() { return Locator::here(); }
-inline TSTP::Space TSTP::relative(TSTP::Global_Space s) { return Locator::relative(s); }
-inline TSTP::Global_Space TSTP::absolute(const TSTP::Space & s) { return Locator::absolute(s); }
+inline TSTP::Buffer * TSTP::alloc(unsigned int size, unsigned int nic) { return stack(nic)->_nic->alloc(Address::BROADCAST, PROTO_TSTP, 0, 0, size); }
 
-inline TSTP::Time TSTP::now() { return Timekeeper::now(); }
-inline TSTP::Time TSTP::relative(const TSTP::Time & t) { return TSTP::_timekeeper->relative(t); }
-inline TSTP::Time TSTP::absolute(const TSTP::Time & t) { return t ? TSTP::_timekeeper->relative(t) : t; }
+inline int TSTP::send(TSTP::Buffer * buf, unsigned int nic)
+{
+    db<TSTP>(TRC) << "TSTP::send(buf=" << buf << ",nic=" << nic << ")" << endl;
+
+    TSTP * tstp = stack(nic);
+    if(buf->nic() != tstp->_nic) {
+        db<TSTP>(ERR) << "TSTP::send: buffer " << buf << " was not allocated from stack " << nic << "!" << endl;
+        buf->nic()->free(buf);
+        return 0;
+    }
+    tstp->marshal(buf);
+    return tstp->_nic->send(buf);
+}
+
+inline TSTP::Space TSTP::here(unsigned int nic) { return stack(nic)->_locator->here(); }
+inline TSTP::Space TSTP::relative(TSTP::Global_Space s, unsigned int nic) { return stack(nic)->_locator->relative(s); }
+inline TSTP::Global_Space TSTP::absolute(const TSTP::Space & s, unsigned int nic) { return stack(nic)->_locator->absolute(s); }
+
+inline TSTP::Time TSTP::now(unsigned int nic) { return stack(nic)->_timekeeper->now(); }
+inline TSTP::Time TSTP::relative(const TSTP::Time & t, unsigned int nic) { return stack(nic)->_timekeeper->relative(t); }
+inline TSTP::Time TSTP::absolute(const TSTP::Time & t, unsigned int nic) { return stack(nic)->_timekeeper->absolute(t); }
+
+inline TSTP::Space TSTP::Part::here() const { return _tstp->_locator->here(); }
+inline TSTP::Time TSTP::Part::now() const { return _tstp->_timekeeper->now(); }
+inline bool TSTP::Part::synchronized() const { return _tstp->_timekeeper->synchronized(); }
 
 
 #endif
@@ -9,6 +9,7 @@
 #include <system/types.h>
 #include <utility/geometry.h>
 #include <utility/observer.h>
+#include <utility/octree.h>
 #include <utility/predictor.h>
 
 class SmartData
@@ -459,7 +460,7 @@ public:
 
         operator _Spacetime<S>() const { return _Spacetime<S>(this->center, t0); }
 
-        bool operator==(const _Region & r) const { return (*this == r); }
+        bool operator==(const _Region & r) const { return (this->center == r.center) && (this->radius == r.radius) && (t0 == r.t0) && (t1 == r.t1); }
         bool operator!=(const _Region & r) const { return !(*this == r); }
 
         bool contains(const _Spacetime<S> & st) const {
@@ -818,7 +819,7 @@ public:
     class Control: public Header
     {
     protected:
-        Control(const Mode & mode): Header(mode) {}
+        Control(const Mode & mode): Header(0, 0, CONTROL, mode), _radius(0), _t1(0) {}
         Control(const Region & region, const Unit & unit, const Device_Id & device, const Mode & mode)
         : Header(region, unit, device, CONTROL, mode), _radius(region.radius), _t1(region.t1) {}
         Control(const Spacetime & origin, const Unit & unit, const Device_Id & device, const Mode & mode)
@@ -837,6 +838,27 @@ public:
     } __attribute__((packed));
 
 
+    // Configuration of the predictors of PREDICTIVE SmartData (from which that of any Predictor can be built)
+    struct Prediction
+    {
+        Prediction()
+        : relative_error(Traits<SmartData>::PREDICTION_ERROR), absolute_error(0), time_error(Traits<SmartData>::PREDICTION_MISSES),
+          window_size(Traits<SmartData>::PREDICTION_WINDOW), points(Traits<SmartData>::PREDICTION_POINTS),
+          process_noise(Traits<SmartData>::PREDICTION_PROCESS_NOISE), measurement_noise(Traits<SmartData>::PREDICTION_MEASUREMENT_NOISE),
+          smoothing(Traits<SmartData>::PREDICTION_SMOOTHING), trend_smoothing(Traits<SmartData>::PREDICTION_TREND_SMOOTHING) {}
+
+        float relative_error;
+        float absolute_error;
+        unsigned int time_error;
+        unsigned int window_size;
+        unsigned int points;
+        float process_noise;
+        float measurement_noise;
+        float smoothing;
+        float trend_smoothing;
+    };
+
+
     // SmartData observer/d conditioned to Unit
     template<typename Network>
     using Observer = Data_Observer<typename Network::Buffer, Unit>;
@@ -903,6 +925,16 @@ template<> inline SmartData::_Space<SmartData::CM_32>::operator    SmartData::_S
 template<> inline SmartData::_Space<SmartData::CM_16>::operator    SmartData::_Space<CMx50_8>() const { return _Space<CMx50_8>(Point<Number, 3>::x / 50, Point<Number, 3>::y / 50, Point<Number, 3>::z / 50); }
 template<> inline SmartData::_Space<SmartData::CMx25_16>::operator SmartData::_Space<CMx50_8>() const { return _Space<CMx50_8>(Point<Number, 3>::x /  2, Point<Number, 3>::y /  2, Point<Number, 3>::z /  2); }
 
+template<> inline SmartData::_Space<SmartData::CMx50_8>::operator  SmartData::_Space<CM_16>()   const { return _Space<CM_16>(Point<Number, 3>::x * 50, Point<Number, 3>::y * 50, Point<Number, 3>::z * 50); }
+template<> inline SmartData::_Space<SmartData::CM_16>::operator    SmartData::_Space<CM_16>()   const { return _Space<CM_16>(Point<Number, 3>::x,      Point<Number, 3>::y,      Point<Number, 3>::z); }
+template<> inline SmartData::_Space<SmartData::CMx25_16>::operator SmartData::_Space<CM_16>()   const { return _Space<CM_16>(Point<Number, 3>::x * 25, Point<Number, 3>::y * 25, Point<Number, 3>::z * 25); }
+template<> inline SmartData::_Space<SmartData::CM_32>::operator    SmartData::_Space<CM_16>()   const { return _Space<CM_16>(Point<Number, 3>::x,      Point<Number, 3>::y,      Point<Number, 3>::z); }
+
+template<> inline SmartData::_Space<SmartData::CMx50_8>::operator  SmartData::_Space<CMx25_16>() const { return _Space<CMx25_16>(Point<Number, 3>::x * 2,  Point<Number, 3>::y * 2,  Point<Number, 3>::z * 2); }
+template<> inline SmartData::_Space<SmartData::CM_16>::operator    SmartData::_Space<CMx25_16>() const { return _Space<CMx25_16>(Point<Number, 3>::x / 25, Point<Number, 3>::y / 25, Point<Number, 3>::z / 25); }
+template<> inline SmartData::_Space<SmartData::CMx25_16>::operator SmartData::_Space<CMx25_16>() const { return _Space<CMx25_16>(Point<Number, 3>::x,      Point<Number, 3>::y,      Point<Number, 3>::z); }
+template<> inline SmartData::_Space<SmartData::CM_32>::operator    SmartData::_Space<CMx25_16>() const { return _Space<CMx25_16>(Point<Number, 3>::x / 25, Point<Number, 3>::y / 25, Point<Number, 3>::z / 25); }
+
 #if !defined(__smartdata_h) && !defined(__smartdata_common_only__)
 #define __smartdata_h
 
@@ -929,21 +961,31 @@ private:
     typedef typename Network::Buffer Buffer;
     typedef typename Network::Locator Locator;
     typedef typename Network::Timekeeper Timekeeper;
+    typedef typename Network::Manager::Model Model;
     typedef typename Select_Predictor<Traits<SmartData>::PREDICTOR>::template Predictor<Time, Value> Predictor;
+    // Every engine, not just the one selected, so that switching Traits<SmartData>::PREDICTOR cannot overflow a frame
+    static_assert(sizeof(typename LVP<Time, Value>::Model) <= sizeof(typename Model::Data), "LVP models must fit in a Model message");
+    static_assert(sizeof(typename DBP<Time, Value>::Model) <= sizeof(typename Model::Data), "DBP models must fit in a Model message");
+    static_assert(sizeof(typename KFP<Time, Value>::Model) <= sizeof(typename Model::Data), "KFP models must fit in a Model message");
+    static_assert(sizeof(typename DESP<Time, Value>::Model) <= sizeof(typename Model::Data), "DESP models must fit in a Model message");
 
     class Binding;
-    typedef Simple_List<Binding> Interesteds;
+    typedef Loose_Octree<Binding, Region, Traits<SmartData>::REGIONS> Interesteds;
+    typedef Ordered_List<Binding, Time> Bindings;
     typedef Simple_List<SmartData> Responsives;
 
+    // An interest this SmartData responds to. The index is shared by all SmartData of the unit, so each binding
+    // belongs to the one that took it, which also keeps its own by the end of their interests (to expire them).
     class Binding
     {
     private:
-        typedef typename Simple_List<Binding>::Element Element;
+        typedef typename Interesteds::Element Element;
 
     public:
-        Binding(const Interest & interest)
-        : _region(interest.region()), _mode(interest.mode()), _uncertainty(interest.uncertainty()), _expiry(interest.expiry()), _period(interest.period()), _link(this) {}
+        Binding(const Interest & interest, Responsive_SmartData * owner)
+        : _region(interest.region()), _mode(interest.mode()), _uncertainty(interest.uncertainty()), _expiry(interest.expiry()), _period(interest.period()), _owner(owner), _link(this, &_region), _due(this, _region.t1) {}
 
+        Responsive_SmartData * owner() const { return _owner; }
         const Region & region() const { return _region; }
         const Mode & mode() const { return _mode; }
         const Uncertainty & uncertainty() const { return _uncertainty; }
@@ -951,6 +993,7 @@ private:
         const Microsecond & period() const { return _period; }
 
         Element * link() { return &_link; }
+        typename Bindings::Element * due() { return &_due; }
 
     private:
         Region _region;
@@ -958,21 +1001,31 @@ private:
         Uncertainty _uncertainty;
         Time _expiry;
         Microsecond _period;
+        Responsive_SmartData * _owner;
 
         Element _link;
+        typename Bindings::Element _due;
     };
 
 public:
-    Responsive_SmartData(const Device_Id & dev, const Time & expiry, const Mode & mode = PRIVATE, const Microsecond & period = 0 )
-    : _mode(mode), _origin(Locator::here(), Timekeeper::now()), _device(dev), _value(0), _uncertainty(UNCERTAINTY), _expiry(expiry),
-     _transducer(new /*(SYSTEM)*/ Transducer(dev)), _predictor(predictive ? new /*(SYSTEM)*/ Predictor(typename Predictor::Configuration(), false) : 0), _thread(0), _link(this) {
-        db<SmartData>(TRC) << "SmartData[R](d=" << dev << ",x=" << expiry << ",m=" << ((mode & COMMANDED) ? "CMD" : ((mode & ADVERTISED) ? "ADV" : "PRI")) << ")=>" << this << endl;
+    // nic is the stack of Network (by its NIC) this SmartData lives in: it is there that it is, answers interests and sends
+    Responsive_SmartData(const Device_Id & dev, const Time & expiry, const Mode & mode = PRIVATE, const Microsecond & period = 0, unsigned int nic = 0)
+    : _nic(nic), _mode(mode), _origin(Network::here(nic), Network::now(nic)), _device(dev), _value(0), _uncertainty(UNCERTAINTY), _expiry(expiry),
+     _transducer(new /*(SYSTEM)*/ Transducer(dev)), _predictor(predictive ? new /*(SYSTEM)*/ Predictor(Prediction(), false) : 0), _thread(0), _link(this) {
+        db<SmartData>(TRC) << "SmartData[R](d=" << dev << ",x=" << expiry << ",m=" << ((mode & COMMANDED) ? "CMD" : ((mode & ADVERTISED) ? "ADV" : "PRI")) << ",nic=" << nic << ")=>" << this << endl;
+        // Recursive, for observers notified by process() may read the value back
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+        pthread_mutex_init(&_lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+
         if(active)
             _transducer->attach(this);
         else
             if(Transducer::TYPE & Transducer::SENSOR) {
                 _value = _transducer->sense();
-                _origin = Timekeeper::now();
+                _origin = Network::now(_nic);
             }
         db<SmartData>(INF) << "SmartData[R]::this=" << this << "=>" << *this << endl;
         if(_mode & ADVERTISED) {
@@ -991,28 +1044,44 @@ public:
         process(CONCEAL);
         Network::detach(this, UNIT);
         _responsives.remove(&_link);
-        if(_thread)
-            delete _thread;
+        // A worker still binding may be creating a thread, so it is taken under _lock and deleted out of it
+        pthread_mutex_lock(&_lock);
+        Periodic_Thread * thread = _thread;
+        _thread = 0;
+        // Interests not over yet would otherwise leave bindings of no one in the shared index
+        pthread_rwlock_wrlock(&_interesteds_lock);
+        while(typename Bindings::Element * e = _bindings.remove()) {
+            _interesteds.remove(e->object()->link());
+            delete e->object();
+        }
+        pthread_rwlock_unlock(&_interesteds_lock);
+        pthread_mutex_unlock(&_lock);
+        if(thread)
+            delete thread;
+        if(_predictor)
+            delete _predictor;
+        pthread_mutex_destroy(&_lock);
     }
 
     const Unit unit() const { return UNIT; }
     const Mode & mode() const { return _mode; }
     const Uncertainty & uncertainty() const { return _uncertainty; }
 
-    Space where() const { return Locator::absolute(_origin); }
-    Time when() const { return Timekeeper::absolute(_origin); }
+    Space where() const { return Network::absolute(_origin.space, _nic); }
+    Time when() const { return Network::absolute(_origin, _nic); }
 
     Time expiry() const { return _expiry; }
-    bool expired() const { return Timekeeper::now() > (_origin.time + _expiry); }
+    bool expired() const { return Network::now(_nic) > (_origin.time + _expiry); }
 
     operator Value() {
         db<SmartData>(TRC) << "SmartData[R]::operator Value()[v=" << _value << "]" << endl;
 
+        pthread_mutex_lock(&_lock);
         if(Transducer::TYPE & Transducer::SENSOR) {
             if(expired()) {
                 if(!active) {
                     _value = _transducer->sense();
-                    _origin = Timekeeper::now();
+                    _origin = Network::now(_nic);
                 } else {
                     // Active transducer should have called update() timely
                     db<SmartData>(WRN) << "SmartData[R]::value(this=" << this << ",t=" <<_origin.time + _expiry << ",v=" << _value << ") => expired!" << endl;
@@ -1021,22 +1090,26 @@ public:
         } else
             db<SmartData>(WRN) << "SmartData[R]::value() called for actuation-only transducer!" << endl;
 
+        Value value = _value;
         if(_mode & CUMULATIVE)
             _value = 0;
+        pthread_mutex_unlock(&_lock);
 
-        db<SmartData>(INF) << "SmartData[R]::operator Value():v=" << _value << endl;
+        db<SmartData>(INF) << "SmartData[R]::operator Value():v=" << value << endl;
 
-        return _value;
+        return value;
     }
 
     SmartData & operator=(const Value & v) {
         db<SmartData>(TRC) << "SmartData[R]::operator=(v=" << v << ")" << endl;
 
         if(Transducer::TYPE & Transducer::ACTUATOR) {
+            pthread_mutex_lock(&_lock);
             _transducer->actuate(v);
             _value = _transducer->sense();
-            if(!_thread && !_interesteds.empty())
+            if(!_thread && interested())
                 process(RESPOND);
+            pthread_mutex_unlock(&_lock);
         } else
             db<SmartData>(WRN) << "SmartData[R]::operator= called for sensing-only transducer!" << endl;
 
@@ -1060,8 +1133,9 @@ public:
         return record;
     }
 
-    static Space here() { return Locator::here(); } // Scale conversion done by SmartData::_Space specializations
-    static Time now() { return Timekeeper::now(); }
+    // Of the stack in Network (by its NIC, the first one by default), for those not bound to one yet
+    static Space here(unsigned int nic = 0) { return Network::here(nic); } // Scale conversion done by SmartData::_Space specializations
+    static Time now(unsigned int nic = 0) { return Network::now(nic); }
 
     friend Debug & operator<<(Debug & db, const Responsive_SmartData & d) {
         db << "{RES:" << ((d._thread) ? "TT" : "ED");
@@ -1081,8 +1155,19 @@ private:
     void process(const Mode & op) {
         db<SmartData>(TRC) << "SmartData[R]::process(op=" << ((op == ADVERTISE) ? "ADV" : (op == CONCEAL) ? "DEL" : (op == RESPOND) ? "RES" : "CTL") << ")" << endl;
 
-        if(_mode & ADVERTISED) {
-            Buffer * buffer = Network::alloc(sizeof(Response) + sizeof(Value));
+        pthread_mutex_lock(&_lock);
+        if((op == RESPOND) && (_mode & ADVERTISED) && (_mode & PREDICTIVE) && _predictor) {
+            // The sink predicts our values with the last model we sent, so only a model that no longer does it well enough is replaced
+            if(!_predictor->trickle(_origin.time, _value)) {
+                Buffer * buffer = Network::alloc(Model::template size<typename Predictor::Model>(), _nic);
+                Header * header = buffer->frame()->template data<Header>();
+                Model * model = new (header) Model(_origin, UNIT, _device, _uncertainty, _expiry, _predictor->model());
+
+                db<SmartData>(INF) << "SmartData[R]::process:msg=" << *model << endl;
+                Network::send(buffer, _nic);
+            }
+        } else if(_mode & ADVERTISED) {
+            Buffer * buffer = Network::alloc(sizeof(Response) + sizeof(Value), _nic);
             Header * header = buffer->frame()->template data<Header>();
             Response * response = new (header) Response(_origin, UNIT, _device, (_mode | op), _uncertainty, _expiry);
 
@@ -1090,32 +1175,45 @@ private:
                 response->value<Value>(_value);
 
             db<SmartData>(INF) << "SmartData[R]::process:msg=" << *response << endl;
-            Network::send(buffer);
+            Network::send(buffer, _nic);
         }
         notify();
+        pthread_mutex_unlock(&_lock);
     }
 
     // Network::Observer::update pure virtual method, called whenever the Network receives a SmartData-related message
     void update(typename Network::Observed * obs, const typename Network::Observed::Observing_Condition & cond, Buffer * buffer) {
 
         db<SmartData>(TRC) << "SmartData[R]::update(obs=" << obs << ",cond=" << cond << ",buf=" << buffer << ")" << endl;
+        // Clients are shared by all stacks, but each SmartData only takes the messages of its own
+        if(!Network::carried(buffer, _nic))
+            return;
         Header * header = buffer->frame()->template data<Header>();
         switch(header->type()) {
         case INTEREST: {
             Interest * interest = reinterpret_cast<Interest *>(header);
             db<SmartData>(INF) << "SmartData[R]::update:msg=" << *interest << endl;
             if(_mode & ADVERTISED) {
-                if(interest->mode() & REVOKE)
-                    unbind(interest);
-                else
+                // The updater and the other workers take _lock too, so the predictor is never replaced under their feet
+                pthread_mutex_lock(&_lock);
+                Periodic_Thread * retired = expire(Network::now(_nic));
+                if(interest->mode() & REVOKE) {
+                    Periodic_Thread * thread = unbind(interest);
+                    if(thread)
+                        retired = thread;
+                } else
                     bind(interest);
-                if(!_interesteds.empty()) {
+                if(interested()) {
                     if(!active) {
                         _value = _transducer->sense();
-                        _origin = Timekeeper::now();
+                        _origin = Network::now(_nic);
                     }
                     process(RESPOND);
                 }
+                pthread_mutex_unlock(&_lock);
+                // A job of the retired thread may be waiting for _lock, and deleting it waits for that job
+                if(retired)
+                    delete retired;
             } else
                 db<SmartData>(INF) << "SmartData[R]::update: not advertised!" << endl;
         } break;
@@ -1137,50 +1235,40 @@ private:
         case CONTROL: {
             Control * control = reinterpret_cast<Control *>(header);
             db<SmartData>(INF) << "SmartData[R]::update:msg=" << *control << endl;
-
-//            switch(header->mode()) {
-            //            case Network::MODEL: {
-            //                Network::Model * model = reinterpret_cast<Network::Model *>(packet);
-            //                if(model->model<Model_Common>()->type() == Predictor::Model::TYPE) {
-            //                    if(_predictor){
-            //                        _origin = model->time();
-            //                        _error = model->error();
-            //                        _coordinates = model->origin();
-            //                        _predictor->update(*model->model<typename Predictor::Model>(), false);
-            //                        _value = _predictor->predict(_origin.t);
-            //                        notify();
-            //                    }
-            //                }
-            //            } break;
-            //            default:
-            //                break;
-//            }
         } break;
         }
     }
 
     // Transducer::Observer::update pure virtual method, called whenever the Transducer gets updated (i.e. an event-driven SmartData)
     void update(typename Transducer::Observed * obs) {
-        _origin = Timekeeper::now();
+        pthread_mutex_lock(&_lock);
+        _origin = Network::now(_nic);
         _value = _transducer->sense();
         db<SmartData>(TRC) << "SmartData[R]::update(this=" << this << ",x=" << _expiry << ")=>" << _value << endl;
         notify();
-        if(!_thread && !_interesteds.empty())
+        if(!_thread && interested())
             process(RESPOND);
+        pthread_mutex_unlock(&_lock);
     }
 
+    // Called with _lock held
     bool bind(Interest * interest) {
         db<SmartData>(TRC) << "SmartData[R]::bind(int=" << interest << ")" << endl;
 
-        bool bound = false;
-        typename Interesteds::Iterator i = _interesteds.begin();
-        for(; i != _interesteds.end(); i++)
-            if((interest->device() == _device) && i->object()->region().contains(interest->region()))
-                break;
-
-        if(i == _interesteds.end()) {
-            Binding * binding = new /*(SYSTEM)*/ Binding(*interest);
+        bool covered = false;
+        pthread_rwlock_wrlock(&_interesteds_lock);
+        if(interest->device() == _device) {
+            const Region & r = interest->region();
+            _interesteds.search(r.center, r.t0, [&](Binding * b) { if(b->owner() == this) covered = true; });
+        }
+        if(!covered) {
+            Binding * binding = new /*(SYSTEM)*/ Binding(*interest, this);
             _interesteds.insert(binding->link());
+            _bindings.insert(binding->due());
+        }
+        pthread_rwlock_unlock(&_interesteds_lock);
+
+        if(!covered) {
             if(interest->period()) {
                 if(!_thread)
                     _thread = new /*(SYSTEM)*/ Periodic_Thread(Microsecond(interest->period()), &updater, _device, interest->expiry(), this);
@@ -1188,55 +1276,104 @@ private:
                     if(interest->period() != _thread->period())
                         _thread->period(Math::gcd(_thread->period(),  interest->period()));
             }
-            bound = true;
+            // The new interested has no model yet, so the next sample has to be predicted from scratch
+            if(predictive) {
+                if(_predictor)
+                    delete _predictor;
+                _predictor = new /*(SYSTEM)*/ Predictor(Prediction(), false);
+            }
         }
 
-        db<SmartData>(INF) << "SmartData[R]::bind:" << (bound ? "bound" : "not bound") << "!" << endl;
+        db<SmartData>(INF) << "SmartData[R]::bind:" << (!covered ? "bound" : "not bound") << "!" << endl;
 
-        return bound;
+        return !covered;
     }
 
-    bool unbind(Interest * interest) {
-        bool bound = true;
-
-        typename Interesteds::Iterator i = _interesteds.begin();
-        for(; i != _interesteds.end(); i++)
-            if((interest->device() == _device) && (i->object()->region() == interest->region()))
-                break;
-
-        if(i != _interesteds.end()) {
-            _interesteds.remove(i);
-            delete i->object();
-            if(_interesteds.empty()) {
-                if(_thread) {
-                    delete _thread;
-                    _thread = 0;
-                }
-                if(_predictor){
-                    delete _predictor;
-                    _predictor = 0;
-                }
-                bound = false;
+    // Called with _lock held; returns the thread to delete once it is released, if the last interested left
+    Periodic_Thread * unbind(Interest * interest) {
+        db<SmartData>(TRC) << "SmartData[R]::unbind(int=" << interest << ")" << endl;
+
+        Binding * binding = 0;
+        pthread_rwlock_wrlock(&_interesteds_lock);
+        if(interest->device() == _device) {
+            const Region & r = interest->region();
+            _interesteds.search(r.center, r.t0, [&](Binding * b) { if((b->owner() == this) && (b->region() == r)) binding = b; });
+        }
+        if(binding) {
+            _interesteds.remove(binding->link());
+            _bindings.remove(binding->due());
+        }
+        pthread_rwlock_unlock(&_interesteds_lock);
+
+        db<SmartData>(INF) << "SmartData[R]::unbind:" << (binding ? "unbound" : "not bound") << "!" << endl;
+
+        if(!binding)
+            return 0;
+
+        delete binding;
+        return unbound();
+    }
+
+    // Called with _lock held; drops the bindings whose interests are over, for interesteds that leave (or die)
+    // without revoking would otherwise be responded to for ever. Returns the thread to delete as unbind() does
+    // (also one left by the updater once there were no bindings). Only the due bindings, at the head of
+    // _bindings, are looked at, and the index is only locked if there are any.
+    Periodic_Thread * expire(const Time & now) {
+        if(interested() && (_bindings.head()->rank() < now)) {
+            unsigned int expired = 0;
+            pthread_rwlock_wrlock(&_interesteds_lock);
+            for(typename Bindings::Element * e = _bindings.head(); e && (e->rank() < now); e = _bindings.head(), expired++) {
+                _bindings.remove(e);
+                _interesteds.remove(e->object()->link());
+                delete e->object();
             }
+            pthread_rwlock_unlock(&_interesteds_lock);
+
+            db<SmartData>(INF) << "SmartData[R]::expire:" << expired << " interests over!" << endl;
         }
 
-        return bound;
+        return unbound();
     }
 
+    // Called with _lock held, after bindings were removed
+    Periodic_Thread * unbound() {
+        if(interested())
+            return 0;
 
-    // Time-triggered updater
+        Periodic_Thread * retired = _thread;
+        _thread = 0;
+        if(_predictor) {
+            delete _predictor;
+            _predictor = 0;
+        }
+        return retired;
+    }
+
+    bool interested() const { return !_bindings.empty(); }
+
+    // Time-triggered updater (one job, released by _thread on every period)
     static int updater(unsigned int device, Time expiry, Responsive_SmartData * sd) {
         db<SmartData>(TRC) << "SmartData[R]::updater(d=" << device << ",x=" << expiry << ",sd=" << sd << ")" << endl;
-        while(true) {
-            sd->_value = sd->_transducer->sense();
-            sd->_origin = Timekeeper::now();
-            sd->process(RESPOND);
-            Periodic_Thread::wait_next();
+        pthread_mutex_lock(&sd->_lock);
+        sd->_value = sd->_transducer->sense();
+        sd->_origin = Network::now(sd->_nic);
+        // Once every interest is over, the thread stays until the next Interest or the destructor retires it (a job
+        // cannot delete the thread that released it), and responds to no one meanwhile
+        bool idle = false;
+        if(sd->_mode & ADVERTISED) {
+            Periodic_Thread * retired = sd->expire(sd->_origin.time);
+            if(retired)
+                sd->_thread = retired;
+            idle = !sd->interested();
         }
+        if(!idle)
+            sd->process(RESPOND);
+        pthread_mutex_unlock(&sd->_lock);
         return 0;
     }
 
 private:
+    unsigned int _nic;
     Mode _mode;
     Spacetime _origin;
     unsigned int _device;
@@ -1247,17 +1384,21 @@ private:
     Transducer * _transducer;
     Predictor * _predictor;
     Periodic_Thread * _thread;
+    Bindings _bindings; // in _interesteds, by the end of their interests
 
     typename Simple_List<SmartData>::Element _link;
 
+    pthread_mutex_t _lock; // of the value, the predictor and the thread, shared by the Network workers and the updater
+
     static Interesteds _interesteds;
+    static pthread_rwlock_t _interesteds_lock; // of the index (bindings are counted under _lock), taken after _lock
     static Responsives _responsives;
 };
 
 
 // SmartData encapsulating remote transducers
 template<typename _Unit, typename Network>
-class Interested_SmartData: public SmartData, public Observed, private Network::Observer
+class Interested_SmartData: public SmartData, public Observed
 {
 public:
     static const unsigned long UNIT = _Unit::UNIT;
@@ -1274,9 +1415,11 @@ private:
     typedef typename Network::Buffer Buffer;
     typedef typename Network::Locator Locator;
     typedef typename Network::Timekeeper Timekeeper;
+    typedef typename Network::Manager::Model Model;
     typedef typename Select_Predictor<Traits<SmartData>::PREDICTOR>::template Predictor<Time, Value> Predictor;
 
-    typedef Simple_List<SmartData> Interests;
+    class Dispatcher;
+    typedef Loose_Octree<Interested_SmartData, Region, Traits<SmartData>::REGIONS> Interests;
 
     enum Operation {
         ANNOUNCE,
@@ -1286,11 +1429,27 @@ private:
     };
 
 public:
-    Interested_SmartData(const Region & region, const Time & expiry, const Microsecond & period = 0, const Mode & mode = SINGLE, const Uncertainty & uncertainty = ANY, const Device_Id & device = UNIQUE)
-    : _mode(mode), _region(region), _device(device), _uncertainty(uncertainty), _expiry(expiry), _period(period), _value(0), _predictor((predictive && (mode & PREDICTIVE)) ? new /*(SYSTEM)*/ Predictor : 0), _link(this) {
-        db<SmartData>(TRC) << "SmartData[I](r=" << region << ",d=" << device << ",x=" << expiry << ",m=" << ((mode & ALL) ? "ALL" : "SGL") << ",err=" << int(uncertainty) << ",p=" << period << ")=>" << this << endl;
+    // nic is the stack of Network (by its NIC) that region refers to and through which the interest is sent
+    Interested_SmartData(const Region & region, const Time & expiry, const Microsecond & period = 0, const Mode & mode = SINGLE, const Uncertainty & uncertainty = ANY, const Device_Id & device = UNIQUE, unsigned int nic = 0)
+    : _nic(nic), _mode(mode), _region(region), _device(device), _uncertainty(uncertainty), _expiry(expiry), _period(period), _value(0), _predictor((predictive && (mode & PREDICTIVE)) ? new /*(SYSTEM)*/ Predictor(Prediction(), false) : 0), _link(this, &_region) {
+        db<SmartData>(TRC) << "SmartData[I](r=" << region << ",d=" << device << ",x=" << expiry << ",m=" << ((mode & ALL) ? "ALL" : "SGL") << ",err=" << int(uncertainty) << ",p=" << period << ",nic=" << nic << ")=>" << this << endl;
+        // Recursive, for observers notified by update() may read the value back
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+        pthread_mutex_init(&_lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+
+        // The index is never held while (de)attaching the Dispatcher, for workers hold the Network's clients
+        // while searching it; _attaching keeps the first and the last interest from crossing instead
+        pthread_mutex_lock(&_attaching);
+        pthread_rwlock_wrlock(&_interests_lock);
         _interests.insert(&_link);
-        Network::attach(this, UNIT);
+        bool first = (_interests.size() == 1);
+        pthread_rwlock_unlock(&_interests_lock);
+        if(first)
+            Network::attach(&_dispatcher, UNIT);
+        pthread_mutex_unlock(&_attaching);
         process(ANNOUNCE);
         db<SmartData>(INF) << "SmartData[I]::this=" << this << "=>" << *this << endl;
     }
@@ -1298,8 +1457,16 @@ public:
     virtual ~Interested_SmartData() {
         db<SmartData>(TRC) << "~SmartData[I](this=" << this << ")" << endl;
         process(SUPPRESS);
-        Network::detach(this, UNIT);
+        // Once out of the index (which waits for the searches in progress), no worker can update this one
+        pthread_mutex_lock(&_attaching);
+        pthread_rwlock_wrlock(&_interests_lock);
         _interests.remove(&_link);
+        bool last = _interests.empty();
+        pthread_rwlock_unlock(&_interests_lock);
+        if(last)
+            Network::detach(&_dispatcher, UNIT);
+        pthread_mutex_unlock(&_attaching);
+        pthread_mutex_destroy(&_lock);
     }
 
     const Unit unit() const { return UNIT; }
@@ -1310,21 +1477,19 @@ public:
     const Mode & mode() const { return _response.mode(); }
     const Uncertainty & uncertainty() const { return _response.uncertainty(); }
 
-    Space where() const { return Locator::absolute(_response.origin().space); }
-    Time when() const { return Timekeeper::absolute(_response.origin().time); }
+    Space where() const { return Network::absolute(_response.origin().space, _nic); }
+    Time when() const { return Network::absolute(_response.origin().time, _nic); }
 
     Time expiry() const { return _response.expiry(); }
-    bool expired() const { return Timekeeper::now() > (_response.time() + _expiry); }
+    bool expired() const { return Network::now(_nic) > (_response.time() + _expiry); }
 
     operator Value & () {
         db<SmartData>(TRC) << "SmartData[I]::operator Value()[v=" << _value << "]" << endl;
-        // if(expired()) {
-        //     if(predictive)
-        //         _value = _predictor->predict(Timekeeper::now());
-        //     else
-        //         // Remote data sources should have sent messages timely, thus triggering update()
-        //         db<SmartData>(WRN) << "SmartData[I]::value(this=" << this << ",t=" << _response.time() + _expiry << ",v=" << _value << ") => expired!" << endl;
-        // }
+        // Predictive sources only send a new model when the last one stops predicting them well
+        pthread_mutex_lock(&_lock);
+        if(_predictor && (_response.mode() & PREDICTIVE))
+            _value = _predictor->predict(Network::now(_nic));
+        pthread_mutex_unlock(&_lock);
         return _value;
     }
 
@@ -1340,13 +1505,16 @@ public:
         DB_Record record;
         record.type = STATIC;
         record.unit = UNIT;
+        pthread_mutex_lock(&_lock);
         record.value = _value;
         record.uncertainty = _response.uncertainty();
+        record.confidence = _response.location_confidence();
         record.x = _response.origin().space.x;
         record.y = _response.origin().space.y;
         record.z = _response.origin().space.z;
         record.t = _response.origin().time;
         record.device = _response.device();
+        pthread_mutex_unlock(&_lock);
         return record;
     }
 
@@ -1354,18 +1522,20 @@ public:
         DB_Series series;
         series.type = STATIC;
         series.unit = UNIT;
-        Space c = Locator::absolute(_region.center);
+        Space c = Network::absolute(_region.center, _nic);
         series.x = c.x;
         series.y = c.y;
         series.z = c.z;
+        series.device = _device;
         series.r = _region.radius;
-        series.t0 = Timekeeper::absolute(_region.t0);
-        series.t1 = Timekeeper::absolute(_region.t1);
+        series.t0 = Network::absolute(_region.t0, _nic);
+        series.t1 = Network::absolute(_region.t1, _nic);
         return series;
     }
 
-    static Space here() { return Locator::here(); } // Scale conversion done by SmartData::_Space specializations
-    static Time now() { return Timekeeper::now(); }
+    // Of the stack in Network (by its NIC, the first one by default), for those not bound to one yet
+    static Space here(unsigned int nic = 0) { return Network::here(nic); } // Scale conversion done by SmartData::_Space specializations
+    static Time now(unsigned int nic = 0) { return Network::now(nic); }
 
     friend Debug & operator<<(Debug & db, const Interested_SmartData & d) {
         db << "{INT:" << ((d._period) ? "TT" : "ED");
@@ -1382,7 +1552,7 @@ private:
     void process(const Operation & op, const Value & v = 0) {
         db<SmartData>(TRC) << "SmartData[I]::process(op=" << ((op == ANNOUNCE) ? "ANN" : (op == SUPPRESS) ? "SUP" : (op == COMMAND) ? "COM" : "CTL") << ",v=" << v << ")" << endl;
 
-        Buffer * buffer = Network::alloc(sizeof(Interest) + sizeof(Value));
+        Buffer * buffer = Network::alloc(sizeof(Interest) + sizeof(Value), _nic);
         Header * header = buffer->frame()->template data<Header>();
         Interest * interest = new (header) Interest(_region, UNIT, _device, (_mode | op), _uncertainty, _expiry, _period);
 
@@ -1393,68 +1563,102 @@ private:
 
         db<SmartData>(INF) << "SmartData[I]::process:msg=" << *interest << endl;
 
-        Network::send(buffer);
+        Network::send(buffer, _nic);
     }
 
-    // Network::Observer::update pure virtual method, called whenever the Network receives a SmartData-related message
-    void update(typename Network::Observed * obs, const typename Network::Observed::Observing_Condition & cond, Buffer * buffer) {
-        db<SmartData>(TRC) << "SmartData[I]::update(obs=" << obs << ",cond=" << cond << ",buf=" << buffer << ")" << endl;
-        Header * header = buffer->frame()->template data<Header>();
-        switch(header->type()) {
-        case INTEREST: {
-            Interest * interest = buffer->frame()->template data<Interest>();
-            db<SmartData>(INF) << "SmartData[I]::update:msg=" << *interest << endl;
-            db<SmartData>(WRN) << "SmartData[I]::update:not advertised!" << endl;
-        } break;
-        case RESPONSE: {
-            Response * response = buffer->frame()->template data<Response>();
-            db<SmartData>(INF) << "SmartData[I]::update:msg=" << *response << endl;
-            if((response->unit() == UNIT) && _region.contains(response->origin())) {
-                if((response->operation()) == ADVERTISE)
-                    process(ANNOUNCE);
-                else {
-                    _response = *response;
-                    if(_mode & CUMULATIVE)
-                        _value += response->template value<Value>();
-                    else
-                        _value = response->template value<Value>();
-                    notify();
-                }
-            } else
-                db<SmartData>(INF) << "SmartData[I]::update: not interested!" << endl;
-        } break;
-        case COMMAND: {
-            Command * command = buffer->frame()->template data<Command>();
-            db<SmartData>(INF) << "SmartData[I]::update:msg=" << *command << endl;
-            db<SmartData>(WRN) << "SmartData[I]::update: not commanded!" << endl;
-        } break;
-        case CONTROL: {
-            Control * control = buffer->frame()->template data<Control>();
-            db<SmartData>(INF) << "SmartData[I]::update:msg=" << *control << endl;
-
-//            switch(header->subtype()) {
-            //            case Network::MODEL: {
-            //                Network::Model * model = reinterpret_cast<Network::Model *>(packet);
-            //                if(model->model<Model_Common>()->type() == Predictor::Model::TYPE) {
-            //                    if(_predictor){
-            //                        _origin = model->time();
-            //                        _error = model->error();
-            //                        _coordinates = model->origin();
-            //                        _predictor->update(*model->model<typename Predictor::Model>(), false);
-            //                        _value = _predictor->predict(_origin.t);
-            //                        notify();
-            //                    }
-            //                }
-            //            } break;
-            //            default:
-            //                break;
-//            }
-        } break;
+    // Called by the Dispatcher for each Response originated inside _region (by any worker, so serialized)
+    void update(Response * response) {
+        db<SmartData>(TRC) << "SmartData[I]::update(this=" << this << ",res=" << response << ")" << endl;
+        if((response->operation()) == ADVERTISE)
+            process(ANNOUNCE);
+        else {
+            pthread_mutex_lock(&_lock);
+            _response = *response;
+            if(_mode & CUMULATIVE)
+                _value += response->template value<Value>();
+            else
+                _value = response->template value<Value>();
+            notify();
+            pthread_mutex_unlock(&_lock);
         }
     }
 
+    // Called by the Dispatcher for each Model originated inside _region
+    void update(Model * model) {
+        db<SmartData>(TRC) << "SmartData[I]::update(this=" << this << ",mod=" << model << ")" << endl;
+        if(!_predictor || (model->template model<typename Predictor::Model>().type() != Predictor::Model::TYPE)) {
+            db<SmartData>(WRN) << "SmartData[I]::update: model not predictable!" << endl;
+            return;
+        }
+
+        // Values predicted from now on are reported as Responses of the model's origin would be
+        pthread_mutex_lock(&_lock);
+        _response = Response(model->origin(), UNIT, model->device(), (RESPOND | PREDICTIVE), model->uncertainty(), model->expiry());
+        _response.location_confidence(model->location_confidence());
+        _predictor->update(model->template model<typename Predictor::Model>(), false);
+        _value = _predictor->predict(model->time());
+        notify();
+        pthread_mutex_unlock(&_lock);
+    }
+
+    // The Network observer of UNIT on behalf of all Interested_SmartData of this type. Responses are handed
+    // only to those whose region contains their origin, as found by the spatial index of interests, and that
+    // are bound to the stack the Response arrived through.
+    class Dispatcher: public Network::Observer
+    {
+    public:
+        // Network::Observer::update pure virtual method, called whenever the Network receives a SmartData-related message
+        void update(typename Network::Observed * obs, const typename Network::Observed::Observing_Condition & cond, Buffer * buffer) {
+            db<SmartData>(TRC) << "SmartData[I]::Dispatcher::update(obs=" << obs << ",cond=" << cond << ",buf=" << buffer << ")" << endl;
+            Header * header = buffer->frame()->template data<Header>();
+            switch(header->type()) {
+            case INTEREST: {
+                Interest * interest = buffer->frame()->template data<Interest>();
+                db<SmartData>(INF) << "SmartData[I]::update:msg=" << *interest << endl;
+                db<SmartData>(WRN) << "SmartData[I]::update:not advertised!" << endl;
+            } break;
+            case RESPONSE: {
+                Response * response = buffer->frame()->template data<Response>();
+                db<SmartData>(INF) << "SmartData[I]::update:msg=" << *response << endl;
+                if(response->unit() != UNIT)
+                    break;
+                pthread_rwlock_rdlock(&_interests_lock);
+                bool interested = _interests.search(response->origin().space, response->origin().time, [buffer, response](Interested_SmartData * sd) { if(Network::carried(buffer, sd->_nic)) sd->update(response); });
+                pthread_rwlock_unlock(&_interests_lock);
+                if(!interested)
+                    db<SmartData>(INF) << "SmartData[I]::update: not interested!" << endl;
+            } break;
+            case COMMAND: {
+                Command * command = buffer->frame()->template data<Command>();
+                db<SmartData>(INF) << "SmartData[I]::update:msg=" << *command << endl;
+                db<SmartData>(WRN) << "SmartData[I]::update: not commanded!" << endl;
+            } break;
+            case CONTROL: {
+                Control * control = buffer->frame()->template data<Control>();
+                db<SmartData>(INF) << "SmartData[I]::update:msg=" << *control << endl;
+                if(control->subtype() == MODEL) {
+                    Model * model = buffer->frame()->template data<Model>();
+                    if(model->unit() != UNIT)
+                        break;
+                    // A Model retargets the predictors of those interested, so only an authenticated one is taken
+                    if(!buffer->trusted) {
+                        db<SmartData>(WRN) << "SmartData[I]::update: untrusted model!" << endl;
+                        break;
+                    }
+                    pthread_rwlock_rdlock(&_interests_lock);
+                    bool interested = _interests.search(model->origin().space, model->origin().time, [buffer, model](Interested_SmartData * sd) { if(Network::carried(buffer, sd->_nic)) sd->update(model); });
+                    pthread_rwlock_unlock(&_interests_lock);
+                    if(!interested)
+                        db<SmartData>(INF) << "SmartData[I]::update: not interested!" << endl;
+                }
+            } break;
+            }
+        }
+    };
+
 private:
     // Interested attributes
+    unsigned int _nic;
     Mode _mode;
     Region _region;
     unsigned int _device;
@@ -1462,13 +1666,18 @@ private:
     Time _expiry;
     Microsecond _period;
     Predictor * _predictor;
-    typename Simple_List<SmartData>::Element _link;
+    typename Interests::Element _link;
+
+    pthread_mutex_t _lock; // of the attributes below
 
-    // Last response attributes
+    // Last response attributes (Response ends in a flexible array)
     Value _value;
     Response _response;
 
     static Interests _interests;
+    static pthread_rwlock_t _interests_lock; // written by constructors and destructors, read by the Dispatcher
+    static pthread_mutex_t _attaching;
+    static Dispatcher _dispatcher;
 };
 
 
@@ -1487,10 +1696,18 @@ public:
 template<typename Transducer, typename Network>
 typename Responsive_SmartData<Transducer, Network>::Interesteds Responsive_SmartData<Transducer, Network>::_interesteds;
 template<typename Transducer, typename Network>
+pthread_rwlock_t Responsive_SmartData<Transducer, Network>::_interesteds_lock = PTHREAD_RWLOCK_INITIALIZER;
+template<typename Transducer, typename Network>
 typename Responsive_SmartData<Transducer, Network>::Responsives Responsive_SmartData<Transducer, Network>::_responsives;
 
 template<typename Unit, typename Network>
 typename Interested_SmartData<Unit, Network>::Interests Interested_SmartData<Unit, Network>::_interests;
+template<typename Unit, typename Network>
+pthread_rwlock_t Interested_SmartData<Unit, Network>::_interests_lock = PTHREAD_RWLOCK_INITIALIZER;
+template<typename Unit, typename Network>
+pthread_mutex_t Interested_SmartData<Unit, Network>::_attaching = PTHREAD_MUTEX_INITIALIZER;
+template<typename Unit, typename Network>
+typename Interested_SmartData<Unit, Network>::Dispatcher Interested_SmartData<Unit, Network>::_dispatcher;
 
 #include <transducer.h>
 
@@ -176,6 +176,14 @@ struct MIN
 template<unsigned int N, typename T>
 constexpr unsigned int COUNTOF(const T (&)[N]) { return N; }
 
+template<unsigned int N, typename T>
+constexpr T MAXOF(const T (& array)[N]) {
+    T max = array[0];
+    for(const T & v : array)
+        if(v > max) max = v;
+    return max;
+}
+
 template<unsigned int N, typename T>
 constexpr bool INARRAY(const T (& array)[N], const T & value) {
     for(const T & v : array)
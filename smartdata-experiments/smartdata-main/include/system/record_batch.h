@@ -0,0 +1,152 @@
+#pragma once
+
+#include <system/types.h>
+#include <smartdata.h>
+
+// Wire format for bulk transfers of SmartData records (DB_Record), e.g. for a sink to export its series
+// database or import another's. A batch is a Header followed by its records, in one of two encodings:
+// RAW, the records as they are in memory (the host's byte order and DB_Record layout), which a receiver reads in
+// place through operator[] without copying or parsing anything; or DELTA, in which each field is a varint of its
+// difference to the same field of the previous record (values as the XOR of their bits, byte-swapped so the
+// trailing zeros of similar doubles become leading zeros), which takes 4-5x less bytes for slowly changing series,
+// does not depend on the host and is read sequentially by a Reader. The header is little-endian and records the
+// byte order and the size of DB_Record of the encoder, so RAW batches from a different kind of host are rejected
+// (they have to be sent as DELTA). Batches carry their length, so a stream of them can be walked with next().
+class Record_Batch
+{
+public:
+    typedef SmartData::DB_Record DB_Record;
+
+    static const unsigned int MAGIC = 0x42524453; // "SDRB"
+    static const unsigned char VERSION = 2;
+
+    enum Encoding {
+        RAW   = 0,
+        DELTA = 1
+    };
+
+    enum Order {
+        LITTLE = 1,
+        BIG    = 2
+    };
+
+    static const unsigned char ORDER = (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) ? LITTLE : BIG;
+    static const unsigned char LAYOUT = sizeof(DB_Record);
+    static_assert(sizeof(DB_Record) < 256, "DB_Record layout must fit in a byte of the header");
+
+    // Little-endian
+    struct Header {
+        unsigned int magic;
+        unsigned char version;
+        unsigned char encoding;
+        unsigned char order; // of the encoder's host
+        unsigned char layout; // sizeof(DB_Record) on the encoder's host
+        unsigned int count;
+        unsigned int length; // of the records, in bytes
+    } __attribute__((packed));
+
+    // Upper bound on the size of a batch of n records
+    static unsigned int size(unsigned int n, Encoding e) { return sizeof(Header) + n * ((e == RAW) ? sizeof(DB_Record) : MAX_DELTA); }
+
+    // Builds a batch into a buffer, one record at a time (e.g. from Series_Store::query())
+    class Encoder
+    {
+    public:
+        Encoder(void * buffer, unsigned int size, Encoding e = DELTA);
+
+        // False (and the record is left out) if the buffer is full
+        bool put(const DB_Record & r);
+        bool put(const DB_Record * r, unsigned int n);
+
+        unsigned int count() const { return _count; }
+
+        // Bytes of the batch so far
+        unsigned int length() const { return _p - reinterpret_cast<unsigned char *>(_header); }
+
+    private:
+        Header * _header;
+        unsigned char * _end;
+        unsigned char * _p;
+        unsigned int _count;
+        DB_Record _previous;
+    };
+
+    // Sequential access to the records of a batch, in any encoding
+    class Reader
+    {
+    public:
+        Reader(const Record_Batch & b);
+
+        // False at the end of the batch or if it is corrupt
+        bool next(DB_Record * r);
+
+    private:
+        const Record_Batch & _batch;
+        const unsigned char * _p;
+        const unsigned char * _end;
+        unsigned int _read;
+        DB_Record _previous;
+    };
+
+public:
+    // A view over a batch as received; nothing is copied
+    Record_Batch(const void * data, unsigned int size);
+
+    // Whether the header is sound and the records fit in the bytes given
+    bool valid() const { return _header; }
+
+    Encoding encoding() const { return Encoding(_header->encoding); }
+    unsigned int count() const { return le(_header->count); }
+
+    // Bytes of the whole batch, i.e. the offset of the next one in a stream
+    unsigned int length() const { return sizeof(Header) + le(_header->length); }
+
+    // Records of RAW batches, in place
+    const DB_Record & operator[](unsigned int i) const { return _records[i]; }
+    const DB_Record * records() const { return _records; }
+
+    // The batch following this one in a stream of size bytes (invalid if there is none)
+    Record_Batch next(unsigned int size) const {
+        return (valid() && (length() < size)) ? Record_Batch(reinterpret_cast<const unsigned char *>(_header) + length(), size - length()) : Record_Batch(0, 0);
+    }
+
+private:
+    // Header fields to and from little-endian (a byte swap, if any, is its own inverse)
+    static unsigned int le(unsigned int v) { return CPU::letoh32(v); }
+
+    static const unsigned int MAX_DELTA = 3 + 7 * 10; // type, uncertainty and confidence, then 7 varints of up to 10 bytes
+
+    static unsigned char * put(unsigned char * p, unsigned long long v) {
+        while(v >= 0x80) {
+            *p++ = v | 0x80;
+            v >>= 7;
+        }
+        *p++ = v;
+        return p;
+    }
+    static unsigned char * put_signed(unsigned char * p, long long v) { return put(p, (static_cast<unsigned long long>(v) << 1) ^ (v >> 63)); }
+
+    static const unsigned char * get(const unsigned char * p, const unsigned char * end, unsigned long long * v) {
+        unsigned long long x = 0;
+        for(unsigned int shift = 0; (p < end) && (shift < 64); shift += 7) {
+            unsigned char b = *p++;
+            x |= static_cast<unsigned long long>(b & 0x7f) << shift;
+            if(!(b & 0x80)) {
+                *v = x;
+                return p;
+            }
+        }
+        return 0;
+    }
+    static const unsigned char * get_signed(const unsigned char * p, const unsigned char * end, long long * v) {
+        unsigned long long x;
+        p = get(p, end, &x);
+        if(p)
+            *v = (x >> 1) ^ -(x & 1);
+        return p;
+    }
+
+private:
+    const Header * _header;
+    const DB_Record * _records;
+};
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <system/types.h>
+#include <system/series_store.h>
+#include <system/record_batch.h>
+#include <utility/observer.h>
+#include <utility/list.h>
+#include <pthread.h>
+
+// Ingestion stage in front of a Series_Store, for sinks fed by many sensors at high rates.
+// Producers (e.g. the TSTP workers, through a Series_Recorder) put records into an open batch of their
+// series, which is handed to a flusher thread when it fills up or gets older than Traits<Series_Ingestor>::FLUSH,
+// so the store sees a few large appends instead of one per Response, and the producers never wait for I/O.
+// Batches come from a fixed pool of Traits<Series_Ingestor>::BATCHES: once all of them are open or waiting
+// for the store, producers block until the flusher gives one back (back-pressure), rather than dropping samples.
+class Series_Ingestor
+{
+public:
+    typedef Series_Store::DB_Series DB_Series;
+    typedef Series_Store::DB_Record DB_Record;
+    typedef Series_Store::Series_Id Series_Id;
+
+    static const unsigned int BATCH = Traits<Series_Ingestor>::BATCH;
+    static const unsigned int BATCHES = Traits<Series_Ingestor>::BATCHES;
+
+private:
+    typedef unsigned long long Tick; // us on CLOCK_MONOTONIC
+
+    struct Batch {
+        Series_Id id;
+        unsigned int count;
+        Tick opened;
+        DB_Record records[BATCH];
+        Simple_List<Batch>::Element link;
+
+        Batch(): link(this) {}
+    };
+
+public:
+    Series_Ingestor(Series_Store * store);
+    ~Series_Ingestor();
+
+    // Series are created in the store right away, so records can be put by id
+    Series_Id series(const DB_Series & s) { return _store->series(s); }
+
+    void put(Series_Id id, const DB_Record & r);
+
+    // Imports the records of a batch (e.g. exported by another sink) into the series, and returns how many
+    // it did (fewer than the batch's count if it is corrupt)
+    unsigned int put(Series_Id id, const Record_Batch & batch);
+
+    // Returns once all records put so far are in the store and the store has sealed them into the file
+    void flush();
+
+    unsigned long long records() const { return _records; }
+    unsigned long long stalls() const { return _stalls; }
+
+private:
+    void lock() { pthread_mutex_lock(&_mutex); }
+    void unlock() { pthread_mutex_unlock(&_mutex); }
+
+    Batch * open(Series_Id id);
+    void close(Series_Id id);
+
+    static void * run(void * p);
+
+    static Tick now();
+
+private:
+    Series_Store * _store;
+
+    Batch * _pool;
+    Simple_List<Batch> _free;
+    Simple_List<Batch> _full;
+    Batch ** _open; // by series id
+    unsigned int _n_open;
+
+    bool _handover; // hand open batches over right away
+    bool _exiting;
+    unsigned long long _records;
+    unsigned long long _stored;
+    unsigned long long _stalls;
+
+    pthread_t _thread;
+    pthread_mutex_t _mutex;
+    pthread_cond_t _work;
+    pthread_cond_t _room;
+    pthread_cond_t _done;
+};
+
+// Observer that records every value an Interested_SmartData gets from the network, as a DB_Record of the
+// series of that SmartData. Values are recorded on the thread that delivers them (i.e. a TSTP worker).
+template<typename SD>
+class Series_Recorder: private Observer
+{
+public:
+    Series_Recorder(SD * sd, Series_Ingestor * ingestor): _sd(sd), _ingestor(ingestor), _id(ingestor->series(sd->db_series())) {
+        db<Series_Ingestor>(TRC) << "Series_Recorder(sd=" << sd << ",id=" << _id << ")" << endl;
+        if(_id != Series_Store::NONE)
+            _sd->attach(this);
+    }
+    ~Series_Recorder() {
+        if(_id != Series_Store::NONE)
+            _sd->detach(this);
+    }
+
+    Series_Ingestor::Series_Id series() const { return _id; }
+
+private:
+    void update(Observed * o) { _ingestor->put(_id, _sd->db_record()); }
+
+private:
+    SD * _sd;
+    Series_Ingestor * _ingestor;
+    Series_Ingestor::Series_Id _id;
+};
@@ -0,0 +1,376 @@
+#pragma once
+
+#include <system/types.h>
+#include <smartdata.h>
+#include <pthread.h>
+
+// Append-only store of SmartData series (DB_Series) and their data points (DB_Record) in a single file.
+// Records are buffered per series and sealed into columnar blocks of up to Traits<Series_Store>::BLOCK
+// records: timestamps coded as delta-of-deltas, values XORed with their predecessors (as in Facebook's
+// Gorilla), uncertainty and confidence as plain bytes, and the (x, y, z, device) origin as runs, since
+// it seldom changes within a series. The file is a log of series definitions and blocks, so it is
+// recovered on open by walking it, cutting off whatever a crash may have left half written.
+// Reads go through a shared memory mapping of the file; blocks not overlapping a query are skipped by
+// their time bounds, kept in an in-memory index per series. All operations are serialized by a mutex.
+// Each series also keeps rollups: min, max, mean, count and last value over fixed windows, one level per
+// window in Traits<Series_Store>::ROLLUPS. They are folded as records are appended and written as blocks of
+// aggregates next to the records, so aggregate() can answer long time ranges from the coarsest level that
+// is still fine enough, without touching the records. A level only pays off if its windows take several
+// records, so once the first Traits<Series_Store>::PROBE records of a series tell its sampling period, the
+// levels whose windows would take fewer than Traits<Series_Store>::DENSITY of them are dropped for it.
+class Series_Store
+{
+public:
+    typedef SmartData::DB_Series DB_Series;
+    typedef SmartData::DB_Record DB_Record;
+    typedef unsigned long long Time;
+    typedef unsigned int Series_Id;
+
+    static const unsigned int BLOCK = Traits<Series_Store>::BLOCK;
+    static const Series_Id NONE = ~0U;
+    static const unsigned int LEVELS = COUNTOF(Traits<Series_Store>::ROLLUPS);
+    static const unsigned int ROLLUP = Traits<Series_Store>::ROLLUP;
+    static const unsigned int DENSITY = Traits<Series_Store>::DENSITY;
+    static const unsigned int PROBE = Traits<Series_Store>::PROBE;
+    static_assert((PROBE > 1) && (PROBE < ROLLUP), "Series_Store probes must span a period and not fill a rollup block");
+    static_assert(LEVELS <= 32, "Series_Store keeps a bit per rollup level");
+
+    // Summary of the records of a series in the window [t, t + window)
+    struct Aggregate {
+        Time t;
+        Time last_t; // time of the last record, whose value is last
+        unsigned long long count;
+        double min;
+        double max;
+        double sum;
+        double last;
+
+        Aggregate() {}
+        Aggregate(const DB_Record & r, Time window): t(r.t - r.t % window), last_t(r.t), count(1), min(r.value), max(r.value), sum(r.value), last(r.value) {}
+
+        double mean() const { return sum / count; }
+
+        void merge(const Aggregate & a) {
+            count += a.count;
+            sum += a.sum;
+            if(a.min < min)
+                min = a.min;
+            if(a.max > max)
+                max = a.max;
+            if(a.last_t >= last_t) {
+                last_t = a.last_t;
+                last = a.last;
+            }
+        }
+    } __attribute__((packed));
+
+private:
+    static const unsigned int MAGIC = 0x42445344; // "SDDB"
+    static const unsigned int VERSION = 1;
+
+    enum {
+        SERIES  = 0x52534453, // "SDSR"
+        DATA    = 0x4b424453, // "SDBK"
+        ROLLUPS = 0x4c524453 // "SDRL"
+    };
+
+    struct File_Header {
+        unsigned int magic;
+        unsigned int version;
+    } __attribute__((packed));
+
+    struct Series_Entry {
+        unsigned int magic;
+        Series_Id id;
+        unsigned char type;
+        unsigned int unit;
+        long long x, y, z, device;
+        unsigned long long r;
+        unsigned long long t0, t1;
+    } __attribute__((packed));
+
+    // Followed by the time, value, uncertainty, confidence and origin columns, in this order
+    struct Block_Header {
+        unsigned int magic;
+        Series_Id id;
+        unsigned int count;
+        unsigned int runs;
+        unsigned long long t_min;
+        unsigned long long t_max;
+        unsigned int time_bytes;
+        unsigned int value_bytes;
+    } __attribute__((packed));
+
+    // Followed by count Aggregates, in the order they were closed
+    struct Rollup_Header {
+        unsigned int magic;
+        Series_Id id;
+        Time window;
+        unsigned int count;
+        unsigned long long t_min;
+        unsigned long long t_max;
+    } __attribute__((packed));
+
+    struct Run {
+        unsigned int count;
+        long long x, y, z, device;
+    } __attribute__((packed));
+
+    struct Block_Ref {
+        unsigned long long offset;
+        Time t_min;
+        Time t_max;
+    };
+
+    // Growable index of the blocks of a series (or of one of its rollups) in the file
+    struct Blocks {
+        Block_Ref * refs;
+        unsigned int size;
+        unsigned int max;
+
+        void insert(unsigned long long offset, Time t_min, Time t_max);
+    };
+
+    struct Rollup {
+        Aggregate open; // the latest window, still taking records (if open.count)
+        Aggregate * closed; // aggregates not yet written
+        unsigned int pending;
+        Blocks blocks;
+    };
+
+    struct Series {
+        DB_Series definition;
+        Series_Id id;
+        unsigned long long records;
+
+        DB_Record * open; // records not yet sealed into a block
+        unsigned int pending;
+        Blocks blocks;
+
+        Rollup rollups[LEVELS];
+        unsigned int levels; // rollups kept, a bit per level (all of them until planned)
+        bool planned; // after PROBE records; before that, rollups are folded but not written
+        Time first; // earliest and latest times among the records probed
+        Time last;
+
+        Series * next; // in the catalog bucket
+    };
+
+    template<typename F>
+    class Merger;
+
+    class Bit_Writer;
+    class Bit_Reader;
+
+    static const unsigned int BUCKETS = 256;
+
+public:
+    Series_Store(const char * path);
+    ~Series_Store();
+
+    bool ready() const { return _fd >= 0; }
+
+    // Finds the series with this definition, creating it if there is none yet (or NONE on I/O errors)
+    Series_Id series(const DB_Series & s);
+
+    unsigned int series();
+    const DB_Series & definition(Series_Id id);
+    unsigned long long records(Series_Id id);
+
+    // Records need not come in time order, but blocks are pruned better when they mostly do
+    bool append(Series_Id id, const DB_Record & r) { return append(id, &r, 1); }
+    bool append(Series_Id id, const DB_Record * r, unsigned int n);
+
+    // Seals every partially filled block, so all records appended so far are in the file
+    bool flush();
+    // Also waits until the file is on stable storage
+    bool sync();
+
+    // Calls f(const DB_Record &) for each record of the series with t0 <= t <= t1, block by block (sealed
+    // blocks in the order they were written, then the ones not yet sealed), and returns how many it did.
+    // f is called with the store locked, so it must not call the store back.
+    template<typename F>
+    unsigned long long query(Series_Id id, Time t0, Time t1, F f);
+
+    // Calls f(const Aggregate &) for each window of the series overlapping [t0, t1], from the coarsest rollup
+    // whose window is at most resolution, and returns how many it did. If no rollup is that fine (or the series
+    // does not keep it), the records are aggregated on the fly into windows of resolution. Windows come in the order they were closed, which
+    // is time order if records were appended so; consecutive pieces of a window (as left by records appended
+    // late or by a reopened store) are merged. f is called with the store locked, so it must not call it back.
+    template<typename F>
+    unsigned long long aggregate(Series_Id id, Time t0, Time t1, Time resolution, F f);
+
+    static Time window(unsigned int level) { return Traits<Series_Store>::ROLLUPS[level]; }
+
+    // Bytes in the file
+    unsigned long long size() const { return _size; }
+
+private:
+    void lock() { pthread_mutex_lock(&_mutex); }
+    void unlock() { pthread_mutex_unlock(&_mutex); }
+
+    bool recover();
+    bool map();
+    bool write(const void * data, unsigned int size);
+    bool seal(Series * s);
+    bool seal(Series * s, unsigned int level);
+    bool fold(Series * s, const DB_Record & r);
+    bool fold(Series * s, unsigned int level, const DB_Record & r);
+    void plan(Series * s);
+    bool close(Series * s, unsigned int level, const Aggregate & a);
+
+    Series * insert(const DB_Series & def, Series_Id id);
+    Series * find(const DB_Series & def);
+    static unsigned int hash(const DB_Series & def);
+    static bool same(const DB_Series & a, const DB_Series & b);
+
+    unsigned int encode(const Series * s, unsigned char * out);
+    static unsigned int decode(const unsigned char * block, const DB_Series & def, DB_Record * out);
+
+private:
+    int _fd;
+    unsigned long long _size;
+    const unsigned char * _map;
+    unsigned long long _mapped;
+
+    Series ** _series;
+    unsigned int _n_series;
+    unsigned int _max_series;
+    Series * _catalog[BUCKETS];
+
+    unsigned char * _scratch; // worst case encoding of one block
+    DB_Record * _decoded;
+
+    pthread_mutex_t _mutex;
+};
+
+template<typename F>
+unsigned long long Series_Store::query(Series_Id id, Time t0, Time t1, F f)
+{
+    db<Series_Store>(TRC) << "Series_Store::query(id=" << id << ",t=[" << t0 << "," << t1 << "])" << endl;
+
+    unsigned long long n = 0;
+
+    lock();
+
+    if(id < _n_series) {
+        Series * s = _series[id];
+
+        for(unsigned int b = 0; b < s->blocks.size; b++) {
+            const Block_Ref & ref = s->blocks.refs[b];
+            if((ref.t_max < t0) || (ref.t_min > t1))
+                continue;
+            if((ref.offset >= _mapped) && !map())
+                break;
+            unsigned int count = decode(_map + ref.offset, s->definition, _decoded);
+            for(unsigned int i = 0; i < count; i++)
+                if((_decoded[i].t >= t0) && (_decoded[i].t <= t1)) {
+                    f(const_cast<const DB_Record &>(_decoded[i]));
+                    n++;
+                }
+        }
+
+        for(unsigned int i = 0; i < s->pending; i++)
+            if((s->open[i].t >= t0) && (s->open[i].t <= t1)) {
+                f(const_cast<const DB_Record &>(s->open[i]));
+                n++;
+            }
+    }
+
+    unlock();
+
+    return n;
+}
+
+// Merges consecutive aggregates of the same window before handing them to f
+template<typename F>
+class Series_Store::Merger
+{
+public:
+    Merger(F & f): _f(f), _n(0) { _a.count = 0; }
+
+    void operator()(const Aggregate & a) {
+        if(_a.count && (a.t == _a.t))
+            _a.merge(a);
+        else {
+            if(_a.count) {
+                _f(const_cast<const Aggregate &>(_a));
+                _n++;
+            }
+            _a = a;
+        }
+    }
+
+    unsigned long long close() {
+        if(_a.count) {
+            _f(const_cast<const Aggregate &>(_a));
+            _n++;
+            _a.count = 0;
+        }
+        return _n;
+    }
+
+private:
+    F & _f;
+    Aggregate _a;
+    unsigned long long _n;
+};
+
+template<typename F>
+unsigned long long Series_Store::aggregate(Series_Id id, Time t0, Time t1, Time resolution, F f)
+{
+    db<Series_Store>(TRC) << "Series_Store::aggregate(id=" << id << ",t=[" << t0 << "," << t1 << "],res=" << resolution << ")" << endl;
+
+    // Query planning: the coarsest rollup that is fine enough, among those the series keeps
+    lock();
+    unsigned int levels = ((id < _n_series) && _series[id]->planned) ? _series[id]->levels : 0;
+    unlock();
+
+    unsigned int level = LEVELS;
+    for(unsigned int l = 0; l < LEVELS; l++)
+        if((levels & (1U << l)) && (window(l) <= resolution) && ((level == LEVELS) || (window(l) > window(level))))
+            level = l;
+
+    Merger<F> merger(f);
+
+    if(level == LEVELS) {
+        Time w = resolution ? resolution : 1;
+        query(id, t0 - t0 % w, t1, [&](const DB_Record & r) { merger(Aggregate(r, w)); });
+        return merger.close();
+    }
+
+    Time w = window(level);
+    Time from = t0 - t0 % w;
+
+    lock();
+
+    if(id < _n_series) {
+        Rollup & u = _series[id]->rollups[level];
+
+        for(unsigned int b = 0; b < u.blocks.size; b++) {
+            const Block_Ref & ref = u.blocks.refs[b];
+            if((ref.t_max < from) || (ref.t_min > t1))
+                continue;
+            if((ref.offset >= _mapped) && !map())
+                break;
+            const Rollup_Header * h = reinterpret_cast<const Rollup_Header *>(_map + ref.offset);
+            const Aggregate * a = reinterpret_cast<const Aggregate *>(h + 1);
+            for(unsigned int i = 0; i < h->count; i++)
+                if((a[i].t >= from) && (a[i].t <= t1))
+                    merger(a[i]);
+        }
+
+        for(unsigned int i = 0; i < u.pending; i++)
+            if((u.closed[i].t >= from) && (u.closed[i].t <= t1))
+                merger(u.closed[i]);
+
+        if(u.open.count && (u.open.t >= from) && (u.open.t <= t1))
+            merger(u.open);
+    }
+
+    unsigned long long n = merger.close();
+
+    unlock();
+
+    return n;
+}
@@ -1,63 +1,200 @@
 #pragma once
 #include <system/types.h>
+#include <utility/handler.h>
+#include <utility/list.h>
+#include <utility/wheel.h>
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
 #include <pthread.h>
 
+// Threads, alarms and periodic threads on top of POSIX.
+// Periodic threads do not own a host thread: their jobs are released by the
+// alarm engine, which spreads alarms over one timer thread per core, each
+// keeping its alarms in a hierarchical timing wheel (O(1) arm and cancel)
+// ticking on CLOCK_MONOTONIC at Traits<Alarm>::FREQUENCY. Periods are re-armed
+// from the previous deadline, not from the time the job actually ran, so
+// activations do not drift.
+
 class Thread
 {
+protected:
+	// An entry point bound to its arguments
+	template<typename F>
+	class Job: public Handler
+	{
+	public:
+		Job(const F & f): _f(f) {}
+		void operator()() { _f(); }
+
+	private:
+		F _f;
+	};
+
+	template<typename F>
+	static Handler * job(const F & f) { return new /*(SYSTEM)*/ Job<F>(f); }
+
 public:
-	Thread(int (*)())
+	template<typename ... Pn, typename ... An>
+	Thread(int (* entry)(Pn ...), An ... an): _job(job([=]() { entry(an ...); }))
 	{
-		// TCB - to be implemented.
-		db<Thread>(TRC) << "Thread::Thread()" << endl;
+		db<Thread>(TRC) << "Thread::Thread(entry=" << reinterpret_cast<void *>(entry) << ")" << endl;
+
+		pthread_create(&_handle, 0, &run, this);
+	}
+	// A thread not joined is cancelled, so one that must not be stopped just anywhere (e.g. holding a lock) is told
+	// to return and joined first
+	virtual ~Thread()
+	{
+		db<Thread>(TRC) << "~Thread(this=" << this << ")" << endl;
+
+		if(_job) {
+			pthread_cancel(_handle);
+			pthread_join(_handle, 0);
+			delete _job;
+		}
+	}
+
+	// Waits for the entry point to return
+	void join()
+	{
+		db<Thread>(TRC) << "Thread::join(this=" << this << ")" << endl;
+
+		if(_job) {
+			pthread_join(_handle, 0);
+			delete _job;
+			_job = 0;
+		}
 	}
+
 	static void yield()
 	{
 		db<Thread>(TRC) << "Thread::yield()" << endl;
 		usleep(100 * 1000); // TCB - avoid using excessive CPU. Maybe it should be removed at the end of implementation.
 		pthread_yield();
 	}
+
+protected:
+	// Used by Periodic_Thread, whose jobs run on the alarm engine
+	Thread(): _job(0) {}
+
+private:
+	static void * run(void * t) { (*reinterpret_cast<Thread *>(t)->_job)(); return 0; }
+
+private:
+	Handler * _job;
+	pthread_t _handle;
 };
 
-class Periodic_Thread : public Thread
+class Alarm
 {
 private:
-	Microsecond _period;
+	typedef unsigned long long Tick; // absolute time in us on CLOCK_MONOTONIC
+	typedef Timing_Wheel<Alarm> Wheel;
+
+	static const unsigned int FREQUENCY = Traits<Alarm>::FREQUENCY;
+	static const Tick RESOLUTION = 1000000 / FREQUENCY;
+
+	// One timer thread per core, each serving its own wheel
+	class Dispatcher
+	{
+		friend class Alarm;
+
+	public:
+		Dispatcher(): _wheel(ticks(now())), _wakeup(0), _current(0) {}
+
+		void insert(Alarm * a);
+		void remove(Alarm * a);
+
+		void lock() { pthread_mutex_lock(&_mutex); }
+		void unlock() { pthread_mutex_unlock(&_mutex); }
+
+		static void * run(void * d);
+
+	private:
+		Wheel _wheel;
+		Wheel::Tick _wakeup;
+		Alarm * volatile _current;
+		pthread_t _thread;
+		pthread_mutex_t _mutex;
+		pthread_cond_t _changed;
+		pthread_cond_t _done;
+	};
 
 public:
-	Periodic_Thread(const Microsecond&, int(*callback)(unsigned int, SmartData::Time, Responsive_SmartData<Dummy_Transducer>*),
-		unsigned int&, const SmartData::Time&, Responsive_SmartData<Dummy_Transducer>*) : Thread::Thread(0)
+	Alarm(const Microsecond & time, Handler * handler, unsigned int times = 1);
+	~Alarm();
+
+	const Microsecond & period() const { return _time; }
+	void period(const Microsecond & p);
+
+	void reset();
+
+	static void delay(const Microsecond & time)
 	{
-		// TCB - to be implemented.
-		db<Periodic_Thread>(TRC) << "Periodic_Thread::Periodic_Thread()" << endl;
+		db<Alarm>(TRC) << "Alarm::delay(t=" << time << ")" << endl;
+
+		timespec t = to_timespec(now() + time);
+		while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, 0) == EINTR);
 	}
 
-	const Microsecond& period() { return _period; }
-	void period(const Microsecond& p) { _period = p; }
-	static volatile bool wait_next() {
+	static Tick now()
+	{
+		timespec t;
+		clock_gettime(CLOCK_MONOTONIC, &t);
+		return static_cast<Tick>(t.tv_sec) * 1000000 + t.tv_nsec / 1000;
+	}
+
+private:
+	// Deadlines are rounded up to the next wheel tick, so alarms never fire early
+	static Wheel::Tick ticks(const Tick & t) { return (t + RESOLUTION - 1) / RESOLUTION; }
 
-		// TCB - to be implemented.
-		db<Periodic_Thread>(TRC) << "Periodic_Thread::wait_next()" << endl;
-		return true;
+	static timespec to_timespec(const Tick & t)
+	{
+		timespec ts;
+		ts.tv_sec = t / 1000000;
+		ts.tv_nsec = (t % 1000000) * 1000;
+		return ts;
 	}
+
+	static void init();
+
+private:
+	Microsecond _time;
+	Handler * _handler;
+	unsigned int _times;
+	Tick _deadline;
+	Wheel::Element _link;
+	Dispatcher * _dispatcher;
+
+	static unsigned int _dispatchers;
+	static Dispatcher * _dispatcher_list;
+	static volatile unsigned int _next_dispatcher;
+	static pthread_once_t _once;
 };
 
-class Alarm
+class Periodic_Thread: public Thread
 {
 public:
-	Alarm(const Microsecond & time, Handler * handler, unsigned int times = 1)
-	{
-		// TCB - to be implemented.
-		db<Alarm>(TRC) << "Alarm::Alarm()" << endl;
-	}
-	static void delay(const Microsecond & time)
+	// The job is released on every period by the alarm
+	template<typename ... Pn, typename ... An>
+	Periodic_Thread(const Microsecond & p, int (* entry)(Pn ...), An ... an)
+	: _handler(job([=]() { entry(an ...); })), _alarm(new /*(SYSTEM)*/ Alarm(p, _handler, INFINITE))
 	{
-		// TCB - to be implemented.
-		db<Alarm>(TRC) << "Alarm::delay()" << endl;
+		db<Periodic_Thread>(TRC) << "Periodic_Thread(p=" << p << ",entry=" << reinterpret_cast<void *>(entry) << ") => " << this << endl;
 	}
-	void reset()
+	~Periodic_Thread()
 	{
-		// TCB - to be implemented.
-		db<Alarm>(TRC) << "Alarm::reset()" << endl;
+		db<Periodic_Thread>(TRC) << "~Periodic_Thread(this=" << this << ")" << endl;
+
+		delete _alarm;
+		delete _handler;
 	}
-};
\ No newline at end of file
+
+	const Microsecond & period() const { return _alarm->period(); }
+	void period(const Microsecond & p) { _alarm->period(p); }
+
+private:
+	Handler * _handler;
+	Alarm * _alarm;
+};
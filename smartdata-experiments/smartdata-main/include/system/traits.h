@@ -26,6 +26,7 @@ template<typename> class Scheduler;
 
 // System parts
 class Build;
+class Topology;
 class Boot;
 class Setup;
 class Init;
@@ -71,6 +72,9 @@ class E100;
 class M95;
 class IEEE802_15_4_NIC;
 class Ethernet_NIC;
+class UDPNIC;
+class RAWNIC;
+class SIMNIC;
 
 // Transducer Mediators (i.e. sensors and actuators)
 class Transducers;
@@ -145,6 +149,9 @@ template<typename Channel, bool connectionless = Channel::connectionless> class
 class SmartData;
 template<typename Transducer, typename Network = TSTP> class Responsive_SmartData;
 template<typename Transducer, typename Network = TSTP> class Interested_SmartData;
+class Series_Store;
+class Series_Ingestor;
+class Record_Batch;
 
 // Framework
 class Framework;
@@ -189,7 +196,7 @@ struct Traits_Tokens
     enum {STATIC, MAC, INFO, RARP, DHCP};
 
     // SmartData predictors
-    enum :unsigned char {NONE, LVP, DBP};
+    enum :unsigned char {NONE, LVP, DBP, KFP, DESP};
 
     // Monitor events (Transducers)
     enum Transducer_Event {
@@ -9,31 +9,55 @@
 #include <memory.h>
 
 // EPOS 128-bit Advanced Encryption Standard (AES) Software Implementation
-// Adapted from https://github.com/kokke/tiny-AES128-C
+// Constant time and table-free: the state is bitsliced (word j holds bit j of its 16 bytes) and the S-box computed
+// by Boyar and Peralta's circuit, so no memory access nor branch depends on keys or data. Where the CPU has AES-NI
+// (detected at run time, unless Traits<Ciphers>::AES_NI is false), its instructions do the rounds instead.
+// A key is expanded into a Schedule, in the form the backend in use needs. One used over and over (e.g. the id of
+// a TSTP::Security peer) can be expanded once by its owner and given instead, so no block re-expands or copies it.
 template<>
 class SWAES<16>: public AES_Common
 {
 private:
-    static const unsigned int Nb = 4; // number of columns comprising a _state
-    static const unsigned int Nk = 4; // number of 32 bit words in a key
-    static const int Nr = 10; // number of rounds in AES cipher
+    static const unsigned int Nr = 10; // number of rounds in AES cipher
 
-    typedef unsigned char State[4][4]; // array holding the intermediate results during decryption
+    // 11 round keys of 8 bitsliced words, or, with AES-NI, 11 encryption round keys followed by the 11 decryption
+    // ones (both take 352 bytes)
+    typedef unsigned int Round_Keys[2 * (Nr + 1) * 4] __attribute__((aligned(16)));
 
 public:
     static const unsigned int KEY_SIZE = 16;
 
+    // An expanded key, only meaningful to the AES that expanded it
+    struct Schedule {
+        Round_Keys round_keys;
+    };
+
 public:
-    SWAES(const Mode & m = ECB): _mode(m) {
-        assert((m == ECB) || (m == CBC));
-        for(unsigned int i = 0; i < 23; i++)
-            iv[i] = 0;
-    }
+    SWAES(const Mode & m = ECB);
 
     Mode mode() { return _mode; }
 
-    void encrypt(const unsigned char * data, const unsigned char * key, unsigned char * result) { crypt(data, key, result, true); }
-    void decrypt(const unsigned char * data, const unsigned char * key, unsigned char * result) { crypt(data, key, result, false); }
+    void expand_key(const unsigned char * key, Schedule & s) {
+        db<Ciphers>(TRC) << "AES::expand_key(key=" << key << ",s=" << &s << ")" << endl;
+        if(_ni)
+            expand_ni(key, s.round_keys);
+        else
+            expand(key, s.round_keys);
+    }
+
+    void encrypt(const unsigned char * data, const unsigned char * key, unsigned char * result) {
+        Schedule s;
+        expand_key(key, s);
+        crypt(data, s, result, true);
+    }
+    void decrypt(const unsigned char * data, const unsigned char * key, unsigned char * result) {
+        Schedule s;
+        expand_key(key, s);
+        crypt(data, s, result, false);
+    }
+
+    void encrypt(const unsigned char * data, const Schedule & s, unsigned char * result) { crypt(data, s, result, true); }
+    void decrypt(const unsigned char * data, const Schedule & s, unsigned char * result) { crypt(data, s, result, false); }
 
 private:
     void mode(const Mode & m) {
@@ -41,29 +65,25 @@ private:
         _mode = m;
     }
 
-    void crypt(const unsigned char * data, const unsigned char * key, unsigned char * result, bool encrypt) {
-        db<Ciphers>(TRC) << "AES::" << (encrypt ? "en" : "de") << "crypt(data=" << data << ",key=" << key << ",result=" << result << endl;
+    void crypt(const unsigned char * data, const Schedule & s, unsigned char * result, bool encrypt) {
+        db<Ciphers>(TRC) << "AES::" << (encrypt ? "en" : "de") << "crypt(data=" << data << ",s=" << &s << ",result=" << result << endl;
         db<Ciphers>(INF) << "AES::" << (encrypt ? "en" : "de") << "crypt:data = {" << int(data[0]);
         for(unsigned int i = 1; i < 16; i++)
             db<Ciphers>(INF) << "," << int(data[i]);
         db<Ciphers>(INF) << "}" << endl;
-        db<Ciphers>(INF) << "AES::" << (encrypt ? "en" : "de") << "crypt:key = {" << int(key[0]);
-        for(unsigned int i = 1; i < 16; i++)
-            db<Ciphers>(INF) << "," << int(key[i]);
-        db<Ciphers>(INF) << "}" << endl;
 
         switch(_mode) {
         case CBC:
             if(encrypt)
-                cbc_encrypt_buffer(result, data, 16, key, iv);
+                cbc_encrypt_buffer(result, data, 16, s.round_keys, _iv);
             else
-                cbc_decrypt_buffer(result, data, 16, key, iv);
+                cbc_decrypt_buffer(result, data, 16, s.round_keys, _iv);
             break;
         case ECB:
             if(encrypt)
-                ebc_encrypt(data, key, result);
+                encrypt_block(s.round_keys, data, result);
             else
-                ebc_decrypt(data, key, result);
+                decrypt_block(s.round_keys, data, result);
             break;
         }
 
@@ -73,47 +93,36 @@ private:
         db<Ciphers>(INF) << "}" << endl;
     }
 
-    void cbc_encrypt_buffer(unsigned char * output, const unsigned char * input, int length, const unsigned char * key, unsigned char * iv);
-    void cbc_decrypt_buffer(unsigned char * output, const unsigned char * input, int length, const unsigned char * key, unsigned char * iv);
-    void ebc_encrypt(const unsigned char * input, const unsigned char * key, unsigned char *output);
-    void ebc_decrypt(const unsigned char * input, const unsigned char * key, unsigned char *output);
-
-    void expand_key();
-    void add_round_key(int round);
-    void sub_bytes();
-    void shift_rows();
-    void mix_columns();
-    void inv_mix_columns();
-    void inv_sub_bytes();
-    void inv_shift_rows();
-
-    void cipher();
-    void inv_cipher();
-
-    void block_copy(unsigned char * output, const unsigned char * input) { memcpy(output, input, KEY_SIZE); }
-
-    unsigned char xtime(unsigned char x) { return ((x<<1) ^ (((x>>7) & 1) * 0x1b)); }
-    unsigned char multiply(unsigned char x, unsigned char y) {
-        return (((y & 1) * x) ^
-                ((y >> 1 & 1) * xtime(x)) ^
-                ((y >> 2 & 1) * xtime(xtime(x))) ^
-                ((y >> 3 & 1) * xtime(xtime(xtime(x)))) ^
-                ((y >> 4 & 1) * xtime(xtime(xtime(xtime(x))))));
-    }
+    void cbc_encrypt_buffer(unsigned char * output, const unsigned char * input, int length, const Round_Keys & rk, const unsigned char * iv);
+    void cbc_decrypt_buffer(unsigned char * output, const unsigned char * input, int length, const Round_Keys & rk, const unsigned char * iv);
 
-    void xor_with_iv(unsigned char * buf) { for(unsigned int i = 0; i < KEY_SIZE; ++i) buf[i] ^= _iv[i]; }
+    void encrypt_block(const Round_Keys & rk, const unsigned char * input, unsigned char * output) { if(_ni) encrypt_block_ni(rk, input, output); else cipher(rk, input, output); }
+    void decrypt_block(const Round_Keys & rk, const unsigned char * input, unsigned char * output) { if(_ni) decrypt_block_ni(rk, input, output); else inv_cipher(rk, input, output); }
 
-private:
-    Mode _mode;
+    // Bitsliced software
+    static void expand(const unsigned char * key, Round_Keys & rk);
+    static void cipher(const Round_Keys & rk, const unsigned char * input, unsigned char * output);
+    static void inv_cipher(const Round_Keys & rk, const unsigned char * input, unsigned char * output);
 
-    State * _state;
-    unsigned char _round_key[176];
-    const unsigned char * _key;
-    unsigned char * _iv; // initial Vector used only for CBC mode
-    unsigned char iv[23];
+    static void bitslice(const unsigned char * bytes, unsigned int * q);
+    static void unbitslice(const unsigned int * q, unsigned char * bytes);
+    static void add_round_key(unsigned int * q, const unsigned int * rk) { for(unsigned int j = 0; j < 8; j++) q[j] ^= rk[j]; }
+    static void sub_bytes(unsigned int * q);
+    static void inv_sub_bytes(unsigned int * q);
+    static void shift_rows(unsigned int * q);
+    static void inv_shift_rows(unsigned int * q);
+    static void mix_columns(unsigned int * q);
+    static void inv_mix_columns(unsigned int * q);
 
-    static const unsigned char sbox[256];
-    static const unsigned char rsbox[256];
-    static const unsigned char rcon[255];
-};
+    // AES-NI
+    static void expand_ni(const unsigned char * key, Round_Keys & rk);
+    static void encrypt_block_ni(const Round_Keys & rk, const unsigned char * input, unsigned char * output);
+    static void decrypt_block_ni(const Round_Keys & rk, const unsigned char * input, unsigned char * output);
 
+    void xor_with_iv(unsigned char * buf, const unsigned char * iv) { for(unsigned int i = 0; i < KEY_SIZE; ++i) buf[i] ^= iv[i]; }
+
+private:
+    Mode _mode;
+    bool _ni;
+    unsigned char _iv[16]; // initial Vector used only for CBC mode
+};
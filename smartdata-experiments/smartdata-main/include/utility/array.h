@@ -51,6 +51,18 @@ public:
         return out;
     }
 
+    template<typename _T, unsigned int _N>
+    friend Debug & operator<<(Debug & db, const Array<_T, _N> & array) {
+        db << "[";
+        for(unsigned int i = 0; i < N; i++) {
+            db << array[i];
+            if(i < N - 1)
+                db << ",";
+        }
+        db << "]";
+        return db;
+    }
+
 private:
     void copy_and_pad(const void * data, unsigned int size) {
         if(size > SIZE)
@@ -5,10 +5,19 @@
 #include <utility/random.h>
 #include <utility/debug.h>
 
+// Montgomery Bignums need 128-bit products, which only 64-bit compilers have
+#ifdef __SIZEOF_INT128__
+#define __bignum_montgomery__ Traits<Ciphers>::MONTGOMERY
+#else
+#define __bignum_montgomery__ false
+#endif
+
 // This class implements a prime finite field (Fp or GF(p))
 // It basically consists of (possibly) big numbers between 0 and a prime modulo, with + - * / operators
 // Primarily meant to be used primarily by asymmetric cryptography (e.g. Diffie-Hellman)
-template<unsigned int SIZE>
+// This is the portable implementation, on 32-bit digits with Barrett reduction; Bignum<SIZE, true> is the one
+// in Montgomery form, selected by Traits<Ciphers>::MONTGOMERY
+template<unsigned int SIZE, bool montgomery = __bignum_montgomery__>
 class Bignum
 {
     template<typename Cipher> friend class Poly1305;
@@ -78,6 +87,12 @@ public:
 
     const Digit& operator[](unsigned int i) const { return _data[i]; }
 
+    // The inverse of Bignum(bytes, len): the number as little-endian bytes, the same for any Bignum of its SIZE
+    void to_bytes(void * bytes, unsigned int len) const {
+        for(unsigned int i = 0; i < len; i++)
+            reinterpret_cast<unsigned char *>(bytes)[i] = (i < sizeof(Word)) ? _data[i / sizeof(Digit)] >> (8 * (i % sizeof(Digit))) : 0;
+    }
+
     bool operator==(const Bignum & b) const { return (cmp(_data, b._data, DIGITS) == 0); }
     bool operator!=(const Bignum & b) const { return (cmp(_data, b._data, DIGITS) != 0); }
     bool operator>=(const Bignum & b) const { return (cmp(_data, b._data, DIGITS) >= 0); }
@@ -401,3 +416,261 @@ private:
     static const _Word _mod;
     static const _Barrett _barrett_u;
 };
+
+#ifdef __SIZEOF_INT128__
+
+// The same prime field, on 64-bit digits with every number kept in Montgomery form (i.e. a * R % _mod, R being
+// 2^(64 * DIGITS)), so a multiplication takes one Montgomery reduction and no division. Everything that depends
+// on the numbers (but not on the modulo) runs in constant time: additions and subtractions select their results
+// with masks and invert() is a^(_mod - 2) with a fixed sequence of multiplications. Numbers are converted to and
+// from Montgomery form when built from and read as integers (or bytes, with to_bytes()), so their bytes in memory
+// must not leave the node.
+template<unsigned int SIZE>
+class Bignum<SIZE, true>
+{
+public:
+    typedef unsigned long long Digit;
+    typedef unsigned __int128 Double_Digit;
+
+    static const unsigned int DIGITS = (SIZE + sizeof(Digit) - 1) / sizeof(Digit);
+    static const unsigned int BITS_PER_DIGIT = sizeof(Digit) * 8;
+
+    typedef Digit Word[DIGITS];
+
+private:
+    struct Modulo {
+        Word p;
+        Digit p_inv; // -p^-1 % 2^64
+        Word r2; // R^2 % p
+    };
+
+public:
+    Bignum(unsigned int n = 0) { *this = n; }
+    Bignum(const void * bytes, unsigned int len) {
+        Word w;
+        for(unsigned int i = 0, j = 0; i < DIGITS; i++) {
+            w[i] = 0;
+            for(unsigned int k = 0; k < sizeof(Digit) && j < len; k++, j++)
+                w[i] |= static_cast<Digit>(reinterpret_cast<const unsigned char *>(bytes)[j]) << (8 * k);
+        }
+        set(w);
+    }
+
+    bool is_even() const { return !((*this)[0] % 2); }
+
+    operator unsigned int() const { return (*this)[0]; }
+
+    void operator^=(const Bignum & b) {
+        Word x, y;
+        get(x);
+        b.get(y);
+        for(unsigned int i = 0; i < DIGITS; i++)
+            x[i] ^= y[i];
+        set(x);
+    }
+
+    void operator=(unsigned int n) {
+        Word w;
+        w[0] = n;
+        for(unsigned int i = 1; i < DIGITS; i++)
+            w[i] = 0;
+        set(w);
+    }
+
+    void operator=(const Bignum & b) {
+        for(unsigned int i = 0; i < DIGITS; i++)
+            _data[i] = b._data[i];
+    }
+
+    // Digit i of the number (not of its Montgomery form)
+    Digit operator[](unsigned int i) const {
+        Word w;
+        get(w);
+        return w[i];
+    }
+
+    void to_bytes(void * bytes, unsigned int len) const {
+        Word w;
+        get(w);
+        for(unsigned int i = 0; i < len; i++)
+            reinterpret_cast<unsigned char *>(bytes)[i] = (i < sizeof(Word)) ? w[i / sizeof(Digit)] >> (8 * (i % sizeof(Digit))) : 0;
+    }
+
+    // Montgomery form is a bijection, so equality holds for it, but order does not
+    bool operator==(const Bignum & b) const { return (cmp(_data, b._data) == 0); }
+    bool operator!=(const Bignum & b) const { return (cmp(_data, b._data) != 0); }
+    bool operator>=(const Bignum & b) const { return (compare(b) >= 0); }
+    bool operator<=(const Bignum & b) const { return (compare(b) <= 0); }
+    bool  operator>(const Bignum & b) const { return (compare(b) > 0); }
+    bool  operator<(const Bignum & b) const { return (compare(b) < 0); }
+
+    void operator*=(const Bignum & b) { multiply(_data, _data, b._data); } // _data = (_data * b._data) % _mod
+
+    void operator+=(const Bignum & b) { // _data = (_data + b._data) % _mod
+        Word sum, reduced;
+        Digit carry = add(sum, _data, b._data);
+        Digit borrow = sub(reduced, sum, _mod.p);
+        select(_data, reduced, sum, carry | (borrow ^ 1));
+    }
+
+    void operator-=(const Bignum & b) { // _data = (_data - b._data) % _mod
+        Word difference, wrapped;
+        Digit borrow = sub(difference, _data, b._data);
+        add(wrapped, difference, _mod.p);
+        select(_data, wrapped, difference, borrow);
+    }
+
+    void randomize() { // Sets _data to a random number smaller than _mod
+        int i;
+        for(i = DIGITS - 1; i >= 0 && (_mod.p[i] == 0); i--)
+            _data[i] = 0;
+        _data[i] = random() % _mod.p[i];
+        for(--i; i >= 0; i--)
+            _data[i] = random();
+    }
+
+    void invert() { // _data = i, such that (_data * i) % _mod = 1
+        // Fermat: i = _data^(_mod - 2), squaring and multiplying for every bit of _mod - 2 (which is public)
+        Word e;
+        Digit borrow = 2;
+        for(unsigned int i = 0; i < DIGITS; i++) {
+            e[i] = _mod.p[i] - borrow;
+            borrow = (_mod.p[i] < borrow);
+        }
+
+        Word a;
+        for(unsigned int i = 0; i < DIGITS; i++)
+            a[i] = _data[i];
+        *this = 1;
+        for(int i = DIGITS * BITS_PER_DIGIT - 1; i >= 0; i--) {
+            multiply(_data, _data, _data);
+            if((e[i / BITS_PER_DIGIT] >> (i % BITS_PER_DIGIT)) & 1)
+                multiply(_data, _data, a);
+        }
+    }
+
+    friend OStream &operator<<(OStream & out, const Bignum & b){
+        Word w;
+        b.get(w);
+        out << '[';
+        for(unsigned int i = 0; i < DIGITS; i++) {
+            out << w[i];
+            if(i < DIGITS - 1)
+                out << ", ";
+        }
+        out << "]";
+        return out;
+    }
+
+    friend Debug &operator<<(Debug & out, const Bignum & b) {
+        Word w;
+        b.get(w);
+        out << '[';
+        for(unsigned int i = 0; i < DIGITS; i++) {
+            out << w[i];
+            if(i < DIGITS - 1)
+                out << ", ";
+        }
+        out << "]";
+        return out;
+    }
+
+private:
+    static Digit random() { return (static_cast<Digit>(static_cast<unsigned int>(Random::random())) << 32) | static_cast<unsigned int>(Random::random()); }
+
+    // Into and out of Montgomery form
+    void set(const Word & w) { multiply(_data, w, _mod.r2); }
+    void get(Word & w) const {
+        Word one;
+        one[0] = 1;
+        for(unsigned int i = 1; i < DIGITS; i++)
+            one[i] = 0;
+        multiply(w, _data, one);
+    }
+
+    int compare(const Bignum & b) const {
+        Word x, y;
+        get(x);
+        b.get(y);
+        return cmp(x, y);
+    }
+
+    static int cmp(const Digit * a, const Digit * b) { // a == b -> 0, a > b -> 1, a < b -> -1
+        for(int i = DIGITS - 1; i >= 0; i--) {
+            if(a[i] > b[i]) return 1;
+            else if(a[i] < b[i]) return -1;
+        }
+        return 0;
+    }
+
+    // res = a + b, returning the carry
+    static Digit add(Digit * res, const Digit * a, const Digit * b) {
+        Double_Digit t = 0;
+        for(unsigned int i = 0; i < DIGITS; i++) {
+            t += static_cast<Double_Digit>(a[i]) + b[i];
+            res[i] = t;
+            t >>= BITS_PER_DIGIT;
+        }
+        return t;
+    }
+
+    // res = a - b, returning the borrow
+    static Digit sub(Digit * res, const Digit * a, const Digit * b) {
+        Digit borrow = 0;
+        for(unsigned int i = 0; i < DIGITS; i++) {
+            Double_Digit t = static_cast<Double_Digit>(a[i]) - b[i] - borrow;
+            res[i] = t;
+            borrow = (t >> BITS_PER_DIGIT) & 1;
+        }
+        return borrow;
+    }
+
+    // res = c ? a : b, without branching on c (0 or 1)
+    static void select(Digit * res, const Digit * a, const Digit * b, Digit c) {
+        Digit mask = -c;
+        for(unsigned int i = 0; i < DIGITS; i++)
+            res[i] = (a[i] & mask) | (b[i] & ~mask);
+    }
+
+    // res = a * b * R^-1 % _mod (Coarsely Integrated Operand Scanning); res may be a or b
+    static void multiply(Digit * res, const Digit * a, const Digit * b) {
+        Digit t[DIGITS + 2];
+        for(unsigned int i = 0; i < DIGITS + 2; i++)
+            t[i] = 0;
+
+        for(unsigned int i = 0; i < DIGITS; i++) {
+            Double_Digit c = 0;
+            for(unsigned int j = 0; j < DIGITS; j++) {
+                c += static_cast<Double_Digit>(a[j]) * b[i] + t[j];
+                t[j] = c;
+                c >>= BITS_PER_DIGIT;
+            }
+            c += t[DIGITS];
+            t[DIGITS] = c;
+            t[DIGITS + 1] = c >> BITS_PER_DIGIT;
+
+            Digit m = t[0] * _mod.p_inv;
+            c = (static_cast<Double_Digit>(m) * _mod.p[0] + t[0]) >> BITS_PER_DIGIT;
+            for(unsigned int j = 1; j < DIGITS; j++) {
+                c += static_cast<Double_Digit>(m) * _mod.p[j] + t[j];
+                t[j - 1] = c;
+                c >>= BITS_PER_DIGIT;
+            }
+            c += t[DIGITS];
+            t[DIGITS - 1] = c;
+            t[DIGITS] = t[DIGITS + 1] + (c >> BITS_PER_DIGIT);
+        }
+
+        // t < 2 * _mod, so at most one subtraction
+        Word reduced;
+        Digit borrow = sub(reduced, t, _mod.p);
+        select(res, reduced, t, t[DIGITS] | (borrow ^ 1));
+    }
+
+private:
+    Word _data;
+
+    static const Modulo _mod;
+};
+
+#endif
@@ -3,6 +3,7 @@
 // EPOS Buffer Declarations
 
 #include <assert.h>
+#include <architecture/ia32/ia32_cpu.h>
 
 // This Buffer was designed to move data across a zero-copy communication stack, but can be used for several other purposes
 template<typename Owner, typename Data, typename Shadow = void, typename _Metadata = Dummy>
@@ -31,10 +32,7 @@ public:
     Data * frame() { return data(); }
     Data * message() { return data(); }
 
-    bool lock() { bool old = _lock;
-		_lock = 1;
-		return !old;
-	}
+    bool lock() { return !CPU::tsl(_lock); }
     void unlock() { _lock = 0; }
 
     Owner * owner() const { return _owner; }
@@ -153,3 +151,192 @@ private:
     unsigned int _tail;
     T _data[N_ELEMENTS];
 };
+
+// Lock-free pool of N preallocated objects (usually Buffers) for many producers and many consumers.
+// Free objects live in a shared Treiber stack of indices whose head carries an ABA tag next to the
+// index, so a 32-bit CAS suffices. It is fronted by CACHES small caches that threads are spread over
+// and try-lock: objects move between a cache and the stack in batches of CACHE / 2, and a thread that
+// finds its cache taken goes straight to the stack, so nobody ever waits for anybody else.
+template<typename T, unsigned int N, unsigned int CACHES = 8, unsigned int CACHE = 16>
+class Buffer_Pool
+{
+private:
+    static const unsigned int NIL = 0xffff;
+    static const unsigned int INDEX = 0x0000ffff;
+    static const unsigned int TAG = 0x00010000;
+
+    static_assert(N < NIL, "Buffer_Pool indices are 16-bit");
+
+    struct Cache
+    {
+        volatile bool lock;
+        volatile unsigned int size;
+        volatile unsigned short index[CACHE];
+    };
+
+public:
+    template<typename ... Tn>
+    Buffer_Pool(Tn ... an): _objects(reinterpret_cast<T *>(new /*(SYSTEM)*/ char[N * sizeof(T)])) {
+        for(unsigned int i = 0; i < N; i++) {
+            new (&_objects[i]) T(an ...);
+            _next[i] = (i + 1 < N) ? i + 1 : NIL;
+        }
+        _free = 0;
+        for(unsigned int i = 0; i < CACHES; i++) {
+            _caches[i].lock = false;
+            _caches[i].size = 0;
+        }
+    }
+    ~Buffer_Pool() {
+        for(unsigned int i = 0; i < N; i++)
+            _objects[i].~T();
+        delete [] reinterpret_cast<char *>(_objects);
+    }
+
+    bool contains(const T * o) const { return (o >= _objects) && (o < _objects + N); }
+
+    // Returns 0 only if every object is in use
+    T * get() {
+        unsigned int i = NIL;
+        Cache * c = cache();
+        if(c) {
+            if(!c->size)
+                refill(c);
+            if(c->size)
+                i = c->index[--c->size];
+            c->lock = false;
+        } else
+            i = pop();
+
+        if(i == NIL)
+            i = steal();
+
+        return (i == NIL) ? 0 : &_objects[i];
+    }
+
+    void put(T * o) {
+        unsigned int i = o - _objects;
+        Cache * c = cache();
+        if(c) {
+            if(c->size == CACHE)
+                drain(c);
+            c->index[c->size++] = i;
+            c->lock = false;
+        } else
+            push(i, i);
+    }
+
+private:
+    // The calling thread's cache, locked, or 0 if another thread holds it
+    Cache * cache() {
+        static volatile unsigned int threads = 0;
+        static thread_local unsigned int id = CPU::finc(threads);
+
+        Cache * c = &_caches[id % CACHES];
+        return CPU::tsl(c->lock) ? 0 : c;
+    }
+
+    void refill(Cache * c) {
+        for(unsigned int i; (c->size < CACHE / 2) && ((i = pop()) != NIL); )
+            c->index[c->size++] = i;
+    }
+
+    void drain(Cache * c) {
+        unsigned int last = c->index[--c->size];
+        unsigned int first = last;
+        while(c->size > CACHE / 2) {
+            unsigned int i = c->index[--c->size];
+            _next[i] = first;
+            first = i;
+        }
+        push(first, last);
+    }
+
+    // Takes one object from any other cache when the stack runs dry
+    unsigned int steal() {
+        for(unsigned int n = 0; n < CACHES; n++) {
+            Cache * c = &_caches[n];
+            if(!c->size || CPU::tsl(c->lock))
+                continue;
+            unsigned int i = c->size ? c->index[--c->size] : NIL;
+            c->lock = false;
+            if(i != NIL)
+                return i;
+        }
+        return NIL;
+    }
+
+    unsigned int pop() {
+        unsigned int head, next;
+        do {
+            head = _free;
+            if((head & INDEX) == NIL)
+                return NIL;
+            next = ((head & ~INDEX) + TAG) | _next[head & INDEX];
+        } while(CPU::cas(_free, head, next) != head);
+        return head & INDEX;
+    }
+
+    // Pushes a chain already linked from first to last through _next
+    void push(unsigned int first, unsigned int last) {
+        unsigned int head, next;
+        do {
+            head = _free;
+            _next[last] = head & INDEX;
+            next = ((head & ~INDEX) + TAG) | first;
+        } while(CPU::cas(_free, head, next) != head);
+    }
+
+private:
+    T * _objects;
+    volatile unsigned short _next[N];
+    volatile unsigned int _free;
+    Cache _caches[CACHES];
+};
+
+// Lock-free FIFO of N (a power of 2) objects for exactly one producer thread and one consumer thread.
+// Each index is written by a single side and IA-32 does not reorder stores with other stores nor loads
+// with other loads, so volatile accesses are enough to publish an object before the index that covers it.
+// The indices live on separate cache lines so the two sides do not keep stealing each other's line.
+template<typename T, unsigned int N>
+class Ring_Buffer
+{
+private:
+    static const unsigned int LINE = 64;
+
+    static_assert(N && !(N & (N - 1)), "Ring_Buffer size must be a power of 2");
+
+public:
+    Ring_Buffer(): _head(0), _tail(0) {}
+
+    unsigned int size() const { return _tail - _head; }
+    bool empty() const { return _tail == _head; }
+    bool full() const { return (_tail - _head) == N; }
+
+    // Producer side
+    bool insert(const T & o) {
+        unsigned int t = _tail;
+        if(t - _head == N)
+            return false;
+        _data[t & (N - 1)] = o;
+        _tail = t + 1;
+        return true;
+    }
+
+    // Consumer side
+    bool remove(T & o) {
+        unsigned int h = _head;
+        if(h == _tail)
+            return false;
+        o = _data[h & (N - 1)];
+        _head = h + 1;
+        return true;
+    }
+
+private:
+    volatile unsigned int _head;
+    char _pad0[LINE - sizeof(unsigned int)];
+    volatile unsigned int _tail;
+    char _pad1[LINE - sizeof(unsigned int)];
+    volatile T _data[N];
+};
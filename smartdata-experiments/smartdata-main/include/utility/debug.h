@@ -3,12 +3,30 @@
 // EPOS Debug Utility Declarations
 
 #include <utility/ostream.h>
+#include <utility/log.h>
 
 class Debug
 {
 public:
+    // Only for what OStream prints by itself; other types are printed by their own operator<<(Debug &, ...)
     template<typename T>
-    Debug & operator<<(T p) { kerr << p; return *this; }
+    auto operator<<(T p) -> decltype(Log::put(p), *this) {
+        if(Traits<Debug>::async && !_synchronous)
+            Log::put(p);
+        else
+            kerr << p;
+        return *this;
+    }
+
+    // Set by db<>() for the line it begins: errors and warnings bypass the Log, so they are neither dropped nor left
+    // in a ring by a crash (though they may print ahead of records still queued)
+    static void synchronous(bool s) {
+        if(Traits<Debug>::async)
+            _synchronous = s;
+    }
+
+private:
+    static __thread bool _synchronous;
 };
 
 class Null_Debug
@@ -35,6 +53,7 @@ db(Debug_Error l)
 {
     extern OStream::Err error;
 
+    Debug::synchronous(true);
     Select_Debug<(Traits<T>::debugged && Traits<Debug>::error)>() << begl;
     Select_Debug<(Traits<T>::debugged && Traits<Debug>::error)>() << error;
     return Select_Debug<(Traits<T>::debugged && Traits<Debug>::error)>();
@@ -46,6 +65,7 @@ db(Debug_Error l)
 {
     extern OStream::Err error;
 
+    Debug::synchronous(true);
     Select_Debug<((Traits<T1>::debugged || Traits<T2>::debugged) && Traits<Debug>::error)>() << begl;
     Select_Debug<((Traits<T1>::debugged || Traits<T2>::debugged) && Traits<Debug>::error)>() << error;
     return Select_Debug<((Traits<T1>::debugged || Traits<T2>::debugged) && Traits<Debug>::error)>();
@@ -58,6 +78,7 @@ template<typename T>
 inline Select_Debug<(Traits<T>::debugged && Traits<Debug>::warning)>
 db(Debug_Warning l)
 {
+    Debug::synchronous(true);
     Select_Debug<(Traits<T>::debugged && Traits<Debug>::warning)>() << begl;
     return Select_Debug<(Traits<T>::debugged && Traits<Debug>::warning)>();
 }
@@ -66,6 +87,7 @@ template<typename T1, typename T2>
 inline Select_Debug<((Traits<T1>::debugged || Traits<T2>::debugged) && Traits<Debug>::warning)>
 db(Debug_Warning l)
 {
+    Debug::synchronous(true);
     Select_Debug<((Traits<T1>::debugged || Traits<T2>::debugged) && Traits<Debug>::warning)>() << begl;
     return Select_Debug<((Traits<T1>::debugged || Traits<T2>::debugged) && Traits<Debug>::warning)>();
 }
@@ -77,6 +99,7 @@ template<typename T>
 inline Select_Debug<(Traits<T>::debugged && Traits<Debug>::info)>
 db(Debug_Info l)
 {
+    Debug::synchronous(false);
     Select_Debug<(Traits<T>::debugged && Traits<Debug>::info)>() << begl;
     return Select_Debug<(Traits<T>::debugged && Traits<Debug>::info)>();
 }
@@ -85,6 +108,7 @@ template<typename T1, typename T2>
 inline Select_Debug<((Traits<T1>::debugged || Traits<T2>::debugged) && Traits<Debug>::info)>
 db(Debug_Info l)
 {
+    Debug::synchronous(false);
     Select_Debug<((Traits<T1>::debugged || Traits<T2>::debugged) && Traits<Debug>::info)>() << begl;
     return Select_Debug<((Traits<T1>::debugged || Traits<T2>::debugged) && Traits<Debug>::info)>();
 }
@@ -96,6 +120,7 @@ template<typename T>
 inline Select_Debug<(Traits<T>::debugged && Traits<Debug>::trace)>
 db(Debug_Trace l)
 {
+    Debug::synchronous(false);
     Select_Debug<(Traits<T>::debugged && Traits<Debug>::trace)>() << begl;
     return Select_Debug<(Traits<T>::debugged && Traits<Debug>::trace)>();
 }
@@ -104,6 +129,7 @@ template<typename T1, typename T2>
 inline Select_Debug<((Traits<T1>::debugged || Traits<T2>::debugged) && Traits<Debug>::trace)>
 db(Debug_Trace l)
 {
+    Debug::synchronous(false);
     Select_Debug<((Traits<T1>::debugged || Traits<T2>::debugged) && Traits<Debug>::trace)>() << begl;
     return Select_Debug<((Traits<T1>::debugged || Traits<T2>::debugged) && Traits<Debug>::trace)>();
 }
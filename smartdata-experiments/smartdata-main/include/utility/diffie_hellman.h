@@ -4,6 +4,11 @@
 
 #include <utility/bignum.h>
 
+// Points are kept in Jacobian coordinates (x / z^2, y / z^3), so additions and doublings take no inversion (the curve
+// has a = -3, which saves two multiplications per doubling). Points are multiplied by a width-4 NAF of the scalar,
+// over P, 3P, 5P and 7P, so there is an addition every five doublings on average, instead of every other one.
+// Key pairs for the default base point (the secp128r1 generator) take a fixed-base comb instead, whose precomputed
+// table replaces 106 of the 128 doublings.
 template<typename Cipher>
 class Diffie_Hellman
 {
@@ -14,6 +19,15 @@ public:
 private:
     typedef _UTIL::Bignum<SECRET_SIZE> Bignum;
 
+    static const unsigned int BITS = SECRET_SIZE * 8;
+    static const unsigned int NAF_WIDTH = 4;
+    static const unsigned int COMB_TEETH = 6;
+    static const unsigned int COMB_COLUMNS = (BITS + COMB_TEETH - 1) / COMB_TEETH;
+
+    // The default base point and its comb table are those of secp128r1, the table precomputed for 6 teeth of 22 columns
+    static_assert(SECRET_SIZE == 16, "the default base point and its comb table are only given for 128-bit secrets (secp128r1)");
+    static_assert((COMB_TEETH == 6) && (COMB_COLUMNS == 22), "the comb table must be recomputed for other teeth or columns");
+
     class Elliptic_Curve_Point
     {
     public:
@@ -24,6 +38,9 @@ private:
 
         void operator*=(const Coordinate & b);
 
+        // *this = b * the default base point
+        void comb(const Coordinate & b);
+
         friend Debug &operator<<(Debug &out, const Elliptic_Curve_Point &a) {
             out << "{x=" << a.x << ",y=" << a.y << ",z=" << a.z << "}";
             return out;
@@ -35,7 +52,20 @@ private:
 
     private:
         void jacobian_double();
+        void add_jacobian(const Elliptic_Curve_Point &b);
         void add_jacobian_affine(const Elliptic_Curve_Point &b);
+        void negate() { Coordinate y0(y); y -= y0; y -= y0; }
+        void normalize();
+
+        // The bits of a scalar, least significant first
+        static void bits(bool * k, const Coordinate & b) {
+            static const unsigned int bits_in_digit = sizeof(typename Coordinate::Digit) * 8;
+            for(unsigned int i = 0; i < sizeof(Coordinate) / sizeof(typename Coordinate::Digit); i++) {
+                typename Coordinate::Digit d = b[i];
+                for(unsigned int j = 0; j < bits_in_digit; j++)
+                    k[i * bits_in_digit + j] = (d >> j) & 1;
+            }
+        }
 
     public:
         Coordinate x, y, z;
@@ -46,14 +76,14 @@ public:
     typedef Bignum Shared_Key;
     typedef Bignum Private_Key;
 
-    Diffie_Hellman() {
+    Diffie_Hellman(): _fixed_base(true) {
         new (&_base_point.x) Bignum(_default_base_point_x, SECRET_SIZE);
         new (&_base_point.y) Bignum(_default_base_point_y, SECRET_SIZE);
         _base_point.z = 1;
         generate_keypair();
     }
 
-    Diffie_Hellman(const Elliptic_Curve_Point & base_point): _base_point(base_point) {
+    Diffie_Hellman(const Elliptic_Curve_Point & base_point): _base_point(base_point), _fixed_base(false) {
         generate_keypair();
     }
 
@@ -78,8 +108,12 @@ private:
         db<Diffie_Hellman>(INF) << "Diffie_Hellman Private: " << _private << endl;
         db<Diffie_Hellman>(INF) << "Diffie_Hellman Base Point: " << _base_point << endl;
 
-        _public = _base_point;
-        _public *= _private;
+        if(_fixed_base)
+            _public.comb(_private);
+        else {
+            _public = _base_point;
+            _public *= _private;
+        }
 
         db<Diffie_Hellman>(INF) << "Diffie_Hellman Public: " << _public << endl;
     }
@@ -87,12 +121,13 @@ private:
 private:
     Private_Key _private;
     Elliptic_Curve_Point _base_point;
+    bool _fixed_base;
     Elliptic_Curve_Point _public;
     static const char _default_base_point_x[SECRET_SIZE];
     static const char _default_base_point_y[SECRET_SIZE];
+    static const unsigned char _comb[(1 << COMB_TEETH) - 1][2][SECRET_SIZE];
 };
 
-//TODO: base point is dependent of SECRET_SIZE
 template<typename Cipher>
 const char Diffie_Hellman<Cipher>::_default_base_point_x[SECRET_SIZE] =
 {
@@ -111,121 +146,400 @@ const char Diffie_Hellman<Cipher>::_default_base_point_y[SECRET_SIZE] =
  '\x39', '\xC8', '\x5A', '\xCF'
 };
 
+// Entry j - 1 is the sum of 2^(COMB_COLUMNS * t) times the default base point for every bit t set in j (affine, little-endian)
+template<typename Cipher>
+const unsigned char Diffie_Hellman<Cipher>::_comb[(1 << COMB_TEETH) - 1][2][SECRET_SIZE] =
+{
+ { { 0x86, 0x5b, 0x2c, 0xa5, 0x7c, 0x60, 0x28, 0x0c, 0x2d, 0x9b, 0x89, 0x8b, 0x52, 0xf7, 0x1f, 0x16 },
+   { 0x83, 0x7a, 0xed, 0xdd, 0x92, 0xa2, 0x2d, 0xc0, 0x13, 0xeb, 0xaf, 0x5b, 0x39, 0xc8, 0x5a, 0xcf } },
+ { { 0x0e, 0xd2, 0xa3, 0x12, 0x28, 0xb5, 0x2f, 0x2d, 0xc7, 0xc7, 0xbd, 0xfe, 0x66, 0xff, 0xbc, 0x95 },
+   { 0x3d, 0xe0, 0xa0, 0xed, 0xa6, 0x79, 0xb1, 0x41, 0xa4, 0x9a, 0x9b, 0xb3, 0x37, 0xba, 0x25, 0x6a } },
+ { { 0xbe, 0x31, 0x55, 0x6a, 0x09, 0xa4, 0x4b, 0xc0, 0x18, 0xaf, 0xd3, 0xf1, 0x61, 0x5c, 0xaa, 0xb6 },
+   { 0x7e, 0xb8, 0xa5, 0xd1, 0xad, 0x7b, 0x3c, 0x38, 0xa9, 0x3f, 0xff, 0xeb, 0xe4, 0xc1, 0xa0, 0x9f } },
+ { { 0xf4, 0x60, 0xdc, 0x31, 0x57, 0x66, 0xe7, 0xf7, 0x5b, 0x1e, 0x6d, 0xfc, 0xf3, 0x31, 0x80, 0xf4 },
+   { 0x9e, 0xe3, 0x4c, 0x9b, 0x77, 0x16, 0xee, 0xa7, 0x10, 0x70, 0xfa, 0xce, 0x93, 0x9e, 0x12, 0xec } },
+ { { 0xcf, 0x57, 0xe4, 0x2d, 0x1a, 0x24, 0x29, 0x97, 0x92, 0x9b, 0xc5, 0x6a, 0xa1, 0xa8, 0x9a, 0x7f },
+   { 0x45, 0x53, 0xdc, 0x10, 0xb0, 0x10, 0x50, 0xe7, 0x39, 0x5b, 0x2e, 0x98, 0x22, 0x82, 0x8b, 0x30 } },
+ { { 0xf0, 0x51, 0x41, 0x43, 0x0b, 0x19, 0x1d, 0x89, 0x6e, 0x54, 0x9a, 0x12, 0x8d, 0x23, 0x4c, 0x31 },
+   { 0x3b, 0x46, 0x26, 0x44, 0xdf, 0xd7, 0xc6, 0x54, 0x93, 0xe3, 0xe6, 0x92, 0x1b, 0x84, 0x52, 0x43 } },
+ { { 0x91, 0xd3, 0xe4, 0x35, 0xe8, 0x28, 0x01, 0x3a, 0x6c, 0x0c, 0x83, 0x04, 0x95, 0x11, 0x4b, 0x56 },
+   { 0x3d, 0x85, 0x4b, 0xfd, 0xa2, 0x9a, 0xfa, 0x1e, 0x1d, 0xb0, 0x89, 0xfe, 0x35, 0x28, 0x42, 0xc9 } },
+ { { 0x27, 0x5c, 0xaf, 0xb4, 0x06, 0x17, 0xde, 0x36, 0x0c, 0x2e, 0xed, 0x12, 0x1a, 0x79, 0x84, 0x33 },
+   { 0x0e, 0xce, 0x2f, 0x93, 0x28, 0xc0, 0x38, 0xb8, 0xf8, 0x58, 0x29, 0x19, 0xeb, 0xea, 0x75, 0x28 } },
+ { { 0x37, 0x2b, 0x96, 0x77, 0xed, 0x79, 0x51, 0x59, 0x67, 0xd7, 0xa2, 0x7f, 0xe8, 0x59, 0x09, 0xea },
+   { 0x65, 0x15, 0xc0, 0xc6, 0xea, 0x70, 0x0b, 0x99, 0x43, 0x4d, 0xaa, 0x4f, 0x55, 0xdd, 0x15, 0x52 } },
+ { { 0x43, 0xb0, 0xc8, 0xbf, 0x07, 0x45, 0xd8, 0xc5, 0xf6, 0xa5, 0xbd, 0xb5, 0x16, 0x6c, 0xe2, 0x5d },
+   { 0x78, 0xb0, 0xef, 0x84, 0xd4, 0xc9, 0x8d, 0xf8, 0xae, 0x3e, 0x7e, 0xc9, 0x26, 0x43, 0xc0, 0x24 } },
+ { { 0xea, 0xe3, 0x59, 0x52, 0x01, 0x5f, 0x81, 0x66, 0xc5, 0x65, 0xd6, 0x37, 0xaa, 0x16, 0xac, 0x81 },
+   { 0x22, 0x81, 0x33, 0x62, 0x7a, 0x97, 0x1c, 0x9e, 0xd4, 0xdf, 0xd7, 0xb9, 0x7f, 0x84, 0xae, 0x09 } },
+ { { 0x82, 0xd8, 0x67, 0xc9, 0xf8, 0x99, 0x3e, 0xd3, 0x9c, 0x50, 0xac, 0xb0, 0x23, 0xb9, 0xaf, 0x45 },
+   { 0x7c, 0xe7, 0x6e, 0x87, 0x79, 0xf7, 0x87, 0x4c, 0x02, 0xbd, 0xd2, 0x40, 0x73, 0xbd, 0x44, 0x4b } },
+ { { 0x74, 0xe2, 0x5a, 0xe7, 0xb3, 0x78, 0xc1, 0xba, 0x61, 0x09, 0x02, 0x41, 0xb9, 0x5a, 0xbf, 0x15 },
+   { 0x60, 0x02, 0x3c, 0x66, 0xd3, 0x2e, 0x9f, 0xa1, 0xfd, 0xf5, 0x0d, 0x5c, 0x2f, 0x53, 0x2a, 0x21 } },
+ { { 0x23, 0x11, 0xe9, 0x7f, 0xab, 0x12, 0x6b, 0xa9, 0x83, 0xcf, 0x12, 0x47, 0xe5, 0x75, 0xa6, 0xe6 },
+   { 0xf3, 0x9c, 0x0d, 0x6f, 0x64, 0xfc, 0x68, 0xe1, 0x3d, 0xdd, 0xd2, 0xd7, 0x38, 0x74, 0x76, 0xc5 } },
+ { { 0x57, 0x5f, 0xf3, 0xb5, 0x3a, 0xa6, 0x61, 0x38, 0x4b, 0x31, 0x69, 0xc4, 0xa8, 0x11, 0x66, 0xc1 },
+   { 0xe9, 0xd3, 0x13, 0x89, 0xba, 0xac, 0x9f, 0x56, 0x6a, 0x42, 0x8f, 0xa9, 0x03, 0xbb, 0xdf, 0x6f } },
+ { { 0x8c, 0x4e, 0x23, 0x0a, 0x8d, 0x74, 0x01, 0x3c, 0x78, 0xe1, 0x94, 0xc4, 0x60, 0x45, 0xa7, 0xc9 },
+   { 0x3e, 0xcf, 0xc6, 0xa5, 0x65, 0x63, 0xf8, 0x2c, 0x11, 0x00, 0x2a, 0x1a, 0xd2, 0x06, 0x13, 0x98 } },
+ { { 0xf6, 0x75, 0xc1, 0xed, 0xbf, 0xf6, 0xd1, 0x6d, 0x67, 0x97, 0xa2, 0xf7, 0xc5, 0xb7, 0x43, 0xf7 },
+   { 0x88, 0xb6, 0xec, 0x18, 0x9b, 0x08, 0x8f, 0xdb, 0xcc, 0x57, 0x5b, 0xfb, 0xfc, 0x66, 0x48, 0xe6 } },
+ { { 0xf5, 0xd3, 0x11, 0x84, 0x71, 0x8f, 0xb3, 0x5e, 0xff, 0x12, 0x55, 0x48, 0x6b, 0x3c, 0x1e, 0x7f },
+   { 0xff, 0x17, 0x7e, 0x55, 0xd9, 0x48, 0x6f, 0xc2, 0xec, 0x91, 0xa6, 0xf4, 0xed, 0xc6, 0xa7, 0x9e } },
+ { { 0x75, 0xe4, 0x22, 0x65, 0x94, 0x54, 0x17, 0x1c, 0xf1, 0xc5, 0x83, 0xb3, 0xf3, 0x07, 0xd3, 0x2d },
+   { 0x4b, 0x26, 0x10, 0xe7, 0x16, 0xf4, 0xc4, 0x3c, 0x6e, 0x21, 0x61, 0x15, 0x69, 0xe7, 0x66, 0xee } },
+ { { 0xec, 0x73, 0x10, 0x3d, 0xc2, 0xb6, 0x5c, 0x86, 0x11, 0x4c, 0xb7, 0x4f, 0xb4, 0x93, 0x84, 0x80 },
+   { 0x62, 0xa9, 0xe9, 0xe2, 0xe5, 0x28, 0x9d, 0x9d, 0x0b, 0xb8, 0x54, 0x2f, 0xa7, 0xf9, 0x84, 0x5c } },
+ { { 0x1a, 0xf2, 0x85, 0x3c, 0x9a, 0x75, 0xfc, 0x07, 0x28, 0xf5, 0x0b, 0xdf, 0xec, 0xaa, 0xd7, 0xf5 },
+   { 0x1f, 0xee, 0x52, 0x0d, 0xea, 0x9d, 0x0a, 0x7d, 0x13, 0xd4, 0x79, 0x1d, 0xd0, 0x13, 0xbb, 0x69 } },
+ { { 0xd5, 0xb6, 0x50, 0x11, 0x6f, 0xe0, 0x50, 0x2a, 0x4f, 0x1e, 0xa6, 0x5f, 0x5d, 0x3d, 0x52, 0x39 },
+   { 0x42, 0x87, 0x84, 0x30, 0xfb, 0xf4, 0xd6, 0xb4, 0x19, 0xe8, 0x67, 0x3a, 0x68, 0x24, 0xe4, 0xde } },
+ { { 0xba, 0x4c, 0x40, 0xd2, 0xa7, 0x1d, 0x23, 0xc8, 0x54, 0x54, 0x46, 0x2f, 0xb8, 0xdb, 0xfb, 0x67 },
+   { 0xb8, 0xa7, 0xac, 0x87, 0x12, 0x98, 0x5a, 0xb2, 0x43, 0xf5, 0x6c, 0x18, 0xbf, 0x70, 0xb0, 0x43 } },
+ { { 0x3e, 0x4f, 0xb0, 0x47, 0x6e, 0x7b, 0x2b, 0xa1, 0xf0, 0x2b, 0xdb, 0x65, 0x84, 0x25, 0x42, 0xdc },
+   { 0x32, 0x5c, 0x30, 0x0a, 0x8f, 0xe4, 0xb2, 0xcd, 0xb4, 0xb0, 0x00, 0x82, 0x26, 0xf4, 0x94, 0xbc } },
+ { { 0x97, 0x06, 0xa6, 0xf1, 0xf7, 0xd9, 0xce, 0x0a, 0x7f, 0xc2, 0x3a, 0x40, 0xca, 0x98, 0x71, 0xf5 },
+   { 0xa5, 0x29, 0x5a, 0x62, 0xb9, 0xe1, 0xea, 0x99, 0x89, 0xfa, 0x4c, 0x17, 0x62, 0xd8, 0xf4, 0x02 } },
+ { { 0x60, 0x10, 0x39, 0xf7, 0xc4, 0xf7, 0x5a, 0x1a, 0x81, 0xed, 0x44, 0xfb, 0x29, 0x97, 0xba, 0x6b },
+   { 0x32, 0x07, 0x6b, 0x61, 0xf4, 0xf2, 0x94, 0x55, 0x2d, 0x7b, 0x6f, 0xad, 0xf5, 0x36, 0x05, 0x79 } },
+ { { 0x41, 0x14, 0x1e, 0x8b, 0x85, 0xef, 0x20, 0xab, 0xb2, 0x63, 0x73, 0x4d, 0xbe, 0x39, 0x59, 0xf6 },
+   { 0x69, 0x81, 0x88, 0xcc, 0x6c, 0x83, 0x72, 0x53, 0xc9, 0xe4, 0xa1, 0x0a, 0x34, 0xc8, 0xc0, 0x59 } },
+ { { 0x94, 0x62, 0xcf, 0xe8, 0x87, 0x6f, 0x57, 0x33, 0x9b, 0xca, 0x25, 0x86, 0xc8, 0x9f, 0x3b, 0xc4 },
+   { 0x60, 0xbb, 0x7a, 0x2a, 0xd2, 0xc4, 0x70, 0xef, 0x4f, 0x6a, 0xb3, 0xd3, 0x2d, 0xd3, 0x7b, 0xa1 } },
+ { { 0x06, 0xeb, 0xf3, 0x30, 0x44, 0xf8, 0xf2, 0xae, 0xbf, 0xa9, 0x71, 0xe2, 0xb2, 0xda, 0x8e, 0xb7 },
+   { 0x94, 0x5c, 0xaf, 0x28, 0x43, 0x4b, 0xd8, 0x85, 0xfb, 0xe9, 0x09, 0xff, 0xe2, 0x9a, 0x20, 0x1f } },
+ { { 0x2b, 0xde, 0xc9, 0xc4, 0xe9, 0x12, 0x1b, 0x56, 0xa1, 0x83, 0x79, 0x86, 0x0f, 0xd9, 0xa1, 0xeb },
+   { 0x9a, 0x25, 0x6c, 0x57, 0xe6, 0x38, 0xc0, 0x51, 0x18, 0xac, 0x1b, 0xb8, 0xbd, 0x8e, 0x7f, 0xa7 } },
+ { { 0xdd, 0x2f, 0x6d, 0x5d, 0x2f, 0x4d, 0xec, 0xb1, 0x19, 0x4c, 0x8f, 0x1d, 0xf8, 0x5f, 0x7e, 0x89 },
+   { 0x11, 0x6f, 0xe5, 0x8b, 0x64, 0x2d, 0x76, 0x20, 0xb3, 0x54, 0xaf, 0xc1, 0xfd, 0xa4, 0x89, 0xd4 } },
+ { { 0x21, 0x82, 0x72, 0x0a, 0xb7, 0x23, 0x9c, 0x21, 0x3f, 0x13, 0x00, 0xbf, 0x13, 0xc6, 0x87, 0x7d },
+   { 0xc8, 0x63, 0x64, 0xaa, 0xde, 0xd0, 0xbf, 0x3f, 0x94, 0xdd, 0xb7, 0xce, 0x09, 0x6b, 0x81, 0xaf } },
+ { { 0xdb, 0xe8, 0x57, 0x07, 0x58, 0x6a, 0xf9, 0x48, 0x47, 0x7b, 0x43, 0xfa, 0x95, 0xdf, 0xf2, 0x52 },
+   { 0xb3, 0xf4, 0x75, 0x16, 0xf9, 0xdd, 0x11, 0x41, 0x17, 0x07, 0x7a, 0xe9, 0x5b, 0x8a, 0x11, 0x04 } },
+ { { 0x8b, 0xe1, 0xfd, 0xf8, 0x7d, 0x0a, 0x24, 0xb6, 0xce, 0xf9, 0x92, 0xbb, 0xb6, 0x00, 0xae, 0x50 },
+   { 0xdc, 0x90, 0xe4, 0xa0, 0x67, 0x0c, 0xb0, 0xa7, 0x08, 0x64, 0xfc, 0x0e, 0xe6, 0x2a, 0x80, 0xd5 } },
+ { { 0xa8, 0xd7, 0xbb, 0x55, 0x4e, 0x04, 0x29, 0x3c, 0xe2, 0x5b, 0xf4, 0xa9, 0xaf, 0x13, 0x1a, 0xf0 },
+   { 0xca, 0xd1, 0x0b, 0x49, 0x03, 0xb1, 0x36, 0xd5, 0x41, 0xa6, 0x17, 0xea, 0x4e, 0x7d, 0xf9, 0x80 } },
+ { { 0xdc, 0x78, 0xcb, 0x10, 0x46, 0x61, 0x98, 0x85, 0xd9, 0xec, 0xf9, 0x4d, 0x87, 0xa1, 0xf1, 0xcb },
+   { 0x9b, 0xc1, 0x3b, 0x3f, 0x61, 0x1a, 0xe7, 0xc1, 0x26, 0x03, 0x56, 0xbe, 0xb6, 0xeb, 0x3d, 0xf0 } },
+ { { 0x3c, 0x4c, 0x3b, 0xa7, 0x9b, 0x74, 0x4b, 0xf9, 0x3e, 0x3b, 0x96, 0xb1, 0x63, 0x9c, 0x6c, 0x02 },
+   { 0xa5, 0x7d, 0x43, 0x3e, 0x16, 0x04, 0xe2, 0xfd, 0x95, 0x9c, 0x30, 0xf4, 0xea, 0x96, 0x40, 0xe1 } },
+ { { 0x19, 0x72, 0xea, 0xe8, 0x90, 0xb2, 0x8b, 0xa7, 0xf8, 0x58, 0x55, 0x69, 0x4b, 0xf4, 0xdc, 0x44 },
+   { 0x5d, 0x84, 0xd3, 0xcd, 0x38, 0x7a, 0x13, 0x96, 0x5e, 0xb1, 0x4c, 0x4e, 0x93, 0x11, 0xd0, 0x01 } },
+ { { 0xec, 0xd3, 0xe3, 0xdf, 0xae, 0x9c, 0x20, 0x77, 0xe7, 0x06, 0x74, 0xd5, 0x3e, 0x85, 0xd1, 0x30 },
+   { 0xb1, 0xf4, 0xd4, 0xa4, 0xd7, 0x85, 0x12, 0xc4, 0xf1, 0x14, 0x6d, 0x40, 0xda, 0xe7, 0x79, 0x1c } },
+ { { 0x40, 0x5f, 0x2f, 0x3d, 0x14, 0x21, 0x27, 0x24, 0x4a, 0xb1, 0xf1, 0x78, 0xf2, 0x48, 0xa7, 0x4f },
+   { 0xad, 0x91, 0xaa, 0xf4, 0x09, 0x5a, 0x4f, 0xc2, 0x5e, 0x5e, 0x6b, 0x62, 0x4e, 0x34, 0x05, 0x8c } },
+ { { 0xdb, 0xdb, 0xdb, 0x76, 0x15, 0x79, 0x39, 0xb6, 0x9a, 0xe8, 0xb1, 0x26, 0x28, 0xbe, 0x7f, 0x5d },
+   { 0xe8, 0x6b, 0xaf, 0xc6, 0x4b, 0x19, 0x40, 0x15, 0x2f, 0xc4, 0x87, 0xbd, 0xc0, 0x02, 0xae, 0x8d } },
+ { { 0xfe, 0xb7, 0x33, 0xf9, 0xd9, 0xc7, 0x18, 0xcf, 0x80, 0xe1, 0xed, 0x53, 0x1e, 0x37, 0x1e, 0x65 },
+   { 0x70, 0xc8, 0x6e, 0x30, 0xa9, 0x95, 0x4c, 0xf3, 0xdb, 0x77, 0xae, 0x56, 0xf9, 0x2f, 0x51, 0x07 } },
+ { { 0xd5, 0xb6, 0xb2, 0x87, 0x74, 0xef, 0x69, 0xbd, 0x12, 0x65, 0x1e, 0x89, 0x2e, 0xf3, 0xf9, 0x08 },
+   { 0x92, 0x9a, 0x64, 0x71, 0x3a, 0x5e, 0x2b, 0x32, 0xa6, 0xf2, 0x0f, 0x53, 0xca, 0xa7, 0x8d, 0x15 } },
+ { { 0x98, 0x37, 0xa4, 0xe5, 0xf2, 0xac, 0xa7, 0xc6, 0x36, 0x65, 0xdb, 0xf0, 0x6e, 0x25, 0x05, 0xdf },
+   { 0xee, 0xdd, 0xd5, 0x60, 0xdb, 0x21, 0xfd, 0x9a, 0xf9, 0xff, 0x94, 0x40, 0xf9, 0x66, 0x7c, 0x94 } },
+ { { 0x57, 0x1c, 0x60, 0x25, 0x95, 0x5e, 0x29, 0x44, 0x45, 0xd0, 0x8f, 0x47, 0xe6, 0x70, 0x75, 0xcd },
+   { 0x27, 0x82, 0x9a, 0x23, 0x7e, 0x4f, 0x57, 0xeb, 0x01, 0x48, 0xae, 0x42, 0xa3, 0xfc, 0x5f, 0xd8 } },
+ { { 0xfe, 0xdb, 0x3b, 0x4d, 0xf2, 0xb3, 0xb9, 0x7c, 0x55, 0x41, 0x39, 0xd2, 0x3a, 0xe7, 0xf0, 0x99 },
+   { 0x45, 0xae, 0x11, 0x83, 0xf0, 0x61, 0xfa, 0x84, 0x3e, 0xed, 0xd7, 0xa8, 0x5b, 0x71, 0x3f, 0xe7 } },
+ { { 0x9b, 0x57, 0x4f, 0xd3, 0xe0, 0x45, 0x02, 0x97, 0xab, 0x6d, 0x34, 0xf4, 0x38, 0x41, 0x61, 0x24 },
+   { 0x8f, 0xfc, 0xd1, 0x8e, 0x86, 0x9f, 0xef, 0x22, 0x16, 0x0e, 0x2f, 0x4c, 0xa2, 0xf0, 0xee, 0x70 } },
+ { { 0x5f, 0x24, 0x71, 0x2f, 0x83, 0xb3, 0x7f, 0x2b, 0x62, 0x25, 0xa6, 0x59, 0x44, 0xc5, 0x0d, 0xf3 },
+   { 0xc8, 0x2e, 0x17, 0x03, 0x80, 0x13, 0x13, 0x8d, 0x5e, 0x0c, 0x28, 0xf5, 0x4d, 0x09, 0x1e, 0xc7 } },
+ { { 0x26, 0xce, 0x9d, 0xdc, 0xab, 0x9e, 0xdb, 0x49, 0x5f, 0x4e, 0x7c, 0xd4, 0x1c, 0x7e, 0x47, 0x89 },
+   { 0x8e, 0xd5, 0xa6, 0x6b, 0xe0, 0xc4, 0x1c, 0x16, 0x91, 0xa8, 0x66, 0xc2, 0xd8, 0x1c, 0x4a, 0x19 } },
+ { { 0x9a, 0x72, 0xfd, 0x8d, 0xcc, 0x76, 0x11, 0xfb, 0x13, 0x97, 0x40, 0x01, 0x8f, 0xd9, 0x00, 0x14 },
+   { 0x28, 0xca, 0xe9, 0x02, 0x17, 0x49, 0x22, 0x0b, 0x32, 0xf2, 0x2f, 0xc0, 0x76, 0xa0, 0xbb, 0x31 } },
+ { { 0x5b, 0xe2, 0x58, 0xe5, 0x98, 0x47, 0x3a, 0x2b, 0x05, 0x18, 0x21, 0x49, 0x6f, 0x90, 0xfe, 0xe0 },
+   { 0xab, 0x4b, 0xda, 0x12, 0x26, 0x43, 0x79, 0x0d, 0xba, 0xeb, 0xea, 0x16, 0x60, 0x03, 0x52, 0xb0 } },
+ { { 0xd0, 0x23, 0xbc, 0xe5, 0x14, 0x33, 0xc2, 0xa2, 0x4e, 0x34, 0x81, 0x46, 0xd1, 0x1c, 0x8c, 0xdc },
+   { 0xdb, 0x5d, 0x5a, 0x9d, 0x16, 0x69, 0xf4, 0xae, 0x16, 0xf0, 0x43, 0x47, 0xec, 0x99, 0x92, 0xf9 } },
+ { { 0x7c, 0x5e, 0x52, 0x4c, 0x8e, 0xb6, 0x41, 0x4d, 0x37, 0xee, 0x9c, 0xd3, 0x33, 0x54, 0x1d, 0xbc },
+   { 0xdb, 0x8b, 0x31, 0x2c, 0xb9, 0xbd, 0x6f, 0xb8, 0x2c, 0x47, 0xa6, 0x88, 0xe0, 0xea, 0x9c, 0xc3 } },
+ { { 0x1c, 0x45, 0x6a, 0xdf, 0xab, 0x7e, 0x37, 0xd8, 0xd2, 0xaf, 0x75, 0x8d, 0x55, 0x93, 0xa7, 0x18 },
+   { 0x94, 0x15, 0xc3, 0x90, 0x24, 0x1a, 0x2a, 0x11, 0x0e, 0x6a, 0x67, 0x9f, 0x78, 0x47, 0xc9, 0x3b } },
+ { { 0x25, 0xef, 0xc1, 0xfd, 0xee, 0x58, 0x73, 0x5a, 0x3f, 0x6b, 0x7c, 0xf8, 0xb3, 0x18, 0x92, 0x83 },
+   { 0xcf, 0xbc, 0xa6, 0x42, 0xad, 0x5f, 0x43, 0xc4, 0x15, 0x68, 0x36, 0x98, 0x14, 0xb3, 0x6e, 0x35 } },
+ { { 0x57, 0x29, 0x61, 0x33, 0xbb, 0x0a, 0x1e, 0x11, 0x0f, 0x1a, 0x09, 0x4e, 0xa5, 0xb0, 0xf9, 0x27 },
+   { 0xf6, 0xcb, 0x1f, 0x22, 0x74, 0x11, 0x19, 0xc6, 0x8f, 0x4d, 0x85, 0x98, 0x41, 0x16, 0xee, 0x36 } },
+ { { 0x8a, 0x74, 0xe6, 0xd8, 0x4c, 0xbf, 0x28, 0xb2, 0xaa, 0xb7, 0x5b, 0xdd, 0xd7, 0xe0, 0x0f, 0x6c },
+   { 0x50, 0x0e, 0xf8, 0x59, 0x1e, 0x57, 0x7b, 0x37, 0x8b, 0x59, 0x96, 0xb5, 0xae, 0xa1, 0xbd, 0x44 } },
+ { { 0x87, 0x6b, 0x6e, 0xb4, 0xa5, 0x26, 0x39, 0xd0, 0x77, 0x78, 0xdc, 0x89, 0x3a, 0xa0, 0x6f, 0x24 },
+   { 0xee, 0x0f, 0x9e, 0xe5, 0x0d, 0x88, 0x16, 0x6b, 0x48, 0xed, 0x3b, 0x73, 0x34, 0x69, 0x7d, 0x1d } },
+ { { 0x5e, 0xd6, 0x30, 0xa7, 0x23, 0xc3, 0x57, 0xa5, 0x63, 0xf0, 0x7a, 0x0f, 0xf5, 0x67, 0xc8, 0x0f },
+   { 0x7d, 0x70, 0xdf, 0xd3, 0xde, 0x9c, 0x20, 0x90, 0xe7, 0xa1, 0x9a, 0x92, 0xc5, 0xa3, 0xd5, 0x5b } },
+ { { 0x03, 0x52, 0xac, 0x67, 0x9e, 0xea, 0xba, 0xa5, 0xe3, 0xe5, 0xba, 0x12, 0xe0, 0xd3, 0xb9, 0x57 },
+   { 0xb9, 0xf0, 0x49, 0x25, 0x6e, 0xcb, 0x67, 0xfd, 0xf9, 0x05, 0x1c, 0x48, 0x4d, 0x0b, 0xe6, 0xc0 } },
+ { { 0xf6, 0x61, 0xb9, 0x93, 0xf4, 0x84, 0x73, 0x52, 0x5b, 0x5b, 0x46, 0x2a, 0xd2, 0x97, 0x45, 0x23 },
+   { 0xee, 0xf4, 0x7a, 0xd2, 0xf2, 0x2f, 0xf5, 0x09, 0x48, 0xf5, 0xab, 0xdf, 0xbf, 0x37, 0x30, 0xac } },
+ { { 0xda, 0xd8, 0x84, 0xba, 0x39, 0x9c, 0xaf, 0xcb, 0x70, 0x7d, 0xfd, 0xc7, 0xab, 0x4b, 0x68, 0x74 },
+   { 0x38, 0x21, 0x12, 0x78, 0xa5, 0xa6, 0x2f, 0xcd, 0xf9, 0x0d, 0xe0, 0xb9, 0x21, 0x07, 0x39, 0xfa } },
+ { { 0xf8, 0x42, 0x65, 0x14, 0x89, 0x0e, 0x6f, 0x6c, 0x6a, 0x1c, 0xf6, 0x06, 0x5f, 0xfa, 0xe6, 0x9d },
+   { 0xd7, 0x35, 0x45, 0xcf, 0x80, 0xba, 0x2f, 0x2f, 0x68, 0x30, 0x7a, 0x48, 0x57, 0x06, 0x07, 0xaa } }
+};
+
 template<typename Cipher>
 void Diffie_Hellman<Cipher>::Elliptic_Curve_Point::operator*=(const Coordinate & b)
 {
-    // Finding last '1' bit of b
-    static const unsigned int bits_in_digit = sizeof(typename Coordinate::Digit) * 8;
+    // Width-w NAF: digits are 0 or odd, below 2^(w-1) in magnitude, and any w consecutive ones have at most one not 0
+    bool k[BITS + NAF_WIDTH + 1];
+    bits(k, b);
+    for(unsigned int i = BITS; i < BITS + NAF_WIDTH + 1; i++)
+        k[i] = false;
+
+    int naf[BITS + 1];
+    for(unsigned int i = 0; i <= BITS; i++) {
+        naf[i] = 0;
+        if(!k[i])
+            continue;
+
+        int d = 0;
+        for(unsigned int j = 0; j < NAF_WIDTH; j++) {
+            d |= k[i + j] << j;
+            k[i + j] = false;
+        }
+        if(d >= (1 << (NAF_WIDTH - 1))) {
+            // k += 2^(i+w), to subtract d - 2^w
+            d -= 1 << NAF_WIDTH;
+            unsigned int j = i + NAF_WIDTH;
+            for(; k[j]; j++)
+                k[j] = false;
+            k[j] = true;
+        }
+        naf[i] = d;
+    }
+
+    // P, 3P, 5P, 7P, ...
+    Elliptic_Curve_Point odd[1 << (NAF_WIDTH - 2)];
+    odd[0] = *this;
+    Elliptic_Curve_Point twice(*this);
+    twice.jacobian_double();
+    for(unsigned int i = 1; i < sizeof(odd) / sizeof(Elliptic_Curve_Point); i++) {
+        odd[i] = odd[i - 1];
+        odd[i].add_jacobian(twice);
+    }
 
-    typename Coordinate::Digit now;
-    unsigned int b_len = sizeof(Coordinate) / sizeof(typename Coordinate::Digit);
-    for(; (b_len > 1) && (b[b_len - 1] == 0); b_len--);
-    if((b_len == 0) || (b[b_len - 1] == 0)) {
+    bool infinity = true;
+    for(int i = BITS; i >= 0; i--) {
+        if(!infinity)
+            jacobian_double();
+        if(naf[i]) {
+            Elliptic_Curve_Point p(odd[((naf[i] > 0) ? naf[i] : -naf[i]) / 2]);
+            if(naf[i] < 0)
+                p.negate();
+            if(infinity) {
+                *this = p;
+                infinity = false;
+            } else
+                add_jacobian(p);
+        }
+    }
+
+    if(infinity) {
         x = 0;
         y = 0;
         z = 0;
         return;
     }
 
-    now = b[b_len - 1];
-
-    bool bin[bits_in_digit]; // Binary representation of 'now'
-    unsigned int current_bit = bits_in_digit;
+    normalize();
+}
 
-    Elliptic_Curve_Point pp(*this);
+template<typename Cipher>
+void Diffie_Hellman<Cipher>::Elliptic_Curve_Point::comb(const Coordinate & b)
+{
+    bool k[COMB_TEETH * COMB_COLUMNS];
+    bits(k, b);
+    for(unsigned int i = BITS; i < COMB_TEETH * COMB_COLUMNS; i++)
+        k[i] = false;
+
+    // Column c adds the table entry of bits c, c + COMB_COLUMNS, c + 2 * COMB_COLUMNS, ... of b
+    bool infinity = true;
+    for(int c = COMB_COLUMNS - 1; c >= 0; c--) {
+        if(!infinity)
+            jacobian_double();
 
-    for(int i = bits_in_digit - 1; i >= 0; i--) {
-        if(now % 2)
-            current_bit = i + 1;
-        bin[i] = now % 2;
-        now /= 2;
+        unsigned int j = 0;
+        for(unsigned int t = 0; t < COMB_TEETH; t++)
+            j |= k[t * COMB_COLUMNS + c] << t;
+        if(j) {
+            Elliptic_Curve_Point p(Coordinate(_comb[j - 1][0], SECRET_SIZE), Coordinate(_comb[j - 1][1], SECRET_SIZE), Coordinate(1));
+            if(infinity) {
+                *this = p;
+                infinity = false;
+            } else
+                add_jacobian_affine(p);
+        }
     }
 
-    for(int i = b_len - 1; i >= 0; i--) {
-        for(; current_bit < bits_in_digit; current_bit++) {
-            jacobian_double();
-            if(bin[current_bit])
-                add_jacobian_affine(pp);
-        }
-        if(i > 0) {
-            now = b[i-1];
-            for(int j = bits_in_digit-1; j >= 0; j--) {
-                bin[j] = now % 2;
-                now /= 2;
-            }
-            current_bit = 0;
-        }
+    if(infinity) {
+        x = 0;
+        y = 0;
+        z = 0;
+        return;
     }
 
-    Coordinate Z;
-    z.invert();
-    Z = z;
-    Z *= z;
+    normalize();
+}
+
+// Back to z = 1
+template<typename Cipher>
+void Diffie_Hellman<Cipher>::Elliptic_Curve_Point::normalize()
+{
+    Coordinate Z(z);
+    Z.invert();
+    Coordinate Z2(Z);
+    Z2 *= Z;
 
-    x *= Z;
-    Z *= z;
+    x *= Z2;
+    Z2 *= Z;
 
-    y *= Z;
+    y *= Z2;
     z = 1;
 }
 
+// "dbl-2001-b" (Bernstein and Lange's Explicit-Formulas Database), for a = -3: 3M + 5S
 template<typename Cipher>
 void Diffie_Hellman<Cipher>::Elliptic_Curve_Point::jacobian_double()
 {
-    Coordinate B, C(x), aux(z);
-
-    aux *= z; C -= aux;
-    aux += x; C *= aux;
-    C *= 3;
-
-    z *= y; z *= 2;
-
-    y *= y; B = y;
-
-    y *= x; y *= 4;
-
-    B *= B; B *= 8;
-
-    x = C; x *= x;
-    aux = y; aux *= 2;
+    Coordinate delta(z), gamma(y), beta(x), alpha(x), aux(x);
+
+    delta *= z;
+    gamma *= y;
+    beta *= gamma;
+
+    // alpha = 3 * (x - delta) * (x + delta)
+    alpha -= delta;
+    aux += delta;
+    alpha *= aux;
+    aux = alpha;
+    alpha += aux;
+    alpha += aux;
+
+    // z = (y + z)^2 - gamma - delta
+    z += y;
+    z *= z;
+    z -= gamma;
+    z -= delta;
+
+    // x = alpha^2 - 8 * beta
+    beta += beta;
+    beta += beta;
+    x = alpha;
+    x *= alpha;
+    aux = beta;
+    aux += beta;
     x -= aux;
 
-    y -= x; y *= C;
-    y -= B;
+    // y = alpha * (4 * beta - x) - 8 * gamma^2
+    y = beta;
+    y -= x;
+    y *= alpha;
+    gamma *= gamma;
+    gamma += gamma;
+    gamma += gamma;
+    gamma += gamma;
+    y -= gamma;
 }
 
+// "add-2007-bl": 11M + 5S
 template<typename Cipher>
-void Diffie_Hellman<Cipher>::Elliptic_Curve_Point::add_jacobian_affine(const Elliptic_Curve_Point &b)
+void Diffie_Hellman<Cipher>::Elliptic_Curve_Point::add_jacobian(const Elliptic_Curve_Point &b)
 {
-    Coordinate A(z), B, C, X, Y, aux, aux2;
-
-    A *= z;
-
-    B = A;
-
-    A *= b.x;
-
-    B *= z; B *= b.y;
-
-    C = A; C -= x;
-
-    B -= y;
-
-    X = B; X *= B;
-    aux = C; aux *= C;
-
-    Y = aux;
-
-    aux2 = aux; aux *= C;
-    aux2 *= 2; aux2 *= x;
-    aux += aux2; X -= aux;
-
-    aux = Y; Y *= x;
-    Y -= X; Y *= B;
-    aux *= y; aux *= C;
-    Y -= aux;
-
-    z *= C;
+    Coordinate z1z1(z), z2z2(b.z), u1(x), u2(b.x), s1(y), s2(b.y);
+
+    z1z1 *= z;
+    z2z2 *= b.z;
+    u1 *= z2z2;
+    u2 *= z1z1;
+    s1 *= b.z;
+    s1 *= z2z2;
+    s2 *= z;
+    s2 *= z1z1;
+
+    // h = u2 - u1, i = (2 * h)^2, j = h * i, r = 2 * (s2 - s1), v = u1 * i
+    Coordinate h(u2);
+    h -= u1;
+    Coordinate i(h);
+    i += h;
+    i *= i;
+    Coordinate j(h);
+    j *= i;
+    Coordinate r(s2);
+    r -= s1;
+    r += r;
+    Coordinate v(u1);
+    v *= i;
+
+    // z = ((z1 + z2)^2 - z1z1 - z2z2) * h
+    z += b.z;
+    z *= z;
+    z -= z1z1;
+    z -= z2z2;
+    z *= h;
+
+    // x = r^2 - j - 2 * v
+    x = r;
+    x *= r;
+    x -= j;
+    x -= v;
+    x -= v;
+
+    // y = r * (v - x) - 2 * s1 * j
+    y = v;
+    y -= x;
+    y *= r;
+    s1 *= j;
+    y -= s1;
+    y -= s1;
+}
 
-    x = X; y = Y;
+// "madd-2007-bl", b having z = 1: 7M + 4S
+template<typename Cipher>
+void Diffie_Hellman<Cipher>::Elliptic_Curve_Point::add_jacobian_affine(const Elliptic_Curve_Point &b)
+{
+    Coordinate z1z1(z), u2(b.x), s2(b.y);
+
+    z1z1 *= z;
+    u2 *= z1z1;
+    s2 *= z;
+    s2 *= z1z1;
+
+    // h = u2 - x, hh = h^2, i = 4 * hh, j = h * i, r = 2 * (s2 - y), v = x * i
+    Coordinate h(u2);
+    h -= x;
+    Coordinate hh(h);
+    hh *= h;
+    Coordinate i(hh);
+    i += hh;
+    i += i;
+    Coordinate j(h);
+    j *= i;
+    Coordinate r(s2);
+    r -= y;
+    r += r;
+    Coordinate v(x);
+    v *= i;
+
+    // z = (z + h)^2 - z1z1 - hh
+    z += h;
+    z *= z;
+    z -= z1z1;
+    z -= hh;
+
+    // x = r^2 - j - 2 * v
+    x = r;
+    x *= r;
+    x -= j;
+    x -= v;
+    x -= v;
+
+    // y = r * (v - x) - 2 * y1 * j
+    Coordinate y1(y);
+    y = v;
+    y -= x;
+    y *= r;
+    y1 *= j;
+    y -= y1;
+    y -= y1;
 }
@@ -90,6 +90,11 @@ public:
         return os;
     }
 
+    friend Debug & operator<<(Debug & db, const Point<T, 2> & c) {
+        db << "{" << static_cast<Print_Type>(c.x) << "," << static_cast<Print_Type>(c.y) << "}";
+        return db;
+    }
+
     T x, y;
 }__attribute__((packed));
 
@@ -179,6 +184,11 @@ public:
         return os;
     }
 
+    friend Debug & operator<<(Debug & db, const Point & c) {
+        db << "(" << static_cast<Print_Type>(c.x) << "," << static_cast<Print_Type>(c.y) << "," << static_cast<Print_Type>(c.z) << ")";
+        return db;
+    }
+
     T x, y, z;
 }__attribute__((packed));
 
@@ -203,6 +213,11 @@ public:
         return os;
     }
 
+    friend Debug & operator<<(Debug & db, const Sphere & s) {
+        db << "{" << "c=" << s.center << ",r=" << static_cast<Print_Type>(s.radius) << "}";
+        return db;
+    }
+
     Center center;
     Radius radius;
 }__attribute__((packed));
@@ -0,0 +1,66 @@
+#pragma once
+
+// EPOS Hash Table Utility Declarations
+
+#include <utility/list.h>
+
+// Objects ranked by an unsigned key (typically a digest of a larger identifier, see key()), spread over SIZE
+// (a power of 2) buckets by a Fibonacci hash of it. Buckets are doubly-linked and ordered by key, so synonyms are
+// contiguous: search() returns the first one, and callers walk next() while rank() matches, comparing whatever the
+// key stands for. Insertion and removal are O(1) plus the bucket. Not synchronized: callers must serialize access.
+template<typename T, unsigned int SIZE>
+class Hash
+{
+public:
+    typedef unsigned int Key;
+    typedef Ordered_List<T, Key> Bucket;
+    typedef typename Bucket::Element Element;
+
+private:
+    static_assert(SIZE && !(SIZE & (SIZE - 1)), "Hash size must be a power of 2");
+
+public:
+    Hash(): _size(0) {}
+
+    bool empty() const { return !_size; }
+    unsigned int size() const { return _size; }
+
+    // The key of the element must not change while it is in the table
+    void insert(Element * e) {
+        bucket(e->rank())->insert(e);
+        _size++;
+    }
+
+    Element * remove(Element * e) {
+        bucket(e->rank())->remove(e);
+        _size--;
+        return e;
+    }
+
+    // The first element with key k, or 0
+    Element * search(const Key & k) {
+        for(Element * e = bucket(k)->head(); e && (e->rank() <= k); e = e->next())
+            if(e->rank() == k)
+                return e;
+        return 0;
+    }
+
+    // FNV-1a digest of an identifier of size bytes
+    static Key key(const void * id, unsigned int size) {
+        const unsigned char * b = reinterpret_cast<const unsigned char *>(id);
+        Key h = 2166136261U;
+        for(unsigned int i = 0; i < size; i++)
+            h = (h ^ b[i]) * 16777619U;
+        return h;
+    }
+
+private:
+    Bucket * bucket(const Key & k) {
+        unsigned int h = k * 2654435761U;
+        return &_buckets[(h ^ (h >> 16)) & (SIZE - 1)];
+    }
+
+private:
+    unsigned int _size;
+    Bucket _buckets[SIZE];
+};
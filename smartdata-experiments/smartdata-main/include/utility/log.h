@@ -0,0 +1,230 @@
+#pragma once
+
+// EPOS Asynchronous Log Declarations
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <utility/ostream.h>
+
+struct dl_phdr_info;
+
+// Backend of db<> when Traits<Debug>::async is set. Instead of being formatted as they are streamed, items are
+// appended, tagged, to a record staged by the calling thread, which endl (or the next begl, or a full record) moves
+// into the thread's ring. Each ring has a single producer (its thread, or the next one once that exits) and a single
+// consumer (the flusher thread), so neither side locks. The flusher merges the rings by time stamp and replays the
+// items into kerr, so the output is what the synchronous path would have printed; or, if Traits<Debug>::LOG_FILE is
+// set, writes the records there in binary, for decode() (i.e. the smartdata-log tool) to render later.
+// Strings in the read-only segments of the executable (i.e. literals, most of what is logged) are recorded by
+// offset, each defined only once in a binary log; other strings are copied. Records that do not fit in a full ring
+// are dropped (and counted), so producers never wait. Whatever is in the rings at exit, or when the process gets a
+// fatal signal (e.g. SIGSEGV or SIGABRT), is still flushed. Errors and warnings do not come here (see Debug).
+// The fatal signal handlers are installed with the first ring, so only if Traits<Debug>::async is set. They only
+// make async-signal-safe calls: the record staged by the failing thread is committed and the flusher, which also
+// flushes stdout, is given FATAL_FLUSH seconds to finish, polled with nanosleep(). The handlers found then are
+// restored before the signal is raised again, so they still run; handlers an application installs later replace
+// these instead, and the rings are then only flushed at exit.
+class Log
+{
+private:
+    static const unsigned int BUFFER = Traits<Debug>::BUFFER;
+    static const unsigned int RECORD = 256; // bytes of the largest record (longer lines are split)
+    static const unsigned int HEADER = 12; // size (2), thread (2) and time stamp (8)
+    static const unsigned int SEGMENTS = 8;
+    static const unsigned int LITERALS = 1024;
+    static const unsigned int SIGNALS = 5;
+    static const unsigned int FATAL_FLUSH = 1; // s the flusher has to empty the rings on a fatal signal
+
+    static_assert(BUFFER && !(BUFFER & (BUFFER - 1)), "Log buffer size must be a power of 2");
+
+    // Items
+    enum : unsigned char {
+        BEGL,
+        ENDL,
+        HEX,
+        DEC,
+        OCT,
+        BIN,
+        ERROR,
+        CHAR,
+        INT,
+        UNSIGNED,
+        LONG_LONG,
+        UNSIGNED_LONG_LONG,
+        POINTER, // 64 bits, so logs of 32-bit builds can be decoded anywhere
+        FLOAT,
+        LITERAL, // offset from the first read-only segment, 32 bits
+        STRING // size (2), then the characters
+    };
+
+    // Binary log entries
+    enum : unsigned char {
+        DEFINED = 'S', // literal (4), size (2), characters
+        RECORDED = 'R', // record (size first)
+        DROPPED = 'D' // thread (2), records (4)
+    };
+
+    struct Ring
+    {
+        Ring * next;
+        unsigned int thread;
+        volatile bool owned;
+
+        // Producer
+        unsigned int tail;
+        unsigned int size; // of the record being staged
+        unsigned int dropped;
+        unsigned char record[RECORD];
+
+        // Consumer
+        unsigned int head;
+        unsigned int reported;
+        unsigned char data[BUFFER];
+    };
+
+    class Literals;
+
+public:
+    static void put(const OStream::Begl & begl) {
+        Ring * r = ring();
+        if(r->size)
+            commit(r);
+        tag(BEGL);
+    }
+    static void put(const OStream::Endl & endl) {
+        tag(ENDL);
+        commit(_ring);
+    }
+    static void put(const OStream::Hex & hex) { tag(HEX); }
+    static void put(const OStream::Dec & dec) { tag(DEC); }
+    static void put(const OStream::Oct & oct) { tag(OCT); }
+    static void put(const OStream::Bin & bin) { tag(BIN); }
+    static void put(const OStream::Err & err) { tag(ERROR); }
+
+    // The same conversions OStream does, so a value prints the same either way
+    static void put(char c) { item(CHAR, c); }
+    static void put(unsigned char c) { put(static_cast<unsigned int>(c)); }
+    static void put(int i) { item(INT, i); }
+    static void put(short s) { put(static_cast<int>(s)); }
+    static void put(long l) { put(static_cast<int>(l)); }
+    static void put(unsigned int u) { item(UNSIGNED, u); }
+    static void put(unsigned short s) { put(static_cast<unsigned int>(s)); }
+    static void put(unsigned long l) { put(static_cast<unsigned int>(l)); }
+    static void put(long long int i) { item(LONG_LONG, i); }
+    static void put(unsigned long long int u) { item(UNSIGNED_LONG_LONG, u); }
+    static void put(const void * p) { item(POINTER, static_cast<unsigned long long>(reinterpret_cast<unsigned long>(p))); }
+    static void put(const char * s) {
+        ring();
+        if(literal(s))
+            item(LITERAL, static_cast<unsigned int>(s - _segment[0][0]));
+        else
+            string(s);
+    }
+    static void put(float f) { item(FLOAT, f); }
+    static void put(double d) { put(static_cast<float>(d)); }
+
+    // Renders the binary log in into os, optionally prefixing each line with its time stamp and thread, and returns
+    // how many records were in it
+    static unsigned int decode(FILE * in, OStream & os, bool stamped = false);
+
+private:
+    static Ring * ring() {
+        if(!_ring)
+            attach();
+        return _ring;
+    }
+
+    static bool literal(const char * s) {
+        for(unsigned int i = 0; i < _segments; i++)
+            if((s >= _segment[i][0]) && (s < _segment[i][1]))
+                return true;
+        return false;
+    }
+
+    // The ring of the calling thread, with room for n more bytes in its staged record
+    static Ring * reserve(unsigned int n) {
+        Ring * r = ring();
+        if(r->size + n > RECORD)
+            commit(r);
+        if(!r->size) {
+            // As TSC::time_stamp(), whose header includes this one (through cpu.h), at half the cost of clock_gettime()
+            unsigned int low, high;
+            asm volatile("rdtsc" : "=a"(low), "=d"(high));
+            unsigned long long t = (static_cast<unsigned long long>(high) << 32) | low;
+            r->record[2] = r->thread;
+            r->record[3] = r->thread >> 8;
+            memcpy(&r->record[4], &t, sizeof(t));
+            r->size = HEADER;
+        }
+        return r;
+    }
+
+    static void tag(unsigned char t) {
+        Ring * r = reserve(1);
+        r->record[r->size++] = t;
+    }
+
+    template<typename T>
+    static void item(unsigned char t, const T & v) {
+        Ring * r = reserve(1 + sizeof(T));
+        r->record[r->size] = t;
+        memcpy(&r->record[r->size + 1], &v, sizeof(T));
+        r->size += 1 + sizeof(T);
+    }
+
+    static void string(const char * s);
+
+    // Moves the staged record into the ring, if there is room for it
+    static void commit(Ring * r) {
+        unsigned int size = r->size;
+        r->size = 0;
+        if(size <= HEADER)
+            return;
+
+        unsigned int tail = r->tail;
+        if(BUFFER - (tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) < size) {
+            __atomic_store_n(&r->dropped, r->dropped + 1, __ATOMIC_RELAXED);
+            return;
+        }
+
+        r->record[0] = size;
+        r->record[1] = size >> 8;
+        unsigned int i = tail & (BUFFER - 1);
+        unsigned int n = (size < BUFFER - i) ? size : BUFFER - i;
+        memcpy(&r->data[i], r->record, n);
+        memcpy(r->data, &r->record[n], size - n);
+        __atomic_store_n(&r->tail, tail + size, __ATOMIC_RELEASE);
+    }
+
+    static void init();
+    static void attach();
+    static void detach(void * ring);
+    static int segments(struct dl_phdr_info * info, size_t size, void * data);
+
+    static void * flusher(void *);
+    static unsigned int drain();
+    static void finish();
+    static void fatal(int signal);
+
+    static void write(const unsigned char * record, unsigned int size);
+    static void replay(OStream & os, const unsigned char * record, unsigned int size, Literals * literals, bool stamped);
+    static void dropped(OStream & os, unsigned int thread, unsigned int records);
+    static unsigned int length(const unsigned char * item, unsigned int left);
+
+private:
+    static __thread Ring * _ring;
+    static __thread bool _flushing; // the flusher thread (pthread_self() is not async-signal-safe)
+    static Ring * _rings;
+    static unsigned int _threads;
+    static const char * _segment[SEGMENTS][2]; // read-only segments of the executable
+    static unsigned int _segments;
+    static pthread_once_t _once;
+    static pthread_key_t _key;
+    static pthread_t _flusher;
+    static volatile bool _finishing;
+    static volatile bool _flushed; // once the flusher has emptied the rings and stdout after _finishing
+    static FILE * _file;
+    static Literals * _defined;
+    static const int _signal[SIGNALS];
+    static struct sigaction _previous[SIGNALS];
+};
@@ -9,6 +9,7 @@
 // declare them as non-virtual. But it must be clear that this is one of the few uses
 // for them.
 
+#include <pthread.h>
 #include <utility/list.h>
 
 // Observer x Observed
@@ -178,6 +179,9 @@ private:
 template<typename D, typename C = void>
 class Data_Observer;
 
+template<typename D, typename C, unsigned int SIZE>
+class Hashed_Data_Observed;
+
 template<typename D, typename C = void>
 class Data_Observed
 {
@@ -252,6 +256,7 @@ template<typename D, typename C>
 class Data_Observer
 {
     friend class Data_Observed<D, C>;
+    template<typename, typename, unsigned int> friend class Hashed_Data_Observed;
 
 public:
     typedef D Observed_Data;
@@ -273,6 +278,94 @@ private:
     typename Data_Observed<D, C>::Element _link;
 };
 
+// (Conditional) Observer x (Conditionally) Observed with Data, indexed by condition
+// Observers are spread over SIZE (a power of 2) buckets by a hash of their condition, so notify() only
+// walks those that share a bucket with the notified condition instead of every attached observer.
+// C must convert to an unsigned integer. Observers may attach and detach while others are notified from other
+// threads: notify() and observer() hold the buckets for reading, attach() and detach() for writing, so an observer
+// must not attach or detach from its own update().
+template<typename D, typename C, unsigned int SIZE>
+class Hashed_Data_Observed: public Data_Observed<D, C>
+{
+private:
+    typedef Data_Observer<D, C> _Observer;
+    typedef Simple_Ordered_List<Data_Observer<D, C>, C> Bucket;
+    typedef typename Bucket::Element Element;
+
+    static_assert(SIZE && !(SIZE & (SIZE - 1)), "Hashed_Data_Observed size must be a power of 2");
+
+public:
+    Hashed_Data_Observed(): _observers(0) { pthread_rwlock_init(&_lock, 0); }
+    ~Hashed_Data_Observed() { pthread_rwlock_destroy(&_lock); }
+
+    void attach(Data_Observer<D, C> * o, const C & c) {
+        db<Observers>(TRC) << "Hashed_Data_Observed::attach(obs=" << o << ",cond=" << c << ")" << endl;
+
+        pthread_rwlock_wrlock(&_lock);
+        o->_link = Element(o, c);
+        bucket(c)->insert(&o->_link);
+        _observers++;
+        pthread_rwlock_unlock(&_lock);
+    }
+
+    void detach(Data_Observer<D, C> * o, const C & c) {
+        db<Observers>(TRC) << "Hashed_Data_Observed::detach(obs=" << o << ",cond=" << c << ")" << endl;
+
+        pthread_rwlock_wrlock(&_lock);
+        if(bucket(c)->remove(o))
+            _observers--;
+        pthread_rwlock_unlock(&_lock);
+    }
+
+    bool notify(const C & c, D * d) {
+        bool notified = false;
+
+        db<Observers>(TRC) << "Hashed_Data_Observed::notify(this=" << this << ",cond=" << c << ")" << endl;
+
+        // Buckets are ordered by condition, so the matching observers are contiguous
+        pthread_rwlock_rdlock(&_lock);
+        for(Element * e = bucket(c)->head(); e && (e->rank() <= c); e = e->next()) {
+            if(e->rank() == c) {
+                db<Observers>(INF) << "Hashed_Data_Observed::notify(this=" << this << ",obs=" << e->object() << ")" << endl;
+                e->object()->update(this, c, d);
+                notified = true;
+            }
+        }
+        pthread_rwlock_unlock(&_lock);
+
+        return notified;
+    }
+
+    _Observer * observer(const C & c, unsigned int index = 0) {
+        _Observer * o = 0;
+        pthread_rwlock_rdlock(&_lock);
+        for(Element * e = bucket(c)->head(); e && (e->rank() <= c); e = e->next())
+            if(e->rank() == c) {
+                if(!index) {
+                    o = e->object();
+                    break;
+                }
+                index--;
+            }
+        pthread_rwlock_unlock(&_lock);
+        return o;
+    }
+
+    unsigned int observers() const { return _observers; }
+
+private:
+    // Fibonacci hashing spreads the low-entropy bit fields of units over the buckets
+    Bucket * bucket(const C & c) {
+        unsigned int h = static_cast<unsigned int>(c) * 2654435761U;
+        return &_buckets[(h ^ (h >> 16)) & (SIZE - 1)];
+    }
+
+private:
+    unsigned int _observers;
+    Bucket _buckets[SIZE];
+    pthread_rwlock_t _lock;
+};
+
 
 // (Unconditional) Observer x (Unconditionally) Observed with Data
 template<typename D>
@@ -0,0 +1,163 @@
+#pragma once
+
+// EPOS Loose Octree Utility Declarations
+
+#include <utility/list.h>
+
+// Spatial index of spherical regions (e.g. SmartData::Region), answering which regions contain a point.
+// Space is the cube of 32-bit coordinates, halved along each axis at every level, down to 1 unit cells
+// at level 32. Each region goes to the deepest level whose cells are at least as large as its diameter,
+// into the cell holding its center. Cells are "loose": they take regions that spill over their borders
+// by up to half a cell, so no region is stuck near the root for crossing a border. A region containing
+// a point then has its center within half a cell of it, which narrows the search to 2x2x2 cells in each
+// occupied level. Cells are not materialized: elements are chained in hash buckets by (level, cell).
+// Insertion and removal are O(1); search() costs 8 bucket probes per occupied level plus the candidates.
+// R must provide center, radius and contains(center, time). Not synchronized: callers must serialize access.
+template<typename T, typename R, unsigned int BUCKETS = 256>
+class Loose_Octree
+{
+public:
+    static const unsigned int LEVELS = 33;
+
+    typedef typename R::Center Center;
+
+    class Element;
+    typedef List<T, Element> Bucket;
+
+    class Element
+    {
+        friend class Loose_Octree;
+
+    public:
+        typedef T Object_Type;
+
+    public:
+        Element(const T * o, const R * r): _object(o), _region(r), _prev(0), _next(0), _bucket(0) {}
+
+        T * object() const { return const_cast<T *>(_object); }
+        const R & region() const { return *_region; }
+
+        Element * prev() const { return _prev; }
+        Element * next() const { return _next; }
+        void prev(Element * e) { _prev = e; }
+        void next(Element * e) { _next = e; }
+
+        bool linked() const { return _bucket; }
+
+    private:
+        const T * _object;
+        const R * _region;
+        Element * _prev;
+        Element * _next;
+        Bucket * _bucket;
+        unsigned int _level;
+        unsigned int _x, _y, _z;
+    };
+
+private:
+    typedef unsigned long long Coordinate;
+
+    static const Coordinate ORIGIN = 1ULL << 31;
+    static const Coordinate MAX = (1ULL << 32) - 1;
+
+    static_assert(BUCKETS && !(BUCKETS & (BUCKETS - 1)), "Loose_Octree buckets must be a power of 2");
+
+public:
+    Loose_Octree(): _size(0), _levels(0) {
+        for(unsigned int l = 0; l < LEVELS; l++)
+            _count[l] = 0;
+    }
+
+    bool empty() const { return !_size; }
+    unsigned int size() const { return _size; }
+
+    // The region must not change while the element is in the tree
+    void insert(Element * e) {
+        const R & r = *e->_region;
+        Coordinate d = 2 * static_cast<Coordinate>(r.radius);
+        unsigned int l = LEVELS - 1;
+        while(l && ((1ULL << (LEVELS - 1 - l)) < d))
+            l--;
+
+        unsigned int shift = LEVELS - 1 - l;
+        e->_level = l;
+        e->_x = coordinate(r.center.x) >> shift;
+        e->_y = coordinate(r.center.y) >> shift;
+        e->_z = coordinate(r.center.z) >> shift;
+        e->_bucket = bucket(l, e->_x, e->_y, e->_z);
+        e->_bucket->insert(e);
+
+        _count[l]++;
+        _levels |= 1ULL << l;
+        _size++;
+    }
+
+    Element * remove(Element * e) {
+        e->_bucket->remove(e);
+        e->_bucket = 0;
+        if(!--_count[e->_level])
+            _levels &= ~(1ULL << e->_level);
+        _size--;
+        return e;
+    }
+
+    // Calls f(object) for each region that contains point c at time t and returns how many did.
+    // f may not change the tree.
+    template<typename Time, typename F>
+    unsigned int search(const Center & c, const Time & t, F f) {
+        Coordinate p[3] = { coordinate(c.x), coordinate(c.y), coordinate(c.z) };
+        unsigned int found = 0;
+
+        for(unsigned long long levels = _levels; levels; levels &= levels - 1) {
+            unsigned int l = __builtin_ctzll(levels);
+            unsigned int shift = LEVELS - 1 - l;
+            Coordinate half = (1ULL << shift) / 2;
+
+            unsigned int lo[3], hi[3];
+            for(unsigned int i = 0; i < 3; i++) {
+                lo[i] = ((p[i] > half) ? p[i] - half : 0) >> shift;
+                hi[i] = ((p[i] + half < MAX) ? p[i] + half : MAX) >> shift;
+            }
+
+            for(unsigned int x = lo[0]; x <= hi[0]; x++)
+                for(unsigned int y = lo[1]; y <= hi[1]; y++)
+                    for(unsigned int z = lo[2]; z <= hi[2]; z++)
+                        for(Element * e = bucket(l, x, y, z)->head(); e; e = e->next())
+                            if((e->_level == l) && (e->_x == x) && (e->_y == y) && (e->_z == z) && boxed(c, *e->_region) && e->_region->contains(c, t)) {
+                                f(e->object());
+                                found++;
+                            }
+        }
+
+        return found;
+    }
+
+private:
+    // Bounding box test, to spare the distance computation of most candidates that are not hits
+    static bool boxed(const Center & c, const R & r) {
+        long long d = r.radius;
+        return (c.x - static_cast<long long>(r.center.x) <= d) && (static_cast<long long>(r.center.x) - c.x <= d)
+            && (c.y - static_cast<long long>(r.center.y) <= d) && (static_cast<long long>(r.center.y) - c.y <= d)
+            && (c.z - static_cast<long long>(r.center.z) <= d) && (static_cast<long long>(r.center.z) - c.z <= d);
+    }
+
+    static Coordinate coordinate(long long n) {
+        n += ORIGIN;
+        return (n < 0) ? 0 : (static_cast<Coordinate>(n) > MAX) ? MAX : n;
+    }
+
+    Bucket * bucket(unsigned int l, unsigned int x, unsigned int y, unsigned int z) {
+        unsigned int h = l;
+        h = h * 0x9e3779b1U + x;
+        h = h * 0x9e3779b1U + y;
+        h = h * 0x9e3779b1U + z;
+        h *= 0x9e3779b1U;
+        return &_buckets[(h ^ (h >> 16)) & (BUCKETS - 1)];
+    }
+
+private:
+    unsigned int _size;
+    unsigned long long _levels;
+    unsigned int _count[LEVELS];
+    Bucket _buckets[BUCKETS];
+};
@@ -2,64 +2,311 @@
 
 // EPOS Poly1305-AES Message Authentication Code Component Declarations
 
-#include <utility/bignum.h>
 #include <utility/math.h>
 
+// MACs are (c_1 * r^q + c_2 * r^(q-1) + ... + c_q * r^1) % (2^130 - 5) + AES_k(nonce), modulo 2^128.
+// Numbers modulo 2^130 - 5 are kept in three limbs of 44, 44 and 42 bits, whose products are summed in 128 bits,
+// where the compiler has unsigned __int128 (as for Montgomery Bignums); elsewhere (e.g. 32-bit builds), in five
+// 26-bit limbs, whose products are summed in 64 bits. r, r^2, r^3 and r^4 are computed once per key, so four blocks
+// at a time are multiplied by independent powers and reduced together, instead of going through a chain of four
+// multiplications.
+// AES_k(nonce) (the mask) depends only on the nonce, so messages sharing it (e.g. from the same peer within a
+// time window) can be verified in a batch, encrypting the nonce only once. If k is given already expanded by a
+// cipher, that cipher encrypts the masks with it; otherwise, k is expanded for each mask.
 template<typename Cipher>
 class Poly1305
 {
-    typedef _UTIL::Bignum<17> Bignum;
+private:
+#ifdef __SIZEOF_INT128__
+    static const unsigned int LIMBS = 3;
+    static const unsigned long long MASK = 0xfffffffffffULL; // 44 bits
+    static const unsigned long long MASK_TOP = 0x3ffffffffffULL; // 42 bits
+
+    typedef unsigned long long Element[LIMBS];
+    typedef unsigned __int128 Product[LIMBS];
+#else
+    static const unsigned int LIMBS = 5;
+    static const unsigned int MASK = 0x3ffffff;
+
+    typedef unsigned int Element[LIMBS];
+    typedef unsigned long long Product[LIMBS];
+#endif
 
 public:
-    Poly1305(const unsigned char k[16], const unsigned char r[16]) : _k(k, 16), _r(r, 16) {
-        clamp();
+    static const unsigned int BLOCK_SIZE = 16;
+
+public:
+    Poly1305(const unsigned char k1[16], const unsigned char r1[16], Cipher * cipher = 0): _cipher(cipher), _schedule(0) {
+        k(k1);
+        r(r1);
+    }
+    Poly1305(const typename Cipher::Schedule & k1, const unsigned char r1[16], Cipher & cipher): _cipher(&cipher), _schedule(&k1) {
+        r(r1);
     }
-    Poly1305() {}
+    Poly1305(): _cipher(0), _schedule(0) {}
 
     void stamp(unsigned char out[16], const unsigned char nonce[16], const unsigned char * message, int message_len) {
-        // cr = (c_1 * r^q + c_2 * r^(q-1) + ... + c_q * r^1) % (2^130 - 5)
-        Bignum cr(0);
-        for(; message_len > 0; message_len -= 16, message += 16) {
-            int len = Math::min(16, message_len);
-            Bignum c(message, len);
-            reinterpret_cast<unsigned char *>(c._data)[len] = 1;
-
-            cr += c;
-            cr *= _r;
+        unsigned char s[16];
+        mask(s, nonce);
+        tag(out, s, message, message_len);
+    }
+
+    bool verify(const unsigned char mac[16], const unsigned char nonce[16], const unsigned char * message, unsigned int message_len) {
+        unsigned char s[16];
+        mask(s, nonce);
+        return check(mac, s, message, message_len);
+    }
+
+    // Verifies n messages of message_len bytes with the same nonce, setting valid[i] for each, and returns how many are authentic
+    unsigned int verify(unsigned int n, const unsigned char * const macs[], const unsigned char nonce[16], const unsigned char * const messages[], unsigned int message_len, bool valid[]) {
+        unsigned char s[16];
+        mask(s, nonce);
+
+        unsigned int authentic = 0;
+        for(unsigned int i = 0; i < n; i++) {
+            valid[i] = check(macs[i], s, messages[i], message_len);
+            authentic += valid[i];
+        }
+        return authentic;
+    }
+
+    // AES_k(nonce)
+    void mask(unsigned char s[16], const unsigned char nonce[16]) {
+        if(_schedule)
+            _cipher->encrypt(nonce, *_schedule, s);
+        else if(_cipher)
+            _cipher->encrypt(nonce, _k, s);
+        else {
+            Cipher cipher;
+            cipher.encrypt(nonce, _k, s);
         }
+    }
 
-        unsigned char ciphertext[16];
-        Cipher cipher;
-        cipher.encrypt(nonce, reinterpret_cast<const unsigned char *>(_k._data), ciphertext);
+    // MAC of a message given the mask of its nonce
+    void tag(unsigned char out[16], const unsigned char s[16], const unsigned char * message, int message_len) {
+        Element h = { 0 };
+
+        for(; message_len >= int(4 * BLOCK_SIZE); message_len -= 4 * BLOCK_SIZE, message += 4 * BLOCK_SIZE) {
+            // h = (h + c_1) * r^4 + c_2 * r^3 + c_3 * r^2 + c_4 * r
+            Element c;
+            Product d = { 0 };
+            load(c, message, 1);
+            for(unsigned int i = 0; i < LIMBS; i++)
+                c[i] += h[i];
+            accumulate(d, c, 3);
+            for(unsigned int j = 1; j < 4; j++) {
+                load(c, message + j * BLOCK_SIZE, 1);
+                accumulate(d, c, 3 - j);
+            }
+            carry(h, d);
+        }
+
+        for(; message_len > 0; message_len -= BLOCK_SIZE, message += BLOCK_SIZE) {
+            Element c;
+            if(message_len >= int(BLOCK_SIZE))
+                load(c, message, 1);
+            else {
+                unsigned char last[BLOCK_SIZE];
+                for(int i = 0; i < int(BLOCK_SIZE); i++)
+                    last[i] = (i < message_len) ? message[i] : (i == message_len);
+                load(c, last, 0);
+            }
+            for(unsigned int i = 0; i < LIMBS; i++)
+                c[i] += h[i];
+
+            Product d = { 0 };
+            accumulate(d, c, 0);
+            carry(h, d);
+        }
 
-        // out = (cr + aes(k,n)) % 2^128
-        Bignum::simple_add(reinterpret_cast<Bignum::Digit *>(out), reinterpret_cast<const Bignum::Digit *>(ciphertext), cr._data, 4);
+        finish(out, h, s);
     }
 
-    bool verify(const unsigned char mac[16], const unsigned char nonce[16], const unsigned char * message, unsigned int message_len) {
+    // Whether mac is the MAC of message, in time independent of where they differ
+    bool check(const unsigned char mac[16], const unsigned char s[16], const unsigned char * message, unsigned int message_len) {
         unsigned char my_mac[16];
-        stamp(my_mac, nonce, message, message_len);
-        for(int i = 0; i < 16; i++) {
-            if(my_mac[i] != mac[i])
-                return false;
+        tag(my_mac, s, message, message_len);
+
+        unsigned char diff = 0;
+        for(int i = 0; i < 16; i++)
+            diff |= my_mac[i] ^ mac[i];
+        return !diff;
+    }
+
+    void k(const unsigned char k1[16]) {
+        for(unsigned int i = 0; i < 16; i++)
+            _k[i] = k1[i];
+    }
+
+    void r(const unsigned char r1[16]) {
+        // Clamped
+        unsigned char c[16];
+        for(unsigned int i = 0; i < 16; i++)
+            c[i] = r1[i];
+        c[3] &= 15;
+        c[7] &= 15;
+        c[11] &= 15;
+        c[15] &= 15;
+        c[4] &= 252;
+        c[8] &= 252;
+        c[12] &= 252;
+
+        load(_r[0], c, 0);
+        for(unsigned int j = 1; j < 4; j++) {
+            five(j - 1);
+            Product d = { 0 };
+            accumulate(d, _r[j - 1], 0);
+            carry(_r[j], d);
         }
-        return true;
+        five(3);
     }
 
-    void k(const unsigned char k1[16]) { new /*(&_k)*/ Bignum(k1,16); }
-    void r(const unsigned char r1[16]) { new /*(&_r)*/ Bignum(r1,16); clamp(); }
+private:
+    static unsigned int le32(const unsigned char * b) { return b[0] | (b[1] << 8) | (b[2] << 16) | (static_cast<unsigned int>(b[3]) << 24); }
+
+#ifdef __SIZEOF_INT128__
+    static unsigned long long le64(const unsigned char * b) { return le32(b) | (static_cast<unsigned long long>(le32(b + 4)) << 32); }
+    static void store64(unsigned char * b, unsigned long long x) { for(unsigned int i = 0; i < 8; i++) b[i] = x >> (8 * i); }
+
+    // A 16-byte block, plus 2^128 if hibit is set
+    static void load(Element x, const unsigned char * b, unsigned int hibit) {
+        unsigned long long t0 = le64(b);
+        unsigned long long t1 = le64(b + 8);
+        x[0] = t0 & MASK;
+        x[1] = ((t0 >> 44) | (t1 << 20)) & MASK;
+        x[2] = ((t1 >> 24) & MASK_TOP) | (static_cast<unsigned long long>(hibit) << 40);
+    }
+
+    // 20 * r^(p+1), for the limbs of the product beyond 2^130 (since 2^132 = 20 modulo 2^130 - 5)
+    void five(unsigned int p) {
+        for(unsigned int i = 1; i < LIMBS; i++)
+            _s[p][i] = _r[p][i] * 20;
+    }
+
+    // d += h * r^(p+1), unreduced (the limbs of h are below 2^45 and those of r below 2^45, so twelve products fit in
+    // 128 bits)
+    void accumulate(Product d, const Element h, unsigned int p) const {
+        typedef unsigned __int128 P;
+        const Element & r = _r[p];
+        const Element & s = _s[p];
+        d[0] += static_cast<P>(h[0]) * r[0] + static_cast<P>(h[1]) * s[2] + static_cast<P>(h[2]) * s[1];
+        d[1] += static_cast<P>(h[0]) * r[1] + static_cast<P>(h[1]) * r[0] + static_cast<P>(h[2]) * s[2];
+        d[2] += static_cast<P>(h[0]) * r[2] + static_cast<P>(h[1]) * r[1] + static_cast<P>(h[2]) * r[0];
+    }
+
+    // h = d, partially reduced (limbs below 2^44, but for h[1], which may be a little above)
+    static void carry(Element h, Product d) {
+        unsigned __int128 d1 = d[1] + static_cast<unsigned long long>(d[0] >> 44);
+        unsigned __int128 d2 = d[2] + static_cast<unsigned long long>(d1 >> 44);
+        unsigned long long t = (static_cast<unsigned long long>(d[0]) & MASK) + static_cast<unsigned long long>(d2 >> 42) * 5;
+        h[0] = t & MASK;
+        h[1] = (static_cast<unsigned long long>(d1) & MASK) + (t >> 44);
+        h[2] = static_cast<unsigned long long>(d2) & MASK_TOP;
+    }
+
+    // out = (h % (2^130 - 5) + s) % 2^128 (on scalars, so the compiler keeps it all in registers)
+    static void finish(unsigned char out[16], Element h, const unsigned char s[16]) {
+        unsigned long long h0 = h[0], h1 = h[1], h2 = h[2], c;
+        c = h1 >> 44; h1 &= MASK; h2 += c;
+        c = h2 >> 42; h2 &= MASK_TOP; h0 += c * 5;
+        c = h0 >> 44; h0 &= MASK; h1 += c;
+        c = h1 >> 44; h1 &= MASK; h2 += c;
+        c = h2 >> 42; h2 &= MASK_TOP; h0 += c * 5;
+        c = h0 >> 44; h0 &= MASK; h1 += c;
+
+        // g = h - (2^130 - 5), taken instead of h unless it is negative
+        unsigned long long g0, g1, g2;
+        g0 = h0 + 5; c = g0 >> 44; g0 &= MASK;
+        g1 = h1 + c; c = g1 >> 44; g1 &= MASK;
+        g2 = h2 + c - (1ULL << 42);
+        unsigned long long select = (g2 >> 63) - 1;
+        h0 = (h0 & ~select) | (g0 & select);
+        h1 = (h1 & ~select) | (g1 & select);
+        h2 = (h2 & ~select) | (g2 & select);
+
+        unsigned long long t0 = le64(s);
+        unsigned long long t1 = le64(s + 8);
+        h0 += t0 & MASK; c = h0 >> 44; h0 &= MASK;
+        h1 += (((t0 >> 44) | (t1 << 20)) & MASK) + c; c = h1 >> 44; h1 &= MASK;
+        h2 += ((t1 >> 24) & MASK_TOP) + c;
+
+        store64(out, h0 | (h1 << 44));
+        store64(out + 8, (h1 >> 20) | (h2 << 24));
+    }
+#else
+    // A 16-byte block, plus 2^128 if hibit is set
+    static void load(Element x, const unsigned char * b, unsigned int hibit) {
+        x[0] = le32(b) & MASK;
+        x[1] = (le32(b + 3) >> 2) & MASK;
+        x[2] = (le32(b + 6) >> 4) & MASK;
+        x[3] = (le32(b + 9) >> 6) & MASK;
+        x[4] = (le32(b + 12) >> 8) | (hibit << 24);
+    }
+
+    // 5 * r^(p+1), for the limbs of the product beyond 2^130 (since 2^130 = 5 modulo 2^130 - 5)
+    void five(unsigned int p) {
+        for(unsigned int i = 1; i < LIMBS; i++)
+            _s[p][i] = _r[p][i] * 5;
+    }
+
+    // d += h * r^(p+1), unreduced (the limbs of h are below 2^27, so four products fit in 64 bits)
+    void accumulate(Product d, const Element h, unsigned int p) const {
+        const Element & r = _r[p];
+        const Element & s = _s[p];
+        d[0] += static_cast<unsigned long long>(h[0]) * r[0] + static_cast<unsigned long long>(h[1]) * s[4] + static_cast<unsigned long long>(h[2]) * s[3] + static_cast<unsigned long long>(h[3]) * s[2] + static_cast<unsigned long long>(h[4]) * s[1];
+        d[1] += static_cast<unsigned long long>(h[0]) * r[1] + static_cast<unsigned long long>(h[1]) * r[0] + static_cast<unsigned long long>(h[2]) * s[4] + static_cast<unsigned long long>(h[3]) * s[3] + static_cast<unsigned long long>(h[4]) * s[2];
+        d[2] += static_cast<unsigned long long>(h[0]) * r[2] + static_cast<unsigned long long>(h[1]) * r[1] + static_cast<unsigned long long>(h[2]) * r[0] + static_cast<unsigned long long>(h[3]) * s[4] + static_cast<unsigned long long>(h[4]) * s[3];
+        d[3] += static_cast<unsigned long long>(h[0]) * r[3] + static_cast<unsigned long long>(h[1]) * r[2] + static_cast<unsigned long long>(h[2]) * r[1] + static_cast<unsigned long long>(h[3]) * r[0] + static_cast<unsigned long long>(h[4]) * s[4];
+        d[4] += static_cast<unsigned long long>(h[0]) * r[4] + static_cast<unsigned long long>(h[1]) * r[3] + static_cast<unsigned long long>(h[2]) * r[2] + static_cast<unsigned long long>(h[3]) * r[1] + static_cast<unsigned long long>(h[4]) * r[0];
+    }
+
+    // h = d, partially reduced (limbs below 2^26, but for h[1], which may be a little above)
+    static void carry(Element h, Product d) {
+        for(unsigned int i = 0; i < 4; i++) {
+            d[i + 1] += d[i] >> 26;
+            h[i] = d[i] & MASK;
+        }
+        h[4] = d[4] & MASK;
+        unsigned long long t = h[0] + (d[4] >> 26) * 5;
+        h[0] = t & MASK;
+        h[1] += t >> 26;
+    }
+
+    // out = (h % (2^130 - 5) + s) % 2^128
+    static void finish(unsigned char out[16], Element h, const unsigned char s[16]) {
+        unsigned int c;
+        c = h[1] >> 26; h[1] &= MASK; h[2] += c;
+        c = h[2] >> 26; h[2] &= MASK; h[3] += c;
+        c = h[3] >> 26; h[3] &= MASK; h[4] += c;
+        c = h[4] >> 26; h[4] &= MASK; h[0] += c * 5;
+        c = h[0] >> 26; h[0] &= MASK; h[1] += c;
+
+        // g = h - (2^130 - 5), taken instead of h unless it is negative
+        Element g;
+        g[0] = h[0] + 5; c = g[0] >> 26; g[0] &= MASK;
+        g[1] = h[1] + c; c = g[1] >> 26; g[1] &= MASK;
+        g[2] = h[2] + c; c = g[2] >> 26; g[2] &= MASK;
+        g[3] = h[3] + c; c = g[3] >> 26; g[3] &= MASK;
+        g[4] = h[4] + c - (1 << 26);
+        unsigned int select = (g[4] >> 31) - 1;
+        for(unsigned int i = 0; i < LIMBS; i++)
+            h[i] = (h[i] & ~select) | (g[i] & select);
+
+        unsigned int w[4] = { h[0] | (h[1] << 26), (h[1] >> 6) | (h[2] << 20), (h[2] >> 12) | (h[3] << 14), (h[3] >> 18) | (h[4] << 8) };
+        unsigned long long f = 0;
+        for(unsigned int i = 0; i < 4; i++) {
+            f += static_cast<unsigned long long>(w[i]) + le32(&s[4 * i]);
+            for(unsigned int j = 0; j < 4; j++)
+                out[4 * i + j] = f >> (8 * j);
+            f >>= 32;
+        }
+    }
+#endif
 
 private:
-    void clamp() {
-        reinterpret_cast<unsigned char *>(_r._data)[3] &= 15;
-        reinterpret_cast<unsigned char *>(_r._data)[7] &= 15;
-        reinterpret_cast<unsigned char *>(_r._data)[11] &= 15;
-        reinterpret_cast<unsigned char *>(_r._data)[15] &= 15;
-        reinterpret_cast<unsigned char *>(_r._data)[4] &= 252;
-        reinterpret_cast<unsigned char *>(_r._data)[8] &= 252;
-        reinterpret_cast<unsigned char *>(_r._data)[12] &= 252;
-    }
-
-    Bignum _k;
-    Bignum _r;
+    unsigned char _k[16];
+    Element _r[4]; // r, r^2, r^3, r^4
+    Element _s[4]; // 5 times the above
+    Cipher * _cipher;
+    const typename Cipher::Schedule * _schedule;
 };
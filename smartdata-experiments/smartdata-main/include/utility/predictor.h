@@ -15,7 +15,9 @@ public:
     enum : unsigned char {
         NONE = Traits<Build>::NONE,
         LVP = Traits<Build>::LVP,
-        DBP = Traits<Build>::DBP
+        DBP = Traits<Build>::DBP,
+        KFP = Traits<Build>::KFP,
+        DESP = Traits<Build>::DESP
     };
 
     // Predictor Model Types
@@ -37,11 +39,16 @@ public:
     public:
         Constant(const Value & v = 0) : _value(v) {}
 
-        Value operator()(const Time & t) { return _value; }
+        Value operator()(const Time & t) const { return _value; }
 
         Value value() const { return _value; }
         void value(const Value & v)  { _value = v; }
 
+        friend Debug & operator<<(Debug & db, const Constant & m) {
+            db << "v=" << m._value;
+            return db;
+        }
+
     private:
         Value _value;
     } __attribute__((packed));
@@ -52,7 +59,8 @@ public:
     public:
         Linear(const Value & a = 0, const Value & b = 0, const Time & t0 = 0): _a(a), _b(b), _t0(t0) {}
 
-        Value operator()(const Time & t1) { return (_a * (t1 - _t0) + _b); }
+        // Time may be unsigned, so instants before t0 are taken apart
+        Value operator()(const Time & t1) const { return (t1 >= _t0) ? (_a * (t1 - _t0) + _b) : (_b - _a * (_t0 - t1)); }
 
         Value a() const { return _a; }
         void a(const Value & a)  { _a = a; }
@@ -61,6 +69,11 @@ public:
         Time t0() const { return _t0; }
         void t0(const Time & t0) { _t0 = t0; }
 
+        friend Debug & operator<<(Debug & db, const Linear & m) {
+            db << "a=" << m._a << ",b=" << m._b << ",t0=" << m._t0;
+            return db;
+        }
+
     private:
         Value _a;
         Value _b;
@@ -97,6 +110,11 @@ public:
         unsigned char type() const { return _type; }
         unsigned char id() const { return _id; }
 
+        friend Debug & operator<<(Debug & db, const Model & m) {
+            db << "{t=" << int(m._type) << ",i=" << int(m._id) << "," << static_cast<const _Model &>(m) << "}";
+            return db;
+        }
+
     private:
         void id(unsigned char id) { _id = id; }
 
@@ -153,9 +171,39 @@ public:
         Value _value;
     };
 
-    // History (circular buffer of Records)
+    // History (the last SIZE Records, oldest first)
     template<History_Type TYPE, unsigned int SIZE, typename ... Tn>
-    class History: public Circular_Buffer<Record<TYPE, Tn ...>, SIZE> {};
+    class History
+    {
+    public:
+        typedef Record<TYPE, Tn ...> Object_Type;
+
+    public:
+        History(): _head(0), _size(0) {}
+
+        unsigned int size() const { return _size; }
+        bool empty() const { return (_size == 0); }
+        bool full() const { return (_size == SIZE); }
+
+        const Object_Type & operator[](unsigned int i) const { return _data[(_head + i) % SIZE]; }
+        const Object_Type & head() const { return (*this)[0]; }
+        const Object_Type & tail() const { return (*this)[_size - 1]; }
+
+        void insert(const Object_Type & o) {
+            if(full()) {
+                _data[_head] = o;
+                _head = (_head + 1) % SIZE;
+            } else
+                _data[(_head + _size++) % SIZE] = o;
+        }
+
+        void clear() { _head = _size = 0; }
+
+    private:
+        Object_Type _data[SIZE];
+        unsigned int _head;
+        unsigned int _size;
+    };
 
 
 //protected:
@@ -198,7 +246,13 @@ public:
     static const Predictor_Type TYPE = NONE;
 
     typedef Dummy_Model<Time, Value> Model;
-    struct Configuration {};
+    struct Configuration
+    {
+        Configuration() {}
+
+        template<typename Config>
+        Configuration(const Config & conf) {}
+    };
 
 public:
     Dummy_Predictor(): _model(TYPE) {}
@@ -246,12 +300,12 @@ public:
     } __attribute__((packed));
 
 public:
-    LVP(Value r = 0, Value a = 0, Time t = 0): _config(r, a, t), _miss_predicted(0) {
+    LVP(Value r = 0, Value a = 0, Time t = 0): _config(r, a, t), _model(Model::TYPE), _miss_predicted(0) {
         db<Predictors>(TRC) << "LVP(r=" << r << ",a=" << a << ",t=" << t << ")" << endl;
         db<Predictors>(INF) << "LVP:config=" << _config << ",model=" << _model << ")" << endl;
     }
 
-    LVP(const Configuration & c, bool r = false): _config(c), _miss_predicted(0) {
+    LVP(const Configuration & c, bool r = false): _config(c), _model(Model::TYPE), _miss_predicted(0) {
         db<Predictors>(TRC) << "LVP(c=" << c << ",r=" << r << ")" << endl;
         db<Predictors>(INF) << "LVP:config=" << _config << ",model=" << _model << ")" << endl;
     }
@@ -272,7 +326,7 @@ public:
 
         if(error > max_acceptable_error) {
             if(++_miss_predicted > _config.time_error) {
-                _model->value(value);
+                _model.value(value);
                 _miss_predicted = 0;
                 return false;
             }
@@ -280,11 +334,6 @@ public:
             _miss_predicted = 0;
         }
 
-//            Value predicted = (*_model)(time);
-//            if(predicted != value){
-//                _model->value(value);
-//                return false;
-//            }
         return true;
     }
 
@@ -308,6 +357,9 @@ private:
 
 
 // Derivative-based Predictor (DBP)
+// Models are lines through the sample that expired the previous model, with the slope between the averages of the
+// oldest and of the most recent points of the last window_size samples (a constant, as LVP's, while there are fewer).
+// Slopes are per unit of Time, usually tiny fractions, thus models are float regardless of Value.
 template<typename Time, typename Value>
 class DBP: public Predictor_Common
 {
@@ -315,8 +367,10 @@ private:
     static const Predictor_Type TYPE = Predictor_Common::DBP;
     static const unsigned int MAX_WINDOW = 100;
 
+    typedef Record<TEMPORAL, Time, Value> Sample;
+
 public:
-    typedef Linear_Model<Time, Value> Model;
+    typedef Linear_Model<Time, float> Model;
 
     struct Configuration
     {
@@ -340,53 +394,42 @@ public:
     } __attribute__((packed));
 
 public:
-    DBP(unsigned int w, unsigned int p, Value r = 0, Value a = 0, Time t = 0): _ready(false), _config(w, p, r, a, t), _miss_predicted(0) {
-        db<Predictors>(TRC) << "DBP(r=" << r << ",a=" << a << ",t=" << t << ")" << endl;
+    DBP(unsigned int w, unsigned int p, Value r = 0, Value a = 0, Time t = 0): _miss_predicted(0), _config(r, a, t, w, p), _model(Model::TYPE) {
+        db<Predictors>(TRC) << "DBP(w=" << w << ",p=" << p << ",r=" << r << ",a=" << a << ",t=" << t << ")" << endl;
         db<Predictors>(INF) << "DBP:config=" << _config << ",model=" << _model << ")" << endl;
     }
 
-    DBP(const Configuration & c, bool r = false): _ready(false), _config(c), _miss_predicted(0) {
+    DBP(const Configuration & c, bool r = false): _miss_predicted(0), _config(c), _model(Model::TYPE) {
         db<Predictors>(TRC) << "DBP(c=" << c << ",r=" << r << ")" << endl;
         db<Predictors>(INF) << "DBP:config=" << _config << ",model=" << _model << ")" << endl;
     }
 
     template<typename ... Tn>
     Value predict(const Time & t, const Tn & ... an) const {
-        if(_ready)
-            return _model(t, an ...);
-        else if(!_history.empty())
-            return _history->tail().value();
-        else
-            return 0;
+        return _model(t, an ...);
     }
 
-    void update(const Time & t, const Value & v) { _history.insert(t, v); }
+    void update(const Time & t, const Value & v) { _history.insert(Sample(t, v)); }
 
     bool trickle(const Time & time, const Value & value) {
+        db<Predictors>(TRC) << "DBP::trickle(t=" << time << ",v=" << value << ")" << endl;
+
         update(time, value);
 
-        if(!_model) {
-            if(_history.full()){
+        float predicted = predict(time);
+        float max_acceptable_error = Math::max(Math::abs(((float)value * (float)_config.relative_error)/100.0f), (float)_config.absolute_error);
+        float error = Math::abs((float)value - predicted);
+
+        db<Predictors>(TRC) << "DBP::trickle:real=" << value << ",pred=" << predicted << ",err=" << error << ",max=" << max_acceptable_error << ",t_err:" << _config.time_error << ",miss:" << _miss_predicted << ")" << endl;
+
+        if(error > max_acceptable_error) {
+            if(++_miss_predicted > _config.time_error) {
                 build_model(time, value);
+                _miss_predicted = 0;
                 return false;
             }
         } else {
-            float predicted = predict(time);
-            OStream cout;
-            float max_acceptable_error = Math::max(Math::abs(((float)value * (float)_config.relative_error)/100.0f), (float)_config.absolute_error);
-            float error = Math::abs((float)value - predicted);
-
-            db<Predictors>(TRC) << "LVP::trickle:real=" << value << ",pred=" << predicted << ",err=" << error << ",max=" << max_acceptable_error << ",t_err:" << _config.time_error << ",miss:" << _miss_predicted << ")" << endl;
-
-            if(error > max_acceptable_error) {
-                if(++_miss_predicted > _config.time_error) {
-                    build_model(time, value);
-                    _miss_predicted = 0;
-                    return false;
-                }
-            } else {
-                _miss_predicted = 0;
-            }
+            _miss_predicted = 0;
         }
 
         return true;
@@ -399,6 +442,7 @@ public:
 
     template<typename Config>
     void configure(const Config & c) {
+        _config.window_size = c.window_size;
         _config.points = c.points;
         _config.relative_error = c.relative_error;
         _config.absolute_error = c.absolute_error;
@@ -406,42 +450,296 @@ public:
     }
 
 protected:
-    void build_model(const Time & t, const Value & v){
-        assert(_history.full());
+    void build_model(const Time & t, const Value & v) {
+        unsigned int window = _config.window_size;
+        if(window > MAX_WINDOW)
+            window = MAX_WINDOW;
+        unsigned int points = _config.points;
+
+        // Ages (i.e. t - time) rather than times, which floats could not tell apart
+        float slope = 0;
+        if(points && (2 * points <= window) && (_history.size() >= window)) {
+            unsigned int first = _history.size() - window;
+            float avg_oldest = 0;
+            float avg_recent = 0;
+            float age_oldest = 0;
+            float age_recent = 0;
+
+            for(unsigned int i = 0; i < points; i++) {
+                const Sample & oldest = _history[first + i];
+                const Sample & recent = _history[_history.size() - 1 - i];
+                avg_oldest += oldest.value();
+                age_oldest += t - oldest.time();
+                avg_recent += recent.value();
+                age_recent += t - recent.time();
+            }
 
-        float avg_oldest = 0;
-        float avg_recent = 0;
+            // The 1 / points of the averages cancel out
+            if(age_oldest > age_recent)
+                slope = (avg_recent - avg_oldest) / (age_oldest - age_recent);
+        }
 
-        _model.t0(_history[0].time());
+        _model.a(slope);
+        _model.b(v);
+        _model.t0(t);
 
-        for(unsigned int i = 0; i < _config.points; i++)
-            avg_oldest += _history[i].value();
-        avg_oldest /= _config.points;
+        db<Predictors>(INF) << "DBP::build_model:model=" << _model << endl;
+    }
 
-        for(unsigned int i = 0; i < _config.point; i++)
-            avg_recent += _history[_history.size() -1 - i].value();
-        avg_recent /= _config.points;
+private:
+    unsigned int _miss_predicted;
 
-        float t_oldest = (_history[0].time() + _history[_config.points - 1].time()) / 2;
-        float t_recent = (_history[_history.size() - 1].time() + _history[_history.size() -1 - (_config.point - 1)].time()) / 2;
+    Configuration _config;
+    Model _model;
+    History<TEMPORAL, MAX_WINDOW, Time, Value> _history;
+};
 
-        _model.a((avg_recent - avg_oldest) / (t_recent - t_oldest));
-        _model.b(avg_oldest);
-        _model.t0(t_oldest);
+// Kalman Filter Predictor (KFP)
+// For noisy sensors, on which LVP and DBP miss all the time. Samples are taken as a value that drifts as a random
+// walk (of process_noise variance per sample) measured with noise of measurement_noise variance, estimated by a
+// scalar Kalman filter. Models are constants, as LVP's, but of the estimate instead of the last sample, and it is
+// the estimate that predictions must be within the configured errors of. As the estimate lags behind steps, samples
+// are also gated: one the model misses by more than the error plus 3 standard deviations of the noise expected of it
+// counts as a miss too, and the filter restarts from it when the model is replaced.
+template<typename Time, typename Value>
+class KFP: public Predictor_Common
+{
+public:
+    static const Predictor_Type TYPE = Predictor_Common::KFP;
+
+    typedef Constant_Model<Time, float> Model;
+
+    struct Configuration
+    {
+        Configuration(Value r = 0, Value a = 0, Time t = 0, float q = 0, float m = 0)
+        : relative_error(r), absolute_error(a), time_error(t), process_noise(q), measurement_noise(m) {}
+
+        template<typename Config>
+        Configuration(const Config & conf)
+        : relative_error(conf.relative_error), absolute_error(conf.absolute_error), time_error(conf.time_error), process_noise(conf.process_noise), measurement_noise(conf.measurement_noise) {}
+
+        friend Debug & operator<<(Debug & db, const Configuration & c) {
+            db << "{r=" << c.relative_error << ",a=" << c.absolute_error << ",t=" << c.time_error << ",q=" << c.process_noise << ",m=" << c.measurement_noise << "}";
+            return db;
+        }
 
-        float predicted = predict(t);
-        float error = v - predicted;
-        _model.b(avg_oldest + error);
-        _ready = true;
+        Value relative_error;
+        Value absolute_error;
+        Time time_error;
+        float process_noise;
+        float measurement_noise;
+    } __attribute__((packed));
+
+public:
+    KFP(Value r = 0, Value a = 0, Time t = 0, float q = 0, float m = 0): _config(r, a, t, q, m), _model(Model::TYPE), _miss_predicted(0), _samples(0), _estimate(0), _variance(0) {
+        db<Predictors>(TRC) << "KFP(r=" << r << ",a=" << a << ",t=" << t << ",q=" << q << ",m=" << m << ")" << endl;
+        db<Predictors>(INF) << "KFP:config=" << _config << ",model=" << _model << ")" << endl;
+    }
+
+    KFP(const Configuration & c, bool r = false): _config(c), _model(Model::TYPE), _miss_predicted(0), _samples(0), _estimate(0), _variance(0) {
+        db<Predictors>(TRC) << "KFP(c=" << c << ",r=" << r << ")" << endl;
+        db<Predictors>(INF) << "KFP:config=" << _config << ",model=" << _model << ")" << endl;
+    }
+
+    template<typename ... Tn>
+    Value predict(const Time & t, const Tn & ... an) const {
+        return _model(t, an...);
+    }
+
+    // Filters a sample into the estimate
+    void update(const Time & time, const Value & value) {
+        if(!_samples++) {
+            _estimate = value;
+            _variance = _config.measurement_noise;
+        } else {
+            _variance += _config.process_noise;
+            float gain = (_variance > 0) ? _variance / (_variance + _config.measurement_noise) : 1;
+            _estimate += gain * ((float)value - _estimate);
+            _variance *= 1 - gain;
+        }
+    }
+
+    bool trickle(const Time & time, const Value & value) {
+        db<Predictors>(TRC) << "KFP::trickle(t=" << time << ",v=" << value << ")" << endl;
+
+        // Variance of the innovation (the sample's distance to the estimate) before the sample is filtered in
+        float spread = _samples ? _variance + _config.process_noise + _config.measurement_noise : 0;
+
+        update(time, value);
+
+        float predicted = predict(time);
+        float max_acceptable_error = Math::max(Math::abs((_estimate * (float)_config.relative_error)/100.0f), (float)_config.absolute_error);
+        float error = Math::abs(_estimate - predicted);
+        float innovation = Math::abs((float)value - predicted) - max_acceptable_error;
+        bool jumped = (innovation > 0) && (innovation * innovation > 9 * spread);
+
+        db<Predictors>(TRC) << "KFP::trickle:real=" << value << ",est=" << _estimate << ",var=" << _variance << ",pred=" << predicted << ",err=" << error << ",max=" << max_acceptable_error << ",jump=" << jumped << ",t_err:" << _config.time_error << ",miss:" << _miss_predicted << ")" << endl;
+
+        if((error > max_acceptable_error) || jumped) {
+            if(++_miss_predicted > _config.time_error) {
+                if(jumped) {
+                    _estimate = value;
+                    _variance = _config.measurement_noise;
+                }
+                _model.value(_estimate);
+                _miss_predicted = 0;
+                return false;
+            }
+        } else {
+            _miss_predicted = 0;
+        }
+
+        return true;
+    }
+
+    const Model & model() const { return _model; }
+    void model(const Model & m) { _model = m; }
+
+    void update(const Model & m, const bool & from_sink) { _model = m; }
+
+    template<typename Config>
+    void configure(const Config & c) {
+        _config.relative_error = c.relative_error;
+        _config.absolute_error = c.absolute_error;
+        _config.time_error = c.time_error;
+        _config.process_noise = c.process_noise;
+        _config.measurement_noise = c.measurement_noise;
     }
 
 private:
-    bool _ready;
+    Configuration _config;
+    Model _model;
     unsigned int _miss_predicted;
+    unsigned int _samples;
+    float _estimate;
+    float _variance;
+};
+
+
+// Double Exponential Smoothing Predictor (DESP)
+// Holt's linear method: a level and a trend, each an exponentially weighted average (by smoothing and
+// trend_smoothing) of the samples and of the slopes between consecutive levels, for sensors too noisy for DBP's
+// differences. Models are lines with the trend as slope through the level, which, as in KFP, is also what
+// predictions must be within the configured errors of, and samples are gated as in KFP, against the variance of
+// the one-step forecast errors (smoothed as the level). Samples need not be periodic.
+template<typename Time, typename Value>
+class DESP: public Predictor_Common
+{
+public:
+    static const Predictor_Type TYPE = Predictor_Common::DESP;
+
+    typedef Linear_Model<Time, float> Model;
+
+    struct Configuration
+    {
+        Configuration(Value r = 0, Value a = 0, Time t = 0, float s = 1, float ts = 0)
+        : relative_error(r), absolute_error(a), time_error(t), smoothing(s), trend_smoothing(ts) {}
+
+        template<typename Config>
+        Configuration(const Config & conf)
+        : relative_error(conf.relative_error), absolute_error(conf.absolute_error), time_error(conf.time_error), smoothing(conf.smoothing), trend_smoothing(conf.trend_smoothing) {}
+
+        friend Debug & operator<<(Debug & db, const Configuration & c) {
+            db << "{r=" << c.relative_error << ",a=" << c.absolute_error << ",t=" << c.time_error << ",s=" << c.smoothing << ",ts=" << c.trend_smoothing << "}";
+            return db;
+        }
+
+        Value relative_error;
+        Value absolute_error;
+        Time time_error;
+        float smoothing;
+        float trend_smoothing;
+    } __attribute__((packed));
+
+public:
+    DESP(Value r = 0, Value a = 0, Time t = 0, float s = 1, float ts = 0): _config(r, a, t, s, ts), _model(Model::TYPE), _miss_predicted(0), _samples(0), _last(0), _level(0), _trend(0), _noise(0) {
+        db<Predictors>(TRC) << "DESP(r=" << r << ",a=" << a << ",t=" << t << ",s=" << s << ",ts=" << ts << ")" << endl;
+        db<Predictors>(INF) << "DESP:config=" << _config << ",model=" << _model << ")" << endl;
+    }
+
+    DESP(const Configuration & c, bool r = false): _config(c), _model(Model::TYPE), _miss_predicted(0), _samples(0), _last(0), _level(0), _trend(0), _noise(0) {
+        db<Predictors>(TRC) << "DESP(c=" << c << ",r=" << r << ")" << endl;
+        db<Predictors>(INF) << "DESP:config=" << _config << ",model=" << _model << ")" << endl;
+    }
+
+    template<typename ... Tn>
+    Value predict(const Time & t, const Tn & ... an) const {
+        return _model(t, an ...);
+    }
 
+    // Smooths a sample into the level and the trend (samples older than the last are ignored)
+    void update(const Time & time, const Value & value) {
+        if(!_samples++) {
+            _level = value;
+            _trend = 0;
+            _last = time;
+        } else if(time >= _last) {
+            float dt = time - _last;
+            float forecast = (float)value - (_level + _trend * dt);
+            _noise = _config.smoothing * forecast * forecast + (1 - _config.smoothing) * _noise;
+            float level = _config.smoothing * (float)value + (1 - _config.smoothing) * (_level + _trend * dt);
+            if(dt > 0)
+                _trend = _config.trend_smoothing * (level - _level) / dt + (1 - _config.trend_smoothing) * _trend;
+            _level = level;
+            _last = time;
+        }
+    }
+
+    bool trickle(const Time & time, const Value & value) {
+        db<Predictors>(TRC) << "DESP::trickle(t=" << time << ",v=" << value << ")" << endl;
+
+        float spread = _noise;
+
+        update(time, value);
+
+        float predicted = predict(time);
+        float max_acceptable_error = Math::max(Math::abs((_level * (float)_config.relative_error)/100.0f), (float)_config.absolute_error);
+        float error = Math::abs(_level - predicted);
+        float innovation = Math::abs((float)value - predicted) - max_acceptable_error;
+        bool jumped = (innovation > 0) && (innovation * innovation > 9 * spread);
+
+        db<Predictors>(TRC) << "DESP::trickle:real=" << value << ",level=" << _level << ",trend=" << _trend << ",pred=" << predicted << ",err=" << error << ",max=" << max_acceptable_error << ",jump=" << jumped << ",t_err:" << _config.time_error << ",miss:" << _miss_predicted << ")" << endl;
+
+        if((error > max_acceptable_error) || jumped) {
+            if(++_miss_predicted > _config.time_error) {
+                if(jumped)
+                    _level = value;
+                _model.a(_trend);
+                _model.b(_level);
+                _model.t0(time);
+                _miss_predicted = 0;
+                return false;
+            }
+        } else {
+            _miss_predicted = 0;
+        }
+
+        return true;
+    }
+
+    const Model & model() const { return _model; }
+    void model(const Model & m) { _model = m; }
+
+    void update(const Model & m, const bool & from_sink) { _model = m; }
+
+    template<typename Config>
+    void configure(const Config & c) {
+        _config.relative_error = c.relative_error;
+        _config.absolute_error = c.absolute_error;
+        _config.time_error = c.time_error;
+        _config.smoothing = c.smoothing;
+        _config.trend_smoothing = c.trend_smoothing;
+    }
+
+private:
     Configuration _config;
     Model _model;
-    History<TEMPORAL, MAX_WINDOW, Time, Value> _history;
+    unsigned int _miss_predicted;
+    unsigned int _samples;
+    Time _last;
+    float _level;
+    float _trend;
+    float _noise; // variance of the one-step forecast errors
 };
 
 template<Predictor_Common::Predictor_Type TYPE>
@@ -464,3 +762,17 @@ struct Select_Predictor<Predictor_Common::DBP>
     template<typename Time, typename Value>
     using Predictor = DBP<Time, Value>;
 };
+
+template<>
+struct Select_Predictor<Predictor_Common::KFP>
+{
+    template<typename Time, typename Value>
+    using Predictor = KFP<Time, Value>;
+};
+
+template<>
+struct Select_Predictor<Predictor_Common::DESP>
+{
+    template<typename Time, typename Value>
+    using Predictor = DESP<Time, Value>;
+};
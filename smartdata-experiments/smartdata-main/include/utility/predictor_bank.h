@@ -0,0 +1,70 @@
+#pragma once
+
+// EPOS Predictor Bank Declarations
+
+#include <system/types.h>
+#include <utility/list.h>
+#include <utility/predictor.h>
+
+// Many LVP/DBP predictors (e.g. one per predictive SmartData of a gateway) kept as a structure of arrays, so
+// that trickle() checks one new sample of each against its model in a single pass, four series at a time with
+// AVX2 when the CPU has it (scalar otherwise, with the same results). Every model is linear, v = a * (t - t0) + b,
+// a constant (LVP) having a = 0. As in LVP and DBP, a series misses when its prediction is off by more than the
+// larger of its relative and absolute errors, and its model is replaced after more than time_error consecutive
+// misses: by the constant model of the sample that expired it. That is LVP's new model; a DBP owner then fits a
+// line to its history and installs it with model(). Not synchronized: callers must serialize access.
+// SmartData do not use it (yet): each one trickles its own predictor as its samples come, so the bank only pays off
+// for an owner that samples many series at once, e.g. a gateway polling its transducers in rounds.
+class Predictor_Bank: public Predictor_Common
+{
+public:
+    typedef unsigned long long Time;
+    typedef double Value;
+
+    static const unsigned int NONE = ~0U;
+
+public:
+    // Without simd, the scalar loop is used even if the CPU has AVX2
+    Predictor_Bank(unsigned int capacity, bool simd = true);
+    ~Predictor_Bank();
+
+    unsigned int size() const { return _size; }
+    bool simd() const { return _avx2; }
+
+    // Adds a series with a constant model of 0 and returns its index (or NONE if the bank is full)
+    unsigned int insert(const Value & relative_error, const Value & absolute_error, unsigned int time_error);
+
+    // From an LVP or DBP Configuration
+    template<typename Config>
+    unsigned int insert(const Config & c) { return insert(c.relative_error, c.absolute_error, c.time_error); }
+
+    void model(unsigned int i, const Value & a, const Value & b, const Time & t0) {
+        _a[i] = a;
+        _b[i] = b;
+        _t0[i] = t0;
+        _misses[i] = 0;
+    }
+
+    Value predict(unsigned int i, const Time & t) const { return _a[i] * static_cast<long long>(t - _t0[i]) + _b[i]; }
+
+    // Checks sample (t[i], v[i]) of each series i < size() and returns how many models were replaced, setting
+    // bit i % 32 of changed[i / 32] for each (i.e. for which LVP::trickle would return false).
+    unsigned int trickle(const Time * t, const Value * v, unsigned int * changed);
+
+private:
+    unsigned int trickle_scalar(unsigned int from, const Time * t, const Value * v, unsigned int * changed);
+    unsigned int trickle_avx2(const Time * t, const Value * v, unsigned int * changed);
+
+private:
+    unsigned int _capacity;
+    unsigned int _size;
+    bool _avx2;
+
+    Value * _a;
+    Value * _b;
+    Time * _t0;
+    Value * _relative; // already divided by 100
+    Value * _absolute;
+    int * _time_error;
+    int * _misses;
+};
@@ -0,0 +1,182 @@
+#pragma once
+
+// EPOS Hierarchical Timing Wheel Utility Declarations
+
+#include <utility/list.h>
+
+// Hierarchical timing wheel (Varghese & Lauck), as in classic Linux timers.
+// Level L has 2^BITS slots of 2^(BITS*L) ticks each. Elements are placed by
+// their expiration tick (the element's rank) relative to the current tick and
+// cascade down one level whenever the level below wraps. Insertion and
+// removal are O(1); expire() returns due elements one at a time while the
+// wheel moves forward, skipping over spans that hold nothing.
+// Not synchronized: callers must serialize access.
+template<typename T, unsigned int LEVELS = 4, unsigned int BITS = 8>
+class Timing_Wheel
+{
+public:
+    typedef unsigned long long Tick;
+
+    static const unsigned int SLOTS = 1 << BITS;
+    static const Tick HORIZON = (1ULL << (LEVELS * BITS)) - 1;
+
+    class Element;
+    typedef List<T, Element> Slot;
+
+    class Element
+    {
+        friend class Timing_Wheel;
+
+    public:
+        typedef T Object_Type;
+        typedef Tick Rank_Type;
+
+    public:
+        Element(const T * o, const Tick & r = 0): _object(o), _rank(r), _prev(0), _next(0), _slot(0), _map(0), _mask(0) {}
+
+        T * object() const { return const_cast<T *>(_object); }
+
+        Element * prev() const { return _prev; }
+        Element * next() const { return _next; }
+        void prev(Element * e) { _prev = e; }
+        void next(Element * e) { _next = e; }
+
+        const Tick & rank() const { return _rank; }
+        void rank(const Tick & r) { _rank = r; }
+
+        bool linked() const { return _slot; }
+
+    private:
+        const T * _object;
+        Tick _rank;
+        Element * _prev;
+        Element * _next;
+        Slot * _slot;
+        unsigned long long * _map;
+        unsigned long long _mask;
+    };
+
+private:
+    static const unsigned int MASK = SLOTS - 1;
+    static const unsigned int WORDS = (SLOTS + 63) / 64;
+
+public:
+    Timing_Wheel(const Tick & now = 0): _current(now), _size(0) {
+        for(unsigned int l = 0; l < LEVELS; l++)
+            for(unsigned int w = 0; w < WORDS; w++)
+                _map[l][w] = 0;
+    }
+
+    bool empty() const { return !_size; }
+    unsigned int size() const { return _size; }
+
+    const Tick & current() const { return _current; }
+
+    // Elements due at (or before) the current tick expire on the next tick
+    void insert(Element * e) {
+        if(e->rank() <= _current)
+            e->rank(_current + 1);
+        place(e);
+        _size++;
+    }
+
+    Element * remove(Element * e) {
+        unplace(e);
+        _size--;
+        return e;
+    }
+
+    // Returns the next element due at or before "now", or 0 once there is none.
+    Element * expire(const Tick & now) {
+        while(true) {
+            Slot * s = &_slots[0][_current & MASK];
+            if(!s->empty())
+                return remove(s->head());
+            if(_current >= now)
+                return 0;
+
+            Tick n = next();
+            _current = (n < now) ? n : now;
+            cascade();
+        }
+    }
+
+    // Lower bound for the next tick at which expire() may return something
+    // (either an expiration or a cascade), or HORIZON + _current if empty.
+    Tick next() const {
+        if(empty())
+            return _current + HORIZON;
+
+        for(unsigned int l = 0; l < LEVELS; l++) {
+            unsigned int shift = BITS * l;
+            unsigned int index = (_current >> shift) & MASK;
+            // The current slot of upper levels has already been cascaded
+            int j = find(l, l ? index + 1 : index);
+            if(j >= 0)
+                return ((_current >> shift) + (j - index)) << shift;
+            if(find(l, 0) >= 0) // wrapped around: due after the next upper level boundary
+                return ((_current >> (shift + BITS)) + 1) << (shift + BITS);
+        }
+
+        return _current + HORIZON;
+    }
+
+private:
+    void place(Element * e) {
+        Tick delta = e->rank() - _current;
+        Tick tick = (delta > HORIZON) ? _current + HORIZON : e->rank();
+        if(delta > HORIZON)
+            delta = HORIZON;
+
+        unsigned int l = 0;
+        while((l < LEVELS - 1) && (delta >> (BITS * (l + 1))))
+            l++;
+        unsigned int index = (tick >> (BITS * l)) & MASK;
+
+        e->_slot = &_slots[l][index];
+        e->_map = &_map[l][index / 64];
+        e->_mask = 1ULL << (index % 64);
+        e->_slot->insert(e);
+        *e->_map |= e->_mask;
+    }
+
+    void unplace(Element * e) {
+        e->_slot->remove(e);
+        if(e->_slot->empty())
+            *e->_map &= ~e->_mask;
+        e->_slot = 0;
+    }
+
+    // Moves the upper level slots that begin at the current tick one level down
+    void cascade() {
+        for(unsigned int l = 1; l < LEVELS; l++) {
+            unsigned int shift = BITS * l;
+            if(_current & ((1ULL << shift) - 1))
+                break;
+            Slot * s = &_slots[l][(_current >> shift) & MASK];
+            while(!s->empty()) {
+                Element * e = s->head();
+                unplace(e);
+                place(e);
+            }
+        }
+    }
+
+    // First occupied slot at a level from "from" on, or -1
+    int find(unsigned int level, unsigned int from) const {
+        for(unsigned int w = from / 64; w < WORDS; w++) {
+            unsigned long long bits = _map[level][w];
+            if(w == from / 64)
+                bits &= ~0ULL << (from % 64);
+            if(bits)
+                return w * 64 + __builtin_ctzll(bits);
+        }
+        return -1;
+    }
+
+private:
+    Tick _current;
+    unsigned int _size;
+    Slot _slots[LEVELS][SLOTS];
+    unsigned long long _map[LEVELS][WORDS];
+};
@@ -0,0 +1,217 @@
+#include "main_traits.h"
+#include <system/thread.h>
+#include <utility/list.h>
+#include <utility/wheel.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Alarm engine benchmark: the cost of arming and cancelling an alarm with n others pending, in the timing wheel
+// the alarms are kept in and in the deadline-ordered list they used to be, then the CPU taken by n periodic threads
+// (of 10 to 20 ms) and the jitter of a 1 kHz one running alongside them, both on the real engine and with a host
+// thread per period (each sleeping to its next deadline with clock_nanosleep()), as periodic SmartData would need
+// without it.
+// Usage: smartdata-bench-alarm [n] [seconds] (from a Release build)
+
+struct Item
+{
+	Item(): wheel_link(this), list_link(this) {}
+
+	Timing_Wheel<Item>::Element wheel_link;
+	Simple_Ordered_List<Item, unsigned long long>::Element list_link;
+};
+
+static double seconds()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static double cpu()
+{
+	rusage u;
+	getrusage(RUSAGE_SELF, &u);
+	return u.ru_utime.tv_sec + u.ru_utime.tv_usec * 1e-6 + u.ru_stime.tv_sec + u.ru_stime.tv_usec * 1e-6;
+}
+
+static const unsigned int FAST = 1000; // us
+
+static unsigned long long start;
+static const unsigned int BUCKETS = 10000; // of 10 us
+static unsigned int lateness[BUCKETS];
+static unsigned int activations;
+static long long worst;
+static int fast()
+{
+	long long late = static_cast<long long>(Alarm::now() - start) - static_cast<long long>(++activations) * FAST;
+	lateness[(late < 0) ? 0 : (late / 10 < BUCKETS) ? late / 10 : BUCKETS - 1]++;
+	if(late > worst)
+		worst = late;
+	return 0;
+}
+
+// Lateness (in us, to 10 us) that fraction f of the activations did not exceed
+static unsigned int percentile(double f)
+{
+	unsigned int n = 0;
+	for(unsigned int i = 0; i < BUCKETS; i++)
+		if((n += lateness[i]) >= f * activations)
+			return (i + 1) * 10;
+	return BUCKETS * 10;
+}
+
+static void reset()
+{
+	memset(lateness, 0, sizeof(lateness));
+	activations = 0;
+	worst = 0;
+}
+
+static volatile unsigned long long jobs;
+static int slow() { __atomic_fetch_add(&jobs, 1, __ATOMIC_RELAXED); return 0; }
+
+// A host thread per period
+static const size_t STACK = 64 * 1024;
+static volatile bool stop;
+static bool go;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t started = PTHREAD_COND_INITIALIZER;
+
+struct Period
+{
+	unsigned int period; // us
+	int (* job)();
+};
+
+static void * periodic(void * arg)
+{
+	Period * p = reinterpret_cast<Period *>(arg);
+
+	// Threads only start once all are created, for n of them running would take the CPU creation needs
+	pthread_mutex_lock(&lock);
+	while(!go)
+		pthread_cond_wait(&started, &lock);
+	pthread_mutex_unlock(&lock);
+
+	timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while(!stop) {
+		next.tv_nsec += p->period * 1000;
+		while(next.tv_nsec >= 1000000000) {
+			next.tv_nsec -= 1000000000;
+			next.tv_sec++;
+		}
+		while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, 0) == EINTR);
+		if(!stop)
+			p->job();
+	}
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned int n = (argc > 1) ? atoi(argv[1]) : 10000;
+	unsigned int duration = (argc > 2) ? atoi(argv[2]) : 5;
+
+	// Arm and cancel, deadlines uniform over the next 20 ms (at 10 kHz, 200 ticks)
+	Item * items = new Item[n + 1];
+	srand(1);
+	const unsigned int ROUNDS = 100000;
+
+	Timing_Wheel<Item> wheel(0);
+	for(unsigned int i = 0; i < n; i++) {
+		items[i].wheel_link.rank(1 + rand() % 200);
+		wheel.insert(&items[i].wheel_link);
+	}
+	double t = seconds();
+	for(unsigned int r = 0; r < ROUNDS; r++) {
+		items[n].wheel_link.rank(1 + rand() % 200);
+		wheel.insert(&items[n].wheel_link);
+		wheel.remove(&items[n].wheel_link);
+	}
+	double tw = (seconds() - t) / ROUNDS;
+
+	Simple_Ordered_List<Item, unsigned long long> list;
+	for(unsigned int i = 0; i < n; i++) {
+		items[i].list_link.rank(1 + rand() % 200);
+		list.insert(&items[i].list_link);
+	}
+	unsigned int rounds = (n > 10000) ? ROUNDS / 100 : ROUNDS / 10;
+	t = seconds();
+	for(unsigned int r = 0; r < rounds; r++) {
+		items[n].list_link.rank(1 + rand() % 200);
+		list.insert(&items[n].list_link);
+		list.remove(&items[n].list_link);
+	}
+	double tl = (seconds() - t) / rounds;
+
+	printf("arm+cancel with %u pending: wheel %.0f ns, ordered list %.0f ns\n", n, tw * 1e9, tl * 1e9);
+	delete [] items;
+
+	// The engine, under load
+	Periodic_Thread ** threads = new Periodic_Thread *[n];
+	for(unsigned int i = 0; i < n; i++)
+		threads[i] = new Periodic_Thread(10000 + rand() % 10000, &slow);
+
+	double c = cpu();
+	t = seconds();
+	start = Alarm::now();
+	Periodic_Thread * timer = new Periodic_Thread(FAST, &fast);
+	sleep(duration);
+	delete timer;
+	double elapsed = seconds() - t;
+	c = cpu() - c;
+
+	for(unsigned int i = 0; i < n; i++)
+		delete threads[i];
+	delete [] threads;
+
+	printf("alarm engine, %u periodic threads for %.1f s: %llu jobs, %.1f%% of a core; 1 kHz alarm: %u activations, lateness p50 %u us, p99 %u us, worst %lld us\n",
+		n, elapsed, jobs, 100 * c / elapsed, activations, percentile(0.5), percentile(0.99), worst);
+
+	// The same load, a host thread per period
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, STACK);
+	Period * periods = new Period[n + 1];
+	pthread_t * hosts = new pthread_t[n + 1];
+	unsigned int created = 0;
+	for(; created < n; created++) {
+		periods[created].period = 10000 + rand() % 10000;
+		periods[created].job = &slow;
+		if(pthread_create(&hosts[created], &attr, &periodic, &periods[created]))
+			break;
+	}
+	pthread_attr_destroy(&attr);
+
+	periods[created].period = FAST;
+	periods[created].job = &fast;
+	pthread_create(&hosts[created], 0, &periodic, &periods[created]);
+	pthread_mutex_lock(&lock);
+	go = true;
+	pthread_cond_broadcast(&started);
+	pthread_mutex_unlock(&lock);
+	reset();
+	jobs = 0;
+	c = cpu();
+	t = seconds();
+	start = Alarm::now();
+	sleep(duration);
+	stop = true;
+	pthread_join(hosts[created], 0);
+	elapsed = seconds() - t;
+	c = cpu() - c;
+
+	for(unsigned int i = 0; i < created; i++)
+		pthread_join(hosts[i], 0);
+	delete [] hosts;
+	delete [] periods;
+
+	printf("thread per period, %u of %u created for %.1f s: %llu jobs, %.1f%% of a core; 1 kHz thread: %u activations, lateness p50 %u us, p99 %u us, worst %lld us\n",
+		created, n, elapsed, jobs, 100 * c / elapsed, activations, percentile(0.5), percentile(0.99), worst);
+
+	return 0;
+}
@@ -0,0 +1,124 @@
+#include "main_traits.h"
+
+#define _UTIL
+
+#include <system/types.h>
+#include <utility/diffie_hellman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Bignum benchmark: times multiplications, additions and inversions (each in a loop of its own) in the secp128r1 field on the portable Bignums and on the
+// ones in Montgomery form (where the compiler has unsigned __int128), and key pairs and shared keys of the build's
+// Diffie_Hellman. Checks that both kinds of Bignum give the same bytes (see Bignum::to_bytes()) for the same
+// operations, and that two parties agree on the shared key when their public keys go through those bytes, as in
+// TSTP::Security::Packed_Public_Key.
+// Usage: smartdata-bench-bignum [operations] [key pairs] (from a Release build)
+
+static const unsigned int SIZE = 16;
+
+struct Cipher { static const unsigned int KEY_SIZE = SIZE; };
+
+typedef Diffie_Hellman<Cipher> DH;
+typedef DH::Public_Key Public_Key;
+typedef Public_Key::Coordinate Coordinate;
+
+static double seconds()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// Seconds per operation
+struct Timing
+{
+	double multiply;
+	double add;
+	double invert;
+};
+
+// Runs n multiplications, n additions and n / 100 inversions on a from bytes, returning the result's bytes in out
+template<typename Number>
+static Timing field(const unsigned char * a, const unsigned char * b, unsigned int n, unsigned char * out)
+{
+	Number x(a, SIZE);
+	Number y(b, SIZE);
+	Timing timing;
+
+	double t = seconds();
+	for(unsigned int i = 0; i < n; i++)
+		x *= y;
+	timing.multiply = (seconds() - t) / n;
+
+	t = seconds();
+	for(unsigned int i = 0; i < n; i++)
+		x += y;
+	timing.add = (seconds() - t) / n;
+
+	t = seconds();
+	for(unsigned int i = 0; i < n / 100; i++)
+		x.invert();
+	timing.invert = (seconds() - t) / (n / 100);
+
+	x.to_bytes(out, SIZE);
+
+	return timing;
+}
+
+static Public_Key wire(const Public_Key & k)
+{
+	unsigned char x[SIZE], y[SIZE], z[SIZE];
+	k.x.to_bytes(x, SIZE);
+	k.y.to_bytes(y, SIZE);
+	k.z.to_bytes(z, SIZE);
+	return Public_Key(Coordinate(x, SIZE), Coordinate(y, SIZE), Coordinate(z, SIZE));
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned int n = (argc > 1) ? atoi(argv[1]) : 1000000;
+	unsigned int pairs = (argc > 2) ? atoi(argv[2]) : 200;
+
+	unsigned char a[SIZE], b[SIZE];
+	for(unsigned int i = 0; i < SIZE; i++) {
+		a[i] = rand();
+		b[i] = rand();
+	}
+	a[SIZE - 1] &= 0x7f; // below the modulo
+	b[SIZE - 1] &= 0x7f;
+
+	unsigned char portable[SIZE];
+	Timing timing = field<Bignum<SIZE, false>>(a, b, n, portable);
+	printf("portable:   multiply %.1f ns, add %.1f ns, invert %.2f us\n", timing.multiply * 1e9, timing.add * 1e9, timing.invert * 1e6);
+#ifdef __SIZEOF_INT128__
+	unsigned char montgomery[SIZE];
+	timing = field<Bignum<SIZE, true>>(a, b, n, montgomery);
+	printf("montgomery: multiply %.1f ns, add %.1f ns, invert %.2f us, same bytes=%d\n", timing.multiply * 1e9, timing.add * 1e9, timing.invert * 1e6, !memcmp(portable, montgomery, SIZE));
+#endif
+
+	double t = seconds();
+	DH ** parties = new DH *[pairs];
+	for(unsigned int i = 0; i < pairs; i++)
+		parties[i] = new DH;
+	double generate = (seconds() - t) / pairs;
+
+	unsigned int agreed = 0;
+	t = seconds();
+	for(unsigned int i = 0; i + 1 < pairs; i += 2) {
+		unsigned char k1[SIZE], k2[SIZE];
+		parties[i]->shared_key(wire(parties[i + 1]->public_key())).to_bytes(k1, SIZE);
+		parties[i + 1]->shared_key(wire(parties[i]->public_key())).to_bytes(k2, SIZE);
+		agreed += !memcmp(k1, k2, SIZE);
+	}
+	double shared = (seconds() - t) / (pairs / 2 * 2);
+
+	printf("%s Diffie_Hellman: key pair %.1f us, shared key %.1f us, %u of %u pairs agreed\n", Traits<Ciphers>::MONTGOMERY && (sizeof(Coordinate::Digit) == 8) ? "montgomery" : "portable", generate * 1e6, shared * 1e6, agreed, pairs / 2);
+
+	for(unsigned int i = 0; i < pairs; i++)
+		delete parties[i];
+	delete [] parties;
+
+	return 0;
+}
@@ -0,0 +1,190 @@
+#include "main_traits.h"
+#include <system/types.h>
+#include <utility/list.h>
+#include <utility/buffer.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Buffer_Pool benchmark: threads take objects in bursts and give them back, as NIC receive threads and TSTP workers
+// do with Buffers, on Buffer_Pool, on the plain tagged stack UDPNIC used before it and on a stack under a mutex.
+// Each object carries an owner, so a pool handing one object to two threads at once is caught and reported.
+// Usage: smartdata-bench-buffer_pool [max threads] [operations per thread] (from a Release build)
+
+static const unsigned int OBJECTS = 256;
+static const unsigned int BURST = 8;
+
+struct Item
+{
+	Item(): owner(0) {}
+
+	volatile unsigned int owner;
+	unsigned int next;
+};
+
+// The pool of UDPNIC before Buffer_Pool: one Treiber stack of tagged indices, no caches
+class Tagged_Stack
+{
+private:
+	static const unsigned int NIL = 0xffff;
+
+public:
+	Tagged_Stack(): _free(0) {
+		for(unsigned int i = 0; i < OBJECTS; i++)
+			_next[i] = (i + 1 < OBJECTS) ? i + 1 : NIL;
+	}
+
+	Item * get() {
+		unsigned int head, next;
+		do {
+			head = _free;
+			if((head & 0xffff) == NIL)
+				return 0;
+			next = (head & 0xffff0000) + 0x10000 + _next[head & 0xffff];
+		} while(CPU::cas(_free, head, next) != head);
+		return &_items[head & 0xffff];
+	}
+
+	void put(Item * o) {
+		unsigned int i = o - _items;
+		unsigned int head, next;
+		do {
+			head = _free;
+			_next[i] = head & 0xffff;
+			next = (head & 0xffff0000) + 0x10000 + i;
+		} while(CPU::cas(_free, head, next) != head);
+	}
+
+private:
+	Item _items[OBJECTS];
+	volatile unsigned short _next[OBJECTS];
+	volatile unsigned int _free;
+};
+
+class Locked_Stack
+{
+public:
+	Locked_Stack(): _top(OBJECTS) {
+		pthread_mutex_init(&_lock, 0);
+		for(unsigned int i = 0; i < OBJECTS; i++)
+			_free[i] = &_items[i];
+	}
+
+	Item * get() {
+		pthread_mutex_lock(&_lock);
+		Item * o = _top ? _free[--_top] : 0;
+		pthread_mutex_unlock(&_lock);
+		return o;
+	}
+
+	void put(Item * o) {
+		pthread_mutex_lock(&_lock);
+		_free[_top++] = o;
+		pthread_mutex_unlock(&_lock);
+	}
+
+private:
+	Item _items[OBJECTS];
+	Item * _free[OBJECTS];
+	unsigned int _top;
+	pthread_mutex_t _lock;
+};
+
+static unsigned int operations;
+static volatile unsigned int errors;
+
+template<typename Pool>
+struct Run
+{
+	Pool * pool;
+	unsigned int id;
+};
+
+template<typename Pool>
+static void * work(void * p)
+{
+	Run<Pool> * r = reinterpret_cast<Run<Pool> *>(p);
+	Item * held[BURST];
+
+	for(unsigned int n = 0; n < operations; n += BURST) {
+		unsigned int got = 0;
+		for(unsigned int i = 0; i < BURST; i++)
+			if((held[got] = r->pool->get())) {
+				if(CPU::cas(held[got]->owner, 0U, r->id) != 0)
+					CPU::finc(errors);
+				got++;
+			}
+		for(unsigned int i = 0; i < got; i++) {
+			if(CPU::cas(held[i]->owner, r->id, 0U) != r->id)
+				CPU::finc(errors);
+			r->pool->put(held[i]);
+		}
+	}
+
+	return 0;
+}
+
+template<typename Pool>
+static double measure(Pool * pool, unsigned int threads)
+{
+	pthread_t thread[threads];
+	Run<Pool> run[threads];
+
+	timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for(unsigned int i = 0; i < threads; i++) {
+		run[i].pool = pool;
+		run[i].id = i + 1;
+		pthread_create(&thread[i], 0, &work<Pool>, &run[i]);
+	}
+	for(unsigned int i = 0; i < threads; i++)
+		pthread_join(thread[i], 0);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	double s = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+	return 2.0 * operations * threads / s / 1e6; // get and put
+}
+
+// Objects that can still be taken, i.e. that were all given back
+template<typename Pool>
+static unsigned int recovered(Pool * pool)
+{
+	Item * taken[OBJECTS];
+	unsigned int n = 0;
+	while((n < OBJECTS) && (taken[n] = pool->get()))
+		n++;
+	for(unsigned int i = 0; i < n; i++)
+		pool->put(taken[i]);
+	return n;
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned int max = (argc > 1) ? atoi(argv[1]) : 16;
+	operations = (argc > 2) ? atoi(argv[2]) : 2000000;
+
+	printf("%-8s %16s %16s %16s   (M operations/s)\n", "threads", "Buffer_Pool", "tagged stack", "locked stack");
+	for(unsigned int threads = 1; threads <= max; threads *= 2) {
+		Buffer_Pool<Item, OBJECTS> * pool = new Buffer_Pool<Item, OBJECTS>;
+		Tagged_Stack * tagged = new Tagged_Stack;
+		Locked_Stack * locked = new Locked_Stack;
+
+		double p = measure(pool, threads);
+		double t = measure(tagged, threads);
+		double l = measure(locked, threads);
+		printf("%-8u %16.1f %16.1f %16.1f\n", threads, p, t, l);
+
+		if(recovered(pool) != OBJECTS)
+			printf("Buffer_Pool lost %u objects!\n", OBJECTS - recovered(pool));
+
+		delete locked;
+		delete tagged;
+		delete pool;
+	}
+
+	if(errors)
+		printf("%u objects were handed to two threads at once!\n", errors);
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,116 @@
+#include "handshake_traits.h"
+#include "main_traits.h"
+#include <network/tstp/tstp.h>
+#include <network/tstp/security.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// Security handshake benchmark: runs the TSTP::Security of a sink and of n peers, each a TSTP stack of its own on a
+// SIMNIC, all in this process and in range of each other (see handshake_traits.h); only those n + 1 stacks are brought
+// up. The sink is given the n peers and each of them the sink (both know a peer by its id), and their key managers take
+// it from there, with the Security and Traits<TSTP> constants the build has. Reports the time until the sink trusts
+// 50%, 90% and all of the peers (and the peers, the sink), against the one handshake per KEY_MANAGER_PERIOD of the key
+// manager it replaced, and then keeps the network running to see keys renewed after KEY_RENEWAL, and how many peers
+// the sink trusts meanwhile.
+// Usage: smartdata-bench-handshake [peers] [seconds after bootstrap] (from a Release build)
+
+typedef TSTP::Security Security;
+
+// Required by the stacks of this process
+OStream cout;
+unsigned int globalCoord = 1;
+const char* globalIPAddress = "127.0.0.1";
+const char* globalInterface = "lo";
+
+static const unsigned int RADIUS = 8; // of the region each peer is known to be deployed in (in units of TSTP::Space)
+static const unsigned int POLL = 1000; // us between looks at the stacks
+
+static double seconds()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// Peers that trust the sink
+static unsigned int trusting(unsigned int n)
+{
+	unsigned int c = 0;
+	for(unsigned int i = 1; i <= n; i++)
+		c += TSTP::get_by_nic(i)->security()->trusted();
+	return c;
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned int n = (argc > 1) ? atoi(argv[1]) : Traits<TSTP>::UNITS - 1;
+	double run = (argc > 2) ? atof(argv[2]) : Security::KEY_EXPIRY / 1e6 + 5;
+	if(n > Traits<TSTP>::UNITS - 1)
+		n = Traits<TSTP>::UNITS - 1;
+
+	printf("peers=%u, handshakes open=%u, handshakers=%u, handshake timeout=%.1f s, key renewal=%.0f s, key expiry=%.0f s, key manager period=%.0f s\n",
+		n, Security::HANDSHAKES, Traits<TSTP>::HANDSHAKERS ? Traits<TSTP>::HANDSHAKERS : static_cast<unsigned int>(sysconf(_SC_NPROCESSORS_ONLN)),
+		Security::HANDSHAKE_TIMEOUT / 1e6, Security::KEY_RENEWAL / 1e6, Security::KEY_EXPIRY / 1e6, Security::KEY_MANAGER_PERIOD / 1e6);
+
+	double t = seconds();
+	TSTP::init(n + 1);
+	printf("%u stacks up and synchronized in %.2f s\n", n + 1, seconds() - t);
+
+	// Bootstrap (the key managers start as soon as they are given peers)
+	Security * sink = TSTP::get_by_nic(0)->security();
+	t = seconds();
+	for(unsigned int i = 1; i <= n; i++) {
+		Security * peer = TSTP::get_by_nic(i)->security();
+		const long * p = Traits<Topology>::POSITIONS[i];
+		SmartData::Space here = SmartData::Global_Space(p[0], p[1], p[2]);
+		peer->add_peer(peer->id(), sizeof(Security::Node_Id), SmartData::Region(TSTP::sink(), RADIUS, 0, INFINITE));
+		sink->add_peer(peer->id(), sizeof(Security::Node_Id), SmartData::Region(here, RADIUS, 0, INFINITE));
+	}
+
+	double half = 0, most = 0, all = 0;
+	double deadline = t + n * Security::KEY_MANAGER_PERIOD / 1e6;
+	unsigned int trusted = 0;
+	while((trusted < n) && (seconds() < deadline)) {
+		usleep(POLL);
+		trusted = sink->trusted();
+		double now = seconds() - t;
+		if(!half && (2 * trusted >= n))
+			half = now;
+		if(!most && (10 * trusted >= 9 * n))
+			most = now;
+		if(trusted == n)
+			all = now;
+	}
+	SmartData::Time bootstrapped = TSTP::now();
+	printf("bootstrap: sink trusts 50%% of the peers after %.3f s, 90%% after %.3f s, %u of %u after %.3f s (one per key manager period: %.0f s)\n",
+		half, most, trusted, n, all ? all : seconds() - t, n * Security::KEY_MANAGER_PERIOD / 1e6);
+	while((trusting(n) < n) && (seconds() < deadline))
+		usleep(POLL);
+	printf("bootstrap: %u of %u peers trust the sink after %.3f s\n", trusting(n), n, seconds() - t);
+
+	// Renewal
+	t = seconds();
+	unsigned int least = trusted;
+	unsigned int renewed = 0;
+	double first = 0, last = 0;
+	while(seconds() - t < run) {
+		usleep(10 * POLL);
+		unsigned int c = sink->trusted();
+		unsigned int r = sink->trusted(bootstrapped);
+		if(c < least)
+			least = c;
+		if(r && !first)
+			first = seconds() - t;
+		if(r > renewed) {
+			renewed = r;
+			last = seconds() - t;
+		}
+	}
+	printf("renewal: %u of %u keys renewed, from %.1f to %.1f s after bootstrap; the sink trusted at least %u peers over %.0f s\n",
+		renewed, n, first, last, least, run);
+
+	fflush(stdout);
+	_exit(0);
+}
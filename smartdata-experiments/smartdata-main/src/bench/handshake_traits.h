@@ -0,0 +1,31 @@
+#pragma once
+#include <system/traits.h>
+
+// Topology of smartdata-bench-handshake, given to each of its sources with -include (see CMakeLists.txt) in place of
+// the one in main_traits.h: the sink and up to 1000 peers, each a TSTP stack on a SIMNIC of its own, on a 10 x 10 x 10
+// grid around the sink, 8 m apart, so every peer is within RADIO_RANGE of the sink and none forwards. The benchmark
+// only brings up the stacks of the peers it was asked for (see TSTP::init()).
+#define __topology_traits__
+
+#define __BENCH_UNIT(i) (i),
+#define __BENCH_POSITION(i) { ((i) - 1) % 10 * 800 - 3600, ((i) - 1) / 10 % 10 * 800 - 3600, ((i) - 1) / 100 * 800 - 3600 },
+#define __BENCH_10(X, i) X(i) X(i + 1) X(i + 2) X(i + 3) X(i + 4) X(i + 5) X(i + 6) X(i + 7) X(i + 8) X(i + 9)
+#define __BENCH_100(X, i) __BENCH_10(X, i) __BENCH_10(X, i + 10) __BENCH_10(X, i + 20) __BENCH_10(X, i + 30) __BENCH_10(X, i + 40) \
+	__BENCH_10(X, i + 50) __BENCH_10(X, i + 60) __BENCH_10(X, i + 70) __BENCH_10(X, i + 80) __BENCH_10(X, i + 90)
+#define __BENCH_1000(X, i) __BENCH_100(X, i) __BENCH_100(X, i + 100) __BENCH_100(X, i + 200) __BENCH_100(X, i + 300) __BENCH_100(X, i + 400) \
+	__BENCH_100(X, i + 500) __BENCH_100(X, i + 600) __BENCH_100(X, i + 700) __BENCH_100(X, i + 800) __BENCH_100(X, i + 900)
+
+template<> struct Traits<Topology> : public Traits_Tokens
+{
+	static const unsigned int NODES = 1001;
+	static const bool simulated = true;
+	static const bool forwarder = false; // the peers are all in range of the sink
+	static constexpr unsigned int NICS[] = { 0, __BENCH_1000(__BENCH_UNIT, 1) };
+	static constexpr long POSITIONS[][3] = { { 0, 0, 0 }, __BENCH_1000(__BENCH_POSITION, 1) };
+};
+
+#undef __BENCH_UNIT
+#undef __BENCH_POSITION
+#undef __BENCH_10
+#undef __BENCH_100
+#undef __BENCH_1000
@@ -0,0 +1,80 @@
+#include "main_traits.h"
+#include <utility/observer.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Client dispatch benchmark: the cost of notifying the observers of one unit among n observers of n / 4 units (as
+// TSTP does for each frame destined to the node), with the observers indexed by unit in Hashed_Data_Observed (as
+// TSTP's clients are) and in the single ordered list of Data_Observed they used to be in.
+// Usage: smartdata-bench-observer [max observers] (from a Release build)
+
+typedef unsigned int Unit;
+typedef int Data;
+
+class Client: public Data_Observer<Data, Unit>
+{
+public:
+	Client(): updates(0) {}
+
+	void update(Data_Observed<Data, Unit> * o, const Unit & u, Data * d) { updates++; }
+
+	unsigned long long updates;
+};
+
+// SmartData units are bit fields, so consecutive indices make poor hashes on purpose
+static Unit unit(unsigned int i) { return 0x84924964 + (i << 4); }
+
+static double seconds()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+template<typename Observed>
+static double measure(Observed * observed, Client * clients, unsigned int n, unsigned int rounds)
+{
+	for(unsigned int i = 0; i < n; i++)
+		observed->attach(&clients[i], unit(i / 4));
+
+	Data d = 0;
+	unsigned int units = (n + 3) / 4;
+	double t = seconds();
+	for(unsigned int r = 0; r < rounds; r++)
+		observed->notify(unit(r % units), &d);
+	t = seconds() - t;
+
+	for(unsigned int i = 0; i < n; i++)
+		observed->detach(&clients[i], unit(i / 4));
+
+	return t / rounds;
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned int max = (argc > 1) ? atoi(argv[1]) : 16384;
+
+	printf("%-10s %16s %16s   (ns per notify)\n", "observers", "hashed", "list");
+	for(unsigned int n = 16; n <= max; n *= 4) {
+		Client * clients = new Client[n];
+		Hashed_Data_Observed<Data, Unit, Traits<TSTP>::CLIENTS> * hashed = new Hashed_Data_Observed<Data, Unit, Traits<TSTP>::CLIENTS>;
+		Data_Observed<Data, Unit> * list = new Data_Observed<Data, Unit>;
+
+		double h = measure(hashed, clients, n, 1000000);
+		unsigned long long updates = 0;
+		for(unsigned int i = 0; i < n; i++)
+			updates += clients[i].updates;
+		double l = measure(list, clients, n, (n > 1024) ? 10000 : 100000);
+		printf("%-10u %16.0f %16.0f\n", n, h * 1e9, l * 1e9);
+
+		if(updates != 4 * 1000000ULL)
+			printf("hashed notified %llu observers instead of %llu!\n", updates, 4 * 1000000ULL);
+
+		delete list;
+		delete hashed;
+		delete [] clients;
+	}
+
+	return 0;
+}
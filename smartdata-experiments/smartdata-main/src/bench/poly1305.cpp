@@ -0,0 +1,94 @@
+#include "main_traits.h"
+#include <assert.h>
+#include <machine/aes.h>
+#include <utility/poly1305.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Poly1305-AES benchmark: verifies n 16-byte messages (the size of a packed RESPONSE) MACed with the same nonce, as
+// those of a peer within a time window reach TSTP::Security::authenticate(), one at a time with k expanded for every
+// mask, one at a time with k expanded once (as the schedule each peer keeps), and all in one batch (one mask for all). Also checks that every authentic MAC is accepted and every tampered one rejected.
+// Usage: smartdata-bench-poly1305 [messages] [rounds] (from a Release build)
+
+typedef AES<16> Cipher;
+typedef Poly1305<Cipher> MAC;
+
+static const unsigned int SIZE = 16;
+
+static double seconds()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned int n = (argc > 1) ? atoi(argv[1]) : 1000;
+	unsigned int rounds = (argc > 2) ? atoi(argv[2]) : 100;
+
+	unsigned char k[16], r[16], nonce[16];
+	for(unsigned int i = 0; i < 16; i++) {
+		k[i] = rand();
+		r[i] = rand();
+		nonce[i] = rand();
+	}
+
+	Cipher cipher;
+	Cipher::Schedule schedule;
+	cipher.expand_key(k, schedule);
+	MAC shared(schedule, r, cipher);
+	MAC own(k, r);
+
+	// Every other message is tampered with after being MACed
+	unsigned char * data = new unsigned char[n * SIZE];
+	unsigned char * tags = new unsigned char[n * 16];
+	const unsigned char ** messages = new const unsigned char *[n];
+	const unsigned char ** macs = new const unsigned char *[n];
+	bool * valid = new bool[n];
+	for(unsigned int i = 0; i < n; i++) {
+		for(unsigned int j = 0; j < SIZE; j++)
+			data[i * SIZE + j] = rand();
+		shared.stamp(&tags[i * 16], nonce, &data[i * SIZE], SIZE);
+		if(i % 2)
+			data[i * SIZE + i % SIZE] ^= 1;
+		messages[i] = &data[i * SIZE];
+		macs[i] = &tags[i * 16];
+	}
+	unsigned int expected = (n + 1) / 2;
+
+	unsigned int authentic[3] = { 0, 0, 0 };
+	double time[3];
+
+	double t = seconds();
+	for(unsigned int round = 0; round < rounds; round++)
+		for(unsigned int i = 0; i < n; i++)
+			authentic[0] += own.verify(macs[i], nonce, messages[i], SIZE);
+	time[0] = seconds() - t;
+
+	t = seconds();
+	for(unsigned int round = 0; round < rounds; round++)
+		for(unsigned int i = 0; i < n; i++)
+			authentic[1] += shared.verify(macs[i], nonce, messages[i], SIZE);
+	time[1] = seconds() - t;
+
+	t = seconds();
+	for(unsigned int round = 0; round < rounds; round++)
+		authentic[2] += shared.verify(n, macs, nonce, messages, SIZE, valid);
+	time[2] = seconds() - t;
+
+	const char * names[] = { "one at a time, k expanded", "one at a time, k scheduled", "in a batch" };
+	for(unsigned int i = 0; i < 3; i++)
+		printf("%-29s: %6.1f ns per message, %u of %u authentic (%s)\n",
+			names[i], time[i] * 1e9 / (n * rounds), authentic[i] / rounds, n, (authentic[i] == expected * rounds) ? "ok" : "WRONG");
+
+	delete [] valid;
+	delete [] macs;
+	delete [] messages;
+	delete [] tags;
+	delete [] data;
+
+	return 0;
+}
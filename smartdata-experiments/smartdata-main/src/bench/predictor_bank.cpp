@@ -0,0 +1,92 @@
+#include "main_traits.h"
+#include <utility/predictor_bank.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+// Predictor_Bank benchmark: checks one noisy sample of each of n series against its LVP model per round, on the bank
+// with AVX2 (if the CPU has it), on the bank's scalar loop and on one LVP object per series (as each SmartData does),
+// and reports the time per series and whether the two paths of the bank changed the same models.
+// Usage: smartdata-bench-predictor_bank [series] [rounds] (from a Release build)
+
+typedef Predictor_Bank::Time Stamp;
+typedef Predictor_Bank::Value Value;
+
+static const Value RELATIVE = 1.0; // %
+static const Value ABSOLUTE = 0.05;
+
+static double seconds()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned int n = (argc > 1) ? atoi(argv[1]) : 10000;
+	unsigned int rounds = (argc > 2) ? atoi(argv[2]) : 2000;
+
+	Predictor_Bank simd(n);
+	Predictor_Bank scalar(n, false);
+	LVP<Stamp, Value> * objects = new LVP<Stamp, Value>[n];
+	for(unsigned int i = 0; i < n; i++) {
+		simd.insert(RELATIVE, ABSOLUTE, i % 3);
+		scalar.insert(RELATIVE, ABSOLUTE, i % 3);
+		objects[i] = LVP<Stamp, Value>(RELATIVE, ABSOLUTE, i % 3);
+	}
+
+	Stamp * t = new Stamp[n];
+	Value * v = new Value[n];
+	unsigned int words = (n + 31) / 32;
+	unsigned int * changed_simd = new unsigned int[words];
+	unsigned int * changed_scalar = new unsigned int[words];
+
+	unsigned long long changes_simd = 0, changes_scalar = 0, changes_objects = 0;
+	double time_simd = 0, time_scalar = 0, time_objects = 0;
+	bool same = true;
+
+	srand(1);
+	for(unsigned int r = 0; r < rounds; r++) {
+		for(unsigned int i = 0; i < n; i++) {
+			t[i] = 1600000000000000ULL + r * 1000000ULL + i;
+			v[i] = 20 + sin(r / 50.0 + i) * 2 + (rand() % 100) / 1000.0;
+		}
+
+		double s = seconds();
+		changes_simd += simd.trickle(t, v, changed_simd);
+		time_simd += seconds() - s;
+
+		s = seconds();
+		changes_scalar += scalar.trickle(t, v, changed_scalar);
+		time_scalar += seconds() - s;
+
+		s = seconds();
+		for(unsigned int i = 0; i < n; i++)
+			changes_objects += !objects[i].trickle(t[i], v[i]);
+		time_objects += seconds() - s;
+
+		if(memcmp(changed_simd, changed_scalar, words * sizeof(unsigned int)))
+			same = false;
+	}
+	for(unsigned int i = 0; i < n; i++)
+		if(simd.predict(i, t[i]) != scalar.predict(i, t[i]))
+			same = false;
+
+	double samples = static_cast<double>(n) * rounds;
+	printf("%u series x %u rounds, ns per series:\n", n, rounds);
+	printf("bank (%s)   %8.1f   %llu models changed\n", simd.simd() ? "AVX2" : "no AVX2", time_simd / samples * 1e9, changes_simd);
+	printf("bank (scalar) %8.1f   %llu models changed\n", time_scalar / samples * 1e9, changes_scalar);
+	printf("LVP objects   %8.1f   %llu models changed (in float)\n", time_objects / samples * 1e9, changes_objects);
+	printf("bank paths %s\n", same ? "agree" : "DISAGREE!");
+
+	delete [] changed_scalar;
+	delete [] changed_simd;
+	delete [] v;
+	delete [] t;
+	delete [] objects;
+
+	return same ? 0 : 1;
+}
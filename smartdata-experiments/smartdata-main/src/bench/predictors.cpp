@@ -0,0 +1,108 @@
+#include "main_traits.h"
+#include <smartdata.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+// Predictor benchmark: a node trickles noisy samples of a signal into each predictor engine, sending its model to
+// a sink (i.e. to a second predictor of the same kind) whenever the model expires, as predictive SmartData do. For
+// each engine and relative error (with the other parameters of Traits<SmartData>), it reports how many models were
+// sent, their size, how far the sink's predictions were from the noise-free signal and the time taken per sample.
+// Usage: smartdata-bench-predictors [samples] (from a Release build)
+
+typedef unsigned long long Stamp;
+
+static const Stamp PERIOD = 10000; // us (100 Hz)
+static const double NOISE = 0.1; // standard deviation
+static const unsigned int REPETITIONS = 20; // of the timed runs
+
+static volatile unsigned int expired; // keeps the timed runs from being optimized away
+
+static double gaussian()
+{
+	double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+	double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+	return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+// An accelerometer at rest, tilted every 1000 samples
+static double gravity(unsigned int i) { return 9.81 * cos(((i / 1000) % 4) * 0.3); }
+// A slow drift, e.g. a temperature
+static double ramp(unsigned int i) { return 20 + i * 0.0005; }
+
+static double seconds()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+template<typename Predictor>
+static void run(const char * name, float error, double (* signal)(unsigned int), unsigned int n)
+{
+	SmartData::Prediction p;
+	p.relative_error = error;
+
+	double * truth = new double[n];
+	float * v = new float[n];
+	srand(7);
+	for(unsigned int i = 0; i < n; i++) {
+		truth[i] = signal(i);
+		v[i] = truth[i] + NOISE * gaussian();
+	}
+
+	// The node alone, timed
+	double elapsed = seconds();
+	for(unsigned int r = 0; r < REPETITIONS; r++) {
+		Predictor timed(p, false);
+		for(unsigned int i = 0; i < n; i++)
+			expired += !timed.trickle(1700000000000000ULL + i * PERIOD, v[i]);
+	}
+	elapsed = (seconds() - elapsed) / REPETITIONS;
+
+	// The node and the sink
+	Predictor node(p, false);
+	Predictor sink(p, false);
+	unsigned int sent = 0;
+	double worst = 0, total = 0;
+	for(unsigned int i = 0; i < n; i++) {
+		Stamp t = 1700000000000000ULL + i * PERIOD;
+		if(!node.trickle(t, v[i])) {
+			sent++;
+			sink.update(node.model(), false);
+		}
+
+		double e = fabs(sink.predict(t) - truth[i]) / fabs(truth[i]);
+		if(e > worst)
+			worst = e;
+		total += e;
+	}
+
+	printf("  %-4s %3.0f%%: %5u models (%6.1fx fewer messages) of %2u bytes, sink error %5.2f%% on average, %5.2f%% at worst, %4.1f ns per sample\n",
+		name, error, sent, sent ? static_cast<double>(n) / sent : n, static_cast<unsigned int>(sizeof(typename Predictor::Model)), total / n * 100, worst * 100, elapsed / n * 1e9);
+
+	delete [] v;
+	delete [] truth;
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned int n = (argc > 1) ? atoi(argv[1]) : 10000;
+
+	static const float ERRORS[] = { 1, 2, 5 };
+	const char * names[] = { "accelerometer (9.81 m/s2, tilted every 1000 samples)", "ramp (20 + 0.0005 per sample)" };
+	double (* signals[])(unsigned int) = { &gravity, &ramp };
+
+	for(unsigned int s = 0; s < 2; s++) {
+		printf("%s, %u samples at 100 Hz with noise of sd %.1f:\n", names[s], n, NOISE);
+		for(unsigned int e = 0; e < sizeof(ERRORS) / sizeof(ERRORS[0]); e++) {
+			run<LVP<Stamp, float>>("LVP", ERRORS[e], signals[s], n);
+			run<DBP<Stamp, float>>("DBP", ERRORS[e], signals[s], n);
+			run<KFP<Stamp, float>>("KFP", ERRORS[e], signals[s], n);
+			run<DESP<Stamp, float>>("DESP", ERRORS[e], signals[s], n);
+		}
+	}
+
+	return 0;
+}
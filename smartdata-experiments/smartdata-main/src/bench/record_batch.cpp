@@ -0,0 +1,111 @@
+#include "main_traits.h"
+#include <system/record_batch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+// Record_Batch benchmark: encodes records of a few interleaved, slowly changing series into a stream of batches,
+// RAW and DELTA, then walks the stream back, checking every record against what was encoded. Reports the bytes each
+// record takes, the encode and decode rates, and whether a RAW batch claiming another kind of host is rejected.
+// Usage: smartdata-bench-record_batch [records] [records per batch] (from a Release build)
+
+typedef SmartData::DB_Record DB_Record;
+
+static const unsigned long long PERIOD = 10000; // us
+
+// Record i: one of 4 devices in turn, a sine quantized to 0.1, sampled every PERIOD with some jitter
+static DB_Record record(unsigned int i)
+{
+	DB_Record r;
+	memset(&r, 0, sizeof(r)); // padding included, as records are compared with memcmp()
+	r.type = 1;
+	r.unit = 0x84924964 + (i % 4 == 3);
+	r.value = round(100 * sin(i / 1000.0)) / 10;
+	r.uncertainty = 3;
+	r.confidence = 90;
+	r.x = 1000 + (i % 4);
+	r.y = -200;
+	r.z = 15;
+	r.device = i % 4;
+	r.t = 1600000000000000ULL + PERIOD * i + (i % 7);
+	return r;
+}
+
+static double seconds()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned int n = (argc > 1) ? atoi(argv[1]) : 1000000;
+	unsigned int batch = (argc > 2) ? atoi(argv[2]) : 1000;
+	n = (n + batch - 1) / batch * batch;
+
+	DB_Record * records = new DB_Record[n];
+	for(unsigned int i = 0; i < n; i++)
+		records[i] = record(i);
+
+	unsigned int capacity = n / batch * Record_Batch::size(batch, Record_Batch::DELTA);
+	unsigned char * stream = new unsigned char[capacity];
+	unsigned int raw = 0;
+
+	for(unsigned int e = Record_Batch::RAW; e <= Record_Batch::DELTA; e++) {
+		Record_Batch::Encoding encoding = Record_Batch::Encoding(e);
+
+		double t = seconds();
+		unsigned int length = 0;
+		for(unsigned int i = 0; i < n; i += batch) {
+			Record_Batch::Encoder encoder(stream + length, capacity - length, encoding);
+			encoder.put(&records[i], batch);
+			length += encoder.length();
+		}
+		double encode = seconds() - t;
+
+		t = seconds();
+		unsigned int decoded = 0;
+		bool exact = true;
+		for(unsigned int offset = 0; offset < length;) {
+			Record_Batch b(stream + offset, length - offset);
+			if(!b.valid()) {
+				exact = false;
+				break;
+			}
+			Record_Batch::Reader reader(b);
+			DB_Record r;
+			while(reader.next(&r)) {
+				exact &= (decoded < n) && !memcmp(&r, &records[decoded], sizeof(r));
+				decoded++;
+			}
+			offset += b.length();
+		}
+		double decode = seconds() - t;
+		exact &= (decoded == n);
+
+		if(encoding == Record_Batch::RAW)
+			raw = length;
+
+		printf("%-5s: %5.1f bytes per record (%3.0f%% of RAW), encode %6.1f M records/s, decode %6.1f M records/s, %u of %u records exact=%d\n",
+			(encoding == Record_Batch::RAW) ? "RAW" : "DELTA", double(length) / n, 100.0 * length / raw, n / encode / 1e6, n / decode / 1e6, decoded, n, exact);
+	}
+
+	// A RAW batch is only read in place by the same kind of host
+	Record_Batch::Encoder encoder(stream, capacity, Record_Batch::RAW);
+	encoder.put(records, batch);
+	Record_Batch::Header * header = reinterpret_cast<Record_Batch::Header *>(stream);
+	header->order = (Record_Batch::ORDER == Record_Batch::LITTLE) ? Record_Batch::BIG : Record_Batch::LITTLE;
+	bool order = !Record_Batch(stream, encoder.length()).valid();
+	header->order = Record_Batch::ORDER;
+	header->layout = Record_Batch::LAYOUT + 8;
+	bool layout = !Record_Batch(stream, encoder.length()).valid();
+	printf("RAW batches of a foreign byte order rejected=%d, of a foreign DB_Record layout rejected=%d\n", order, layout);
+
+	delete [] stream;
+	delete [] records;
+
+	return 0;
+}
@@ -0,0 +1,164 @@
+#include "main_traits.h"
+#include <system/series_store.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+// Series_Store benchmark: appends records of slowly changing series in batches (as Series_Ingestor does), then
+// reports the ingest rate, the bytes each record takes in the file, the rate of time range queries (checking every
+// record against what was appended) and of aggregate queries, and whether a file with a torn tail is recovered, as
+// well as whether a store synced right before a crash aggregates, at every rollup, the records it queries.
+// Usage: smartdata-bench-series_store [file] [series] [records per series] (from a Release build)
+
+typedef SmartData::DB_Record DB_Record;
+typedef SmartData::DB_Series DB_Series;
+
+static const unsigned int BATCH = 64;
+static const unsigned long long PERIOD = 1000000; // us
+
+// Record i of series s: a sine quantized to 0.1, sampled every PERIOD with some jitter
+static DB_Record record(unsigned int s, unsigned int i)
+{
+	DB_Record r;
+	r.type = 1;
+	r.unit = 0x84924964 + s;
+	r.value = 20.0 + round(10 * sin(i / 100.0 + s)) / 10;
+	r.uncertainty = 0;
+	r.confidence = 100;
+	r.x = 10 * s;
+	r.y = 5;
+	r.z = 0;
+	r.device = s & 3;
+	r.t = PERIOD * i + ((i % 7 == 0) ? 13 : 0);
+	return r;
+}
+
+static double seconds()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int main(int argc, char* argv[])
+{
+	const char * path = (argc > 1) ? argv[1] : "/tmp/smartdata-bench.db";
+	unsigned int series = (argc > 2) ? atoi(argv[2]) : 100;
+	unsigned int n = (argc > 3) ? (atoi(argv[3]) + BATCH - 1) / BATCH * BATCH : 50048;
+
+	unlink(path);
+	Series_Store::Series_Id * ids = new Series_Store::Series_Id[series];
+	DB_Record * batch = new DB_Record[BATCH];
+	unsigned long long total = static_cast<unsigned long long>(series) * n;
+	bool exact = true;
+
+	{
+		Series_Store store(path);
+		if(!store.ready()) {
+			printf("Could not open %s\n", path);
+			return 1;
+		}
+
+		for(unsigned int s = 0; s < series; s++) {
+			DB_Series d = {1, 0x84924964 + s, 10 * static_cast<long>(s), 5, 0, static_cast<long>(s & 3), 100, 0, ~0ULL};
+			ids[s] = store.series(d);
+		}
+
+		double t = seconds();
+		for(unsigned int i = 0; i < n; i += BATCH)
+			for(unsigned int s = 0; s < series; s++) {
+				for(unsigned int k = 0; k < BATCH; k++)
+					batch[k] = record(s, i + k);
+				store.append(ids[s], batch, BATCH);
+			}
+		store.flush();
+		t = seconds() - t;
+		printf("ingest: %llu records, %.2f M records/s, %.2f bytes per record (%u in memory)\n",
+			total, total / t / 1e6, static_cast<double>(store.size()) / total, static_cast<unsigned int>(sizeof(DB_Record)));
+
+		// The middle 80% of every series, one record of which is not sealed yet
+		store.append(ids[0], record(0, n));
+		unsigned int first = n / 10;
+		unsigned int last = n - n / 10;
+		unsigned long long queried = 0;
+		t = seconds();
+		for(unsigned int s = 0; s < series; s++) {
+			unsigned int i = first;
+			queried += store.query(ids[s], PERIOD * first, PERIOD * last + 50, [&](const DB_Record & r) {
+				DB_Record e = record(s, i++);
+				if(memcmp(&e, &r, sizeof(DB_Record)))
+					exact = false;
+			});
+		}
+		t = seconds() - t;
+		printf("query: %llu records, %.2f M records/s, %s\n", queried, queried / t / 1e6, exact ? "as appended" : "NOT as appended!");
+
+		// Hourly means over the same range
+		unsigned long long windows = 0;
+		double sum = 0;
+		t = seconds();
+		for(unsigned int s = 0; s < series; s++)
+			windows += store.aggregate(ids[s], PERIOD * first, PERIOD * last, 3600 * PERIOD, [&](const Series_Store::Aggregate & a) { sum += a.sum / a.count; });
+		t = seconds() - t;
+		printf("aggregate: %llu hourly windows in %.3f ms\n", windows, t * 1e3);
+	}
+
+	// A torn append at the end of the file, as a crash would leave
+	int fd = open(path, O_WRONLY | O_APPEND);
+	if(write(fd, "SDBKxxxx", 8) != 8)
+		exact = false;
+	close(fd);
+
+	{
+		double t = seconds();
+		Series_Store store(path);
+		t = seconds() - t;
+		unsigned long long recovered = 0;
+		for(unsigned int s = 0; s < store.series(); s++)
+			recovered += store.records(s);
+		printf("recovery: %u series, %llu records in %.3f ms\n", store.series(), recovered, t * 1e3);
+		if(recovered != total + 1)
+			exact = false;
+	}
+
+	// A crash right after a sync (no destructor closes the open windows of the rollups)
+	unlink(path);
+	unsigned int m = 5000;
+	if(!fork()) {
+		Series_Store store(path);
+		DB_Series d = {1, 0x84924964, 0, 5, 0, 0, 100, 0, ~0ULL};
+		Series_Store::Series_Id id = store.series(d);
+		for(unsigned int i = 0; i < m; i++)
+			store.append(id, record(0, i));
+		_exit(store.sync() ? 0 : 1);
+	}
+	int status;
+	wait(&status);
+
+	{
+		Series_Store store(path);
+		unsigned long long queried = store.query(0, 0, ~0ULL, [](const DB_Record &) {});
+		printf("crash: %llu of %u records synced, aggregated as", queried, m);
+		if(!WIFEXITED(status) || WEXITSTATUS(status) || (queried != m))
+			exact = false;
+		for(unsigned int l = 0; l < Series_Store::LEVELS; l++) {
+			unsigned long long count = 0;
+			store.aggregate(0, 0, ~0ULL, Series_Store::window(l), [&](const Series_Store::Aggregate & a) { count += a.count; });
+			printf(" %llu", count);
+			if(count != queried)
+				exact = false;
+		}
+		printf("\n");
+	}
+
+	unlink(path);
+	delete [] batch;
+	delete [] ids;
+
+	return exact ? 0 : 1;
+}
@@ -0,0 +1,24 @@
+#include "main_traits.h"
+#include <utility/log.h>
+#include <string.h>
+
+// Renders a binary log written with Traits<Debug>::LOG_FILE set; -t prefixes each line with its time stamp (TSC) and thread
+int main(int argc, char* argv[])
+{
+	bool stamped = (argc == 3) && !strcmp(argv[1], "-t");
+	if(argc != 2 + stamped) {
+		kout << "Usage: " << argv[0] << " [-t] <log file>" << endl;
+		return 1;
+	}
+
+	FILE * in = fopen(argv[argc - 1], "rb");
+	if(!in) {
+		kout << "Could not open " << argv[argc - 1] << endl;
+		return 1;
+	}
+
+	Log::decode(in, kout, stamped);
+	fclose(in);
+
+	return 0;
+}
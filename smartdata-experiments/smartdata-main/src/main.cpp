@@ -3,6 +3,8 @@
 #include <network/tstp/tstp.h>
 #include <transducer.h>
 #include <smartdata.h>
+#include <system/series_store.h>
+#include <system/series_ingestor.h>
 #include <unistd.h>
 #include <string.h>
 
@@ -13,6 +15,7 @@ static const int ITERATIONS = 10;
 // This is not good, but it will work...
 unsigned int globalCoord = 1;
 const char* globalIPAddress = "127.0.0.1";
+const char* globalInterface = "veth0";
 
 OStream cout;
 
@@ -94,12 +97,18 @@ void sink()
 	cout << "My coordinates are " << a.here() << endl;
 	cout << "The time now is " << a.now() << endl;
 
+	// Every value received is kept in the series database
+	Series_Store store("smartdata.db");
+	Series_Ingestor ingestor(&store);
+	Series_Recorder<Antigravity_Proxy> recorder(&a, &ingestor);
+
 	cout << "I'm interested on " << SmartData::Unit(a.unit()) << endl;
 	cout << "I'll wait for data of this kind for " << ITERATIONS << " seconds..." << endl;
 	for (int i = 0; i < ITERATIONS + 5; i++) {
-		cout << "a=" << a << endl;
+		cout << "a=" << a << " (" << ingestor.records() << " records)" << endl;
 		Delay(5);
 	}
+	ingestor.flush();
 	cout << "done!" << endl;
 }
 
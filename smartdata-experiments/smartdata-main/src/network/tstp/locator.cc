@@ -7,10 +7,6 @@
 #include <main_traits.h>
 #include <network/tstp/tstp.h>
 
-// Class attributes
-TSTP::Global_Space TSTP::Locator::_reference;
-TSTP::Locator::Engine TSTP::Locator::_engine;
-
 // Methods
 TSTP::Locator::~Locator()
 {
@@ -31,7 +27,7 @@ void TSTP::Locator::update(Data_Observed<Buffer> * obs, Buffer * buf)
             buf->my_distance = here() - sink();
     } else {
         Header * header = buf->frame()->data<Header>();
-        Space dst = Space(Router::destination(buf).center);
+        Space dst = Space(_tstp->_router->destination(buf).center);
         buf->sender_distance = header->last_hop().space - dst;
         _engine.learn(header->last_hop(), header->location_confidence(), buf->rssi);
 
@@ -40,22 +36,20 @@ void TSTP::Locator::update(Data_Observed<Buffer> * obs, Buffer * buf)
 
         // Respond to Keep Alive if sender is low on location confidence
         if(_engine.synchronized() && (header->type() == CONTROL) && (header->subtype() == KEEP_ALIVE) && !_engine.neigbor_synchronized(header->location_confidence()))
-            Timekeeper::keep_alive();
+            _tstp->_timekeeper->keep_alive();
     }
 }
 
-
-// Class Methods
 void TSTP::Locator::marshal(Buffer * buf)
 {
     db<TSTP>(TRC) << "TSTP::Locator::marshal(buf=" << buf << ")" << endl;
 
-    Space dst = Space(Router::destination(buf).center);
+    Space dst = Space(_tstp->_router->destination(buf).center);
     buf->my_distance = here() - dst;
     if(buf->is_new)
         buf->sender_distance = buf->my_distance;
     buf->downlink = dst != sink(); // This would fit better in the Router, but Timekeeper uses this info
-    buf->frame()->data<Header>()->location_confidence(Locator::confidence());
+    buf->frame()->data<Header>()->location_confidence(confidence());
     buf->frame()->data<Header>()->origin(here());
     buf->frame()->data<Header>()->origin(now());
     buf->frame()->data<Header>()->last_hop(here());
@@ -69,19 +69,17 @@ void TSTP::Router::update(Data_Observed<Buffer> * obs, Buffer * buf)
                 send_header->last_hop(now());
                 send_buf->sender_distance = send_buf->my_distance;
 
-                header->location_confidence(_locator->confidence());
-                header->time_request(!Timekeeper::synchronized());
+                header->location_confidence(_tstp->_locator->confidence());
+                header->time_request(!synchronized());
 
                 send_buf->hint = send_buf->my_distance;
 
-                _nic->send(send_buf);
+                nic()->send(send_buf);
             }
         }
     }
 }
 
-
-// Class Methods
 void TSTP::Router::marshal(Buffer * buf)
 {
     db<TSTP>(TRC) << "TSTP::Router::marshal(buf=" << buf << ")" << endl;
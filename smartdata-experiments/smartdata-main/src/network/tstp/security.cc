@@ -10,33 +10,25 @@
 #ifdef __tstp__
 
 // Class attributes
-TSTP::Security::_AES TSTP::Security::_aes;
-TSTP::Security::_AES & TSTP::Security::_cipher = TSTP::Security::_aes;
-TSTP::Security::Node_Id TSTP::Security::_id;
-TSTP::Security::Auth TSTP::Security::_auth;
-TSTP::Security::_DH TSTP::Security::_dh;
-TSTP::Security::Pending_Keys TSTP::Security::_pending_keys;
-TSTP::Security::Peers TSTP::Security::_pending_peers;
-TSTP::Security::Peers TSTP::Security::_trusted_peers;
-volatile bool TSTP::Security::_peers_lock;
-Thread * TSTP::Security::_key_manager = 0;
-unsigned int TSTP::Security::_dh_requests_open;
 const SmartData::Time::Type TSTP::Security::KEY_MANAGER_PERIOD;
 const SmartData::Time::Type TSTP::Security::KEY_EXPIRY;
+const SmartData::Time::Type TSTP::Security::HANDSHAKE_TIMEOUT;
+const SmartData::Time::Type TSTP::Security::KEY_RENEWAL;
 
 // Methods
 TSTP::Security::~Security()
 {
     db<TSTP>(TRC) << "TSTP::~Security()" << endl;
     detach(this);
-    if(_key_manager)
-        delete _key_manager;
-    while(Peers::Element * el = _trusted_peers.remove_head())
-        delete el->object();
-    while(Peers::Element * el = _pending_peers.remove_head())
-        delete el->object();
-    while(Pending_Keys::Element * el = _pending_keys.remove_head())
-        delete el->object();
+    stop();
+
+    while(Peers::Element * el = _trusted_peers.head())
+        untrust(el->object());
+    while(Peers::Element * el = _pending_peers.head())
+        discard(el->object());
+    pthread_rwlock_destroy(&_peers_lock);
+    pthread_cond_destroy(&_key_manager_wakeup);
+    pthread_mutex_destroy(&_key_manager_mutex);
 }
 
 void TSTP::Security::update(Data_Observed<Buffer> * obs, Buffer * buf)
@@ -50,161 +42,22 @@ void TSTP::Security::update(Data_Observed<Buffer> * obs, Buffer * buf)
             case CONTROL: {
                 db<TSTP>(TRC) << "TSTP::Security::update(): Control message received" << endl;
                 switch(header->subtype()) {
-                    case DH_REQUEST: {
-                        if(TSTP::here() != TSTP::sink()) {
-                            DH_Request * dh_req = buf->frame()->data<DH_Request>();
-                            db<TSTP>(INF) << "TSTP::Security::update(): DH_Request message received: " << *dh_req << endl;
-
-                            //while(CPU::tsl(_peers_lock));
-                            //CPU::int_disable();
-                            bool valid_peer = false;
-                            for(Peers::Element * el = _pending_peers.head(); el; el = el->next())
-                                if(el->object()->valid_deploy(dh_req->origin(), TSTP::now())) {
-                                    valid_peer = true;
-                                    break;
-                                }
-                            if(!valid_peer)
-                                for(Peers::Element * el = _trusted_peers.head(); el; el = el->next())
-                                    if(el->object()->valid_deploy(dh_req->origin(), TSTP::now())) {
-                                        valid_peer = true;
-                                        _trusted_peers.remove(el);
-                                        _pending_peers.insert(el);
-                                        break;
-                                    }
-                            //_peers_lock = false;
-                            //CPU::int_enable();
-
-                            if(valid_peer) {
-                                db<TSTP>(TRC) << "TSTP::Security::update(): Sending DH_Response" << endl;
-                                // Respond to Diffie-Hellman request
-                                Buffer * resp = TSTP::alloc(sizeof(DH_Response));
-                                new ((void*)resp->frame()) DH_Response(_dh.public_key());
-                                TSTP::marshal(resp);
-                                TSTP::_nic->send(resp);
-
-                                // Calculate Master Secret
-                                Pending_Key * pk = new /*(SYSTEM)*/ Pending_Key(buf->frame()->data<DH_Request>()->key());
-                                Master_Secret ms = pk->master_secret();
-                                //while(CPU::tsl(_peers_lock));
-                                //CPU::int_disable();
-                                _pending_keys.insert(pk->link());
-                                //_peers_lock = false;
-                                //CPU::int_enable();
-
-                                db<TSTP>(TRC) << "TSTP::Security::update(): Sending Auth_Request" << endl;
-                                // Send Authentication Request
-                                resp = TSTP::alloc(sizeof(Auth_Request));
-                                new (resp->frame()) Auth_Request(_auth, otp(ms, _id));
-                                TSTP::marshal(resp);
-                                TSTP::_nic->send(resp);
-                                db<TSTP>(TRC) << "Sent" << endl;
-                            }
-                        }
-                    } break;
-
-                    case DH_RESPONSE: {
-                        if(_dh_requests_open) {
-                            DH_Response * dh_resp = buf->frame()->data<DH_Response>();
-                            db<TSTP>(INF) << "TSTP::Security::update(): DH_Response message received: " << *dh_resp << endl;
-
-                            //CPU::int_disable();
-                            bool valid_peer = false;
-                            for(Peers::Element * el = _pending_peers.head(); el; el = el->next())
-                                if(el->object()->valid_deploy(dh_resp->origin(), TSTP::now())) {
-                                    valid_peer = true;
-                                    db<TSTP>(TRC) << "Valid peer found: " << *el->object() << endl;
-                                    break;
-                                }
-
-                            if(valid_peer) {
-                                _dh_requests_open--;
-                                Pending_Key * pk = new /*(SYSTEM)*/ Pending_Key(buf->frame()->data<DH_Response>()->key());
-                                _pending_keys.insert(pk->link());
-                                db<TSTP>(INF) << "TSTP::Security::update(): Inserting new Pending Key: " << *pk << endl;
-                            }
-                            //CPU::int_enable();
-                        }
-                    } break;
-
-                    case AUTH_REQUEST: {
-
-                        Auth_Request * auth_req = buf->frame()->data<Auth_Request>();
-                        db<TSTP>(INF) << "TSTP::Security::update(): Auth_Request message received: " << *auth_req << endl;
-
-                        //CPU::int_disable();
-                        Peer * auth_peer = 0;
-                        for(Peers::Element * el = _pending_peers.head(); el; el = el->next()) {
-                            Peer * peer = el->object();
-
-                            if(peer->valid_request(auth_req->auth(), auth_req->origin(), TSTP::now())) {
-                                for(Pending_Keys::Element * pk_el = _pending_keys.head(); pk_el; pk_el = pk_el->next()) {
-                                    Pending_Key * pk = pk_el->object();
-                                    if(verify_auth_request(pk->master_secret(), peer->id(), auth_req->otp())) {
-                                        peer->master_secret(pk->master_secret());
-                                        _pending_peers.remove(el);
-                                        _trusted_peers.insert(el);
-                                        auth_peer = peer;
-
-                                        _pending_keys.remove(pk_el);
-                                        delete pk_el->object();
-
-                                        break;
-                                    }
-                                }
-                                if(auth_peer)
-                                    break;
-                            }
-                        }
-                        //CPU::int_enable();
-
-                        if(auth_peer) {
-                            Auth encrypted_auth;
-                            encrypt(auth_peer->auth(), auth_peer, encrypted_auth);
-
-                            Buffer * resp = TSTP::alloc(sizeof(Auth_Granted));
-                            new (resp->frame()) Auth_Granted(auth_peer->valid(), encrypted_auth);
-                            TSTP::marshal(resp);
-                            db<TSTP>(INF) << "TSTP::Security: Sending Auth_Granted message " << resp->frame()->data<Auth_Granted>() << endl;
-                            TSTP::_nic->send(resp);
-                        } else
-                            db<TSTP>(WRN) << "TSTP::Security::update(): No peer found" << endl;
-                    } break;
-
+                    case DH_REQUEST:
+                    case DH_RESPONSE:
+                    case AUTH_REQUEST:
                     case AUTH_GRANTED: {
-
-                        if(TSTP::here() != TSTP::sink()) {
-                            Auth_Granted * auth_grant = buf->frame()->data<Auth_Granted>();
-                            db<TSTP>(INF) << "TSTP::Security::update(): Auth_Granted message received: " << *auth_grant << endl;
-                            //CPU::int_disable();
-                            bool auth_peer = false;
-                            for(Peers::Element * el = _pending_peers.head(); el; el = el->next()) {
-                                Peer * peer = el->object();
-                                for(Pending_Keys::Element * pk_el = _pending_keys.head(); pk_el; pk_el = pk_el->next()) {
-                                    Pending_Key * pk = pk_el->object();
-                                    Auth decrypted_auth;
-                                    OTP key = otp(pk->master_secret(), peer->id());
-                                    _cipher.decrypt(auth_grant->auth(), key, decrypted_auth);
-                                    if(decrypted_auth == _auth) {
-                                        peer->master_secret(pk->master_secret());
-                                        _pending_peers.remove(el);
-                                        _trusted_peers.insert(el);
-                                        auth_peer = true;
-
-                                        _pending_keys.remove(pk_el);
-                                        delete pk_el->object();
-
-                                        break;
-                                    }
-                                }
-                                if(auth_peer)
-                                    break;
-                            }
-                            //CPU::int_enable();
-                        }
+                        // Copied out of the frame for the handshaker of its origin
+                        unsigned char * msg = new /*(SYSTEM)*/ unsigned char[HANDSHAKE_SIZE];
+                        memcpy(msg, buf->frame()->data<unsigned char>(), HANDSHAKE_SIZE);
+                        const Space & o = header->space();
+                        unsigned long h = o.x;
+                        h = h * 31 + o.y;
+                        h = h * 31 + o.z;
+                        _handshakers[(h ^ (h >> 16)) % _n_handshakers].put(reinterpret_cast<Control *>(msg));
                     } break;
 
                     case MODEL: {
-                        buf->trusted = true;
+                        // Left untrusted here, as responses are
                     } break;
 
                     default: break;
@@ -213,20 +66,7 @@ void TSTP::Security::update(Data_Observed<Buffer> * obs, Buffer * buf)
             break;
             case RESPONSE: {
                 db<TSTP>(INF) << "TSTP::Security::update(): Response message received from " << buf->frame()->data<Header>()->origin() << endl;
-//                Response * resp = buf->frame()->data<Response>();
-                Time reception_time = ts2us(buf->sfdts);
-                for(Peers::Element * el = _trusted_peers.head(); el; el = el->next()) {
-                    if(el->object()->valid_deploy(header->origin(), TSTP::now())) {
-                        unsigned char * data = buf->frame()->data<unsigned char>();
-                        if(unpack(el->object(), data, &data[sizeof(Master_Secret)], reception_time)) {
-                            buf->trusted = true;
-                            break;
-                        } else {
-                            db<TSTP>(WRN) << "TSTP::Security: Unpack failed" << endl;
-                        }
-                    }
-                }
-                buf->trusted = true; // TODO
+                // Left untrusted here: the workers of the stack authenticate responses in batches, before delivering them
             } break;
             case INTEREST: {
                 buf->trusted = true;
@@ -239,18 +79,214 @@ void TSTP::Security::update(Data_Observed<Buffer> * obs, Buffer * buf)
     }
 }
 
+void TSTP::Security::handshake(Control * msg)
+{
+    db<TSTP>(TRC) << "TSTP::Security::handshake(msg=" << msg << ")" << endl;
+
+    switch(msg->subtype()) {
+        case DH_REQUEST: {
+            if(here() != sink()) {
+                DH_Request * dh_req = reinterpret_cast<DH_Request *>(msg);
+                db<TSTP>(INF) << "TSTP::Security::handshake(): DH_Request message received: " << *dh_req << endl;
+
+                Public_Key key = dh_req->key();
+                Master_Secret ms;
+
+                // A trusted peer asking for a handshake is renewing its key, and stays trusted meanwhile
+                write_lock();
+                Peer * peer = pending_peer(dh_req->origin(), now());
+                if(!peer)
+                    peer = trusted_peer(dh_req->origin(), now());
+                Pending_Key * pk = peer ? pending_key(key) : 0;
+                if(pk) {
+                    ms = pk->master_secret();
+                    pk->renew(now());
+                }
+                unlock();
+
+                if(peer) {
+                    db<TSTP>(TRC) << "TSTP::Security::handshake(): Sending DH_Response" << endl;
+                    // Respond to Diffie-Hellman request
+                    Buffer * resp = alloc(sizeof(DH_Response));
+                    new (resp->frame()->data<DH_Response>()) DH_Response(_dh.public_key());
+                    _tstp->marshal(resp);
+                    nic()->send(resp);
+
+                    // Calculate Master Secret (without holding the lock, since it is a point multiplication)
+                    if(!pk) {
+                        ms = _dh.shared_key(key);
+                        write_lock();
+                        peer = 0;
+                        peers(dh_req->origin(), now(), [&](Peer * p) { if(!peer) peer = p; });
+                        if(peer && !pending_key(key)) {
+                            pk = new /*(SYSTEM)*/ Pending_Key(key, ms, peer, now());
+                            peer->keys().insert(pk->link());
+                            _pending_keys.insert(pk->key_link());
+                        }
+                        unlock();
+                    }
+
+                    db<TSTP>(TRC) << "TSTP::Security::handshake(): Sending Auth_Request" << endl;
+                    // Send Authentication Request
+                    resp = alloc(sizeof(Auth_Request));
+                    new (resp->frame()->data<Auth_Request>()) Auth_Request(_auth, otp(ms, _id));
+                    _tstp->marshal(resp);
+                    nic()->send(resp);
+                    db<TSTP>(TRC) << "Sent" << endl;
+                }
+            }
+        } break;
+
+        case DH_RESPONSE: {
+            DH_Response * dh_resp = reinterpret_cast<DH_Response *>(msg);
+            Public_Key key = dh_resp->key();
+
+            // Only from peers we opened a handshake with
+            Peer * peer = 0;
+            read_lock();
+            peers(dh_resp->origin(), now(), [&](Peer * p) { if(!peer && p->handshaking()) peer = p; });
+            bool known = peer && pending_key(key);
+            unlock();
+
+            if(peer) {
+                db<TSTP>(INF) << "TSTP::Security::handshake(): DH_Response message received: " << *dh_resp << endl;
+
+                // Calculate Master Secret (without holding the lock, since it is a point multiplication)
+                Master_Secret ms;
+                if(!known)
+                    ms = _dh.shared_key(key);
+
+                write_lock();
+                peer = 0;
+                peers(dh_resp->origin(), now(), [&](Peer * p) { if(!peer && p->handshaking()) peer = p; });
+                if(peer) {
+                    db<TSTP>(TRC) << "Valid peer found: " << *peer << endl;
+                    Pending_Key * pk = pending_key(key);
+                    if(pk)
+                        pk->renew(now());
+                    else {
+                        if(known) // but expired meanwhile
+                            ms = _dh.shared_key(key);
+                        pk = new /*(SYSTEM)*/ Pending_Key(key, ms, peer, now());
+                        peer->keys().insert(pk->link());
+                        _pending_keys.insert(pk->key_link());
+                        db<TSTP>(INF) << "TSTP::Security::handshake(): Inserting new Pending Key: " << *pk << endl;
+                    }
+                }
+                unlock();
+            }
+        } break;
+
+        case AUTH_REQUEST: {
+
+            Auth_Request * auth_req = reinterpret_cast<Auth_Request *>(msg);
+            db<TSTP>(INF) << "TSTP::Security::handshake(): Auth_Request message received: " << *auth_req << endl;
+
+            Peer * auth_peer = 0;
+            Buffer * resp = 0;
+            bool closed = false;
+
+            write_lock();
+            Time t = now();
+            Auths::Key k = Auths::key(&auth_req->auth(), sizeof(Auth));
+            for(Auths::Element * el = _auths.search(k); el && (el->rank() == k); el = el->next()) {
+                Peer * peer = el->object();
+                if(!peer->valid_request(auth_req->auth(), auth_req->origin(), t))
+                    continue;
+
+                // Keys are linked to the first peer found at the origin of their DH message,
+                // which, where regions overlap, needs not be this one: those of its neighbors are tried too
+                Pending_Key * auth_key = 0;
+                peers(auth_req->origin(), t, [&](Peer * owner) {
+                    for(Pending_Keys::Element * pk_el = owner->keys().head(); pk_el && !auth_key; pk_el = pk_el->next())
+                        if(verify_auth_request(pk_el->object()->master_secret(), peer->id(), auth_req->otp()))
+                            auth_key = pk_el->object();
+                });
+
+                if(auth_key) {
+                    peer->master_secret(auth_key->master_secret(), t);
+                    if(!peer->trusted())
+                        trust(peer);
+                    discard(auth_key);
+                    if(peer->handshaking()) {
+                        peer->close_handshake();
+                        _dh_requests_open--;
+                        closed = true;
+                    }
+                    auth_peer = peer;
+                    break;
+                }
+            }
+            if(auth_peer) {
+                Auth encrypted_auth;
+                encrypt(auth_peer->auth(), auth_peer, encrypted_auth);
+
+                resp = alloc(sizeof(Auth_Granted));
+                new (resp->frame()->data<Auth_Granted>()) Auth_Granted(auth_peer->valid(), encrypted_auth);
+            }
+            unlock();
+
+            if(closed)
+                wake_key_manager();
+
+            if(resp) {
+                _tstp->marshal(resp);
+                db<TSTP>(INF) << "TSTP::Security: Sending Auth_Granted message " << resp->frame()->data<Auth_Granted>() << endl;
+                nic()->send(resp);
+            } else
+                db<TSTP>(WRN) << "TSTP::Security::handshake(): No peer found" << endl;
+        } break;
+
+        case AUTH_GRANTED: {
+
+            if(here() != sink()) {
+                Auth_Granted * auth_grant = reinterpret_cast<Auth_Granted *>(msg);
+                db<TSTP>(INF) << "TSTP::Security::handshake(): Auth_Granted message received: " << *auth_grant << endl;
+
+                write_lock();
+                Time t = now();
+                Peer * auth_peer = 0;
+                Pending_Key * auth_key = 0;
+                // Only the peers deployed at the origin, with the keys linked to any of them (see AUTH_REQUEST)
+                peers(auth_grant->origin(), t, [&](Peer * peer) {
+                    if(auth_peer)
+                        return;
+                    peers(auth_grant->origin(), t, [&](Peer * owner) {
+                        for(Pending_Keys::Element * pk_el = owner->keys().head(); pk_el && !auth_peer; pk_el = pk_el->next()) {
+                            Auth decrypted_auth;
+                            OTP key = otp(pk_el->object()->master_secret(), peer->id());
+                            _cipher.decrypt(auth_grant->auth(), key, decrypted_auth);
+                            if(decrypted_auth == _auth) {
+                                auth_peer = peer;
+                                auth_key = pk_el->object();
+                            }
+                        }
+                    });
+                });
+                if(auth_peer) {
+                    auth_peer->master_secret(auth_key->master_secret(), t);
+                    if(!auth_peer->trusted())
+                        trust(auth_peer);
+                    discard(auth_key);
+                }
+                unlock();
+            }
+        } break;
+
+        default: break;
+    }
+}
+
 void TSTP::Security::marshal(Buffer * buf)
 {
     db<TSTP>(TRC) << "TSTP::Security::marshal(buf=" << buf << ")" << endl;
     if(buf->frame()->data<Header>()->type() == TSTP::RESPONSE) {
-        Peer * peer = 0;
-        for(Peers::Element * el = _trusted_peers.head(); el; el = el->next())
-            if(el->object()->valid_deploy(Router::destination(buf).center, TSTP::now())) {
-                peer = el->object();
-                break;
-            }
-        if(!peer)
+        read_lock();
+        Peer * peer = trusted_peer(_tstp->_router->destination(buf).center, now());
+        if(!peer) {
+            unlock();
             return;
+        }
 
         // Pad data to the size of the key
         unsigned int data_size = buf->size() - (sizeof(Response) - (MTU - sizeof(Unit) - sizeof(int) - sizeof(Time) - sizeof(Trailer)));
@@ -260,26 +296,61 @@ void TSTP::Security::marshal(Buffer * buf)
         for(unsigned int i = data_size; i < sizeof(Master_Secret); i++)
             data[i] = 0;
 
-        pack(data, peer);
+        pack(data, sizeof(Master_Secret), peer);
+        unlock();
+        buf->trusted = true;
+    } else if((buf->frame()->data<Header>()->type() == TSTP::CONTROL) && (buf->frame()->data<Header>()->subtype() == TSTP::MODEL)) {
+        unsigned int size = buf->size();
+        if(size + sizeof(OTP) > MTU) {
+            db<TSTP>(WRN) << "TSTP::Security::marshal: no room for the MAC of a Model!" << endl;
+            return;
+        }
+
+        read_lock();
+        Peer * peer = trusted_peer(_tstp->_router->destination(buf).center, now());
+        if(!peer) {
+            unlock();
+            return;
+        }
+
+        // Forwarders rewrite the last hop, so a Model is packed without it
+        Header * header = buf->frame()->data<Header>();
+        Spacetime hop = header->last_hop();
+        header->last_hop(Spacetime(0, 0, 0, 0));
+        pack(buf->frame()->data<unsigned char>(), size, peer);
+        header->last_hop(hop);
+        unlock();
+        buf->size(size + sizeof(OTP));
         buf->trusted = true;
     } else
         buf->trusted = true;
 }
 
-void TSTP::Security::pack(unsigned char * msg, const Peer * peer)
+unsigned int TSTP::Security::packed(Buffer * buf)
+{
+    const Header * header = buf->frame()->data<Header>();
+    if(header->type() == TSTP::RESPONSE)
+        return sizeof(Master_Secret);
+    if((header->type() == TSTP::CONTROL) && (header->subtype() == TSTP::MODEL) && (buf->size() >= sizeof(Manager::Model) - sizeof(Manager::Model::Data) + sizeof(OTP)))
+        return buf->size() - sizeof(OTP);
+    return 0;
+}
+
+void TSTP::Security::pack(unsigned char * msg, unsigned int size, const Peer * peer)
 {
-    Time t = TSTP::now() / POLY_TIME_WINDOW;
+    Time t = now() / POLY_TIME_WINDOW;
 
-    const unsigned char * ms = reinterpret_cast<const unsigned char *>(&peer->master_secret());
+    unsigned char ms[sizeof(Master_Secret)];
+    peer->master_secret().to_bytes(ms, sizeof(Master_Secret));
     const unsigned char * id = reinterpret_cast<const unsigned char *>(&peer->id());
 
     unsigned char nonce[16];
     memset(nonce, 0, 16);
     memcpy(nonce, &t, sizeof(Time) < 16u ? sizeof(Time) : 16u);
 
-    _Poly1305 poly(id, ms);
+    _Poly1305 poly(peer->schedule(), ms, _aes);
 
-    poly.stamp(&msg[sizeof(Master_Secret)], nonce, reinterpret_cast<const unsigned char *>(msg), sizeof(Master_Secret));
+    poly.stamp(&msg[size], nonce, reinterpret_cast<const unsigned char *>(msg), size);
 
     if(use_encryption) {
         // mi = ms ^ _id
@@ -299,12 +370,100 @@ void TSTP::Security::pack(unsigned char * msg, const Peer * peer)
     }
 }
 
-bool TSTP::Security::unpack(const Peer * peer, unsigned char * msg, const unsigned char * mac, Time reception_time)
+unsigned int TSTP::Security::authenticate(Buffer * const bufs[], unsigned int n)
 {
-    unsigned char original_msg[sizeof(Master_Secret)];
-    memcpy(original_msg, msg, sizeof(Master_Secret));
+    db<TSTP>(TRC) << "TSTP::Security::authenticate(n=" << n << ")" << endl;
+
+    unsigned int authentic = 0;
+
+    read_lock();
+    for(unsigned int first = 0; first < n; first += BATCH) {
+        unsigned int count = (n - first < BATCH) ? n - first : BATCH;
+        Time t = now();
+
+        Peer * peers[BATCH];
+        bool done[BATCH];
+        Spacetime hops[BATCH];
+        for(unsigned int i = 0; i < count; i++) {
+            Header * header = bufs[first + i]->frame()->data<Header>();
+            peers[i] = trusted_peer(header->origin(), t);
+            done[i] = !peers[i];
+            hops[i] = header->last_hop();
+            if(header->type() == TSTP::CONTROL)
+                header->last_hop(Spacetime(0, 0, 0, 0));
+        }
+
+        for(unsigned int i = 0; i < count; i++) {
+            if(done[i])
+                continue;
+            Peer * peer = peers[i];
+
+            unsigned char * msgs[BATCH];
+            unsigned int sizes[BATCH];
+            Time times[BATCH];
+            unsigned int index[BATCH];
+            unsigned int m = 0;
+            for(unsigned int j = i; j < count; j++) {
+                if(!done[j] && (peers[j] == peer)) {
+                    Buffer * buf = bufs[first + j];
+                    msgs[m] = buf->frame()->data<unsigned char>();
+                    sizes[m] = packed(buf);
+                    times[m] = ts2us(buf->sfdts);
+                    index[m++] = j;
+                    done[j] = true;
+                }
+            }
+
+            bool valid[BATCH];
+            authentic += unpack(peer, peer->master_secret(), msgs, sizes, times, m, valid);
+            for(unsigned int j = 0; j < m; j++) {
+                if(valid[j])
+                    bufs[first + index[j]]->trusted = true;
+                else {
+                    // Right after a renewal, the frame may still be packed with the previous key, and, where regions
+                    // overlap, it may be from another of the peers deployed at its origin
+                    Buffer * buf = bufs[first + index[j]];
+                    if(peer->renewed(t))
+                        unpack(peer, peer->previous_master_secret(), &msgs[j], &sizes[j], &times[j], 1, &valid[j]);
+                    _trusted_deployments.search(buf->frame()->data<Header>()->origin(), t, [&](Peer * other) {
+                        if((other != peer) && !valid[j])
+                            unpack(other, other->master_secret(), &msgs[j], &sizes[j], &times[j], 1, &valid[j]);
+                    });
+                    if(valid[j]) {
+                        buf->trusted = true;
+                        authentic++;
+                    }
+                    if(!valid[j])
+                        db<TSTP>(WRN) << "TSTP::Security: Unpack failed" << endl;
+                }
+            }
+        }
+
+        for(unsigned int i = 0; i < count; i++)
+            bufs[first + i]->frame()->data<Header>()->last_hop(hops[i]);
+    }
+    unlock();
+
+    return authentic;
+}
+
+unsigned int TSTP::Security::trusted(const Time & since)
+{
+    unsigned int n = 0;
+
+    read_lock();
+    for(Peers::Element * el = _trusted_peers.head(); el; el = el->next())
+        if(el->object()->authentication_time() >= since)
+            n++;
+    unlock();
+
+    return n;
+}
 
-    const unsigned char * ms = reinterpret_cast<const unsigned char *>(&peer->master_secret());
+unsigned int TSTP::Security::unpack(const Peer * peer, const Master_Secret & master_secret, unsigned char * const msgs[], const unsigned int sizes[], const Time reception_times[], unsigned int n, bool valid[])
+{
+    unsigned char ms[sizeof(Master_Secret)];
+    master_secret.to_bytes(ms, sizeof(Master_Secret));
     const unsigned char * id = reinterpret_cast<const unsigned char *>(&peer->id());
 
     // mi = ms ^ _id
@@ -318,45 +477,70 @@ bool TSTP::Security::unpack(const Peer * peer, unsigned char * msg, const unsign
     for(; i < sizeof(Master_Secret); i++)
         mi[i] = ms[i];
 
-    reception_time = reception_time / POLY_TIME_WINDOW;
-
-    OTP key;
-    unsigned char nonce[16];
-    _Poly1305 poly(id, ms);
-
-    memset(nonce, 0, 16);
-    memcpy(nonce, &reception_time, sizeof(Time) < 16u ? sizeof(Time) : 16u);
-    poly.stamp(key, nonce, mi, MI_SIZE);
-    if(use_encryption)
-        _aes.decrypt(original_msg, key, msg);
-    if(poly.verify(mac, nonce, msg, sizeof(Master_Secret)))
-        return true;
+    _Poly1305 poly(peer->schedule(), ms, _aes);
+
+    // A message may have been packed in the time window of its reception or in the ones just before and after it.
+    // Frames of a batch mostly share these windows, so the mask of each (and the key derived from it, expanded) is kept.
+    struct Window {
+        Time t;
+        unsigned char mask[16];
+        _AES::Schedule key;
+    } windows[WINDOWS];
+    unsigned int cached = 0;
+    unsigned int replace = 0;
+    static const int offsets[] = { 0, -1, 1 };
+
+    unsigned int authentic = 0;
+    for(unsigned int j = 0; j < n; j++) {
+        unsigned char * msg = msgs[j];
+        const unsigned char * mac = &msg[sizes[j]];
+        unsigned char original_msg[sizeof(Master_Secret)];
+        memcpy(original_msg, msg, sizeof(Master_Secret));
+
+        valid[j] = false;
+        for(unsigned int k = 0; (k < sizeof(offsets) / sizeof(int)) && !valid[j]; k++) {
+            Time t = reception_times[j] / POLY_TIME_WINDOW + offsets[k];
+
+            Window * w = 0;
+            for(unsigned int l = 0; (l < cached) && !w; l++)
+                if(windows[l].t == t)
+                    w = &windows[l];
+            if(!w) {
+                w = &windows[replace];
+                replace = (replace + 1) % WINDOWS;
+                if(cached < WINDOWS)
+                    cached++;
+
+                unsigned char nonce[16];
+                memset(nonce, 0, 16);
+                memcpy(nonce, &t, sizeof(Time) < 16u ? sizeof(Time) : 16u);
+                w->t = t;
+                poly.mask(w->mask, nonce);
+                if(use_encryption) {
+                    OTP key;
+                    poly.tag(key, w->mask, mi, MI_SIZE);
+                    _aes.expand_key(key, w->key);
+                }
+            }
 
-    reception_time = reception_time - 1;
-    memset(nonce, 0, 16);
-    memcpy(nonce, &reception_time, sizeof(Time) < 16u ? sizeof(Time) : 16u);
-    poly.stamp(key, nonce, mi, MI_SIZE);
-    if(use_encryption)
-        _aes.decrypt(original_msg, key, msg);
-    if(poly.verify(mac, nonce, msg, sizeof(Master_Secret)))
-        return true;
+            if(use_encryption)
+                _aes.decrypt(original_msg, w->key, msg);
+            valid[j] = poly.check(mac, w->mask, msg, sizes[j]);
+        }
 
-    reception_time = reception_time + 2;
-    memset(nonce, 0, 16);
-    memcpy(nonce, &reception_time, sizeof(Time) < 16u ? sizeof(Time) : 16u);
-    poly.stamp(key, nonce, mi, MI_SIZE);
-    if(use_encryption)
-        _aes.decrypt(original_msg, key, msg);
-    if(poly.verify(mac, nonce, msg, sizeof(Master_Secret)))
-        return true;
+        if(valid[j])
+            authentic++;
+        else
+            memcpy(msg, original_msg, sizeof(Master_Secret));
+    }
 
-    memcpy(msg, original_msg, sizeof(Master_Secret));
-    return false;
+    return authentic;
 }
 
 TSTP::Security::OTP TSTP::Security::otp(const Master_Secret & master_secret, const Node_Id & id)
 {
-    const unsigned char * ms = reinterpret_cast<const unsigned char *>(&master_secret);
+    unsigned char ms[sizeof(Master_Secret)];
+    master_secret.to_bytes(ms, sizeof(Master_Secret));
 
     // mi = ms ^ _id
     static const unsigned int MI_SIZE = sizeof(Node_Id) > sizeof(Master_Secret) ? sizeof(Node_Id) : sizeof(Master_Secret);
@@ -369,20 +553,21 @@ TSTP::Security::OTP TSTP::Security::otp(const Master_Secret & master_secret, con
     for(; i < sizeof(Master_Secret); i++)
         mi[i] = ms[i];
 
-    Time t = TSTP::now() / POLY_TIME_WINDOW;
+    Time t = now() / POLY_TIME_WINDOW;
 
     unsigned char nonce[16];
     memset(nonce, 0, 16);
     memcpy(nonce, &t, sizeof(Time) < 16u ? sizeof(Time) : 16u);
 
     OTP out;
-    _Poly1305(id, ms).stamp(out, nonce, mi, MI_SIZE);
+    _Poly1305(id, ms, &_aes).stamp(out, nonce, mi, MI_SIZE);
     return out;
 }
 
 bool TSTP::Security::verify_auth_request(const Master_Secret & master_secret, const Node_Id & id, const OTP & otp)
 {
-    const unsigned char * ms = reinterpret_cast<const unsigned char *>(&master_secret);
+    unsigned char ms[sizeof(Master_Secret)];
+    master_secret.to_bytes(ms, sizeof(Master_Secret));
 
     // mi = ms ^ _id
     static const unsigned int MI_SIZE = sizeof(Node_Id) > sizeof(Master_Secret) ? sizeof(Node_Id) : sizeof(Master_Secret);
@@ -396,9 +581,9 @@ bool TSTP::Security::verify_auth_request(const Master_Secret & master_secret, co
         mi[i] = ms[i];
 
     unsigned char nonce[16];
-    Time t = TSTP::now() / POLY_TIME_WINDOW;
+    Time t = now() / POLY_TIME_WINDOW;
 
-    _Poly1305 poly(id, ms);
+    _Poly1305 poly(id, ms, &_aes);
 
     memset(nonce, 0, 16);
     memcpy(nonce, &t, sizeof(Time) < 16u ? sizeof(Time) : 16u);
@@ -420,86 +605,270 @@ bool TSTP::Security::verify_auth_request(const Master_Secret & master_secret, co
     return false;
 }
 
+TSTP::Security::Peer * TSTP::Security::pending_peer(const Space & where, const Time & when)
+{
+    Peer * peer = 0;
+    _pending_deployments.search(where, when, [&](Peer * p) { if(!peer) peer = p; });
+    return peer;
+}
+
+TSTP::Security::Peer * TSTP::Security::trusted_peer(const Space & where, const Time & when)
+{
+    Peer * peer = 0;
+    _trusted_deployments.search(where, when, [&](Peer * p) { if(!peer) peer = p; });
+    return peer;
+}
+
+TSTP::Security::Pending_Key * TSTP::Security::pending_key(const Public_Key & pk)
+{
+    Public_Keys::Key k = Public_Keys::key(&pk, sizeof(Public_Key));
+    for(Public_Keys::Element * el = _pending_keys.search(k); el && (el->rank() == k); el = el->next())
+        if(!memcmp(&el->object()->public_key(), &pk, sizeof(Public_Key)))
+            return el->object();
+    return 0;
+}
+
+void TSTP::Security::trust(Peer * peer)
+{
+    _pending_peers.remove(peer->link());
+    _pending_deployments.remove(peer->deploy_link());
+    _trusted_peers.insert(peer->link());
+    _trusted_deployments.insert(peer->deploy_link());
+    peer->trusted(true);
+}
+
+void TSTP::Security::untrust(Peer * peer)
+{
+    _trusted_peers.remove(peer->link());
+    _trusted_deployments.remove(peer->deploy_link());
+    _pending_peers.insert(peer->link());
+    _pending_deployments.insert(peer->deploy_link());
+    peer->trusted(false);
+}
+
+// Removes a pending peer, with its pending keys, and deletes it (trusted ones are untrusted first)
+void TSTP::Security::discard(Peer * peer)
+{
+    while(Pending_Keys::Element * el = peer->keys().head())
+        discard(el->object());
+    if(peer->handshaking())
+        _dh_requests_open--;
+
+    _pending_peers.remove(peer->link());
+    _pending_deployments.remove(peer->deploy_link());
+    _auths.remove(peer->auth_link());
+    delete peer;
+}
+
+void TSTP::Security::discard(Pending_Key * pk)
+{
+    pk->peer()->keys().remove(pk->link());
+    _pending_keys.remove(pk->key_link());
+    delete pk;
+}
+
+void TSTP::Security::stop()
+{
+    db<TSTP>(TRC) << "TSTP::Security::stop()" << endl;
+
+    // The key manager writes under the peers lock, so it is not cancelled, but told to return when it next wakes up
+    if(_key_manager) {
+        pthread_mutex_lock(&_key_manager_mutex);
+        _key_manager_stopped = true;
+        pthread_cond_signal(&_key_manager_wakeup);
+        pthread_mutex_unlock(&_key_manager_mutex);
+        _key_manager->join();
+        delete _key_manager;
+        _key_manager = 0;
+    }
+
+    // Let the handshakers run what they were already given
+    for(unsigned int i = 0; i < _n_handshakers; i++)
+        _handshakers[i].put(0);
+    for(unsigned int i = 0; i < _n_handshakers; i++) {
+        pthread_join(_handshakers[i]._thread, 0);
+        pthread_cond_destroy(&_handshakers[i]._ready);
+        pthread_mutex_destroy(&_handshakers[i]._mutex);
+    }
+    delete [] _handshakers;
+    _handshakers = 0;
+    _n_handshakers = 0;
+}
+
+void TSTP::Security::wake_key_manager()
+{
+    pthread_mutex_lock(&_key_manager_mutex);
+    _key_manager_woken = true;
+    pthread_cond_signal(&_key_manager_wakeup);
+    pthread_mutex_unlock(&_key_manager_mutex);
+}
+
+// Keeps up to HANDSHAKES handshakes open, taking the next pending peers as soon as one ends (or times out), and
+// renews the keys of trusted peers before they expire, so bootstrapping a network takes about as many handshake
+// round trips as peers over HANDSHAKES, instead of a KEY_MANAGER_PERIOD per peer.
 int TSTP::Security::key_manager()
 {
-    Peers::Element * last_dh_request = 0;
+    Peer * last_dh_request = 0;
+    Time::Type period = KEY_MANAGER_PERIOD;
 
     while(true) {
-        Alarm::delay(KEY_MANAGER_PERIOD);
+        // Sleep for a period, or until woken
+        timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += period / 1000000 + (deadline.tv_nsec + (period % 1000000) * 1000) / 1000000000;
+        deadline.tv_nsec = (deadline.tv_nsec + (period % 1000000) * 1000) % 1000000000;
+        pthread_mutex_lock(&_key_manager_mutex);
+        while(!_key_manager_woken && !_key_manager_stopped && (pthread_cond_timedwait(&_key_manager_wakeup, &_key_manager_mutex, &deadline) != ETIMEDOUT));
+        _key_manager_woken = false;
+        bool stopped = _key_manager_stopped;
+        pthread_mutex_unlock(&_key_manager_mutex);
+        if(stopped)
+            break;
 
         db<TSTP>(TRC) << "TSTP::Security::key_manager()" << endl;
-        CPU::int_disable();
-        //while(CPU::tsl(_peers_lock));
+        write_lock();
+        Time t = now();
 
         // Cleanup expired pending keys
-        Pending_Keys::Element * next_key;
-        for(Pending_Keys::Element * el = _pending_keys.head(); el; el = next_key) {
-            next_key = el->next();
-            Pending_Key * p = el->object();
-            if(p->expired()) {
-                _pending_keys.remove(el);
-                delete p;
-                db<TSTP>(INF) << "TSTP::Security::key_manager(): removed pending key" << endl;
+        Peers * lists[] = { &_pending_peers, &_trusted_peers };
+        for(unsigned int i = 0; i < sizeof(lists) / sizeof(Peers *); i++)
+            for(Peers::Element * el = lists[i]->head(); el; el = el->next()) {
+                Pending_Keys::Element * next_key;
+                for(Pending_Keys::Element * pk_el = el->object()->keys().head(); pk_el; pk_el = next_key) {
+                    next_key = pk_el->next();
+                    if(pk_el->object()->expired(t)) {
+                        discard(pk_el->object());
+                        db<TSTP>(INF) << "TSTP::Security::key_manager(): removed pending key" << endl;
+                    }
+                }
             }
-        }
 
         // Cleanup expired peers
         Peers::Element * next;
         for(Peers::Element * el = _trusted_peers.head(); el; el = next) {
             next = el->next();
             Peer * p = el->object();
-            if(!p->valid_deploy(p->valid().center, TSTP::now())) {
-                _trusted_peers.remove(el);
-                delete p;
+            if(!p->valid_deploy(p->valid().center, t)) {
+                if(p == last_dh_request)
+                    last_dh_request = 0;
+                untrust(p);
+                discard(p);
                 db<TSTP>(INF) << "TSTP::Security::key_manager(): permanently removed trusted peer" << endl;
             }
         }
         for(Peers::Element * el = _pending_peers.head(); el; el = next) {
             next = el->next();
             Peer * p = el->object();
-            if(!p->valid_deploy(p->valid().center, TSTP::now())) {
-                _pending_peers.remove(el);
-                delete p;
+            if(!p->valid_deploy(p->valid().center, t)) {
+                if(p == last_dh_request)
+                    last_dh_request = 0;
+                discard(p);
                 db<TSTP>(INF) << "TSTP::Security::key_manager(): permanently removed pending peer" << endl;
             }
         }
 
-        // Cleanup expired established keys
+        // Cleanup expired established keys (whose renewal did not make it)
         for(Peers::Element * el = _trusted_peers.head(); el; el = next) {
             next = el->next();
             Peer * p = el->object();
-            if(TSTP::now() - p->authentication_time() > KEY_EXPIRY) {
-                _trusted_peers.remove(el);
-                _pending_peers.insert(el);
+            if(t - p->authentication_time() > KEY_EXPIRY) {
+                untrust(p);
                 db<TSTP>(INF) << "TSTP::Security::key_manager(): trusted peer's key expired" << endl;
             }
         }
 
-        // Send DH Request to at most one peer
-        Peers::Element * el;
-        if(last_dh_request && last_dh_request->next())
-            el = last_dh_request->next();
-        else
-            el = _pending_peers.head();
-
-        last_dh_request = 0;
+        // Free the slots of unanswered handshakes
+        for(unsigned int i = 0; i < sizeof(lists) / sizeof(Peers *); i++)
+            for(Peers::Element * el = lists[i]->head(); el; el = el->next()) {
+                Peer * p = el->object();
+                if(p->handshaking() && (t - p->handshake_time() > HANDSHAKE_TIMEOUT)) {
+                    p->close_handshake();
+                    _dh_requests_open--;
+                    db<TSTP>(INF) << "TSTP::Security::key_manager(): handshake timed out" << endl;
+                }
+            }
 
-        for(; el; el = el->next()) {
+        // Open handshakes with pending peers, taken round-robin so unresponsive ones do not hold the others back,
+        // and then with trusted peers whose keys are due for renewal. Only nodes answer DH_Requests (see handshake()),
+        // so only the sink opens handshakes: those of nodes would just be broadcast for no one.
+        Buffer * requests[HANDSHAKES];
+        unsigned int n = 0;
+        unsigned int slots = (here() == sink()) ? HANDSHAKES : 0;
+        auto request = [&](Peer * p) {
+            p->open_handshake(t);
+            _dh_requests_open++;
+            requests[n] = alloc(sizeof(DH_Request));
+            new (requests[n]->frame()->data<DH_Request>()) DH_Request(p->valid(), _dh.public_key());
+            n++;
+        };
+
+        if(last_dh_request && last_dh_request->trusted())
+            last_dh_request = 0;
+        Peers::Element * el = (last_dh_request && last_dh_request->link()->next()) ? last_dh_request->link()->next() : _pending_peers.head();
+        for(unsigned int i = 0; el && (i < _pending_peers.size()) && (_dh_requests_open < slots); i++) {
             Peer * p = el->object();
-            if(p->valid_deploy(p->valid().center, TSTP::now())) {
-                last_dh_request = el;
-                Buffer * buf = alloc(sizeof(DH_Request));
-//                    new (buf->frame()->data<DH_Request>()) DH_Request(Region::Space(p->valid().center, p->valid().radius), _dh.public_key());
-                marshal(buf);
-                _dh_requests_open++;
-                TSTP::_nic->send(buf);
-                db<TSTP>(INF) << "TSTP::Security::key_manager(): Sent DH_Request: "  << *buf->frame()->data<DH_Request>() << endl;
-                break;
+            if(!p->handshaking() && p->valid_deploy(p->valid().center, t)) {
+                request(p);
+                last_dh_request = p;
             }
+            el = el->next() ? el->next() : _pending_peers.head();
+        }
+        for(el = _trusted_peers.head(); el && (_dh_requests_open < slots); el = el->next()) {
+            Peer * p = el->object();
+            if(!p->handshaking() && (t - p->authentication_time() > KEY_RENEWAL))
+                request(p);
         }
 
-        //_peers_lock = false;
-        CPU::int_enable();
+        // While handshakes are open, check on them at the pace they time out
+        period = _dh_requests_open ? HANDSHAKE_TIMEOUT : KEY_MANAGER_PERIOD;
+        unlock();
+
+        // Fully marshaled (origin, time, location), as those of handshake() are, and logged before the NIC takes the buffer back
+        for(unsigned int i = 0; i < n; i++) {
+            _tstp->marshal(requests[i]);
+            db<TSTP>(INF) << "TSTP::Security::key_manager(): Sending DH_Request: "  << *requests[i]->frame()->data<DH_Request>() << endl;
+            nic()->send(requests[i]);
+        }
+    }
+
+    return 0;
+}
+
+void TSTP::Security::Handshaker::put(Control * msg)
+{
+    // A full queue holds the NIC's receive thread back, as a full worker queue does
+    while(!_queue.insert(msg))
+        sched_yield();
+
+    // See TSTP::Worker::put()
+    if(CPU::cas(_sleeping, 1U, 0U)) {
+        pthread_mutex_lock(&_mutex);
+        pthread_cond_signal(&_ready);
+        pthread_mutex_unlock(&_mutex);
+    }
+}
+
+void * TSTP::Security::Handshaker::run(void * p)
+{
+    Handshaker * h = reinterpret_cast<Handshaker *>(p);
+
+    while(true) {
+        Control * msg;
+        if(!h->_queue.remove(msg)) {
+            pthread_mutex_lock(&h->_mutex);
+            CPU::tsl(h->_sleeping);
+            while(h->_queue.empty())
+                pthread_cond_wait(&h->_ready, &h->_mutex);
+            h->_sleeping = 0;
+            pthread_mutex_unlock(&h->_mutex);
+            continue;
+        }
+
+        if(!msg)
+            break;
+
+        h->_security->handshake(msg);
+        delete [] reinterpret_cast<unsigned char *>(msg);
     }
 
     return 0;
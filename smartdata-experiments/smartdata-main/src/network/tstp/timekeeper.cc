@@ -10,12 +10,6 @@
 
 #ifdef __tstp__
 
-TSTP::Time TSTP::Timekeeper::_reference;
-TSTP::Time TSTP::Timekeeper::_skew;
-volatile TSTP::Time TSTP::Timekeeper::_next_sync;
-Function_Handler * TSTP::Timekeeper::_life_keeper_handler;
-Alarm * TSTP::Timekeeper::_life_keeper;
-
 const unsigned int TSTP::Timekeeper::MAX_DRIFT;
 
 
@@ -24,6 +18,10 @@ TSTP::Timekeeper::~Timekeeper()
     db<TSTP>(TRC) << "TSTP::~Timekeeper()" << endl;
 
     detach(this);
+    if(_life_keeper) {
+        delete _life_keeper;
+        delete _life_keeper_handler;
+    }
 }
 
 
@@ -36,7 +34,7 @@ void TSTP::Timekeeper::update(Data_Observed<Buffer> * obs, Buffer * buf)
         if(!synchronized())
             buf->relevant = true;
     } else {
-        buf->deadline = Microsecond(Router::destination(buf).t1);
+        buf->deadline = Microsecond(_tstp->_router->destination(buf).t1);
         bool closer_to_sink = buf->downlink ? ((here() - sink()) < (header->last_hop().space - sink())) : (buf->my_distance < buf->sender_distance);
 
         if(synchronized()) {
@@ -71,7 +69,7 @@ void TSTP::Timekeeper::marshal(Buffer * buf)
     if((header->type() == CONTROL) && (header->subtype() == KEEP_ALIVE))
     	buf->deadline = now() + sync_period();
     else
-        buf->deadline = Microsecond(Router::destination(buf).t1); // deadline must be set after origin time for Security messages
+        buf->deadline = Microsecond(_tstp->_router->destination(buf).t1); // deadline must be set after origin time for Security messages
 }
 
 
@@ -80,9 +78,9 @@ void TSTP::Timekeeper::keep_alive()
     db<TSTP>(TRC) << "TSTP::Timekeeper::keep_alive()" << endl;
 
     Buffer * buf = alloc(sizeof(Keep_Alive));
-    new (buf->frame()->data<Keep_Alive>()) Keep_Alive;
+    new (buf->frame()->data<Keep_Alive>()) Keep_Alive(Spacetime(here(), now()));
     buf->frame()->data<Header>()->time_request(true);
-    TSTP::send(buf);
+    send(buf);
 }
 
 #endif
@@ -11,18 +11,12 @@
 // #include <utility/string.h>
 #include <machine/nic.h>
 #include <network/tstp/tstp.h>
+#include <sched.h>
 
 // __BEGIN_SYS
 
-TSTP::Security * TSTP::_security;
-TSTP::Timekeeper * TSTP::_timekeeper;
-TSTP::Locator * TSTP::_locator;
-TSTP::Router * TSTP::_router;
-TSTP::Manager * TSTP::_manager;
-
-NIC<TSTP::NIC_Family> * TSTP::_nic;
-Data_Observed<TSTP::Buffer> TSTP::_parts;
-Data_Observed<TSTP::Buffer, TSTP::Unit> TSTP::_clients;
+TSTP * TSTP::_networks[UNITS];
+Hashed_Data_Observed<TSTP::Buffer, TSTP::Unit, Traits<TSTP>::CLIENTS> TSTP::_clients;
 
 
 
@@ -61,9 +55,9 @@ Debug & operator<<(Debug & db, const TSTP::Packet & p)
         case TSTP::EPOCH:
             db << reinterpret_cast<const TSTP::Timekeeper::Epoch &>(p);
             break;
-//        case TSTP::MODEL:
-//            db << reinterpret_cast<const TSTP::Model &>(p);
-//            break;
+        case TSTP::MODEL:
+            db << reinterpret_cast<const TSTP::Manager::Model &>(p);
+            break;
         default:
             break;
         }
@@ -75,17 +69,131 @@ Debug & operator<<(Debug & db, const TSTP::Packet & p)
     return db;
 };
 
+TSTP::~TSTP()
+{
+    db<TSTP>(TRC) << "TSTP::~TSTP()" << endl;
+
+    _nic->detach(this, 0);
+    _networks[_unit] = 0;
+
+    // Let the workers drain what the NIC has already handed over
+    for(unsigned int i = 0; i < _n_workers; i++)
+        _workers[i].put(0);
+    for(unsigned int i = 0; i < _n_workers; i++) {
+        pthread_join(_workers[i]._thread, 0);
+        pthread_cond_destroy(&_workers[i]._ready);
+        pthread_mutex_destroy(&_workers[i]._mutex);
+    }
+
+    // The key manager and handshakers of Security and the life keeper of Timekeeper marshal through every part, so
+    // they are stopped before any part goes (Timekeeper's along with it). The others go in reverse creation order.
+    _security->stop();
+    delete _timekeeper;
+    delete _manager;
+    delete _security;
+    delete _router;
+    delete _locator;
+
+    delete [] _workers;
+}
+
 void TSTP::update(NIC_Family::Observed * obs, const Protocol & prot, Buffer * buf)
 {
     db<TSTP>(TRC) << "TSTP::update(nic=" << obs << ",prot=" << hex << prot << ",buf=" << buf << ")" << endl;
 
-    Packet * packet = buf->frame()->data<Packet>();
-    db<TSTP>(INF) << "TSTP::update:packet=" << *packet << endl;
-
+    // The parts change state shared by the whole stack (keys, clock, location, routes), so they run here, on
+    // the NIC's receive thread, one frame at a time. Only the clients are spread over the workers, by series,
+    // i.e. by (unit, origin), so each series is still delivered in order.
     _parts.notify(buf);
 
-    if(buf->destined_to_me)
-        _clients.notify(packet->header()->unit(), buf);
+    if(!buf->destined_to_me) {
+        _nic->free(buf);
+        return;
+    }
+
+    Header * header = buf->frame()->data<Header>();
+    const Space & s = header->space();
+    unsigned long h = header->unit();
+    h = h * 31 + s.x;
+    h = h * 31 + s.y;
+    h = h * 31 + s.z;
+
+    _workers[(h ^ (h >> 16)) % _n_workers].put(buf);
+}
+
+void TSTP::process(Buffer * const bufs[], unsigned int n)
+{
+    // Responses and Models are authenticated here, together, rather than one by one by the Security part on the
+    // receive thread, so the keys of a peer and time window are derived once per batch. Each is trusted on its own result.
+    if(_security) {
+        Buffer * frames[Security::BATCH];
+        unsigned int m = 0;
+        for(unsigned int i = 0; i < n; i++)
+            if(!bufs[i]->is_microframe && Security::packed(bufs[i]))
+                frames[m++] = bufs[i];
+        if(m)
+            _security->authenticate(frames, m);
+    }
+
+    for(unsigned int i = 0; i < n; i++) {
+        Packet * packet = bufs[i]->frame()->data<Packet>();
+        db<TSTP>(INF) << "TSTP::process:packet=" << *packet << ",trusted=" << bufs[i]->trusted << endl;
+
+        _clients.notify(packet->header()->unit(), bufs[i]);
+
+        _nic->free(bufs[i]);
+    }
+}
+
+void TSTP::Worker::put(Buffer * buf)
+{
+    // A full queue holds the NIC back, whose own rings then absorb (or drop) the burst
+    while(!_queue.insert(buf))
+        sched_yield();
+
+    // The locked exchange orders the insertion above before reading the flag, as does the one the
+    // worker uses to raise it before checking the queue, so either we see it asleep or it sees the buffer
+    if(CPU::cas(_sleeping, 1U, 0U)) {
+        pthread_mutex_lock(&_mutex);
+        pthread_cond_signal(&_ready);
+        pthread_mutex_unlock(&_mutex);
+    }
+}
+
+void * TSTP::Worker::run(void * p)
+{
+    Worker * w = reinterpret_cast<Worker *>(p);
+
+    bool stop = false;
+    while(!stop) {
+        Buffer * buf;
+        if(!w->_queue.remove(buf)) {
+            pthread_mutex_lock(&w->_mutex);
+            CPU::tsl(w->_sleeping);
+            while(w->_queue.empty())
+                pthread_cond_wait(&w->_ready, &w->_mutex);
+            w->_sleeping = 0;
+            pthread_mutex_unlock(&w->_mutex);
+            continue;
+        }
+
+        // Take whatever else is already queued, up to a batch, without waiting for more
+        Buffer * bufs[Security::BATCH];
+        unsigned int n = 0;
+        for(; buf; n++) {
+            bufs[n] = buf;
+            if((n + 1 == Security::BATCH) || !w->_queue.remove(buf))
+                buf = 0;
+            else if(!buf)
+                stop = true;
+        }
+        if(!n)
+            break;
+
+        w->_tstp->process(bufs, n);
+    }
+
+    return 0;
 }
 
 //    if(buf->is_microframe || !buf->trusted)
@@ -227,11 +335,11 @@ void TSTP::marshal(Buffer * buf)
 {
     db<TSTP>(TRC) << "TSTP::marshal(buf=" << buf << ")" << endl;
 
-    Manager::marshal(buf);
-    Router::marshal(buf);
-    Locator::marshal(buf);
-    Timekeeper::marshal(buf);
-    Security::marshal(buf);
+    _manager->marshal(buf);
+    _router->marshal(buf);
+    _locator->marshal(buf);
+    _timekeeper->marshal(buf);
+    _security->marshal(buf);
 
     Packet * packet = buf->frame()->data<Packet>();
     db<TSTP>(INF) << "TSTP::marshal:packet=" << *packet << endl;
@@ -6,31 +6,93 @@
 
 #include <main_traits.h>
 #include <machine/udpnic.h>
+#include <machine/rawnic.h>
+#include <machine/simnic.h>
 #include <network/tstp/tstp.h>
+#include <sched.h>
+#include <unistd.h>
 
-TSTP::TSTP(NIC<NIC_Family> * nic)
+constexpr unsigned int Traits<Topology>::NICS[];
+constexpr long Traits<Topology>::POSITIONS[][3];
+constexpr const char * Traits<RAWNIC>::INTERFACES[];
+
+TSTP::TSTP(unsigned int unit, NIC<NIC_Family> * nic): _unit(unit), _nic(nic), _n_workers(0), _workers(0), _security(0), _timekeeper(0), _locator(0), _router(0), _manager(0)
 {
-    db<Init, TSTP>(TRC) << "TSTP(nic=" << nic << ")" << endl;
+    db<Init, TSTP>(TRC) << "TSTP(unit=" << unit << ",nic=" << nic << ")" << endl;
+
+    _networks[unit] = this;
+
+    // Receive pipeline, one worker per core, each pinned to its own
+    unsigned int cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if(!cores)
+        cores = 1;
+    _n_workers = Traits<TSTP>::WORKERS ? Traits<TSTP>::WORKERS : cores;
+    _workers = new /*(SYSTEM)*/ Worker[_n_workers];
+    for(unsigned int i = 0; i < _n_workers; i++) {
+        Worker * w = &_workers[i];
+        w->_tstp = this;
+        pthread_mutex_init(&w->_mutex, 0);
+        pthread_cond_init(&w->_ready, 0);
+        pthread_create(&w->_thread, 0, &Worker::run, w);
+
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET((i % cores) % CPU_SETSIZE, &cpus);
+        pthread_setaffinity_np(w->_thread, sizeof(cpus), &cpus);
+    }
+    db<Init, TSTP>(INF) << "TSTP:workers=" << _n_workers << endl;
 
-    _nic = nic;
+    // The order parts are created defines the order they get notified when packets arrive:
+    // mac->locator->timekeeper->router->security(decrypt)->manager->security(encrypt)->mac
+    // Security only takes what the router found destined_to_me, so it must come after it
+    _locator = new /*(SYSTEM)*/ Locator(this);
+    _timekeeper = new /*(SYSTEM)*/ Timekeeper(this); // here() reports (0,0,0) if _locator wasn't created first!
+    _router = new /*(SYSTEM)*/ Router(this);
+    _security = new /*(SYSTEM)*/ Security(this);
+    _manager = new /*(SYSTEM)*/ Manager(this);
+
+    // Only now the stack is complete and can take packets in
     _nic->attach(this, PROTO_TSTP);
 
-    // The order parts are created defines the order they get notified when packets arrive:
-    // mac->security(decrypt)->locator->timekeeper->router->manager->security(encrypt)->mac
-    _security = new /*(SYSTEM)*/ Security;
-    _locator = new /*(SYSTEM)*/ Locator;
-    _timekeeper = new /*(SYSTEM)*/ Timekeeper; // here() reports (0,0,0) if _locator wasn't created first!
-    _router = new /*(SYSTEM)*/ Router;
-    _manager = new /*(SYSTEM)*/ Manager;
+    // Parts are all in place to marshal the Keep Alives that will get this stack synchronized
+    _timekeeper->bootstrap();
 }
 
-TSTP::Security::Security()
+TSTP::Security::Security(TSTP * tstp): Part(tstp), _key_manager(0), _key_manager_woken(false), _key_manager_stopped(false), _dh_requests_open(0), _cipher(_aes)
 {
     db<TSTP>(TRC) << "TSTP::Security()" << endl;
 
+    pthread_rwlock_init(&_peers_lock, 0);
+
+    // The key manager sleeps on CLOCK_MONOTONIC, like alarms
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&_key_manager_wakeup, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&_key_manager_mutex, 0);
+
+    // Handshake pool
+    unsigned int cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if(!cores)
+        cores = 1;
+    _n_handshakers = Traits<TSTP>::HANDSHAKERS ? Traits<TSTP>::HANDSHAKERS : cores;
+    _handshakers = new /*(SYSTEM)*/ Handshaker[_n_handshakers];
+    for(unsigned int i = 0; i < _n_handshakers; i++) {
+        Handshaker * h = &_handshakers[i];
+        h->_security = this;
+        pthread_mutex_init(&h->_mutex, 0);
+        pthread_cond_init(&h->_ready, 0);
+        pthread_create(&h->_thread, 0, &Handshaker::run, h);
+    }
+    db<Init, TSTP>(INF) << "TSTP::Security:handshakers=" << _n_handshakers << endl;
+
 	unsigned char uuid[8] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x05, 0x07, 0x08 };
+    // Each stack stands for a machine of its own (e.g. the simulated ones of SIMNIC)
+    uuid[6] ^= tstp->unit() >> 8;
+    uuid[7] ^= tstp->unit();
 
-    _id = new /*(&_id)*/ Node_Id(/*Machine::*/uuid/*()*/, sizeof(UUID));
+    _id = Node_Id(/*Machine::*/uuid/*()*/, sizeof(UUID));
 
     db<TSTP>(INF) << "TSTP::Security:uuid=" << _id << endl;
 
@@ -53,7 +115,7 @@ TSTP::Security::Security()
     */
 }
 
-TSTP::Locator::Locator()
+TSTP::Locator::Locator(TSTP * tstp): Part(tstp)
 {
     db<TSTP>(TRC) << "TSTP::Locator()" << endl;
 
@@ -63,9 +125,10 @@ TSTP::Locator::Locator()
     //    _engine.confidence(100);
     //} else {
 	
-	// TCB - usar valores diferentes para instncias diferentes.
-        _engine.here(Space(0, 0, 0));
-        _engine.confidence(0);
+        // Each stack is where Traits<Topology>::POSITIONS puts it (and its SIMNIC, if simulated)
+        const long * p = Traits<Topology>::POSITIONS[tstp->unit()];
+        _engine.here(Global_Space(p[0], p[1], p[2]));
+        _engine.confidence(100);
     //}
 
     attach(this);
@@ -84,7 +147,7 @@ TSTP::Locator::Locator()
     // _absolute_location is initialized later through an Epoch message
 }
 
-TSTP::Timekeeper::Timekeeper()
+TSTP::Timekeeper::Timekeeper(TSTP * tstp): Part(tstp), _reference(0), _skew(0), _life_keeper_handler(0), _life_keeper(0)
 {
     db<TSTP>(TRC) << "TSTP::Timekeeper()" << endl;
     db<TSTP>(INF) << "TSTP::Timekeeper:timer accuracy = " << timer_accuracy() << " ppb" << endl;
@@ -96,38 +159,61 @@ TSTP::Timekeeper::Timekeeper()
 
     if(here() == sink())
         _next_sync = INFINITE; // just so that the sink will always have synchronized() returning true
-    else {
+    else
         _next_sync = 0;
-        keep_alive();
+}
+
+void TSTP::Timekeeper::bootstrap()
+{
+    db<TSTP>(TRC) << "TSTP::Timekeeper::bootstrap()" << endl;
+
+    if(here() != sink()) {
+        // The life keeper must exist before the first Keep Alive, for update() resets it when the answer arrives
         Microsecond period = static_cast<Microsecond>(sync_period());
-        _life_keeper_handler = new /*(SYSTEM)*/ Function_Handler(&keep_alive);
+        _life_keeper_handler = new /*(SYSTEM)*/ Functor_Handler<Timekeeper>(&life_keeper, this);
         _life_keeper = new /*(SYSTEM)*/ Alarm(period, _life_keeper_handler, INFINITE);
+        keep_alive();
         while(!synchronized())
             Thread::/*self()->*/yield();
     }
 }
 
-TSTP::Router::Router()
+TSTP::Router::Router(TSTP * tstp): Part(tstp)
 {
     db<TSTP>(TRC) << "TSTP::Router()" << endl;
 
     attach(this);
 }
 
-TSTP::Manager::Manager()
+TSTP::Manager::Manager(TSTP * tstp): Part(tstp)
 {
     db<TSTP>(TRC) << "TSTP::Manager()" << endl;
 
     attach(this);
 }
 
-void TSTP::init()
+void TSTP::init(unsigned int units)
 {
-    db<Init, TSTP>(TRC) << "TSTP::init()" << endl;
+    db<Init, TSTP>(TRC) << "TSTP::init(units=" << units << ")" << endl;
+
+    static_assert(!Traits<RAWNIC>::enabled || (MAXOF(Traits<Topology>::NICS) < COUNTOF(Traits<RAWNIC>::INTERFACES)), "Each RAWNIC unit in Traits<Topology>::NICS needs its own interface in Traits<RAWNIC>::INTERFACES");
+    static_assert(COUNTOF(Traits<Topology>::POSITIONS) == UNITS, "Each TSTP stack needs its own position in Traits<Topology>::POSITIONS");
 
-	NIC<NIC_Family>* nic = new UDPNIC();
+    if(units > UNITS)
+        units = UNITS;
 
-    new /*(SYSTEM)*/ TSTP(nic);
+    // One stack per configured NIC
+    for(unsigned int i = 0; i < units; i++) {
+        NIC<NIC_Family> * nic;
+        if(Traits<SIMNIC>::enabled)
+            nic = new /*(SYSTEM)*/ SIMNIC(Traits<Topology>::NICS[i], SIMNIC::Position(Traits<Topology>::POSITIONS[i][0], Traits<Topology>::POSITIONS[i][1], Traits<Topology>::POSITIONS[i][2]));
+        else if(Traits<RAWNIC>::enabled)
+            nic = new /*(SYSTEM)*/ RAWNIC(Traits<Topology>::NICS[i]);
+        else
+            nic = new /*(SYSTEM)*/ UDPNIC(Traits<Topology>::NICS[i]);
+
+        new /*(SYSTEM)*/ TSTP(i, nic);
+    }
 }
 
 //template <typename Engine>
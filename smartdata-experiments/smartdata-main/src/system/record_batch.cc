@@ -0,0 +1,166 @@
+// EPOS SmartData Record Batch Implementation
+
+#include <main_traits.h>
+#include <system/record_batch.h>
+#include <string.h>
+
+Record_Batch::Record_Batch(const void * data, unsigned int size): _header(0), _records(0)
+{
+    const Header * h = reinterpret_cast<const Header *>(data);
+    if(!h || (size < sizeof(Header)) || (le(h->magic) != MAGIC) || (h->version != VERSION) || (le(h->length) > size - sizeof(Header))) {
+        db<Record_Batch>(WRN) << "Record_Batch: not a batch!" << endl;
+        return;
+    }
+
+    unsigned int count = le(h->count);
+    unsigned int length = le(h->length);
+    switch(h->encoding) {
+    case RAW:
+        if((h->order != ORDER) || (h->layout != LAYOUT)) {
+            db<Record_Batch>(WRN) << "Record_Batch: RAW batch from a foreign host (order=" << h->order << ",layout=" << h->layout << ")!" << endl;
+            return;
+        }
+        // Dividing first, for the product may wrap around where sizeof(DB_Record) does not divide 2^32
+        if((count > length / sizeof(DB_Record)) || (length != count * sizeof(DB_Record))) {
+            db<Record_Batch>(WRN) << "Record_Batch: length does not match count!" << endl;
+            return;
+        }
+        _records = reinterpret_cast<const DB_Record *>(h + 1);
+        break;
+    case DELTA:
+        break;
+    default:
+        db<Record_Batch>(WRN) << "Record_Batch: unknown encoding " << h->encoding << "!" << endl;
+        return;
+    }
+
+    _header = h;
+}
+
+Record_Batch::Encoder::Encoder(void * buffer, unsigned int size, Encoding e)
+: _header(reinterpret_cast<Header *>(buffer)), _end(reinterpret_cast<unsigned char *>(buffer) + size), _p(reinterpret_cast<unsigned char *>(_header + 1)), _count(0)
+{
+    _header->magic = le(MAGIC);
+    _header->version = VERSION;
+    _header->encoding = e;
+    _header->order = ORDER;
+    _header->layout = LAYOUT;
+    _header->count = 0;
+    _header->length = 0;
+    memset(&_previous, 0, sizeof(_previous));
+}
+
+bool Record_Batch::Encoder::put(const DB_Record & r)
+{
+    if(_header->encoding == RAW) {
+        if(_p + sizeof(DB_Record) > _end)
+            return false;
+        memcpy(_p, &r, sizeof(DB_Record));
+        _p += sizeof(DB_Record);
+    } else {
+        // Checking the worst case spares a check per field
+        if(_p + MAX_DELTA > _end)
+            return false;
+
+        unsigned long long value, previous;
+        memcpy(&value, &r.value, sizeof(value));
+        memcpy(&previous, &_previous.value, sizeof(previous));
+
+        *_p++ = r.type;
+        _p = Record_Batch::put_signed(_p, static_cast<long long>(r.unit) - static_cast<long long>(_previous.unit));
+        _p = Record_Batch::put(_p, __builtin_bswap64(value ^ previous));
+        *_p++ = r.uncertainty;
+        *_p++ = r.confidence;
+        _p = Record_Batch::put_signed(_p, static_cast<long long>(r.x) - _previous.x);
+        _p = Record_Batch::put_signed(_p, static_cast<long long>(r.y) - _previous.y);
+        _p = Record_Batch::put_signed(_p, static_cast<long long>(r.z) - _previous.z);
+        _p = Record_Batch::put_signed(_p, static_cast<long long>(r.device) - _previous.device);
+        _p = Record_Batch::put_signed(_p, static_cast<long long>(r.t - _previous.t));
+
+        _previous = r;
+    }
+
+    _header->count = le(++_count);
+    _header->length = le(_p - reinterpret_cast<unsigned char *>(_header + 1));
+
+    return true;
+}
+
+bool Record_Batch::Encoder::put(const DB_Record * r, unsigned int n)
+{
+    for(unsigned int i = 0; i < n; i++)
+        if(!put(r[i]))
+            return false;
+    return true;
+}
+
+Record_Batch::Reader::Reader(const Record_Batch & b)
+: _batch(b), _p(0), _end(0), _read(0)
+{
+    if(b.valid()) {
+        _p = reinterpret_cast<const unsigned char *>(b._header + 1);
+        _end = _p + le(b._header->length);
+    }
+    memset(&_previous, 0, sizeof(_previous));
+}
+
+bool Record_Batch::Reader::next(DB_Record * r)
+{
+    if(!_p || (_read == _batch.count()))
+        return false;
+
+    if(_batch.encoding() == RAW) {
+        *r = _batch[_read++];
+        return true;
+    }
+
+    const unsigned char * p = _p;
+    unsigned long long value, previous;
+    long long unit, x, y, z, device, t;
+
+    if(p + 1 > _end)
+        p = 0;
+    else
+        r->type = *p++;
+    if(p)
+        p = get_signed(p, _end, &unit);
+    if(p)
+        p = get(p, _end, &value);
+    if(p && (p + 2 > _end))
+        p = 0;
+    if(p) {
+        r->uncertainty = *p++;
+        r->confidence = *p++;
+    }
+    if(p)
+        p = get_signed(p, _end, &x);
+    if(p)
+        p = get_signed(p, _end, &y);
+    if(p)
+        p = get_signed(p, _end, &z);
+    if(p)
+        p = get_signed(p, _end, &device);
+    if(p)
+        p = get_signed(p, _end, &t);
+    if(!p) {
+        db<Record_Batch>(WRN) << "Record_Batch::Reader: record " << _read << " is truncated!" << endl;
+        _p = 0;
+        return false;
+    }
+
+    memcpy(&previous, &_previous.value, sizeof(previous));
+    previous ^= __builtin_bswap64(value);
+    memcpy(&r->value, &previous, sizeof(previous));
+    r->unit = _previous.unit + unit;
+    r->x = _previous.x + x;
+    r->y = _previous.y + y;
+    r->z = _previous.z + z;
+    r->device = _previous.device + device;
+    r->t = _previous.t + t;
+
+    _previous = *r;
+    _p = p;
+    _read++;
+
+    return true;
+}
@@ -0,0 +1,230 @@
+// EPOS SmartData Series Ingestor Implementation (POSIX)
+
+#include <main_traits.h>
+#include <system/series_ingestor.h>
+#include <string.h>
+#include <time.h>
+
+Series_Ingestor::Series_Ingestor(Series_Store * store)
+: _store(store), _open(0), _n_open(0), _handover(false), _exiting(false), _records(0), _stored(0), _stalls(0)
+{
+    db<Series_Ingestor>(TRC) << "Series_Ingestor(store=" << store << ")" << endl;
+
+    _pool = new /*(SYSTEM)*/ Batch[BATCHES];
+    for(unsigned int i = 0; i < BATCHES; i++)
+        _free.insert(&_pool[i].link);
+
+    // Flush deadlines are absolute on CLOCK_MONOTONIC, so are the timed waits
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+    pthread_mutex_init(&_mutex, 0);
+    pthread_cond_init(&_work, &attr);
+    pthread_cond_init(&_room, 0);
+    pthread_cond_init(&_done, 0);
+    pthread_condattr_destroy(&attr);
+
+    pthread_create(&_thread, 0, &run, this);
+}
+
+Series_Ingestor::~Series_Ingestor()
+{
+    db<Series_Ingestor>(TRC) << "~Series_Ingestor()" << endl;
+
+    // The flusher hands everything over to the store before exiting
+    lock();
+    _exiting = true;
+    pthread_cond_signal(&_work);
+    unlock();
+    pthread_join(_thread, 0);
+
+    _store->flush();
+
+    pthread_cond_destroy(&_done);
+    pthread_cond_destroy(&_room);
+    pthread_cond_destroy(&_work);
+    pthread_mutex_destroy(&_mutex);
+
+    delete [] _open;
+    delete [] _pool;
+}
+
+void Series_Ingestor::put(Series_Id id, const DB_Record & r)
+{
+    db<Series_Ingestor>(TRC) << "Series_Ingestor::put(id=" << id << ",r=" << r << ")" << endl;
+
+    lock();
+
+    Batch * b = open(id);
+    b->records[b->count++] = r;
+    _records++;
+    if(b->count == BATCH)
+        close(id);
+
+    unlock();
+}
+
+unsigned int Series_Ingestor::put(Series_Id id, const Record_Batch & batch)
+{
+    db<Series_Ingestor>(TRC) << "Series_Ingestor::put(id=" << id << ",batch=" << &batch << ")" << endl;
+
+    if(!batch.valid())
+        return 0;
+
+    // As put(), with the records read in place or decoded as they go
+    unsigned int n = 0;
+    Record_Batch::Reader reader(batch);
+    DB_Record r;
+    lock();
+    while((batch.encoding() == Record_Batch::RAW) ? (n < batch.count()) : reader.next(&r)) {
+        Batch * b = open(id);
+        b->records[b->count++] = (batch.encoding() == Record_Batch::RAW) ? batch[n] : r;
+        _records++;
+        n++;
+        if(b->count == BATCH)
+            close(id);
+    }
+    unlock();
+
+    return n;
+}
+
+void Series_Ingestor::flush()
+{
+    db<Series_Ingestor>(TRC) << "Series_Ingestor::flush()" << endl;
+
+    lock();
+    unsigned long long target = _records;
+    while(_stored < target) {
+        _handover = true;
+        pthread_cond_signal(&_work);
+        pthread_cond_wait(&_done, &_mutex);
+    }
+    unlock();
+
+    _store->flush();
+}
+
+// Called locked. Blocks while there are no free batches.
+Series_Ingestor::Batch * Series_Ingestor::open(Series_Id id)
+{
+    if(id >= _n_open) {
+        unsigned int n = _n_open ? _n_open : 64;
+        while(n <= id)
+            n *= 2;
+        Batch ** open = new /*(SYSTEM)*/ Batch *[n];
+        memcpy(open, _open, _n_open * sizeof(Batch *));
+        memset(open + _n_open, 0, (n - _n_open) * sizeof(Batch *));
+        delete [] _open;
+        _open = open;
+        _n_open = n;
+    }
+
+    while(!_open[id]) {
+        Simple_List<Batch>::Element * e = _free.remove();
+        if(e) {
+            Batch * b = e->object();
+            b->id = id;
+            b->count = 0;
+            b->opened = now();
+            _open[id] = b;
+        } else {
+            // Partially filled batches are handed over too, or they would hold the pool until they time out
+            db<Series_Ingestor>(WRN) << "Series_Ingestor::put: no free batches, waiting for the store!" << endl;
+            _stalls++;
+            _handover = true;
+            pthread_cond_signal(&_work);
+            pthread_cond_wait(&_room, &_mutex);
+        }
+    }
+
+    return _open[id];
+}
+
+// Called locked
+void Series_Ingestor::close(Series_Id id)
+{
+    Batch * b = _open[id];
+    _open[id] = 0;
+    _full.insert(&b->link);
+    pthread_cond_signal(&_work);
+}
+
+void * Series_Ingestor::run(void * p)
+{
+    Series_Ingestor * i = reinterpret_cast<Series_Ingestor *>(p);
+    const Tick FLUSH = Traits<Series_Ingestor>::FLUSH * 1000;
+    const Tick SYNC = Traits<Series_Ingestor>::SYNC * 1000;
+
+    Batch * batches[BATCHES];
+    Tick deadline = now() + FLUSH;
+    Tick synced = now();
+
+    i->lock();
+    while(true) {
+        if(i->_full.empty() && !i->_handover && !i->_exiting) {
+            timespec t;
+            t.tv_sec = deadline / 1000000;
+            t.tv_nsec = (deadline % 1000000) * 1000;
+            pthread_cond_timedwait(&i->_work, &i->_mutex, &t);
+        }
+
+        // Open batches are only looked at once per FLUSH, unless someone is waiting for them
+        Tick t = now();
+        if(i->_handover || i->_exiting || (t >= deadline)) {
+            Tick oldest = t;
+            for(unsigned int id = 0; id < i->_n_open; id++) {
+                Batch * b = i->_open[id];
+                if(!b)
+                    continue;
+                if(i->_handover || i->_exiting || (t - b->opened >= FLUSH))
+                    i->close(id);
+                else if(b->opened < oldest)
+                    oldest = b->opened;
+            }
+            i->_handover = false;
+            deadline = oldest + FLUSH;
+        }
+
+        if(i->_full.empty()) {
+            if(i->_exiting)
+                break;
+            continue;
+        }
+
+        // The store is written unlocked, so producers keep filling batches meanwhile
+        unsigned int n = 0;
+        while(!i->_full.empty())
+            batches[n++] = i->_full.remove()->object();
+        i->unlock();
+
+        unsigned long long stored = 0;
+        for(unsigned int k = 0; k < n; k++) {
+            if(!i->_store->append(batches[k]->id, batches[k]->records, batches[k]->count))
+                db<Series_Ingestor>(ERR) << "Series_Ingestor: could not store " << batches[k]->count << " records of series " << batches[k]->id << "!" << endl;
+            stored += batches[k]->count;
+        }
+        if(SYNC && (now() - synced >= SYNC)) {
+            i->_store->sync();
+            synced = now();
+        }
+
+        i->lock();
+        for(unsigned int k = 0; k < n; k++)
+            i->_free.insert(&batches[k]->link);
+        i->_stored += stored;
+        pthread_cond_broadcast(&i->_room);
+        pthread_cond_broadcast(&i->_done);
+    }
+    i->unlock();
+
+    return 0;
+}
+
+Series_Ingestor::Tick Series_Ingestor::now()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return static_cast<Tick>(t.tv_sec) * 1000000 + t.tv_nsec / 1000;
+}
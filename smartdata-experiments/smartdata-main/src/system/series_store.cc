@@ -0,0 +1,807 @@
+// EPOS SmartData Series Store Implementation (POSIX)
+
+#include <main_traits.h>
+#include <system/series_store.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+constexpr unsigned long long Traits<Series_Store>::ROLLUPS[];
+
+// Packs bit fields MSB first. Fields of up to 64 bits; at most 7 bits are left pending between calls.
+class Series_Store::Bit_Writer
+{
+public:
+    Bit_Writer(unsigned char * out): _out(out), _bytes(0), _acc(0), _bits(0) {}
+
+    void put(unsigned long long v, unsigned int n) {
+        if(n > 32) {
+            put(v >> 32, n - 32);
+            n = 32;
+        }
+        _acc = (_acc << n) | (v & ((1ULL << n) - 1));
+        _bits += n;
+        while(_bits >= 8) {
+            _bits -= 8;
+            _out[_bytes++] = _acc >> _bits;
+        }
+        _acc &= (1ULL << _bits) - 1;
+    }
+
+    // Pads the last byte and returns how many were written
+    unsigned int close() {
+        if(_bits)
+            _out[_bytes++] = _acc << (8 - _bits);
+        _bits = 0;
+        return _bytes;
+    }
+
+private:
+    unsigned char * _out;
+    unsigned int _bytes;
+    unsigned long long _acc;
+    unsigned int _bits;
+};
+
+class Series_Store::Bit_Reader
+{
+public:
+    Bit_Reader(const unsigned char * in): _in(in), _acc(0), _bits(0) {}
+
+    unsigned long long get(unsigned int n) {
+        if(n > 32) {
+            unsigned long long high = get(n - 32);
+            return (high << 32) | get(32);
+        }
+        while(_bits < n) {
+            _acc = (_acc << 8) | *_in++;
+            _bits += 8;
+        }
+        _bits -= n;
+        return (_acc >> _bits) & ((1ULL << n) - 1);
+    }
+
+    bool bit() { return get(1); }
+
+private:
+    const unsigned char * _in;
+    unsigned long long _acc;
+    unsigned int _bits;
+};
+
+Series_Store::Series_Store(const char * path)
+: _fd(-1), _size(0), _map(0), _mapped(0), _series(0), _n_series(0), _max_series(0), _scratch(0), _decoded(0)
+{
+    db<Series_Store>(TRC) << "Series_Store(path=" << path << ")" << endl;
+
+    pthread_mutex_init(&_mutex, 0);
+    for(unsigned int i = 0; i < BUCKETS; i++)
+        _catalog[i] = 0;
+
+    // Worst case per record: 5 + 64 bits of time, 2 + 5 + 6 + 64 bits of value, 2 bytes and a run
+    unsigned int scratch = sizeof(Block_Header) + BLOCK * (19 + 2 + sizeof(Run)) + 16;
+    if(scratch < sizeof(Rollup_Header) + ROLLUP * sizeof(Aggregate))
+        scratch = sizeof(Rollup_Header) + ROLLUP * sizeof(Aggregate);
+    _scratch = new /*(SYSTEM)*/ unsigned char[scratch];
+    _decoded = new /*(SYSTEM)*/ DB_Record[BLOCK];
+
+    _fd = open(path, O_RDWR | O_CREAT, 0644);
+    if(_fd < 0) {
+        db<Series_Store>(ERR) << "Series_Store: could not open " << path << " (errno=" << errno << ")!" << endl;
+        return;
+    }
+
+    if(!recover()) {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+Series_Store::~Series_Store()
+{
+    db<Series_Store>(TRC) << "~Series_Store()" << endl;
+
+    if(_fd >= 0) {
+        // The latest windows are closed too, so they are not lost (if taking more records after a reopen, they get split).
+        // Rollups of series not yet planned are not written: recover() folds their few records again.
+        for(unsigned int i = 0; i < _n_series; i++)
+            for(unsigned int l = 0; l < LEVELS; l++)
+                if(_series[i]->planned && _series[i]->rollups[l].open.count)
+                    close(_series[i], l, _series[i]->rollups[l].open);
+        flush();
+        ::close(_fd);
+    }
+    if(_map)
+        munmap(const_cast<unsigned char *>(_map), _mapped);
+
+    for(unsigned int i = 0; i < _n_series; i++) {
+        Series * s = _series[i];
+        delete [] s->open;
+        delete [] s->blocks.refs;
+        for(unsigned int l = 0; l < LEVELS; l++) {
+            delete [] s->rollups[l].closed;
+            delete [] s->rollups[l].blocks.refs;
+        }
+        delete s;
+    }
+    delete [] _series;
+    delete [] _decoded;
+    delete [] _scratch;
+
+    pthread_mutex_destroy(&_mutex);
+}
+
+Series_Store::Series_Id Series_Store::series(const DB_Series & def)
+{
+    db<Series_Store>(TRC) << "Series_Store::series(def=" << def << ")" << endl;
+
+    if(!ready())
+        return NONE;
+
+    lock();
+
+    Series * s = find(def);
+    if(!s) {
+        Series_Entry e;
+        e.magic = SERIES;
+        e.id = _n_series;
+        e.type = def.type;
+        e.unit = def.unit;
+        e.x = def.x;
+        e.y = def.y;
+        e.z = def.z;
+        e.device = def.device;
+        e.r = def.r;
+        e.t0 = def.t0;
+        e.t1 = def.t1;
+        if(write(&e, sizeof(e)))
+            s = insert(def, e.id);
+    }
+
+    unlock();
+
+    return s ? s->id : NONE;
+}
+
+unsigned int Series_Store::series()
+{
+    lock();
+    unsigned int n = _n_series;
+    unlock();
+
+    return n;
+}
+
+const Series_Store::DB_Series & Series_Store::definition(Series_Id id)
+{
+    // _series grows (and moves) as series are created, possibly by a flusher, but a Series never moves
+    lock();
+    Series * s = _series[id];
+    unlock();
+
+    return s->definition;
+}
+
+unsigned long long Series_Store::records(Series_Id id)
+{
+    lock();
+    unsigned long long n = _series[id]->records;
+    unlock();
+
+    return n;
+}
+
+bool Series_Store::append(Series_Id id, const DB_Record * r, unsigned int n)
+{
+    if(!ready())
+        return false;
+
+    bool ok = true;
+
+    lock();
+
+    if(id >= _n_series) {
+        unlock();
+        return false;
+    }
+
+    Series * s = _series[id];
+    if(!s->open)
+        s->open = new /*(SYSTEM)*/ DB_Record[BLOCK];
+
+    for(unsigned int i = 0; i < n; i++) {
+        s->open[s->pending++] = r[i];
+        if(s->pending == BLOCK)
+            ok &= seal(s);
+        s->records++;
+        ok &= fold(s, r[i]);
+    }
+
+    unlock();
+
+    return ok;
+}
+
+bool Series_Store::flush()
+{
+    db<Series_Store>(TRC) << "Series_Store::flush()" << endl;
+
+    if(!ready())
+        return false;
+
+    bool ok = true;
+
+    lock();
+    for(unsigned int i = 0; i < _n_series; i++) {
+        ok &= seal(_series[i]);
+        if(_series[i]->planned)
+            for(unsigned int l = 0; l < LEVELS; l++)
+                ok &= seal(_series[i], l);
+    }
+    unlock();
+
+    return ok;
+}
+
+bool Series_Store::sync()
+{
+    return flush() && !fdatasync(_fd);
+}
+
+bool Series_Store::recover()
+{
+    struct stat st;
+    if(fstat(_fd, &st)) {
+        db<Series_Store>(ERR) << "Series_Store: could not stat the file (errno=" << errno << ")!" << endl;
+        return false;
+    }
+
+    if(!st.st_size) {
+        File_Header h;
+        h.magic = MAGIC;
+        h.version = VERSION;
+        return write(&h, sizeof(h));
+    }
+
+    _size = st.st_size;
+    if(!map())
+        return false;
+
+    const File_Header * h = reinterpret_cast<const File_Header *>(_map);
+    if((_size < sizeof(File_Header)) || (h->magic != MAGIC) || (h->version != VERSION)) {
+        db<Series_Store>(ERR) << "Series_Store: not a series store!" << endl;
+        return false;
+    }
+
+    unsigned long long offset = sizeof(File_Header);
+    while(offset + sizeof(unsigned int) <= _size) {
+        unsigned int magic = *reinterpret_cast<const unsigned int *>(_map + offset);
+
+        if((magic == SERIES) && (offset + sizeof(Series_Entry) <= _size)) {
+            const Series_Entry * e = reinterpret_cast<const Series_Entry *>(_map + offset);
+            if(e->id != _n_series)
+                break;
+            DB_Series def;
+            def.type = e->type;
+            def.unit = e->unit;
+            def.x = e->x;
+            def.y = e->y;
+            def.z = e->z;
+            def.device = e->device;
+            def.r = e->r;
+            def.t0 = e->t0;
+            def.t1 = e->t1;
+            insert(def, e->id);
+            offset += sizeof(Series_Entry);
+        } else if((magic == DATA) && (offset + sizeof(Block_Header) <= _size)) {
+            const Block_Header * b = reinterpret_cast<const Block_Header *>(_map + offset);
+            unsigned long long size = sizeof(Block_Header) + b->time_bytes + b->value_bytes + 2ULL * b->count + b->runs * sizeof(Run);
+            if((b->id >= _n_series) || !b->count || (b->count > BLOCK) || (b->runs > b->count) || (offset + size > _size))
+                break;
+            Series * s = _series[b->id];
+            s->blocks.insert(offset, b->t_min, b->t_max);
+            s->records += b->count;
+            offset += size;
+        } else if((magic == ROLLUPS) && (offset + sizeof(Rollup_Header) <= _size)) {
+            const Rollup_Header * h = reinterpret_cast<const Rollup_Header *>(_map + offset);
+            unsigned long long size = sizeof(Rollup_Header) + h->count * sizeof(Aggregate);
+            if((h->id >= _n_series) || !h->count || (h->count > ROLLUP) || (offset + size > _size))
+                break;
+            // Rollups of windows no longer configured are left alone
+            for(unsigned int l = 0; l < LEVELS; l++)
+                if(window(l) == h->window)
+                    _series[h->id]->rollups[l].blocks.insert(offset, h->t_min, h->t_max);
+            offset += size;
+        } else
+            break;
+    }
+
+    if(offset < _size) {
+        db<Series_Store>(WRN) << "Series_Store: discarding " << _size - offset << " bytes of an incomplete entry at " << offset << endl;
+        if(ftruncate(_fd, offset)) {
+            db<Series_Store>(ERR) << "Series_Store: could not truncate the file (errno=" << errno << ")!" << endl;
+            return false;
+        }
+        _size = offset;
+    }
+
+    // Series past their probe are planned again from the first PROBE records (keeping the rollups they have blocks of
+    // too), and the records past the last window each rollup wrote (i.e. still open, or not yet written when the store
+    // went down) are folded into it again. The others are probed again from their records.
+    for(unsigned int i = 0; i < _n_series; i++) {
+        Series * s = _series[i];
+        if(s->records >= PROBE) {
+            unsigned long long probed = 0;
+            for(unsigned int b = 0; (b < s->blocks.size) && (probed < PROBE); b++) {
+                unsigned int count = decode(_map + s->blocks.refs[b].offset, s->definition, _decoded);
+                for(unsigned int j = 0; (j < count) && (probed < PROBE); j++, probed++) {
+                    if(_decoded[j].t < s->first)
+                        s->first = _decoded[j].t;
+                    if(_decoded[j].t > s->last)
+                        s->last = _decoded[j].t;
+                }
+            }
+            plan(s);
+
+            bool written[LEVELS];
+            Time t_max[LEVELS];
+            for(unsigned int l = 0; l < LEVELS; l++) {
+                const Blocks & blocks = s->rollups[l].blocks;
+                written[l] = blocks.size;
+                t_max[l] = 0;
+                for(unsigned int b = 0; b < blocks.size; b++)
+                    if(blocks.refs[b].t_max > t_max[l])
+                        t_max[l] = blocks.refs[b].t_max;
+                if(written[l])
+                    s->levels |= 1U << l;
+            }
+
+            for(unsigned int b = 0; b < s->blocks.size; b++) {
+                const Block_Ref & ref = s->blocks.refs[b];
+                bool behind = true;
+                for(unsigned int l = 0; l < LEVELS; l++)
+                    if((s->levels & (1U << l)) && (!written[l] || (ref.t_max - ref.t_max % window(l) > t_max[l])))
+                        behind = false;
+                if(behind)
+                    continue;
+                unsigned int count = decode(_map + ref.offset, s->definition, _decoded);
+                for(unsigned int j = 0; j < count; j++)
+                    for(unsigned int l = 0; l < LEVELS; l++)
+                        if((s->levels & (1U << l)) && (!written[l] || (Aggregate(_decoded[j], window(l)).t > t_max[l])))
+                            fold(s, l, _decoded[j]);
+            }
+        } else if(s->records) {
+            s->records = 0;
+            for(unsigned int b = 0; b < s->blocks.size; b++) {
+                unsigned int count = decode(_map + s->blocks.refs[b].offset, s->definition, _decoded);
+                for(unsigned int j = 0; j < count; j++) {
+                    s->records++;
+                    fold(s, _decoded[j]);
+                }
+            }
+        }
+    }
+
+    db<Series_Store>(INF) << "Series_Store: recovered " << _n_series << " series, " << _size << " bytes" << endl;
+
+    return true;
+}
+
+// Maps the file as it is now (reads of what is appended later remap it)
+bool Series_Store::map()
+{
+    if(_size == _mapped)
+        return true;
+
+    void * m = _map ? mremap(const_cast<unsigned char *>(_map), _mapped, _size, MREMAP_MAYMOVE) : mmap(0, _size, PROT_READ, MAP_SHARED, _fd, 0);
+    if(m == MAP_FAILED) {
+        db<Series_Store>(ERR) << "Series_Store: could not map the file (errno=" << errno << ")!" << endl;
+        return false;
+    }
+
+    _map = reinterpret_cast<const unsigned char *>(m);
+    _mapped = _size;
+    return true;
+}
+
+bool Series_Store::write(const void * data, unsigned int size)
+{
+    const unsigned char * p = reinterpret_cast<const unsigned char *>(data);
+    unsigned int done = 0;
+    while(done < size) {
+        ssize_t n = pwrite(_fd, p + done, size - done, _size + done);
+        if(n < 0) {
+            if(errno == EINTR)
+                continue;
+            db<Series_Store>(ERR) << "Series_Store::write: failed (errno=" << errno << ")!" << endl;
+            // Whatever made it to the file is cut off on the next recovery
+            return false;
+        }
+        done += n;
+    }
+    _size += size;
+    return true;
+}
+
+bool Series_Store::seal(Series * s)
+{
+    if(!s->pending)
+        return true;
+
+    unsigned long long offset = _size;
+    unsigned int size = encode(s, _scratch);
+    const Block_Header * b = reinterpret_cast<const Block_Header *>(_scratch);
+
+    // Records of a block that could not be written are lost, so the next ones do not pile up behind them
+    s->pending = 0;
+    if(!write(_scratch, size))
+        return false;
+
+    s->blocks.insert(offset, b->t_min, b->t_max);
+
+    return true;
+}
+
+bool Series_Store::seal(Series * s, unsigned int level)
+{
+    Rollup & u = s->rollups[level];
+    if(!u.pending)
+        return true;
+
+    Rollup_Header h;
+    h.magic = ROLLUPS;
+    h.id = s->id;
+    h.window = window(level);
+    h.count = u.pending;
+    h.t_min = h.t_max = u.closed[0].t;
+    for(unsigned int i = 1; i < u.pending; i++) {
+        if(u.closed[i].t < h.t_min)
+            h.t_min = u.closed[i].t;
+        if(u.closed[i].t > h.t_max)
+            h.t_max = u.closed[i].t;
+    }
+
+    unsigned long long offset = _size;
+    u.pending = 0;
+    memcpy(_scratch, &h, sizeof(h));
+    memcpy(_scratch + sizeof(h), u.closed, h.count * sizeof(Aggregate));
+    if(!write(_scratch, sizeof(h) + h.count * sizeof(Aggregate)))
+        return false;
+
+    u.blocks.insert(offset, h.t_min, h.t_max);
+
+    return true;
+}
+
+bool Series_Store::fold(Series * s, const DB_Record & r)
+{
+    bool ok = true;
+
+    if(!s->planned) {
+        if(r.t < s->first)
+            s->first = r.t;
+        if(r.t > s->last)
+            s->last = r.t;
+    }
+
+    for(unsigned int l = 0; l < LEVELS; l++)
+        if(s->levels & (1U << l))
+            ok &= fold(s, l, r);
+
+    if(!s->planned && (s->records == PROBE))
+        plan(s);
+
+    return ok;
+}
+
+bool Series_Store::fold(Series * s, unsigned int level, const DB_Record & r)
+{
+    Rollup & u = s->rollups[level];
+    Aggregate a(r, window(level));
+    if(u.open.count && (a.t == u.open.t))
+        u.open.merge(a);
+    else if(!u.open.count || (a.t > u.open.t)) {
+        bool ok = !u.open.count || close(s, level, u.open);
+        u.open = a;
+        return ok;
+    } else
+        // A late record gets an aggregate of its own, merged with the others of its window by aggregate()
+        return close(s, level, a);
+
+    return true;
+}
+
+// Drops the rollups whose windows would take fewer than DENSITY records at the sampling period of the probe
+void Series_Store::plan(Series * s)
+{
+    Time period = (s->last - s->first) / (PROBE - 1);
+
+    for(unsigned int l = 0; l < LEVELS; l++)
+        if(window(l) < DENSITY * period) {
+            Rollup & u = s->rollups[l];
+            s->levels &= ~(1U << l);
+            u.open.count = 0;
+            u.pending = 0;
+            delete [] u.closed;
+            u.closed = 0;
+        }
+    s->planned = true;
+
+    db<Series_Store>(INF) << "Series_Store: series " << s->id << " sampled every " << period << " us keeps rollups " << hex << s->levels << dec << endl;
+}
+
+bool Series_Store::close(Series * s, unsigned int level, const Aggregate & a)
+{
+    Rollup & u = s->rollups[level];
+    if(!u.closed)
+        u.closed = new /*(SYSTEM)*/ Aggregate[ROLLUP];
+    u.closed[u.pending++] = a;
+    return (u.pending < ROLLUP) || seal(s, level);
+}
+
+void Series_Store::Blocks::insert(unsigned long long offset, Time t_min, Time t_max)
+{
+    if(size == max) {
+        max = max ? 2 * max : 16;
+        Block_Ref * r = new /*(SYSTEM)*/ Block_Ref[max];
+        memcpy(r, refs, size * sizeof(Block_Ref));
+        delete [] refs;
+        refs = r;
+    }
+    Block_Ref & ref = refs[size++];
+    ref.offset = offset;
+    ref.t_min = t_min;
+    ref.t_max = t_max;
+}
+
+Series_Store::Series * Series_Store::insert(const DB_Series & def, Series_Id id)
+{
+    if(_n_series == _max_series) {
+        _max_series = _max_series ? 2 * _max_series : 64;
+        Series ** series = new /*(SYSTEM)*/ Series *[_max_series];
+        memcpy(series, _series, _n_series * sizeof(Series *));
+        delete [] _series;
+        _series = series;
+    }
+
+    Series * s = new /*(SYSTEM)*/ Series;
+    s->definition = def;
+    s->id = id;
+    s->records = 0;
+    s->open = 0;
+    s->pending = 0;
+    s->blocks.refs = 0;
+    s->blocks.size = 0;
+    s->blocks.max = 0;
+    for(unsigned int l = 0; l < LEVELS; l++) {
+        Rollup & u = s->rollups[l];
+        u.open.count = 0;
+        u.closed = 0;
+        u.pending = 0;
+        u.blocks.refs = 0;
+        u.blocks.size = 0;
+        u.blocks.max = 0;
+    }
+    s->levels = (LEVELS < 32) ? (1U << LEVELS) - 1 : ~0U;
+    s->planned = false;
+    s->first = ~0ULL;
+    s->last = 0;
+
+    unsigned int h = hash(def) % BUCKETS;
+    s->next = _catalog[h];
+    _catalog[h] = s;
+
+    _series[_n_series++] = s;
+
+    return s;
+}
+
+Series_Store::Series * Series_Store::find(const DB_Series & def)
+{
+    Series * s = _catalog[hash(def) % BUCKETS];
+    while(s && !same(s->definition, def))
+        s = s->next;
+    return s;
+}
+
+unsigned int Series_Store::hash(const DB_Series & def)
+{
+    unsigned long long h = def.type;
+    h = h * 31 + def.unit;
+    h = h * 31 + def.x;
+    h = h * 31 + def.y;
+    h = h * 31 + def.z;
+    h = h * 31 + def.device;
+    h = h * 31 + def.r;
+    h = h * 31 + def.t0;
+    h = h * 31 + def.t1;
+    return h ^ (h >> 32);
+}
+
+bool Series_Store::same(const DB_Series & a, const DB_Series & b)
+{
+    return (a.type == b.type) && (a.unit == b.unit) && (a.x == b.x) && (a.y == b.y) && (a.z == b.z)
+        && (a.device == b.device) && (a.r == b.r) && (a.t0 == b.t0) && (a.t1 == b.t1);
+}
+
+unsigned int Series_Store::encode(const Series * s, unsigned char * out)
+{
+    const DB_Record * r = s->open;
+    unsigned int n = s->pending;
+
+    Block_Header * b = reinterpret_cast<Block_Header *>(out);
+    b->magic = DATA;
+    b->id = s->id;
+    b->count = n;
+    b->t_min = b->t_max = r[0].t;
+    unsigned char * p = out + sizeof(Block_Header);
+
+    // Timestamps: the first one, then zigzagged deltas of deltas in 0, 7, 9, 12, 32 or 64 bits
+    Bit_Writer time(p);
+    time.put(r[0].t, 64);
+    long long delta = 0;
+    for(unsigned int i = 1; i < n; i++) {
+        if(r[i].t < b->t_min)
+            b->t_min = r[i].t;
+        if(r[i].t > b->t_max)
+            b->t_max = r[i].t;
+
+        long long d = r[i].t - r[i - 1].t;
+        long long dod = d - delta;
+        delta = d;
+        unsigned long long zz = (dod << 1) ^ (dod >> 63);
+        if(!zz)
+            time.put(0, 1);
+        else if(zz < (1ULL << 7)) {
+            time.put(2, 2);
+            time.put(zz, 7);
+        } else if(zz < (1ULL << 9)) {
+            time.put(6, 3);
+            time.put(zz, 9);
+        } else if(zz < (1ULL << 12)) {
+            time.put(14, 4);
+            time.put(zz, 12);
+        } else if(zz < (1ULL << 32)) {
+            time.put(30, 5);
+            time.put(zz, 32);
+        } else {
+            time.put(31, 5);
+            time.put(zz, 64);
+        }
+    }
+    b->time_bytes = time.close();
+    p += b->time_bytes;
+
+    // Values: the first one, then XORs with the previous one, reusing the previous window of meaningful bits when they fit
+    Bit_Writer value(p);
+    unsigned long long previous;
+    memcpy(&previous, &r[0].value, sizeof(previous));
+    value.put(previous, 64);
+    unsigned int leading = 65, trailing = 0; // no window yet
+    for(unsigned int i = 1; i < n; i++) {
+        unsigned long long v;
+        memcpy(&v, &r[i].value, sizeof(v));
+        unsigned long long x = v ^ previous;
+        previous = v;
+        if(!x) {
+            value.put(0, 1);
+            continue;
+        }
+        unsigned int l = __builtin_clzll(x);
+        unsigned int t = __builtin_ctzll(x);
+        if(l > 31)
+            l = 31;
+        if((leading <= 64) && (l >= leading) && (t >= trailing)) {
+            value.put(2, 2);
+            value.put(x >> trailing, 64 - leading - trailing);
+        } else {
+            leading = l;
+            trailing = t;
+            unsigned int length = 64 - l - t;
+            value.put(3, 2);
+            value.put(l, 5);
+            value.put(length - 1, 6);
+            value.put(x >> t, length);
+        }
+    }
+    b->value_bytes = value.close();
+    p += b->value_bytes;
+
+    for(unsigned int i = 0; i < n; i++)
+        *p++ = r[i].uncertainty;
+    for(unsigned int i = 0; i < n; i++)
+        *p++ = r[i].confidence;
+
+    // Origins, as runs of records from the same place and device
+    b->runs = 0;
+    Run * run = 0;
+    for(unsigned int i = 0; i < n; i++) {
+        if(run && (run->x == r[i].x) && (run->y == r[i].y) && (run->z == r[i].z) && (run->device == r[i].device)) {
+            run->count++;
+            continue;
+        }
+        run = reinterpret_cast<Run *>(p);
+        run->count = 1;
+        run->x = r[i].x;
+        run->y = r[i].y;
+        run->z = r[i].z;
+        run->device = r[i].device;
+        p += sizeof(Run);
+        b->runs++;
+    }
+
+    return p - out;
+}
+
+unsigned int Series_Store::decode(const unsigned char * block, const DB_Series & def, DB_Record * out)
+{
+    const Block_Header * b = reinterpret_cast<const Block_Header *>(block);
+    unsigned int n = b->count;
+    const unsigned char * p = block + sizeof(Block_Header);
+
+    Bit_Reader time(p);
+    unsigned long long t = time.get(64);
+    long long delta = 0;
+    out[0].t = t;
+    for(unsigned int i = 1; i < n; i++) {
+        unsigned long long zz;
+        if(!time.bit())
+            zz = 0;
+        else if(!time.bit())
+            zz = time.get(7);
+        else if(!time.bit())
+            zz = time.get(9);
+        else if(!time.bit())
+            zz = time.get(12);
+        else if(!time.bit())
+            zz = time.get(32);
+        else
+            zz = time.get(64);
+        long long dod = (zz >> 1) ^ -(zz & 1);
+        delta += dod;
+        t += delta;
+        out[i].t = t;
+    }
+    p += b->time_bytes;
+
+    Bit_Reader value(p);
+    unsigned long long v = value.get(64);
+    unsigned int leading = 0, trailing = 0;
+    memcpy(&out[0].value, &v, sizeof(v));
+    for(unsigned int i = 1; i < n; i++) {
+        if(value.bit()) {
+            if(value.bit()) {
+                leading = value.get(5);
+                unsigned int length = value.get(6) + 1;
+                trailing = 64 - leading - length;
+            }
+            v ^= value.get(64 - leading - trailing) << trailing;
+        }
+        memcpy(&out[i].value, &v, sizeof(v));
+    }
+    p += b->value_bytes;
+
+    for(unsigned int i = 0; i < n; i++)
+        out[i].uncertainty = *p++;
+    for(unsigned int i = 0; i < n; i++)
+        out[i].confidence = *p++;
+
+    unsigned int i = 0;
+    for(unsigned int k = 0; k < b->runs; k++) {
+        const Run * run = reinterpret_cast<const Run *>(p);
+        for(unsigned int j = 0; (j < run->count) && (i < n); j++, i++) {
+            out[i].type = def.type;
+            out[i].unit = def.unit;
+            out[i].x = run->x;
+            out[i].y = run->y;
+            out[i].z = run->z;
+            out[i].device = run->device;
+        }
+        p += sizeof(Run);
+    }
+
+    return n;
+}
@@ -0,0 +1,154 @@
+// EPOS Alarm Engine Implementation (POSIX)
+
+#include <main_traits.h>
+#include <architecture/ia32/ia32_cpu.h>
+#include <system/thread.h>
+#include <sched.h>
+
+unsigned int Alarm::_dispatchers;
+Alarm::Dispatcher * Alarm::_dispatcher_list;
+volatile unsigned int Alarm::_next_dispatcher;
+pthread_once_t Alarm::_once = PTHREAD_ONCE_INIT;
+
+Alarm::Alarm(const Microsecond & time, Handler * handler, unsigned int times)
+: _time(time), _handler(handler), _times(times), _deadline(0), _link(this)
+{
+    db<Alarm>(TRC) << "Alarm(t=" << time << ",h=" << reinterpret_cast<void *>(handler) << ",x=" << times << ") => " << this << endl;
+
+    pthread_once(&_once, &init);
+    _dispatcher = &_dispatcher_list[CPU::finc(_next_dispatcher) % _dispatchers];
+
+    _dispatcher->lock();
+    if(_time && _times) {
+        _deadline = now() + _time;
+        _dispatcher->insert(this);
+    }
+    _dispatcher->unlock();
+}
+
+Alarm::~Alarm()
+{
+    db<Alarm>(TRC) << "~Alarm(this=" << this << ")" << endl;
+
+    _dispatcher->lock();
+    if(_link.linked())
+        _dispatcher->remove(this);
+    // A handler may be running on the timer thread right now
+    while((_dispatcher->_current == this) && !pthread_equal(pthread_self(), _dispatcher->_thread))
+        pthread_cond_wait(&_dispatcher->_done, &_dispatcher->_mutex);
+    _dispatcher->unlock();
+}
+
+void Alarm::period(const Microsecond & p)
+{
+    _dispatcher->lock();
+    // Next deadline stays, subsequent ones follow the new period
+    _time = p;
+    _dispatcher->unlock();
+}
+
+void Alarm::reset()
+{
+    db<Alarm>(TRC) << "Alarm::reset(this=" << this << ")" << endl;
+
+    _dispatcher->lock();
+    if(_link.linked())
+        _dispatcher->remove(this);
+    if(_time && _times) {
+        _deadline = now() + _time;
+        _dispatcher->insert(this);
+    }
+    _dispatcher->unlock();
+}
+
+void Alarm::init()
+{
+    _dispatchers = Traits<Alarm>::DISPATCHERS ? Traits<Alarm>::DISPATCHERS : sysconf(_SC_NPROCESSORS_ONLN);
+    if(!_dispatchers)
+        _dispatchers = 1;
+
+    db<Alarm>(TRC) << "Alarm::init(dispatchers=" << _dispatchers << ")" << endl;
+
+    _dispatcher_list = new /*(SYSTEM)*/ Dispatcher[_dispatchers];
+
+    // Deadlines are absolute on CLOCK_MONOTONIC, so are the timed waits
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+    for(unsigned int i = 0; i < _dispatchers; i++) {
+        Dispatcher * d = &_dispatcher_list[i];
+        pthread_mutex_init(&d->_mutex, 0);
+        pthread_cond_init(&d->_changed, &attr);
+        pthread_cond_init(&d->_done, 0);
+        pthread_create(&d->_thread, 0, &Dispatcher::run, d);
+
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(i % CPU_SETSIZE, &cpus);
+        pthread_setaffinity_np(d->_thread, sizeof(cpus), &cpus);
+
+        // Run above time-sharing threads whenever allowed to, so releases are not delayed by them
+        sched_param param;
+        param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+        if(pthread_setschedparam(d->_thread, SCHED_FIFO, &param))
+            db<Alarm>(INF) << "Alarm::init: real-time priority not available, timer " << i << " will run time-shared" << endl;
+    }
+
+    pthread_condattr_destroy(&attr);
+}
+
+void Alarm::Dispatcher::insert(Alarm * a)
+{
+    a->_link.rank(ticks(a->_deadline));
+    _wheel.insert(&a->_link);
+
+    // Wake the timer up only if it would sleep past the new deadline
+    if(a->_link.rank() < _wakeup)
+        pthread_cond_signal(&_changed);
+}
+
+void Alarm::Dispatcher::remove(Alarm * a)
+{
+    _wheel.remove(&a->_link);
+}
+
+void * Alarm::Dispatcher::run(void * p)
+{
+    Dispatcher * d = reinterpret_cast<Dispatcher *>(p);
+
+    d->lock();
+    while(true) {
+        Wheel::Element * e = d->_wheel.expire(ticks(now()));
+        if(!e) {
+            d->_wakeup = d->_wheel.next();
+            if(d->_wheel.empty())
+                pthread_cond_wait(&d->_changed, &d->_mutex);
+            else {
+                timespec t = to_timespec(d->_wakeup * RESOLUTION);
+                pthread_cond_timedwait(&d->_changed, &d->_mutex, &t);
+            }
+            d->_wakeup = 0;
+            continue;
+        }
+
+        Alarm * alarm = e->object();
+        if(alarm->_times != INFINITE)
+            alarm->_times--;
+        if(alarm->_times && alarm->_time) {
+            alarm->_deadline += alarm->_time; // from the deadline, not from now, to avoid drift
+            d->insert(alarm);
+        }
+
+        // The handler runs unlocked, so it can arm, reset and delete alarms (including its own)
+        d->_current = alarm;
+        d->unlock();
+        (*alarm->_handler)();
+        d->lock();
+        d->_current = 0;
+        pthread_cond_broadcast(&d->_done);
+    }
+    d->unlock();
+
+    return 0;
+}
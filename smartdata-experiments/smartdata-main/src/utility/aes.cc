@@ -3,407 +3,452 @@
 #include <main_traits.h>
 #include <assert.h>
 #include <utility/aes.h>
+#include <immintrin.h>
 
-// The lookup-tables are marked const so they can be placed in read-only storage instead of RAM
-// The numbers below can be computed dynamically trading ROM for RAM -
-// This can be useful in (embedded) bootloader applications, where ROM is often limited.
-const unsigned char SWAES<16>::sbox[256] = {
-	// 0     1     2     3     4     5     6     7     8     9     a     b     c     d     e     f
-	   0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
-	   0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
-	   0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
-	   0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
-	   0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
-	   0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
-	   0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
-	   0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
-	   0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
-	   0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
-	   0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
-	   0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
-	   0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
-	   0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
-	   0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
-	   0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16 };
-
-const unsigned char SWAES<16>::rsbox[256] = {
-	// 0     1     2     3     4     5     6     7     8     9     a     b     c     d     e     f
-           0x52, 0x09, 0x6a, 0xd5, 0x30, 0x36, 0xa5, 0x38, 0xbf, 0x40, 0xa3, 0x9e, 0x81, 0xf3, 0xd7, 0xfb,
-	   0x7c, 0xe3, 0x39, 0x82, 0x9b, 0x2f, 0xff, 0x87, 0x34, 0x8e, 0x43, 0x44, 0xc4, 0xde, 0xe9, 0xcb,
-	   0x54, 0x7b, 0x94, 0x32, 0xa6, 0xc2, 0x23, 0x3d, 0xee, 0x4c, 0x95, 0x0b, 0x42, 0xfa, 0xc3, 0x4e,
-	   0x08, 0x2e, 0xa1, 0x66, 0x28, 0xd9, 0x24, 0xb2, 0x76, 0x5b, 0xa2, 0x49, 0x6d, 0x8b, 0xd1, 0x25,
-	   0x72, 0xf8, 0xf6, 0x64, 0x86, 0x68, 0x98, 0x16, 0xd4, 0xa4, 0x5c, 0xcc, 0x5d, 0x65, 0xb6, 0x92,
-	   0x6c, 0x70, 0x48, 0x50, 0xfd, 0xed, 0xb9, 0xda, 0x5e, 0x15, 0x46, 0x57, 0xa7, 0x8d, 0x9d, 0x84,
-	   0x90, 0xd8, 0xab, 0x00, 0x8c, 0xbc, 0xd3, 0x0a, 0xf7, 0xe4, 0x58, 0x05, 0xb8, 0xb3, 0x45, 0x06,
-	   0xd0, 0x2c, 0x1e, 0x8f, 0xca, 0x3f, 0x0f, 0x02, 0xc1, 0xaf, 0xbd, 0x03, 0x01, 0x13, 0x8a, 0x6b,
-	   0x3a, 0x91, 0x11, 0x41, 0x4f, 0x67, 0xdc, 0xea, 0x97, 0xf2, 0xcf, 0xce, 0xf0, 0xb4, 0xe6, 0x73,
-	   0x96, 0xac, 0x74, 0x22, 0xe7, 0xad, 0x35, 0x85, 0xe2, 0xf9, 0x37, 0xe8, 0x1c, 0x75, 0xdf, 0x6e,
-	   0x47, 0xf1, 0x1a, 0x71, 0x1d, 0x29, 0xc5, 0x89, 0x6f, 0xb7, 0x62, 0x0e, 0xaa, 0x18, 0xbe, 0x1b,
-	   0xfc, 0x56, 0x3e, 0x4b, 0xc6, 0xd2, 0x79, 0x20, 0x9a, 0xdb, 0xc0, 0xfe, 0x78, 0xcd, 0x5a, 0xf4,
-	   0x1f, 0xdd, 0xa8, 0x33, 0x88, 0x07, 0xc7, 0x31, 0xb1, 0x12, 0x10, 0x59, 0x27, 0x80, 0xec, 0x5f,
-	   0x60, 0x51, 0x7f, 0xa9, 0x19, 0xb5, 0x4a, 0x0d, 0x2d, 0xe5, 0x7a, 0x9f, 0x93, 0xc9, 0x9c, 0xef,
-	   0xa0, 0xe0, 0x3b, 0x4d, 0xae, 0x2a, 0xf5, 0xb0, 0xc8, 0xeb, 0xbb, 0x3c, 0x83, 0x53, 0x99, 0x61,
-	   0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26, 0xe1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0c, 0x7d };
-
-
-// The round constant word array, rcon[i], contains the values given by
-// x to th e power (i-1) being powers of x (x is denoted as {02}) in the field GF(2^8)
-// Note that i starts at 1, not 0).
-const unsigned char SWAES<16>::rcon[255] = {
-	// 0     1     2     3     4     5     6     7     8     9     a     b     c     d     e     f
-           0x8d, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36, 0x6c, 0xd8, 0xab, 0x4d, 0x9a,
-	   0x2f, 0x5e, 0xbc, 0x63, 0xc6, 0x97, 0x35, 0x6a, 0xd4, 0xb3, 0x7d, 0xfa, 0xef, 0xc5, 0x91, 0x39,
-	   0x72, 0xe4, 0xd3, 0xbd, 0x61, 0xc2, 0x9f, 0x25, 0x4a, 0x94, 0x33, 0x66, 0xcc, 0x83, 0x1d, 0x3a,
-	   0x74, 0xe8, 0xcb, 0x8d, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36, 0x6c, 0xd8,
-	   0xab, 0x4d, 0x9a, 0x2f, 0x5e, 0xbc, 0x63, 0xc6, 0x97, 0x35, 0x6a, 0xd4, 0xb3, 0x7d, 0xfa, 0xef,
-	   0xc5, 0x91, 0x39, 0x72, 0xe4, 0xd3, 0xbd, 0x61, 0xc2, 0x9f, 0x25, 0x4a, 0x94, 0x33, 0x66, 0xcc,
-	   0x83, 0x1d, 0x3a, 0x74, 0xe8, 0xcb, 0x8d, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b,
-	   0x36, 0x6c, 0xd8, 0xab, 0x4d, 0x9a, 0x2f, 0x5e, 0xbc, 0x63, 0xc6, 0x97, 0x35, 0x6a, 0xd4, 0xb3,
-	   0x7d, 0xfa, 0xef, 0xc5, 0x91, 0x39, 0x72, 0xe4, 0xd3, 0xbd, 0x61, 0xc2, 0x9f, 0x25, 0x4a, 0x94,
-	   0x33, 0x66, 0xcc, 0x83, 0x1d, 0x3a, 0x74, 0xe8, 0xcb, 0x8d, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20,
-	   0x40, 0x80, 0x1b, 0x36, 0x6c, 0xd8, 0xab, 0x4d, 0x9a, 0x2f, 0x5e, 0xbc, 0x63, 0xc6, 0x97, 0x35,
-	   0x6a, 0xd4, 0xb3, 0x7d, 0xfa, 0xef, 0xc5, 0x91, 0x39, 0x72, 0xe4, 0xd3, 0xbd, 0x61, 0xc2, 0x9f,
-	   0x25, 0x4a, 0x94, 0x33, 0x66, 0xcc, 0x83, 0x1d, 0x3a, 0x74, 0xe8, 0xcb, 0x8d, 0x01, 0x02, 0x04,
-	   0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36, 0x6c, 0xd8, 0xab, 0x4d, 0x9a, 0x2f, 0x5e, 0xbc, 0x63,
-	   0xc6, 0x97, 0x35, 0x6a, 0xd4, 0xb3, 0x7d, 0xfa, 0xef, 0xc5, 0x91, 0x39, 0x72, 0xe4, 0xd3, 0xbd,
-	   0x61, 0xc2, 0x9f, 0x25, 0x4a, 0x94, 0x33, 0x66, 0xcc, 0x83, 0x1d, 0x3a, 0x74, 0xe8, 0xcb  };
-
-void SWAES<16>::ebc_encrypt(const unsigned char * input, const unsigned char * key, unsigned char * output)
+SWAES<16>::SWAES(const Mode & m): _mode(m)
 {
-    // Copy input to output, and work in-memory on output
-    block_copy(output, input);
-    _state = reinterpret_cast<State *>(output);
+    assert((m == ECB) || (m == CBC));
 
-    _key = key;
-    expand_key();
+    _ni = Traits<Ciphers>::AES_NI && __builtin_cpu_supports("aes");
+    for(unsigned int i = 0; i < 16; i++)
+        _iv[i] = 0;
 
-    // The next function call encrypts the PlainText with the _key using AES algorithm.
-    cipher();
+    db<Ciphers>(INF) << "AES:" << (_ni ? "AES-NI" : "bitsliced") << endl;
 }
 
-void SWAES<16>::ebc_decrypt(const unsigned char * input, const unsigned char * key, unsigned char *output)
+// Input is 0-padded to a multiple of 16 bytes
+void SWAES<16>::cbc_encrypt_buffer(unsigned char * output, const unsigned char * input, int length, const Round_Keys & rk, const unsigned char * iv)
 {
-    // Copy input to output, and work in-memory on output
-    block_copy(output, input);
-    _state = reinterpret_cast<State *>(output);
-
-    // The expand_key routine must be called before encryption.
-    _key = key;
-    expand_key();
-
-    inv_cipher();
+    for(int i = 0; i < length; i += KEY_SIZE) {
+        unsigned char block[KEY_SIZE];
+        for(int j = 0; j < int(KEY_SIZE); j++)
+            block[j] = (i + j < length) ? input[i + j] : 0;
+        xor_with_iv(block, iv);
+        encrypt_block(rk, block, output);
+        iv = output;
+        output += KEY_SIZE;
+    }
 }
 
-void SWAES<16>::cbc_encrypt_buffer(unsigned char * output, const unsigned char * _input, int length, const unsigned char * key, unsigned char * iv)
+void SWAES<16>::cbc_decrypt_buffer(unsigned char * output, const unsigned char * input, int length, const Round_Keys & rk, const unsigned char * iv)
 {
-    unsigned char remainders = length % KEY_SIZE; /* Remaining bytes in the last non-full block */
-
-    block_copy(output, _input);
-    _state = reinterpret_cast<State *>(output);
-
-    // Skip the key expansion if key is passed as 0
-    if(0 != key) {
-        _key = key;
-        expand_key();
-    }
-
-    if(iv != 0)
-        _iv = iv;
-
-    int i;
-    for(i = 0; i < length; i += KEY_SIZE) {
-        unsigned char input[KEY_SIZE];
-        for(int j=0; (j<(int)KEY_SIZE) && (j+i < length); j++)
-            input[j] = _input[j+i];
-        xor_with_iv(input);
-        block_copy(output, input);
-        _state = reinterpret_cast<State *>(output);
-        cipher();
-        _iv = output;
+    // Output may overlap input, so the ciphertext each block is chained to is kept apart
+    unsigned char previous[KEY_SIZE];
+    memcpy(previous, iv, KEY_SIZE);
+    for(int i = 0; i < length; i += KEY_SIZE) {
+        unsigned char ciphertext[KEY_SIZE];
+        memcpy(ciphertext, input, KEY_SIZE);
+        decrypt_block(rk, ciphertext, output);
+        xor_with_iv(output, previous);
+        memcpy(previous, ciphertext, KEY_SIZE);
+        input += KEY_SIZE;
         output += KEY_SIZE;
     }
+}
 
-    if(remainders) {
-        block_copy(output, _input+i);
-        memset(output + remainders, 0, KEY_SIZE - remainders); /* add 0-padding */
-        _state = reinterpret_cast<State *>(output);
-        cipher();
-    }
+
+// Bitsliced software
+// Byte k of a state is the one at row k % 4, column k / 4 (i.e. the order of the bytes of a block). Bit k of word j
+// of a bitsliced state is bit j of byte k.
+
+// Transposes the 8x8 bit matrix whose row k is byte k of x (so it is its own inverse)
+static inline unsigned long long transpose(unsigned long long x)
+{
+    unsigned long long t;
+    t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaULL;
+    x ^= t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000cccc0000ccccULL;
+    x ^= t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ULL;
+    x ^= t ^ (t << 28);
+    return x;
 }
 
-void SWAES<16>::cbc_decrypt_buffer(unsigned char * output, const unsigned char * input, int length, const unsigned char * key, unsigned char * iv)
+void SWAES<16>::bitslice(const unsigned char * bytes, unsigned int * q)
 {
-    int i;
-    unsigned char remainders = length % KEY_SIZE; /* Remaining bytes in the last non-full block */
+    unsigned long long lo, hi;
+    memcpy(&lo, bytes, 8);
+    memcpy(&hi, bytes + 8, 8);
+    lo = transpose(lo);
+    hi = transpose(hi);
+    for(unsigned int j = 0; j < 8; j++)
+        q[j] = ((lo >> (8 * j)) & 0xff) | (((hi >> (8 * j)) & 0xff) << 8);
+}
 
-    block_copy(output, input);
-    _state = reinterpret_cast<State *>(output);
+void SWAES<16>::unbitslice(const unsigned int * q, unsigned char * bytes)
+{
+    unsigned long long lo = 0, hi = 0;
+    for(unsigned int j = 0; j < 8; j++) {
+        lo |= static_cast<unsigned long long>(q[j] & 0xff) << (8 * j);
+        hi |= static_cast<unsigned long long>((q[j] >> 8) & 0xff) << (8 * j);
+    }
+    lo = transpose(lo);
+    hi = transpose(hi);
+    memcpy(bytes, &lo, 8);
+    memcpy(bytes + 8, &hi, 8);
+}
 
-    // Skip the key expansion if key is passed as 0
-    if(0 != key) {
-        _key = key;
-        expand_key();
+// The round keys are expanded bytewise, with SubWord() bitsliced too
+void SWAES<16>::expand(const unsigned char * key, Round_Keys & rk)
+{
+    unsigned char w[(Nr + 1) * 16];
+    memcpy(w, key, 16);
+
+    unsigned char rcon = 1;
+    for(unsigned int i = 16; i < sizeof(w); i += 4) {
+        unsigned char t[16] = { w[i - 4], w[i - 3], w[i - 2], w[i - 1] };
+        if(i % 16 == 0) {
+            // RotWord() and SubWord()
+            unsigned int q[8];
+            unsigned char r = t[0];
+            t[0] = t[1];
+            t[1] = t[2];
+            t[2] = t[3];
+            t[3] = r;
+            bitslice(t, q);
+            sub_bytes(q);
+            unbitslice(q, t);
+            t[0] ^= rcon;
+            rcon = (rcon << 1) ^ ((rcon >> 7) * 0x1b);
+        }
+        for(unsigned int j = 0; j < 4; j++)
+            w[i + j] = w[i - 16 + j] ^ t[j];
     }
 
-    // If iv is passed as 0, we continue to encrypt without re-setting the _iv
-    if(iv != 0)
-        _iv = iv;
+    for(unsigned int r = 0; r <= Nr; r++)
+        bitslice(&w[r * 16], &rk[r * 8]);
+}
 
-    for(i = 0; i < length; i += KEY_SIZE) {
-        block_copy(output, input);
-        _state = reinterpret_cast<State *>(output);
-        inv_cipher();
-        xor_with_iv(output);
-        _iv = const_cast<unsigned char *>(input);
-        input += KEY_SIZE;
-        output += KEY_SIZE;
+void SWAES<16>::cipher(const Round_Keys & rk, const unsigned char * input, unsigned char * output)
+{
+    unsigned int q[8];
+
+    bitslice(input, q);
+    add_round_key(q, &rk[0]);
+    for(unsigned int round = 1; round < Nr; round++) {
+        sub_bytes(q);
+        shift_rows(q);
+        mix_columns(q);
+        add_round_key(q, &rk[round * 8]);
     }
+    sub_bytes(q);
+    shift_rows(q);
+    add_round_key(q, &rk[Nr * 8]);
+    unbitslice(q, output);
+}
 
-    if(remainders) {
-        block_copy(output, input);
-        memset(output+remainders, 0, KEY_SIZE - remainders); /* add 0-padding */
-        _state = reinterpret_cast<State *>(output);
-        inv_cipher();
+void SWAES<16>::inv_cipher(const Round_Keys & rk, const unsigned char * input, unsigned char * output)
+{
+    unsigned int q[8];
+
+    bitslice(input, q);
+    add_round_key(q, &rk[Nr * 8]);
+    for(unsigned int round = Nr - 1; round > 0; round--) {
+        inv_shift_rows(q);
+        inv_sub_bytes(q);
+        add_round_key(q, &rk[round * 8]);
+        inv_mix_columns(q);
     }
+    inv_shift_rows(q);
+    inv_sub_bytes(q);
+    add_round_key(q, &rk[0]);
+    unbitslice(q, output);
 }
 
-// This function produces Nb(Nr+1) round keys. The round keys are used in each round to decrypt the states.
-void SWAES<16>::expand_key(void)
+// Boyar and Peralta's circuit for the S-box (113 gates), from "A depth-16 circuit for the AES S-box"
+// (x0 is the most significant bit)
+void SWAES<16>::sub_bytes(unsigned int * q)
 {
-    unsigned int i, j, k;
-    unsigned char tempa[4]; // Used for the column/row operations
-
-    // The first round key is the key itself.
-    for(i = 0; i < Nk; ++i) {
-        _round_key[(i * 4) + 0] = _key[(i * 4) + 0];
-        _round_key[(i * 4) + 1] = _key[(i * 4) + 1];
-        _round_key[(i * 4) + 2] = _key[(i * 4) + 2];
-        _round_key[(i * 4) + 3] = _key[(i * 4) + 3];
-    }
+    unsigned int x0, x1, x2, x3, x4, x5, x6, x7;
+    unsigned int y1, y2, y3, y4, y5, y6, y7, y8, y9, y10, y11, y12, y13, y14, y15, y16, y17, y18, y19, y20, y21;
+    unsigned int z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15, z16, z17;
+    unsigned int t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+    unsigned int t20, t21, t22, t23, t24, t25, t26, t27, t28, t29, t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+    unsigned int t40, t41, t42, t43, t44, t45, t46, t47, t48, t49, t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+    unsigned int t60, t61, t62, t63, t64, t65, t66, t67;
+    unsigned int s0, s1, s2, s3, s4, s5, s6, s7;
+
+    x0 = q[7];
+    x1 = q[6];
+    x2 = q[5];
+    x3 = q[4];
+    x4 = q[3];
+    x5 = q[2];
+    x6 = q[1];
+    x7 = q[0];
+
+    // Top linear transformation
+    y14 = x3 ^ x5;
+    y13 = x0 ^ x6;
+    y9 = x0 ^ x3;
+    y8 = x0 ^ x5;
+    t0 = x1 ^ x2;
+    y1 = t0 ^ x7;
+    y4 = y1 ^ x3;
+    y12 = y13 ^ y14;
+    y2 = y1 ^ x0;
+    y5 = y1 ^ x6;
+    y3 = y5 ^ y8;
+    t1 = x4 ^ y12;
+    y15 = t1 ^ x5;
+    y20 = t1 ^ x1;
+    y6 = y15 ^ x7;
+    y10 = y15 ^ t0;
+    y11 = y20 ^ y9;
+    y7 = x7 ^ y11;
+    y17 = y10 ^ y11;
+    y19 = y10 ^ y8;
+    y16 = t0 ^ y11;
+    y21 = y13 ^ y16;
+    y18 = x0 ^ y16;
+
+    // Non-linear section
+    t2 = y12 & y15;
+    t3 = y3 & y6;
+    t4 = t3 ^ t2;
+    t5 = y4 & x7;
+    t6 = t5 ^ t2;
+    t7 = y13 & y16;
+    t8 = y5 & y1;
+    t9 = t8 ^ t7;
+    t10 = y2 & y7;
+    t11 = t10 ^ t7;
+    t12 = y9 & y11;
+    t13 = y14 & y17;
+    t14 = t13 ^ t12;
+    t15 = y8 & y10;
+    t16 = t15 ^ t12;
+    t17 = t4 ^ t14;
+    t18 = t6 ^ t16;
+    t19 = t9 ^ t14;
+    t20 = t11 ^ t16;
+    t21 = t17 ^ y20;
+    t22 = t18 ^ y19;
+    t23 = t19 ^ y21;
+    t24 = t20 ^ y18;
+
+    t25 = t21 ^ t22;
+    t26 = t21 & t23;
+    t27 = t24 ^ t26;
+    t28 = t25 & t27;
+    t29 = t28 ^ t22;
+    t30 = t23 ^ t24;
+    t31 = t22 ^ t26;
+    t32 = t31 & t30;
+    t33 = t32 ^ t24;
+    t34 = t23 ^ t33;
+    t35 = t27 ^ t33;
+    t36 = t24 & t35;
+    t37 = t36 ^ t34;
+    t38 = t27 ^ t36;
+    t39 = t29 & t38;
+    t40 = t25 ^ t39;
+
+    t41 = t40 ^ t37;
+    t42 = t29 ^ t33;
+    t43 = t29 ^ t40;
+    t44 = t33 ^ t37;
+    t45 = t42 ^ t41;
+    z0 = t44 & y15;
+    z1 = t37 & y6;
+    z2 = t33 & x7;
+    z3 = t43 & y16;
+    z4 = t40 & y1;
+    z5 = t29 & y7;
+    z6 = t42 & y11;
+    z7 = t45 & y17;
+    z8 = t41 & y10;
+    z9 = t44 & y12;
+    z10 = t37 & y3;
+    z11 = t33 & y4;
+    z12 = t43 & y13;
+    z13 = t40 & y5;
+    z14 = t29 & y2;
+    z15 = t42 & y9;
+    z16 = t45 & y14;
+    z17 = t41 & y8;
+
+    // Bottom linear transformation
+    t46 = z15 ^ z16;
+    t47 = z10 ^ z11;
+    t48 = z5 ^ z13;
+    t49 = z9 ^ z10;
+    t50 = z2 ^ z12;
+    t51 = z2 ^ z5;
+    t52 = z7 ^ z8;
+    t53 = z0 ^ z3;
+    t54 = z6 ^ z7;
+    t55 = z16 ^ z17;
+    t56 = z12 ^ t48;
+    t57 = t50 ^ t53;
+    t58 = z4 ^ t46;
+    t59 = z3 ^ t54;
+    t60 = t46 ^ t57;
+    t61 = z14 ^ t57;
+    t62 = t52 ^ t58;
+    t63 = t49 ^ t58;
+    t64 = z4 ^ t59;
+    t65 = t61 ^ t62;
+    t66 = z1 ^ t63;
+    s0 = t59 ^ t63;
+    s6 = t56 ^ ~t62;
+    s7 = t48 ^ ~t60;
+    t67 = t64 ^ t65;
+    s3 = t53 ^ t66;
+    s4 = t51 ^ t66;
+    s5 = t47 ^ t65;
+    s1 = t64 ^ ~s3;
+    s2 = t55 ^ ~t67;
+
+    q[7] = s0;
+    q[6] = s1;
+    q[5] = s2;
+    q[4] = s3;
+    q[3] = s4;
+    q[2] = s5;
+    q[1] = s6;
+    q[0] = s7;
+}
 
-    // All other round keys are found from the previous round keys.
-    for(; (i < (Nb * (Nr + 1))); ++i) {
-        for(j = 0; j < 4; ++j)
-            tempa[j]=_round_key[(i-1) * 4 + j];
-        if (i % Nk == 0) {
-            // This function rotates the 4 bytes in a word to the left once.
-            // [a0,a1,a2,a3] becomes [a1,a2,a3,a0]
-
-            // Function RotWord()
-            {
-                k = tempa[0];
-                tempa[0] = tempa[1];
-                tempa[1] = tempa[2];
-                tempa[2] = tempa[3];
-                tempa[3] = k;
-            }
-
-            // SubWord() is a function that takes a four-byte input word and
-            // applies the S-box to each of the four bytes to produce an output word.
-
-            // Function Subword()
-            {
-                tempa[0] = sbox[static_cast<int>(tempa[0])];
-                tempa[1] = sbox[static_cast<int>(tempa[1])];
-                tempa[2] = sbox[static_cast<int>(tempa[2])];
-                tempa[3] = sbox[static_cast<int>(tempa[3])];
-            }
-
-            tempa[0] =  tempa[0] ^ rcon[i/Nk];
-        }
-        else if (Nk > 6 && i % Nk == 4) {
-            // Function Subword()
-            {
-                tempa[0] = sbox[static_cast<int>(tempa[0])];
-                tempa[1] = sbox[static_cast<int>(tempa[1])];
-                tempa[2] = sbox[static_cast<int>(tempa[2])];
-                tempa[3] = sbox[static_cast<int>(tempa[3])];
-            }
-        }
-        _round_key[i * 4 + 0] = _round_key[(i - Nk) * 4 + 0] ^ tempa[0];
-        _round_key[i * 4 + 1] = _round_key[(i - Nk) * 4 + 1] ^ tempa[1];
-        _round_key[i * 4 + 2] = _round_key[(i - Nk) * 4 + 2] ^ tempa[2];
-        _round_key[i * 4 + 3] = _round_key[(i - Nk) * 4 + 3] ^ tempa[3];
+// S(x) = A(I(x)) ^ 0x63, where I() is the inversion in GF(2^8) and A() an affine transformation, and I() is an
+// involution, so the inverse S-box is B(S(B(x ^ 0x63)) ^ 0x63), B() being the inverse of A()
+void SWAES<16>::inv_sub_bytes(unsigned int * q)
+{
+    for(unsigned int pass = 0; pass < 2; pass++) {
+        if(pass)
+            sub_bytes(q);
+
+        // Bit j of B(x ^ 0x63) is bit j + 2 ^ bit j + 5 ^ bit j + 7 of x ^ 0x63 (mod 8)
+        unsigned int x[8];
+        for(unsigned int j = 0; j < 8; j++)
+            x[j] = (0x63 & (1 << j)) ? ~q[j] : q[j];
+        for(unsigned int j = 0; j < 8; j++)
+            q[j] = x[(j + 2) % 8] ^ x[(j + 5) % 8] ^ x[(j + 7) % 8];
     }
 }
 
-// This function adds the round key to _state.
-// The round key is added to the _state by an XOR function.
-void SWAES<16>::add_round_key(int round)
+// Row r rotated left by r columns: the bits of row r move right by 4 * r positions
+static inline unsigned int rotr16(unsigned int x, unsigned int n) { return ((x >> n) | (x << (16 - n))) & 0xffff; }
+
+void SWAES<16>::shift_rows(unsigned int * q)
 {
-    int i,j;
-    for(i=0;i<4;++i) {
-        for(j = 0; j < 4; ++j) {
-            (*_state)[i][j] ^= _round_key[round * Nb * 4 + i * Nb + j];
-        }
+    for(unsigned int j = 0; j < 8; j++) {
+        unsigned int x = q[j];
+        q[j] = (x & 0x1111) | rotr16(x & 0x2222, 4) | rotr16(x & 0x4444, 8) | rotr16(x & 0x8888, 12);
     }
 }
 
-// The sub_bytes Function Substitutes the values in the
-// _state matrix with values in an S-box.
-void SWAES<16>::sub_bytes(void)
+void SWAES<16>::inv_shift_rows(unsigned int * q)
 {
-    int i, j;
-    for(i = 0; i < 4; ++i) {
-        for(j = 0; j < 4; ++j) {
-            (*_state)[j][i] = sbox[static_cast<int>((*_state)[j][i])];
-        }
+    for(unsigned int j = 0; j < 8; j++) {
+        unsigned int x = q[j];
+        q[j] = (x & 0x1111) | rotr16(x & 0x2222, 12) | rotr16(x & 0x4444, 8) | rotr16(x & 0x8888, 4);
     }
 }
 
-// The shift_rows() function shifts the rows in the _state to the left.
-// Each row is shifted with different offset.
-// Offset = Row number. So the first row is not shifted.
-void SWAES<16>::shift_rows(void)
+// Each byte of a column in the place of the one r rows above it
+static inline unsigned int rot1(unsigned int x) { return ((x >> 1) & 0x7777) | ((x << 3) & 0x8888); }
+static inline unsigned int rot2(unsigned int x) { return ((x >> 2) & 0x3333) | ((x << 2) & 0xcccc); }
+
+// Multiplication by {02} of every byte
+static inline void xtime(const unsigned int * t, unsigned int * x)
 {
-    unsigned char temp;
-
-    // Rotate first row 1 columns to left
-    temp            = (*_state)[0][1];
-    (*_state)[0][1] = (*_state)[1][1];
-    (*_state)[1][1] = (*_state)[2][1];
-    (*_state)[2][1] = (*_state)[3][1];
-    (*_state)[3][1] = temp;
-
-    // Rotate second row 2 columns to left
-    temp            = (*_state)[0][2];
-    (*_state)[0][2] = (*_state)[2][2];
-    (*_state)[2][2] = temp;
-
-    temp            = (*_state)[1][2];
-    (*_state)[1][2] = (*_state)[3][2];
-    (*_state)[3][2] = temp;
-
-    // Rotate third row 3 columns to left
-    temp            = (*_state)[0][3];
-    (*_state)[0][3] = (*_state)[3][3];
-    (*_state)[3][3] = (*_state)[2][3];
-    (*_state)[2][3] = (*_state)[1][3];
-    (*_state)[1][3] = temp;
+    x[0] = t[7];
+    x[1] = t[0] ^ t[7];
+    x[2] = t[1];
+    x[3] = t[2] ^ t[7];
+    x[4] = t[3] ^ t[7];
+    x[5] = t[4];
+    x[6] = t[5];
+    x[7] = t[6];
 }
 
-// mix_columns function mixes the columns of the _state matrix
-void SWAES<16>::mix_columns(void)
+// b[r] = {02}a[r] ^ {03}a[r + 1] ^ a[r + 2] ^ a[r + 3] = {02}(a[r] ^ a[r + 1]) ^ a[r + 1] ^ a[r + 2] ^ a[r + 3]
+void SWAES<16>::mix_columns(unsigned int * q)
 {
-    int i;
-    unsigned char Tmp,Tm,t;
-    for(i = 0; i < 4; ++i) {
-        t   = (*_state)[i][0];
-        Tmp = (*_state)[i][0] ^ (*_state)[i][1] ^ (*_state)[i][2] ^ (*_state)[i][3] ;
-        Tm  = (*_state)[i][0] ^ (*_state)[i][1] ; Tm = xtime(Tm);  (*_state)[i][0] ^= Tm ^ Tmp ;
-        Tm  = (*_state)[i][1] ^ (*_state)[i][2] ; Tm = xtime(Tm);  (*_state)[i][1] ^= Tm ^ Tmp ;
-        Tm  = (*_state)[i][2] ^ (*_state)[i][3] ; Tm = xtime(Tm);  (*_state)[i][2] ^= Tm ^ Tmp ;
-        Tm  = (*_state)[i][3] ^ t ;        Tm = xtime(Tm);  (*_state)[i][3] ^= Tm ^ Tmp ;
+    unsigned int t[8], x[8];
+    for(unsigned int j = 0; j < 8; j++) {
+        unsigned int a1 = rot1(q[j]);
+        unsigned int a2 = rot2(q[j]);
+        t[j] = q[j] ^ a1;
+        q[j] = a1 ^ a2 ^ rot1(a2);
     }
+    xtime(t, x);
+    for(unsigned int j = 0; j < 8; j++)
+        q[j] ^= x[j];
 }
 
-// mix_columns function mixes the columns of the _state matrix.
-// The method used to multiply may be difficult to understand for the inexperienced.
-// Please use the references to gain more information.
-void SWAES<16>::inv_mix_columns(void)
+// InvMixColumns is MixColumns after multiplying each column by {04}x^2 + {05}, i.e. a[r] ^= {04}(a[r] ^ a[r + 2])
+void SWAES<16>::inv_mix_columns(unsigned int * q)
 {
-    int i;
-    unsigned char a,b,c,d;
-    for(i = 0; i < 4; ++i) {
-        a = (*_state)[i][0];
-        b = (*_state)[i][1];
-        c = (*_state)[i][2];
-        d = (*_state)[i][3];
-
-        (*_state)[i][0] = multiply(a, 0x0e) ^ multiply(b, 0x0b) ^ multiply(c, 0x0d) ^ multiply(d, 0x09);
-        (*_state)[i][1] = multiply(a, 0x09) ^ multiply(b, 0x0e) ^ multiply(c, 0x0b) ^ multiply(d, 0x0d);
-        (*_state)[i][2] = multiply(a, 0x0d) ^ multiply(b, 0x09) ^ multiply(c, 0x0e) ^ multiply(d, 0x0b);
-        (*_state)[i][3] = multiply(a, 0x0b) ^ multiply(b, 0x0d) ^ multiply(c, 0x09) ^ multiply(d, 0x0e);
-    }
+    unsigned int t[8], x[8], y[8];
+    for(unsigned int j = 0; j < 8; j++)
+        t[j] = q[j] ^ rot2(q[j]);
+    xtime(t, x);
+    xtime(x, y);
+    for(unsigned int j = 0; j < 8; j++)
+        q[j] ^= y[j];
+    mix_columns(q);
 }
 
 
-// The sub_bytes Function Substitutes the values in the
-// _state matrix with values in an S-box.
-void SWAES<16>::inv_sub_bytes(void)
+// AES-NI
+template<int RCON>
+__attribute__((target("aes,sse2")))
+static inline __m128i expand_round(__m128i k)
 {
-    int i,j;
-    for(i=0;i<4;++i) {
-        for(j=0;j<4;++j) {
-            (*_state)[j][i] = rsbox[static_cast<int>((*_state)[j][i])];
-        }
-    }
+    __m128i g = _mm_shuffle_epi32(_mm_aeskeygenassist_si128(k, RCON), 0xff);
+    k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+    k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+    k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+    return _mm_xor_si128(k, g);
 }
 
-void SWAES<16>::inv_shift_rows(void)
+__attribute__((target("aes,sse2")))
+void SWAES<16>::expand_ni(const unsigned char * key, Round_Keys & rk)
 {
-    unsigned char temp;
-
-    // Rotate first row 1 columns to right
-    temp            = (*_state)[3][1];
-    (*_state)[3][1] = (*_state)[2][1];
-    (*_state)[2][1] = (*_state)[1][1];
-    (*_state)[1][1] = (*_state)[0][1];
-    (*_state)[0][1] = temp;
-
-    // Rotate second row 2 columns to right
-    temp            = (*_state)[0][2];
-    (*_state)[0][2] = (*_state)[2][2];
-    (*_state)[2][2] = temp;
-
-    temp            = (*_state)[1][2];
-    (*_state)[1][2] = (*_state)[3][2];
-    (*_state)[3][2] = temp;
-
-    // Rotate third row 3 columns to right
-    temp            = (*_state)[0][3];
-    (*_state)[0][3] = (*_state)[1][3];
-    (*_state)[1][3] = (*_state)[2][3];
-    (*_state)[2][3] = (*_state)[3][3];
-    (*_state)[3][3] = temp;
+    __m128i * e = reinterpret_cast<__m128i *>(&rk[0]);
+    __m128i * d = e + Nr + 1;
+
+    e[0] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(key));
+    e[1] = expand_round<0x01>(e[0]);
+    e[2] = expand_round<0x02>(e[1]);
+    e[3] = expand_round<0x04>(e[2]);
+    e[4] = expand_round<0x08>(e[3]);
+    e[5] = expand_round<0x10>(e[4]);
+    e[6] = expand_round<0x20>(e[5]);
+    e[7] = expand_round<0x40>(e[6]);
+    e[8] = expand_round<0x80>(e[7]);
+    e[9] = expand_round<0x1b>(e[8]);
+    e[10] = expand_round<0x36>(e[9]);
+
+    // The Equivalent Inverse Cipher's
+    d[0] = e[Nr];
+    for(unsigned int i = 1; i < Nr; i++)
+        d[i] = _mm_aesimc_si128(e[Nr - i]);
+    d[Nr] = e[0];
 }
 
-
-// cipher is the main function that encrypts the PlainText.
-void SWAES<16>::cipher(void)
+__attribute__((target("aes,sse2")))
+void SWAES<16>::encrypt_block_ni(const Round_Keys & rk, const unsigned char * input, unsigned char * output)
 {
-    unsigned char round = 0;
-
-    // Add the First round key to the _state before starting the rounds.
-    add_round_key(0);
-
-    // There will be Nr rounds.
-    // The first Nr-1 rounds are identical.
-    // These Nr-1 rounds are executed in the loop below.
-    for(round = 1; round < Nr; ++round) {
-        sub_bytes();
-        shift_rows();
-        mix_columns();
-        add_round_key(round);
-    }
+    const __m128i * e = reinterpret_cast<const __m128i *>(&rk[0]);
 
-    // The last round is given below.
-    // The mix_columns function is not here in the last round.
-    sub_bytes();
-    shift_rows();
-    add_round_key(Nr);
+    __m128i x = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(input)), e[0]);
+    for(unsigned int i = 1; i < Nr; i++)
+        x = _mm_aesenc_si128(x, e[i]);
+    x = _mm_aesenclast_si128(x, e[Nr]);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(output), x);
 }
 
-void SWAES<16>::inv_cipher(void)
+__attribute__((target("aes,sse2")))
+void SWAES<16>::decrypt_block_ni(const Round_Keys & rk, const unsigned char * input, unsigned char * output)
 {
-    unsigned char round=0;
-
-    // Add the First round key to the _state before starting the rounds.
-    add_round_key(Nr);
-
-    // There will be Nr rounds.
-    // The first Nr-1 rounds are identical.
-    // These Nr-1 rounds are executed in the loop below.
-    for(round = Nr - 1; round > 0; round--) {
-        inv_shift_rows();
-        inv_sub_bytes();
-        add_round_key(round);
-        inv_mix_columns();
-    }
+    const __m128i * d = reinterpret_cast<const __m128i *>(&rk[0]) + Nr + 1;
 
-    // The last round is given below.
-    // The mix_columns function is not here in the last round.
-    inv_shift_rows();
-    inv_sub_bytes();
-    add_round_key(0);
+    __m128i x = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(input)), d[0]);
+    for(unsigned int i = 1; i < Nr; i++)
+        x = _mm_aesdec_si128(x, d[i]);
+    x = _mm_aesdeclast_si128(x, d[Nr]);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(output), x);
 }
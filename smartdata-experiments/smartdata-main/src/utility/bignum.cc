@@ -5,13 +5,13 @@
 
 // Class attributes
 template<>
-const Bignum<16>::_Word Bignum<16>::_mod = {{ 0xff, 0xff, 0xff, 0xff,
+const Bignum<16, false>::_Word Bignum<16, false>::_mod = {{ 0xff, 0xff, 0xff, 0xff,
                                               0xff, 0xff, 0xff, 0xff,
                                               0xff, 0xff, 0xff, 0xff,
                                               0xfd, 0xff, 0xff, 0xff }};
 
 template<>
-const Bignum<16>::_Barrett Bignum<16>::_barrett_u = {{ 17, 0, 0, 0,
+const Bignum<16, false>::_Barrett Bignum<16, false>::_barrett_u = {{ 17, 0, 0, 0,
                                                         8, 0, 0, 0,
                                                         4, 0, 0, 0,
                                                         2, 0, 0, 0,
@@ -20,7 +20,7 @@ const Bignum<16>::_Barrett Bignum<16>::_barrett_u = {{ 17, 0, 0, 0,
 
 // 2^(130) - 5: used by Poly1305
 template<>
-const Bignum<17>::_Word Bignum<17>::_mod = {{ 0xfb, 0xff, 0xff, 0xff,
+const Bignum<17, false>::_Word Bignum<17, false>::_mod = {{ 0xfb, 0xff, 0xff, 0xff,
                                               0xff, 0xff, 0xff, 0xff,
                                               0xff, 0xff, 0xff, 0xff,
                                               0xff, 0xff, 0xff, 0xff,
@@ -28,9 +28,19 @@ const Bignum<17>::_Word Bignum<17>::_mod = {{ 0xfb, 0xff, 0xff, 0xff,
 
 // 0x400000000000000000000000000000005000000000000000
 template<>
-const Bignum<17>::_Barrett Bignum<17>::_barrett_u = {{ 0x00, 0x00, 0x00, 0x00,
+const Bignum<17, false>::_Barrett Bignum<17, false>::_barrett_u = {{ 0x00, 0x00, 0x00, 0x00,
                                                        0x00, 0x00, 0x00, 0x50,
                                                        0x00, 0x00, 0x00, 0x00,
                                                        0x00, 0x00, 0x00, 0x00,
                                                        0x00, 0x00, 0x00, 0x00,
                                                        0x00, 0x00, 0x00, 0x40 }};
+
+#ifdef __SIZEOF_INT128__
+
+// 2^128 - 2^97 - 1 (the prime of secp128r1, used by Diffie-Hellman)
+template<>
+const Bignum<16, true>::Modulo Bignum<16, true>::_mod = { { 0xffffffffffffffffULL, 0xfffffffdffffffffULL },
+                                                          1,
+                                                          { 0x0000000800000011ULL, 0x0000002400000004ULL } };
+
+#endif
@@ -0,0 +1,454 @@
+// EPOS Asynchronous Log Implementation
+
+#include <main_traits.h>
+#include <utility/log.h>
+#include <utility/debug.h>
+#include <utility/hash.h>
+#include <link.h>
+#include <time.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Literals by offset, defined in a binary log or read from one. Open addressed, with the digest of utility/hash.h
+// but not its lists, which would log (from the flusher, into the rings it drains).
+class Log::Literals
+{
+private:
+    struct Literal
+    {
+        unsigned int id;
+        const char * string;
+    };
+
+public:
+    Literals(bool owner): _owner(owner), _size(0), _capacity(LITERALS), _table(new /*(SYSTEM)*/ Literal[LITERALS]()) {}
+    ~Literals() {
+        if(_owner)
+            for(unsigned int i = 0; i < _capacity; i++)
+                delete [] _table[i].string;
+        delete [] _table;
+    }
+
+    const char * search(unsigned int id) const { return _table[slot(_table, _capacity, id)].string; }
+
+    // Keeps s, which, if this is the owner, is deleted with it
+    void insert(unsigned int id, const char * s) {
+        if(2 * (_size + 1) > _capacity) {
+            Literal * table = new /*(SYSTEM)*/ Literal[2 * _capacity]();
+            for(unsigned int i = 0; i < _capacity; i++)
+                if(_table[i].string)
+                    table[slot(table, 2 * _capacity, _table[i].id)] = _table[i];
+            delete [] _table;
+            _table = table;
+            _capacity *= 2;
+        }
+
+        Literal & l = _table[slot(_table, _capacity, id)];
+        if(!l.string)
+            _size++;
+        else if(_owner)
+            delete [] l.string;
+        l.id = id;
+        l.string = s;
+    }
+
+private:
+    // Of id, or of the empty entry it would take
+    static unsigned int slot(const Literal * table, unsigned int capacity, unsigned int id) {
+        unsigned int i = Hash<Literal, LITERALS>::key(&id, sizeof(id)) & (capacity - 1);
+        while(table[i].string && (table[i].id != id))
+            i = (i + 1) & (capacity - 1);
+        return i;
+    }
+
+private:
+    bool _owner;
+    unsigned int _size;
+    unsigned int _capacity;
+    Literal * _table;
+};
+
+// Class attributes
+__thread Log::Ring * Log::_ring;
+__thread bool Log::_flushing;
+Log::Ring * Log::_rings;
+unsigned int Log::_threads;
+const char * Log::_segment[SEGMENTS][2];
+unsigned int Log::_segments;
+pthread_once_t Log::_once = PTHREAD_ONCE_INIT;
+pthread_key_t Log::_key;
+pthread_t Log::_flusher;
+volatile bool Log::_finishing;
+volatile bool Log::_flushed;
+FILE * Log::_file;
+Log::Literals * Log::_defined;
+const int Log::_signal[SIGNALS] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+struct sigaction Log::_previous[SIGNALS];
+
+__thread bool Debug::_synchronous;
+
+// Class methods
+void Log::string(const char * s)
+{
+    if(!s)
+        s = "(null)";
+
+    unsigned int length = strlen(s);
+    do {
+        Ring * r = reserve(1 + 2 + 1);
+        unsigned int n = RECORD - r->size - (1 + 2);
+        if(n > length)
+            n = length;
+        r->record[r->size] = STRING;
+        r->record[r->size + 1] = n;
+        r->record[r->size + 2] = n >> 8;
+        memcpy(&r->record[r->size + 3], s, n);
+        r->size += 1 + 2 + n;
+        s += n;
+        length -= n;
+    } while(length);
+}
+
+void Log::init()
+{
+    dl_iterate_phdr(&segments, 0);
+    pthread_key_create(&_key, &detach);
+
+    if(Traits<Debug>::LOG_FILE) {
+        _file = fopen(Traits<Debug>::LOG_FILE, "wb");
+        if(_file)
+            _defined = new /*(SYSTEM)*/ Literals(false);
+        else
+            kerr << "Log::init: could not open " << Traits<Debug>::LOG_FILE << ", formatting instead!" << endl;
+    }
+
+    pthread_create(&_flusher, 0, &flusher, 0);
+    atexit(&finish);
+
+    if(Traits<Debug>::async) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = &fatal;
+        sigemptyset(&action.sa_mask);
+        for(unsigned int i = 0; i < SIGNALS; i++)
+            sigaction(_signal[i], &action, &_previous[i]);
+    }
+}
+
+// Claims a ring left by a thread that exited, or adds a new one
+void Log::attach()
+{
+    pthread_once(&_once, &init);
+
+    Ring * r;
+    for(r = __atomic_load_n(&_rings, __ATOMIC_ACQUIRE); r; r = r->next) {
+        bool owned = false;
+        if(__atomic_compare_exchange_n(&r->owned, &owned, true, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+
+    if(!r) {
+        r = new /*(SYSTEM)*/ Ring;
+        r->thread = __atomic_fetch_add(&_threads, 1, __ATOMIC_RELAXED);
+        r->owned = true;
+        r->tail = 0;
+        r->size = 0;
+        r->dropped = 0;
+        r->head = 0;
+        r->reported = 0;
+        r->next = __atomic_load_n(&_rings, __ATOMIC_RELAXED);
+        while(!__atomic_compare_exchange_n(&_rings, &r->next, r, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+
+    _ring = r;
+    pthread_setspecific(_key, r);
+}
+
+// At thread exit
+void Log::detach(void * ring)
+{
+    Ring * r = reinterpret_cast<Ring *>(ring);
+    commit(r);
+    _ring = 0;
+    __atomic_store_n(&r->owned, false, __ATOMIC_RELEASE);
+}
+
+// The first object is the executable
+int Log::segments(struct dl_phdr_info * info, size_t size, void * data)
+{
+    for(unsigned int i = 0; (i < info->dlpi_phnum) && (_segments < SEGMENTS); i++) {
+        const ElfW(Phdr) & p = info->dlpi_phdr[i];
+        if((p.p_type == PT_LOAD) && !(p.p_flags & PF_W)) {
+            _segment[_segments][0] = reinterpret_cast<const char *>(info->dlpi_addr + p.p_vaddr);
+            _segment[_segments][1] = _segment[_segments][0] + p.p_memsz;
+            _segments++;
+        }
+    }
+    return 1;
+}
+
+void * Log::flusher(void *)
+{
+    _flushing = true;
+
+    while(true) {
+        bool finishing = _finishing; // read before draining, so the last round sees whatever came before it
+        if(!drain()) {
+            if(finishing)
+                break;
+            usleep(Traits<Debug>::FLUSH * 1000);
+        }
+    }
+
+    if(_file)
+        fclose(_file);
+    else
+        fflush(stdout);
+    __atomic_store_n(&_flushed, true, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Takes every record in the rings, oldest first, and returns how many there were
+unsigned int Log::drain()
+{
+    for(Ring * r = __atomic_load_n(&_rings, __ATOMIC_ACQUIRE); r; r = r->next) {
+        unsigned int dropped = __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+        if(dropped != r->reported) {
+            if(_file) {
+                unsigned char entry[1 + 2 + 4];
+                unsigned int records = dropped - r->reported;
+                entry[0] = DROPPED;
+                entry[1] = r->thread;
+                entry[2] = r->thread >> 8;
+                memcpy(&entry[3], &records, sizeof(records));
+                fwrite(entry, sizeof(entry), 1, _file);
+            } else
+                Log::dropped(kerr, r->thread, dropped - r->reported);
+            r->reported = dropped;
+        }
+    }
+
+    unsigned int n = 0;
+    while(true) {
+        Ring * next = 0;
+        unsigned long long first = 0;
+        for(Ring * r = __atomic_load_n(&_rings, __ATOMIC_ACQUIRE); r; r = r->next) {
+            if(r->head == __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE))
+                continue;
+
+            // The header may wrap around the end of the buffer
+            unsigned long long t = 0;
+            for(unsigned int i = 0; i < sizeof(t); i++)
+                t |= static_cast<unsigned long long>(r->data[(r->head + 4 + i) & (BUFFER - 1)]) << (8 * i);
+            if(!next || (t < first)) {
+                next = r;
+                first = t;
+            }
+        }
+        if(!next)
+            break;
+
+        unsigned char record[RECORD];
+        unsigned int head = next->head;
+        unsigned int size = next->data[head & (BUFFER - 1)] | (next->data[(head + 1) & (BUFFER - 1)] << 8);
+        unsigned int i = head & (BUFFER - 1);
+        unsigned int m = (size < BUFFER - i) ? size : BUFFER - i;
+        memcpy(record, &next->data[i], m);
+        memcpy(&record[m], next->data, size - m);
+        __atomic_store_n(&next->head, head + size, __ATOMIC_RELEASE);
+
+        if(_file)
+            write(record, size);
+        else
+            replay(kerr, record, size, 0, false);
+        n++;
+    }
+
+    if(_file && n)
+        fflush(_file);
+
+    return n;
+}
+
+void Log::finish()
+{
+    if(_ring)
+        commit(_ring);
+    _finishing = true;
+    pthread_join(_flusher, 0);
+}
+
+// Has the flusher empty the rings (unless it was the flusher that failed), then lets the signal take its previous
+// course. Only async-signal-safe calls are made here (the flusher is the one that writes and flushes), and the wait
+// is bounded, for the flusher may block on a lock the failing thread holds (e.g. that of stdout).
+void Log::fatal(int signal)
+{
+    for(unsigned int i = 0; i < SIGNALS; i++)
+        if(_signal[i] == signal)
+            sigaction(signal, &_previous[i], 0);
+
+    if(!_flushing) {
+        if(_ring)
+            commit(_ring);
+        _finishing = true;
+
+        timespec now, deadline;
+        timespec poll = { 0, static_cast<long>(Traits<Debug>::FLUSH) * 1000000 };
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += FATAL_FLUSH;
+        while(!__atomic_load_n(&_flushed, __ATOMIC_ACQUIRE)) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if((now.tv_sec > deadline.tv_sec) || ((now.tv_sec == deadline.tv_sec) && (now.tv_nsec >= deadline.tv_nsec)))
+                break;
+            nanosleep(&poll, 0);
+        }
+    }
+
+    raise(signal);
+}
+
+// Defines the literals first seen, then writes the record
+void Log::write(const unsigned char * record, unsigned int size)
+{
+    for(unsigned int i = HEADER, l; (i < size) && (l = length(&record[i], size - i)); i += l) {
+        if(record[i] != LITERAL)
+            continue;
+
+        unsigned int id;
+        memcpy(&id, &record[i + 1], sizeof(id));
+        if(_defined->search(id))
+            continue;
+
+        const char * s = _segment[0][0] + id;
+        _defined->insert(id, s);
+
+        unsigned int n = strlen(s);
+        if(n > 0xffff)
+            n = 0xffff;
+        unsigned char entry[1 + 4 + 2];
+        entry[0] = DEFINED;
+        memcpy(&entry[1], &id, sizeof(id));
+        entry[5] = n;
+        entry[6] = n >> 8;
+        fwrite(entry, sizeof(entry), 1, _file);
+        fwrite(s, n, 1, _file);
+    }
+
+    fputc(RECORDED, _file);
+    fwrite(record, size, 1, _file);
+}
+
+// Prints the items of a record; literals are looked up in literals if given, otherwise they are in this executable
+void Log::replay(OStream & os, const unsigned char * record, unsigned int size, Literals * literals, bool stamped)
+{
+    for(unsigned int i = HEADER, l; (i < size) && (l = length(&record[i], size - i)); i += l) {
+        const unsigned char * v = &record[i + 1];
+        switch(record[i]) {
+        case BEGL: {
+            os << begl;
+            if(stamped) {
+                unsigned long long t;
+                memcpy(&t, &record[4], sizeof(t));
+                os << "[" << t << " " << static_cast<unsigned int>(record[2] | (record[3] << 8)) << "] ";
+            }
+        } break;
+        case ENDL: os << endl; break;
+        case HEX: os << hex; break;
+        case DEC: os << dec; break;
+        case OCT: os << oct; break;
+        case BIN: os << bin; break;
+        case ERROR: os << OStream::Err(); break;
+        case CHAR: os << static_cast<char>(v[0]); break;
+        case INT: { int x; memcpy(&x, v, sizeof(x)); os << x; } break;
+        case UNSIGNED: { unsigned int x; memcpy(&x, v, sizeof(x)); os << x; } break;
+        case LONG_LONG: { long long int x; memcpy(&x, v, sizeof(x)); os << x; } break;
+        case UNSIGNED_LONG_LONG: { unsigned long long int x; memcpy(&x, v, sizeof(x)); os << x; } break;
+        case POINTER: { unsigned long long x; memcpy(&x, v, sizeof(x)); os << reinterpret_cast<const void *>(static_cast<unsigned long>(x)); } break;
+        case FLOAT: { float x; memcpy(&x, v, sizeof(x)); os << x; } break;
+        case LITERAL: {
+            unsigned int x;
+            memcpy(&x, v, sizeof(x));
+            if(!literals)
+                os << _segment[0][0] + x;
+            else {
+                const char * s = literals->search(x);
+                os << (s ? s : "<?>");
+            }
+        } break;
+        case STRING: {
+            char s[RECORD];
+            unsigned int n = v[0] | (v[1] << 8);
+            memcpy(s, &v[2], n);
+            s[n] = '\0';
+            os << s;
+        } break;
+        }
+    }
+}
+
+void Log::dropped(OStream & os, unsigned int thread, unsigned int records)
+{
+    os << begl << "Log: " << records << " records of thread " << thread << " dropped!" << endl;
+}
+
+// Bytes of the item (tag included), or 0 if it is not whole within left
+unsigned int Log::length(const unsigned char * item, unsigned int left)
+{
+    unsigned int l;
+    switch(item[0]) {
+    case BEGL: case ENDL: case HEX: case DEC: case OCT: case BIN: case ERROR: l = 1; break;
+    case CHAR: l = 1 + 1; break;
+    case INT: case UNSIGNED: case FLOAT: case LITERAL: l = 1 + 4; break;
+    case LONG_LONG: case UNSIGNED_LONG_LONG: case POINTER: l = 1 + 8; break;
+    case STRING: l = (left < 3) ? 0 : 1 + 2 + (item[1] | (item[2] << 8)); break;
+    default: l = 0;
+    }
+    return (l <= left) ? l : 0;
+}
+
+unsigned int Log::decode(FILE * in, OStream & os, bool stamped)
+{
+    Literals * literals = new /*(SYSTEM)*/ Literals(true);
+    unsigned int n = 0;
+
+    for(int entry; (entry = fgetc(in)) != EOF;) {
+        if(entry == DEFINED) {
+            unsigned char h[4 + 2];
+            if(fread(h, sizeof(h), 1, in) != 1)
+                break;
+            unsigned int id;
+            memcpy(&id, h, sizeof(id));
+            unsigned int size = h[4] | (h[5] << 8);
+            char * s = new /*(SYSTEM)*/ char[size + 1];
+            if(size && (fread(s, size, 1, in) != 1)) {
+                delete [] s;
+                break;
+            }
+            s[size] = '\0';
+            literals->insert(id, s);
+        } else if(entry == RECORDED) {
+            unsigned char record[RECORD];
+            if(fread(record, 2, 1, in) != 1)
+                break;
+            unsigned int size = record[0] | (record[1] << 8);
+            if((size <= HEADER) || (size > RECORD) || (fread(&record[2], size - 2, 1, in) != 1))
+                break;
+            replay(os, record, size, literals, stamped);
+            n++;
+        } else if(entry == DROPPED) {
+            unsigned char d[2 + 4];
+            if(fread(d, sizeof(d), 1, in) != 1)
+                break;
+            unsigned int records;
+            memcpy(&records, &d[2], sizeof(records));
+            dropped(os, d[0] | (d[1] << 8), records);
+        } else {
+            kerr << "Log::decode: corrupted entry " << entry << " after " << n << " records!" << endl;
+            break;
+        }
+    }
+
+    delete literals;
+
+    return n;
+}
@@ -0,0 +1,124 @@
+// EPOS Predictor Bank Implementation
+
+#include <main_traits.h>
+#include <utility/predictor_bank.h>
+#include <immintrin.h>
+#include <string.h>
+
+Predictor_Bank::Predictor_Bank(unsigned int capacity, bool simd): _capacity(capacity), _size(0)
+{
+    db<Predictors>(TRC) << "Predictor_Bank(c=" << capacity << ",simd=" << simd << ")" << endl;
+
+    _avx2 = simd && __builtin_cpu_supports("avx2");
+
+    _a = new /*(SYSTEM)*/ Value[capacity];
+    _b = new /*(SYSTEM)*/ Value[capacity];
+    _t0 = new /*(SYSTEM)*/ Time[capacity];
+    _relative = new /*(SYSTEM)*/ Value[capacity];
+    _absolute = new /*(SYSTEM)*/ Value[capacity];
+    _time_error = new /*(SYSTEM)*/ int[capacity];
+    _misses = new /*(SYSTEM)*/ int[capacity];
+
+    db<Predictors>(INF) << "Predictor_Bank:" << (_avx2 ? "AVX2" : "scalar") << endl;
+}
+
+Predictor_Bank::~Predictor_Bank()
+{
+    db<Predictors>(TRC) << "~Predictor_Bank()" << endl;
+
+    delete [] _misses;
+    delete [] _time_error;
+    delete [] _absolute;
+    delete [] _relative;
+    delete [] _t0;
+    delete [] _b;
+    delete [] _a;
+}
+
+unsigned int Predictor_Bank::insert(const Value & relative_error, const Value & absolute_error, unsigned int time_error)
+{
+    db<Predictors>(TRC) << "Predictor_Bank::insert(r=" << relative_error << ",a=" << absolute_error << ",t=" << time_error << ")" << endl;
+
+    if(_size == _capacity)
+        return NONE;
+
+    unsigned int i = _size++;
+    _relative[i] = relative_error / 100;
+    _absolute[i] = absolute_error;
+    _time_error[i] = (time_error > 0x7fffffff) ? 0x7fffffff : time_error;
+    model(i, 0, 0, 0);
+
+    return i;
+}
+
+unsigned int Predictor_Bank::trickle(const Time * t, const Value * v, unsigned int * changed)
+{
+    db<Predictors>(TRC) << "Predictor_Bank::trickle(n=" << _size << ")" << endl;
+
+    memset(changed, 0, ((_size + 31) / 32) * sizeof(unsigned int));
+
+    return _avx2 ? trickle_avx2(t, v, changed) : trickle_scalar(0, t, v, changed);
+}
+
+unsigned int Predictor_Bank::trickle_scalar(unsigned int from, const Time * t, const Value * v, unsigned int * changed)
+{
+    unsigned int n = 0;
+
+    for(unsigned int i = from; i < _size; i++) {
+        Value error = Math::abs(v[i] - predict(i, t[i]));
+        Value max = Math::max(Math::abs(v[i] * _relative[i]), _absolute[i]);
+        if(error > max) {
+            if(++_misses[i] > _time_error[i]) {
+                model(i, 0, v[i], t[i]);
+                changed[i / 32] |= 1U << (i % 32);
+                n++;
+            }
+        } else
+            _misses[i] = 0;
+    }
+
+    return n;
+}
+
+// The same as trickle_scalar(), for four series at a time, up to the last multiple of four
+__attribute__((target("avx2")))
+unsigned int Predictor_Bank::trickle_avx2(const Time * t, const Value * v, unsigned int * changed)
+{
+    // Adding 2^52 + 2^51 to a 64-bit integer below 2^51 in magnitude makes the bits of that double plus the
+    // integer, so the integer is converted by an integer add and a double subtraction (AVX2 has no cvtepi64_pd)
+    const __m256d magic = _mm256_set1_pd(6755399441055744.0);
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    const __m256i low = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+
+    unsigned int n = 0;
+    unsigned int i = 0;
+    for(; i + 4 <= _size; i += 4) {
+        __m256d vv = _mm256_loadu_pd(&v[i]);
+        __m256i tt = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&t[i]));
+        __m256i dt = _mm256_sub_epi64(tt, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&_t0[i])));
+        __m256d x = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_add_epi64(dt, _mm256_castpd_si256(magic))), magic);
+
+        __m256d predicted = _mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(&_a[i]), x), _mm256_loadu_pd(&_b[i]));
+        __m256d error = _mm256_andnot_pd(sign, _mm256_sub_pd(vv, predicted));
+        __m256d max = _mm256_max_pd(_mm256_andnot_pd(sign, _mm256_mul_pd(vv, _mm256_loadu_pd(&_relative[i]))), _mm256_loadu_pd(&_absolute[i]));
+        __m256d miss = _mm256_cmp_pd(error, max, _CMP_GT_OQ);
+
+        // Misses count up, hits reset the count: misses = (misses + 1) & miss
+        __m128i m = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(_mm256_castpd_si256(miss), low));
+        __m128i misses = _mm_and_si128(_mm_sub_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(&_misses[i])), m), m);
+        __m128i expired = _mm_cmpgt_epi32(misses, _mm_loadu_si128(reinterpret_cast<const __m128i *>(&_time_error[i])));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(&_misses[i]), _mm_andnot_si128(expired, misses));
+
+        unsigned int e = _mm_movemask_ps(_mm_castsi128_ps(expired));
+        if(e) {
+            __m256d reset = _mm256_castsi256_pd(_mm256_cvtepi32_epi64(expired));
+            _mm256_storeu_pd(&_a[i], _mm256_andnot_pd(reset, _mm256_loadu_pd(&_a[i])));
+            _mm256_storeu_pd(&_b[i], _mm256_blendv_pd(_mm256_loadu_pd(&_b[i]), vv, reset));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(&_t0[i]), _mm256_castpd_si256(_mm256_blendv_pd(_mm256_loadu_pd(reinterpret_cast<const double *>(&_t0[i])), _mm256_castsi256_pd(tt), reset)));
+            changed[i / 32] |= e << (i % 32);
+            n += __builtin_popcount(e);
+        }
+    }
+
+    return n + trickle_scalar(i, t, v, changed);
+}